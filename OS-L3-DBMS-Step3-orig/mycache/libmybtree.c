@@ -0,0 +1,331 @@
+/*
+ * File:   libmybtree.c
+ *
+ * This file implements the nodes of the B+tree holding records by key.
+ *
+ * Like slotted pages, leaves leave holes among their records when a record
+ * is replaced by a longer one. Holes are only reclaimed when a record or a
+ * slot does not fit in the free space between the slots and the records:
+ * then the records are moved together to the end of the page.
+ */
+
+#include <string.h>
+#include "mybtree.h"
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Get the slots of a leaf.
+ * @param page The leaf.
+ * @return The first slot.
+ */
+static MYPAGE_SLOT_t *
+slotsOf(const void *page)
+{
+  return (MYPAGE_SLOT_t *)((char *)page + sizeof(MYBT_HEADER_t));
+}
+
+/**
+ * Get the entries of a branch.
+ * @param page The branch.
+ * @return The first entry.
+ */
+static MYBT_ENTRY_t *
+entriesOf(const void *page)
+{
+  return (MYBT_ENTRY_t *)((char *)page + sizeof(MYBT_HEADER_t));
+}
+
+/**
+ * Get the bytes between the last slot and the first record of a leaf.
+ * @param header Header of the leaf.
+ * @return The number of bytes.
+ */
+static size_t
+gapOf(const MYBT_HEADER_t *header)
+{
+  return header->upper - sizeof(MYBT_HEADER_t) - header->numkeys * sizeof(MYPAGE_SLOT_t);
+}
+
+/**
+ * Move every record of a leaf to the end of the page, so that all the free
+ * bytes are between the slots and the records. Slots without a record are
+ * left as they are.
+ * @param page The leaf.
+ */
+static void
+compactLeaf(void *page)
+{
+  unsigned char copy[MYP_PAGESIZE];
+  memcpy(copy, page, MYP_PAGESIZE);
+  MYBT_HEADER_t *header = (MYBT_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  unsigned int upper = MYP_PAGESIZE;
+  for (unsigned int i = 0; i < header->numkeys; i++)
+  {
+    if (slots[i].offset == 0)
+      continue;
+    upper -= slots[i].length;
+    memcpy((char *)page + upper, copy + slots[i].offset, slots[i].length);
+    slots[i].offset = (uint16_t)upper;
+  }
+  header->upper = (uint16_t)upper;
+}
+
+/**
+ * Copy a record to the free space of a leaf. There must be room for it.
+ * @param page The leaf.
+ * @param position The slot of the record. It holds no record.
+ * @param data The record.
+ * @param length Bytes of the record.
+ */
+static void
+placeRecord(void *page, unsigned int position, const void *data, size_t length)
+{
+  MYBT_HEADER_t *header = (MYBT_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  if (gapOf(header) < length)
+    compactLeaf(page);
+  header->upper -= (uint16_t)length;
+  memcpy((char *)page + header->upper, data, length);
+  slots[position].offset = header->upper;
+  slots[position].length = (uint16_t)length;
+  header->freebytes -= (uint16_t)length;
+}
+
+/**
+ * Move the upper half of the bytes of a leaf to an empty leaf.
+ * @param page The leaf.
+ * @param right The empty leaf.
+ */
+static void
+splitLeaf(void *page, void *right)
+{
+  MYBT_HEADER_t *header = (MYBT_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  size_t used = MYP_PAGESIZE - sizeof(MYBT_HEADER_t) - header->freebytes;
+  size_t moved = 0;
+  unsigned int first = header->numkeys;
+  while (first > 1 && moved < used / 2)
+  {
+    first--;
+    moved += slots[first].length + sizeof(MYPAGE_SLOT_t);
+  }
+  MYBT_HEADER_t *rightHeader = (MYBT_HEADER_t *)right;
+  for (unsigned int i = first; i < header->numkeys; i++)
+  {
+    unsigned int position = rightHeader->numkeys++;
+    rightHeader->freebytes -= sizeof(MYPAGE_SLOT_t);
+    slotsOf(right)[position].id = slots[i].id;
+    placeRecord(right, position, (char *)page + slots[i].offset, slots[i].length);
+  }
+  header->numkeys = (uint16_t)first;
+  header->freebytes += (uint16_t)moved;
+  compactLeaf(page);
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+/**
+ * Initialize an empty node.
+ * @param page The node.
+ * @param level 0 for a leaf. Levels above the leaves for a branch.
+ */
+void MYBT_init(void *page, unsigned int level)
+{
+  memset(page, 0, MYP_PAGESIZE);
+  MYBT_HEADER_t *header = (MYBT_HEADER_t *)page;
+  header->level = (uint16_t)level;
+  header->upper = MYP_PAGESIZE;
+  header->freebytes = MYP_PAGESIZE - sizeof(MYBT_HEADER_t);
+}
+
+/**
+ * Check the header of a node.
+ * @param page The node.
+ * @param level The level it must have. -1 for any level.
+ * @return 0 if it is a valid node. -1 otherwise.
+ */
+int MYBT_check(const void *page, int level)
+{
+  const MYBT_HEADER_t *header = (const MYBT_HEADER_t *)page;
+  if ((level != -1 && header->level != level) || header->level >= MYBT_MAXLEVELS || header->reserved != 0)
+    return -1;
+  if (header->level > 0)
+    return header->numkeys >= 1 && header->numkeys <= MYBT_ENTRIES ? 0 : -1;
+  size_t slots = sizeof(MYBT_HEADER_t) + header->numkeys * sizeof(MYPAGE_SLOT_t);
+  return slots <= header->upper && header->upper <= MYP_PAGESIZE && header->freebytes <= MYP_PAGESIZE - slots ? 0 : -1;
+}
+
+/**
+ * Find a key in a leaf.
+ * @param page The leaf.
+ * @param key The key.
+ * @param found Where to return 1 if the leaf has the key, 0 otherwise.
+ * @return The position of the first slot with a key not below the key.
+ */
+unsigned int MYBT_find(const void *page, uint32_t key, int *found)
+{
+  const MYBT_HEADER_t *header = (const MYBT_HEADER_t *)page;
+  const MYPAGE_SLOT_t *slots = slotsOf(page);
+  unsigned int low = 0;
+  unsigned int high = header->numkeys;
+  while (low < high)
+  {
+    unsigned int middle = (low + high) / 2;
+    if (slots[middle].id < key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  *found = low < header->numkeys && slots[low].id == key;
+  return low;
+}
+
+/**
+ * Get the record in a position of a leaf.
+ * @param page The leaf.
+ * @param position The position of its slot.
+ * @param key Where to return the key of the record.
+ * @param length Where to return the length of the record.
+ * @return The record. NULL if there is no slot in the position or the slot
+ * is damaged.
+ */
+const unsigned char *MYBT_record(const void *page, unsigned int position, uint32_t *key, size_t *length)
+{
+  const MYBT_HEADER_t *header = (const MYBT_HEADER_t *)page;
+  if (position >= header->numkeys)
+    return NULL;
+  const MYPAGE_SLOT_t *slot = &slotsOf(page)[position];
+  if (slot->offset == 0 || slot->offset + slot->length > MYP_PAGESIZE)
+    return NULL;
+  *key = slot->id;
+  *length = slot->length;
+  return (const unsigned char *)page + slot->offset;
+}
+
+/**
+ * Store a record in a leaf. A record with the same key is replaced: it stays
+ * in place if the new one is not longer.
+ * @param page The leaf.
+ * @param key The key of the record.
+ * @param data The record.
+ * @param length Bytes of the record, from 1 to MYBT_MAXRECORD.
+ * @return 0 if OK. -1 if there is no room.
+ */
+int MYBT_put(void *page, uint32_t key, const void *data, size_t length)
+{
+  MYBT_HEADER_t *header = (MYBT_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  int found;
+  unsigned int position = MYBT_find(page, key, &found);
+  size_t available = header->freebytes + (found ? slots[position].length : 0);
+  size_t needed = length + (found ? 0 : sizeof(MYPAGE_SLOT_t));
+  if (length == 0 || length > MYBT_MAXRECORD || needed > available)
+    return -1;
+  if (found && length <= slots[position].length)
+  {
+    /* Shorter records stay in place and leave a hole. */
+    memcpy((char *)page + slots[position].offset, data, length);
+    header->freebytes += slots[position].length - (uint16_t)length;
+    slots[position].length = (uint16_t)length;
+    return 0;
+  }
+  if (found)
+  {
+    /* Free the old record first, so that compacting the leaf reclaims it. */
+    header->freebytes += slots[position].length;
+  }
+  else
+  {
+    /* The new slot takes its bytes from the gap, which may be full of holes. */
+    if (gapOf(header) < sizeof(MYPAGE_SLOT_t))
+      compactLeaf(page);
+    memmove(&slots[position + 1], &slots[position], (header->numkeys - position) * sizeof(MYPAGE_SLOT_t));
+    header->numkeys++;
+    header->freebytes -= sizeof(MYPAGE_SLOT_t);
+    slots[position].id = key;
+  }
+  slots[position].offset = 0;
+  slots[position].length = 0;
+  placeRecord(page, position, data, length);
+  return 0;
+}
+
+/**
+ * Find the child of a branch holding a key.
+ * @param page The branch.
+ * @param key The key.
+ * @return The page of the child.
+ */
+uint32_t MYBT_child(const void *page, uint32_t key)
+{
+  const MYBT_HEADER_t *header = (const MYBT_HEADER_t *)page;
+  const MYBT_ENTRY_t *entries = entriesOf(page);
+  /* Find the first entry after the first one with a higher key. */
+  unsigned int low = 1;
+  unsigned int high = header->numkeys;
+  while (low < high)
+  {
+    unsigned int middle = (low + high) / 2;
+    if (entries[middle].key <= key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return entries[low - 1].page;
+}
+
+/**
+ * Add a child to a branch, after the children with lower keys.
+ * @param page The branch.
+ * @param key The lowest key of the child.
+ * @param child The page of the child.
+ * @return 0 if OK. -1 if the branch is full.
+ */
+int MYBT_link(void *page, uint32_t key, uint32_t child)
+{
+  MYBT_HEADER_t *header = (MYBT_HEADER_t *)page;
+  MYBT_ENTRY_t *entries = entriesOf(page);
+  if (header->numkeys >= MYBT_ENTRIES)
+    return -1;
+  unsigned int position = header->numkeys;
+  while (position > 1 && entries[position - 1].key > key)
+    position--;
+  memmove(&entries[position + 1], &entries[position], (header->numkeys - position) * sizeof(MYBT_ENTRY_t));
+  entries[position].key = key;
+  entries[position].page = child;
+  header->numkeys++;
+  return 0;
+}
+
+/**
+ * Split a node in two halves. A leaf is split by its bytes, so that both
+ * halves have room for one more record.
+ * @param page The node.
+ * @param right Where to move the upper half. It is initialized here.
+ * @param rightPage The page number of the right node.
+ * @return The lowest key of the right node.
+ */
+uint32_t MYBT_split(void *page, void *right, uint32_t rightPage)
+{
+  MYBT_HEADER_t *header = (MYBT_HEADER_t *)page;
+  MYBT_init(right, header->level);
+  if (header->level == 0)
+  {
+    splitLeaf(page, right);
+    ((MYBT_HEADER_t *)right)->next = header->next;
+    header->next = rightPage;
+    return slotsOf(right)[0].id;
+  }
+  unsigned int first = header->numkeys / 2;
+  MYBT_HEADER_t *rightHeader = (MYBT_HEADER_t *)right;
+  rightHeader->numkeys = header->numkeys - (uint16_t)first;
+  memcpy(entriesOf(right), &entriesOf(page)[first], rightHeader->numkeys * sizeof(MYBT_ENTRY_t));
+  header->numkeys = (uint16_t)first;
+  return entriesOf(right)[0].key;
+}
@@ -7,18 +7,49 @@
  * The RAM cache is a RAM buffer between a program using records and the DB file.
  * When we want to use a record from the DB file, this library must read it from disk to RAM.
  *
- * The RAM cache is a table of BUCKETS. Each bucket may contain one register of
- * the DB file. As it is a cache, the record contained on each bucket may change.
+ * The RAM cache is a table of PAGES. Each entry may contain one page of the
+ * DB file. As it is a cache, the page contained on each entry may change.
+ * Records are packed in slotted pages and found through a directory of pages,
+ * which go through the cache too.
+ *
+ * Each table keeps its DB file and its cache in a table_t. The functions
+ * work on the selected table, so a server with several tables selects the
+ * table of each request before serving it.
+ *
+ * The pages of the column files of a table stored by columns go through the
+ * same cache. They are numbered apart from the pages of the DB file: the
+ * field (plus one) in the high bits and the page of its column file below.
+ *
+ * A table stored as a log-structured merge tree does not use the pages of
+ * its cache: their memory holds the memtable, and every record goes through
+ * the tree.
+ *
+ * The nodes of a table stored in a B+tree are pages of the DB file in the
+ * cache. A node being split is copied out of the cache first, as fetching
+ * the other pages on the way may evict it.
+ *
+ * The pages of a compressed table go through a page map for each data file.
+ * The cache only sees whole pages: readEntry() decompresses them and
+ * writeEntry() compresses them.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
 #include "mycache.h"
+#include "mypagemap.h"
+#include "mylsm.h"
+#include "mybtree.h"
 #include "debug.h"
 
 /************************************************************
@@ -29,14 +60,176 @@
 /* Add the keyword "static" to hide them so that a global variable can't be seen outside
  * this module. */
 
-/* This will be the descriptor for the file returned by open() */
-static int dbFile = -1;
+/* A snapshot being written: an image of a table as it was when it started.
+ * Unit 0 is the DB file and unit f + 1 the column file of field f. Pages are
+ * copied to the image before they change, and the rest in the background. */
+typedef struct
+{
+  /* Names and descriptors of the files of the image. -1 if not used. */
+  char (*names)[FILENAME_MAX];
+  int files[MYSCH_MAXFIELDS + 1];
+
+  /* Pages of each unit when the snapshot started, and first bit of each unit
+   * in the map of the pages copied. */
+  uint32_t pages[MYSCH_MAXFIELDS + 1];
+  uint64_t first[MYSCH_MAXFIELDS + 1];
+  unsigned char *copied;
+
+  /* Header of the image, written when every page was copied. */
+  MYC_FILEHEADER_t header;
+
+  /* Next page to copy in the background and pages not copied yet. */
+  unsigned int unit;
+  uint32_t next;
+  uint64_t left;
+} snapshot_t;
+
+/* Everything about one table: its DB file and its cache. */
+typedef struct
+{
+  /* Name of the DB file. */
+  char filename[FILENAME_MAX];
+
+  /* This will be the descriptor for the file returned by open() */
+  int file;
+
+  /* Layout asked for when opening the table. -1 takes the one of the file. */
+  int layout;
+
+  /* Descriptors of the column files of a table stored by columns. -1 if not open. */
+  int columns[MYSCH_MAXFIELDS];
+
+  /* Descriptors of the segments of a segmented table, opened when first
+   * used: those of the DB file first, then those of each column file, by
+   * number of segment. -1 if not open. */
+  int *segments[MYSCH_MAXFIELDS + 1];
+  uint32_t numSegments[MYSCH_MAXFIELDS + 1];
+
+  /* Page maps of a compressed table: the one of the DB file first, then the
+   * one of each column file. NULL if not open. */
+  MYPM_MAP_t *maps[MYSCH_MAXFIELDS + 1];
+
+  /* Log-structured merge tree of a table stored as one. NULL otherwise. */
+  MYLSM_TREE_t *lsm;
+
+  /* Snapshot being written. NULL if none. */
+  snapshot_t *snapshot;
+
+  /* Number of pages of the cache. */
+  int numentries;
+
+  /* Bytes of memory holding the cache, counted in the limit of all the tables. */
+  size_t memory;
+
+  /* The memory holding the cache starts with a header describing the arrays below. */
+  MYC_SHARED_t *header;
+
+  /* Identifier of the shared memory segment holding the cache. -1 if the cache is private. */
+  int shmId;
+
+  /* You also need a array of pages to use them as a RAM cache. */
+  unsigned char *entries;
+
+  /* Number of the page of the file held by each entry. 0 if the entry is unused. */
+  uint32_t *pages;
+
+  /* Header of the DB file. It lives with the cache, so a cache handed over
+   * keeps the pages allocated by the last server. */
+  MYC_FILEHEADER_t *fileHeader;
+
+  /* The header of the DB file changed and must be written before the next sync. */
+  int headerDirty;
+
+  /* We also need another array of booleans to know if an entry has been written or not to disk.  */
+  int *dirty;
+
+  /* Entry where the search for a clean entry to reuse starts next. */
+  int nextClean;
+
+  /* Version of each entry for readers sharing the cache. Odd while an entry is changing. */
+  unsigned int *versions;
+
+  /* LSN of the oldest write not flushed of each dirty entry. */
+  uint64_t *lsn;
+
+  /* Number of recent accesses to each entry. Halved every time the hot set is saved. */
+  unsigned int *heat;
+
+  /* Hot set being prefetched, hottest first, and next page to load. */
+  int *hotSet;
+  int hotCount;
+  int hotNext;
 
-/* You also need a array of buckets to use them as a RAM cache. */
-static MYBUCKET_BUCKET_t *CacheEntries = NULL;
+  /* LSN of the last write accepted by the cache. */
+  uint64_t lastLSN;
 
-/* We also need another array of booleans to know if an entry has been written or not to disk.  */
-static int *CacheDirty = NULL;
+  /* Lowest LSN written to the file but not synced to disk yet. 0 if none. */
+  uint64_t unsyncedLSN;
+} table_t;
+
+/* Tables open, by handle. NULL if the handle is free. */
+static table_t *Tables[MYC_MAXTABLES];
+
+/* Table used by the functions of the cache. Selected with MYC_useTable(). */
+static table_t *Table = NULL;
+
+/* Limit of the memory of the caches of all the tables and memory used. */
+static size_t memoryLimit = MYC_MEMORYLIMIT;
+static size_t memoryUsed = 0;
+
+/* Directories of the segments of the segmented tables created next. */
+static char segmentDirs[MYC_SEGMENTDIRS] = "";
+
+/* Schema of the records. It is the same for every table. */
+static const MYSCHEMA_t *Schema = NULL;
+
+/* Numbers of the pages of the column files in the cache. */
+#define COLUMN_SHIFT 26
+#define COLUMN_PAGES ((uint32_t)1 << COLUMN_SHIFT)
+#define COLUMN_PAGE(field, page) ((((uint32_t)(field) + 1) << COLUMN_SHIFT) | (uint32_t)(page))
+
+/* Flags added to the layout of a new table. */
+#define LAYOUT_FLAGS (MYC_COMPRESSED | MYC_SEGMENTED)
+
+/* Pages of each column read ahead by a scan, from every segment at once. */
+#define SCAN_AHEAD 64
+
+/* A file synced by a thread while the others are synced too. */
+typedef struct
+{
+  int file;
+  int status;
+  int error;
+  int started; /* 1 if a thread syncs it. */
+  pthread_t thread;
+} sync_t;
+
+/* Header of a hot set file. The numbers of the pages follow it. */
+#define MYC_HOT_MAGIC 0x4d594850
+typedef struct
+{
+  unsigned int magic; /* MYC_HOT_MAGIC */
+  unsigned int count; /* Number of indices. */
+} hotset_header_t;
+
+/* A scan of a table stored as a log-structured merge tree: the function of
+ * the caller and its argument. */
+typedef struct
+{
+  MYC_SCAN_f callback;
+  void *arg;
+  int status;
+} lsm_scan_t;
+
+/* The last read or write found its record in the cache. */
+static int lastHit = 0;
+
+/* Some page was read from the file since the last read or write started. */
+static int pageMissed = 0;
+
+/* Counters of the activity of the caches of all the tables. Only this module updates them, but
+ * other threads may read them at any time, so they are updated atomically. */
+static MYC_STATS_t Stats;
 
 /* Debug level for messages */
 static int debug_level = DEBUG_INIT;
@@ -48,414 +241,2777 @@ static int debug_level = DEBUG_INIT;
 /* Use the keyword "static" before a functions which is only used inside this file */
 
 /**
- * Allocate memory for the cache.
- * @param n Number of buckets of the cache.
- * @return A pointer to a table with the required number of buckets.
- * NULL means a problem allocating memory.
+ * Add to a counter of the statistics. Readers on other threads never see a
+ * torn value and the caller never waits for them.
+ * @param counter The counter.
+ * @param value The value to add.
  */
-static MYBUCKET_BUCKET_t *
-allocateCache(int n)
+static void
+countStat(uint64_t *counter, uint64_t value)
 {
-  return (MYBUCKET_BUCKET_t *)calloc(n, sizeof(MYBUCKET_BUCKET_t));
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
 }
 
 /**
- * Allocate memory for the array of booleans for the dirty flag.
- * @param n Number of buckets of the cache.
- * @return A pointer to a table with the required number of integers.
- * NULL means a problem allocating memory.
+ * Get the time of the monotonic clock.
+ * @return Time in nanoseconds.
  */
-static int *
-allocateDirty(int n)
+static uint64_t
+nowNs()
 {
-  return (int *)calloc(n, sizeof(int));
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
 }
 
 /**
- * Search for an unused entry in the table.
- * If there's no unused one, just one clean entry.
- * If there's no clean one, return -1.
- * @return The index of the selected entry. -1 means that no entry was unused or clean.
+ * Fill the header of the memory holding a cache with the offsets of its arrays.
+ * @param header Header to fill. May be NULL to compute only the size.
+ * @param n Number of pages of the cache.
+ * @return The size in bytes of the memory holding the whole cache.
  */
-static int
-searchUnusedOrClean()
+static size_t
+layoutCache(MYC_SHARED_t *header, int n)
 {
-  for (int i = 0; i < MYC_NUMENTRIES; i++)
-  {
-    /* Any entry with id==0 is free. */
-    if (0 == CacheEntries[i].id)
-    {
-      debug_verbose("returns %d.", i);
-      return i;
-    }
-  }
+  /* Keep every array aligned for its type, and the pages aligned to pages. */
+  size_t versions_off = sizeof(MYC_SHARED_t);
+  size_t pages_off = versions_off + n * sizeof(unsigned int);
+  size_t entries_off = pages_off + n * sizeof(uint32_t);
+  entries_off = (entries_off + MYP_PAGESIZE - 1) / MYP_PAGESIZE * MYP_PAGESIZE;
+  size_t lsn_off = entries_off + (size_t)n * MYP_PAGESIZE;
+  size_t dirty_off = lsn_off + n * sizeof(uint64_t);
+  size_t heat_off = dirty_off + n * sizeof(int);
+  size_t size = heat_off + n * sizeof(unsigned int);
 
-  /* No unused entry in the cache. We have to reuse one clean entry. */
-  for (int i = 0; i < MYC_NUMENTRIES; i++)
+  if (header != NULL)
   {
-    /* Any entry with Dirty==0 is free. */
-    if (0 == CacheDirty[i])
-    {
-      debug_verbose("returns %d.", i);
-      return i;
-    }
+    header->numentries = n;
+    header->versions_off = versions_off;
+    header->pages_off = pages_off;
+    header->entries_off = entries_off;
+    header->dirty_off = dirty_off;
+    header->lsn_off = lsn_off;
+    header->heat_off = heat_off;
+    /* Readers trust the header once they see the magic number. */
+    __atomic_store_n(&header->magic, MYC_SHM_MAGIC, __ATOMIC_RELEASE);
   }
-  /* No unused or clean entry */
-  debug_verbose("returns %d.", -1);
-  return -1;
+  return size;
 }
 
 /**
- * Get a random entry from the cache if all entries are dirty.
- * @return A random index.
+ * Point the private variables to the arrays inside the memory of the cache.
+ * @param header Header of the memory already initialized.
  */
-static int
-searchAny()
+static void
+attachCache(MYC_SHARED_t *header)
 {
-  int i = rand() % MYC_NUMENTRIES;
-  debug_verbose("returns %d.", i);
-  return i;
+  Table->header = header;
+  Table->entries = MYC_SHM_ENTRY(header, 0);
+  Table->pages = MYC_SHM_PAGES(header);
+  Table->fileHeader = &header->file;
+  Table->dirty = MYC_SHM_DIRTY(header);
+  Table->versions = MYC_SHM_VERSIONS(header);
+  Table->lsn = MYC_SHM_LSN(header);
+  Table->heat = MYC_SHM_HEAT(header);
 }
 
 /**
- * Search for an entry already associated with an offset of the file.
- * If there's no such entry, return -1.
- * @return The index of the entry already containing fileIndex. -1 means that no entry was found.
+ * Forget the memory of the cache after freeing or detaching it.
  */
-static int
-searchRecord(int fileIndex)
+static void
+forgetCache()
 {
-  for (int i = 0; i < MYC_NUMENTRIES; i++)
-  {
-    /* Check if entry contains record at fileIndex. */
-    if (fileIndex == CacheEntries[i].id)
-    {
-      debug_verbose("returns %d.", i);
-      return i;
-    }
-  }
-  /* Not found. */
-  return -1;
+  Table->header = NULL;
+  Table->dirty = NULL;
+  Table->entries = NULL;
+  Table->pages = NULL;
+  Table->fileHeader = NULL;
+  Table->versions = NULL;
+  Table->lsn = NULL;
+  Table->heat = NULL;
+  free(Table->hotSet);
+  Table->hotSet = NULL;
+  Table->hotCount = Table->hotNext = 0;
 }
 
 /**
- * This function reads one entry from the file into the cache.
- * The entry CachesEntries[cacheIndex] of the cache is read from the position
- * number "CacheEntries[cacheIndex].id" of the file.
- * @param cacheIndex The index of the entry in the cache.
- * @return -1 indicates an error reading the entry. 0 success.
+ * Take a shared cache handed over by another server, with its dirty entries
+ * and LSNs.
+ * @param id Identifier of the shared memory segment.
+ * @return 0 if OK. -2 if its owner did not hand it over. -1 in case of error.
  */
 static int
-readEntry(int cacheIndex)
+adoptSegment(int id)
 {
-  /* The memory address of the entry can be obtained with this.*/
-  void *src_addr = &(CacheEntries[cacheIndex]);
-  int fileIndex = CacheEntries[cacheIndex].id;
-
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  /* The file contains a table of MYBUCKET_BUCKET_t. */
-  /* Calculate the offset in bytes of the source on this variable. */
-  int offset = fileIndex * sizeof(MYBUCKET_BUCKET_t);
-
-  if (lseek(dbFile, offset, SEEK_SET) != offset)
+  struct shmid_ds info;
+  if (shmctl(id, IPC_STAT, &info) == -1)
   {
-    debug_error("Error seeking into DB file. %s", strerror(errno));
+    debug_error("Error getting the state of the shared cache. %s", strerror(errno));
     return -1;
   }
-
-  /* Read the bucket containing the record from the file.
-   * You use read() to read the memory contents from file. */
-  // modified read for possible interruptions
-  int res;
-  do
-  {
-    res = read(dbFile, src_addr, sizeof(MYBUCKET_BUCKET_t)) != sizeof(MYBUCKET_BUCKET_t);
-  } while (res == -1 && errno == EINTR);
-
-  if (res == -1)
+  if (info.shm_segsz != layoutCache(NULL, Table->numentries))
   {
-    debug_error("Error reading from DB file. %s", strerror(errno));
+    debug_error("The shared cache has another layout (%zu bytes).", (size_t)info.shm_segsz);
     return -1;
   }
-  /* Check status and return -1 in case of error. */
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  CacheDirty[cacheIndex] = 0;
-  return 0;
-}
-
-/**
- * This function writes one entry of the cache to the file.
- * The entry CachesEntries[cacheIndex] of the cache is written on the position
- * number "CachesEntries[cacheIndex].id" of the file.
- * @param cacheIndex The index of the entry in the cache.
- * @return -1 indicates an error writing the entry. 0 success.
- */
-static int
-writeEntry(int cacheIndex)
-{
-  /* The memory address of the entry can be obtained with this.*/
-  void *src_addr = &(CacheEntries[cacheIndex]);
-  int fileIndex = CacheEntries[cacheIndex].id;
-
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  /* The file contains a table of MYBUCKET_BUCKET_t. */
-  /* Calculate the offset in bytes of the destination on this variable. */
-  int offset = fileIndex * sizeof(MYBUCKET_BUCKET_t);
-
-  if (lseek(dbFile, offset, SEEK_SET) != offset)
+  MYC_SHARED_t *header = (MYC_SHARED_t *)shmat(id, NULL, 0);
+  if (header == (void *)-1)
   {
-    debug_error("Error seeking into DB file. %s", strerror(errno));
+    debug_error("Error attaching shared cache. %s", strerror(errno));
     return -1;
   }
-
-  /* Write the bucket containing the record to the file.
-   * You use write() to write the memory contents to file. */
-  // EDITED WRITE FOR POSSIBLE INTERRUPS
-  int res;
-  do
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != MYC_SHM_MAGIC || header->numentries != Table->numentries)
   {
-    res = write(dbFile, src_addr, sizeof(MYBUCKET_BUCKET_t)) != sizeof(MYBUCKET_BUCKET_t);
-  } while (res == -1 && errno == EINTR);
-  if (res == -1)
-  {
-    debug_error("Error writing to DB file. %s", strerror(errno));
+    debug_error("The shared cache is not valid.");
+    shmdt(header);
     return -1;
   }
-  /* Check status and return -1 in case of error. */
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  CacheDirty[cacheIndex] = 0;
+  /* The state is set last by the old owner, after the rest of the cache. */
+  if (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) != MYC_SHM_HANDEDOVER)
+  {
+    shmdt(header);
+    return -2;
+  }
+  attachCache(header);
+  Table->shmId = id;
+  Table->lastLSN = header->last_lsn;
+  Table->unsyncedLSN = header->unsynced_lsn;
+  /* The last server may have allocated pages without writing the header. */
+  Table->headerDirty = 1;
+  header->owner = getpid();
+  __atomic_store_n(&header->state, MYC_SHM_ACTIVE, __ATOMIC_RELEASE);
   return 0;
 }
 
-/************************************************************
- PUBLIC FUNCTIONS
- ************************************************************/
-
-/* Functions without "static" will be visible from any other C file. */
-
-/* This function initializes the cache. */
-
 /**
- * Initialize the cache: allocate RAM, open file, etc.
- * @return -1 in case of error during initialization. 0 means OK.
+ * Read from the DB file or a column file, retrying interrupted and partial reads.
+ * @param file Descriptor of the file.
+ * @param buffer Where to read.
+ * @param size Bytes to read.
+ * @param offset Offset in the file.
+ * @return Bytes read. Less than size at the end of the file. -1 in case of error.
  */
-int MYC_initCache()
+static ssize_t
+readFile(int file, void *buffer, size_t size, off_t offset)
 {
-  /* Allocate memory for the table of buckets. */
-  CacheEntries = allocateCache(MYC_NUMENTRIES);
-  /* Always check everything, warn and return an error. */
-  if (CacheEntries == NULL)
-  {
-    debug_error("Not enough memory for the entry table.");
-    return -1;
-  }
-
-  /* Allocate memory for the table of flags. */
-  CacheDirty = allocateDirty(MYC_NUMENTRIES);
-  /* Always check everything, warn and return an error. */
-  if (CacheDirty == NULL)
+  size_t done = 0;
+  while (done < size)
   {
-    debug_error("Not enough memory for the flags table.");
-    return -1;
+    ssize_t res = pread(file, (char *)buffer + done, size - done, offset + done);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res == -1)
+      return -1;
+    if (res == 0)
+      break;
+    done += res;
   }
+  return done;
+}
 
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  /* Open the DB file below. */
-  /* Insert here the code to open your DB file and leave it open. */
-  /* Add the flags to: READ/WRITE the file and CREATE it if it does not
-   * exists before.
-   * Add the permission flags to set the flags in case of creation.
-   */
-
-  dbFile = open(MYC_FILENAME, O_SYNC | O_RDWR | O_CREAT, S_IRWXU);
-  if (dbFile == -1)
+/**
+ * Write to the DB file or a column file, retrying interrupted and partial writes.
+ * @param file Descriptor of the file.
+ * @param buffer What to write.
+ * @param size Bytes to write.
+ * @param offset Offset in the file.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+writeFile(int file, const void *buffer, size_t size, off_t offset)
+{
+  size_t done = 0;
+  while (done < size)
   {
-    debug_error("Error opening DB file. %s", strerror(errno));
-    return -1;
+    ssize_t res = pwrite(file, (const char *)buffer + done, size - done, offset + done);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res == -1)
+      return -1;
+    done += res;
   }
-
-  debug_info("DB file opened. (%s)", MYC_FILENAME);
-  /* Don't forget to check that the open() has succeded. */
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-
-  /* Everything is OK */
   return 0;
 }
 
 /**
- * This function finishes the cache. It flushes all the information inside the
- * cache that is not written to the file yet and closes the file.
- * @return
+ * Get the name of a segment of the DB file or of a column file. It is in
+ * the directory of the file if no directories were given, or else in one of
+ * them by turns.
+ * @param unit 0 for the DB file. Field + 1 for a column file.
+ * @param segment The number of the segment, from 1.
+ * @param name Where to write the name.
+ * @param size Size of name.
+ * @return -1 if the name is too long. 0 is OK.
  */
-int MYC_closeCache()
+static int
+segmentName(unsigned int unit, uint32_t segment, char *name, size_t size)
 {
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  /* Flush all dirty entries in the cache to the file. */
-  MYC_flushAll();
-
-  /* Free memory of the cache and NULLify pointers. */
-  free(CacheDirty);
-  CacheDirty = NULL;
-  free(CacheEntries);
-  CacheEntries = NULL;
-
-  /* Close the DB file here. */
-  if (close(dbFile) == -1)
-  {
-    debug_error("Error closing DB file. %s", strerror(errno));
-    dbFile = -1;
+  const char *dirs = Table->fileHeader->segmentdirs;
+  char base[FILENAME_MAX];
+  if (unit == 0)
+    snprintf(base, sizeof(base), "%s", Table->filename);
+  else if (snprintf(base, sizeof(base), "%s.%s", Table->filename, Schema->fields[unit - 1].name) >= (int)sizeof(base))
     return -1;
-  }
-  /* Set the file descriptor to -1 to indicate a closed file. */
-  dbFile = -1;
-  debug_info("DB file closed. (%s)", MYC_FILENAME);
-  return 0;
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  if (dirs[0] == '\0')
+    return snprintf(name, size, "%s.%u", base, segment) >= (int)size ? -1 : 0;
+
+  /* Take the directory of the segment from the list. */
+  unsigned int count = 1;
+  for (const char *c = dirs; *c != '\0'; c++)
+    count += *c == ':';
+  for (unsigned int d = (segment - 1) % count; d > 0; d--)
+    dirs = strchr(dirs, ':') + 1;
+  int length = (int)strcspn(dirs, ":");
+  const char *file = strrchr(base, '/');
+  file = file == NULL ? base : file + 1;
+  return snprintf(name, size, "%.*s/%s.%u", length, dirs, file, segment) >= (int)size ? -1 : 0;
 }
 
 /**
- * This function copies into a record passed as argument from the cache.
- * The cache will be read from the given index of the file if not on the cache.
- * The record structure is property of the user, so we have to copy the content
- * of the cache entry onto it.
- *
- * @param fileIndex This is the index of the record in the file.
- * @param record This is a pointer to a record allocated by the user.
- * @return -1 in case of any error like I/O error when reading. 0 is OK.
+ * Get the descriptor of a segment, opening it the first time.
+ * @param unit 0 for the DB file. Field + 1 for a column file.
+ * @param segment The number of the segment, from 1.
+ * @return The descriptor. -1 in case of error.
  */
-int MYC_readEntry(int fileIndex, MYRECORD_RECORD_t *record)
+static int
+segmentFile(unsigned int unit, uint32_t segment)
 {
-  /* This variable will be the index of the entry of the cache to use. */
-  int cacheIndex = 0;
-
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  /* REMEMBER TO USE THE AUXILIARY FUNCTIONS ABOVE. */
-  /* Search the cache to guess if there's already an entry for "fileIndex". */
-  /* If the record was already in the cache copy that entry. */
-  cacheIndex = searchRecord(fileIndex);
-  if (cacheIndex == -1)
+  if (segment >= Table->numSegments[unit])
   {
-    /* If not, get an unused or clean entry to read from the file. */
-    cacheIndex = searchUnusedOrClean();
-    if (cacheIndex == -1)
+    uint32_t count = Table->numSegments[unit] == 0 ? 8 : Table->numSegments[unit];
+    while (count <= segment)
+      count *= 2;
+    int *files = (int *)realloc(Table->segments[unit], count * sizeof(int));
+    if (files == NULL)
     {
-      /* If not, get a dirty entry, and flush its contents before reading from the file. */
-      cacheIndex = searchAny();
-      if (MYC_flushEntry(CacheEntries[cacheIndex].id) == -1)
-      {
-        debug_error("Error flushing entry to cache.");
-        return -1;
-      }
+      debug_error("Not enough memory for the segments of %s.", Table->filename);
+      return -1;
     }
-    /* Remember to update the entry with the index of the file that it contains now. */
-    /* Set the new entry to the current record. */
-    CacheEntries[cacheIndex].id = fileIndex;
-    /* Read from the file to the cache if needed. */
-    if (readEntry(cacheIndex) == -1)
+    for (uint32_t n = Table->numSegments[unit]; n < count; n++)
+      files[n] = -1;
+    Table->segments[unit] = files;
+    Table->numSegments[unit] = count;
+  }
+  int *file = &Table->segments[unit][segment];
+  if (*file == -1)
+  {
+    char name[FILENAME_MAX];
+    if (segmentName(unit, segment, name, sizeof(name)) == -1)
     {
-      debug_error("Error reading entry from cache.");
+      debug_error("Name of segment %u of %s too long.", segment, Table->filename);
+      return -1;
+    }
+    *file = open(name, O_RDWR | O_CREAT, S_IRWXU);
+    if (*file == -1)
+    {
+      debug_error("Error opening segment %s. %s", name, strerror(errno));
       return -1;
     }
+    debug_info("Segment %s opened.", name);
   }
-
-  /* Copy from the record inside the cache entry to the record passed as argument.
-     Remember to use the macros at mybucket.h. */
-  /* Be careful with pointers: record is already a pointer (don't use & again). */
-  myb_bucket2record(&CacheEntries[cacheIndex], record);
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  debug_debug("Entry %d read from cache.", fileIndex);
-  return 0;
+  return *file;
 }
 
-/*
- * This function copies a record passed as argument into the cache.
- * The record will be written at the given index of the file LATER.
- * This funtions does not write the cache entry to the file inmediately.
- * The record structure is property of the user, so we have to copy its
- * content to the entry as the record can be deallocated by the user.
- *
- * @param fileIndex This is the index of the record in the file.
- * @param record This is a pointer to a record allocated by the user.
- * @return -1 in case of any error like I/O error when writing. 0 is OK.
+/**
+ * Close the segments of the selected table.
+ * @return -1 if some segment could not be closed. 0 means OK.
  */
-int MYC_writeEntry(int fileIndex, MYRECORD_RECORD_t *record)
+static int
+closeSegments()
 {
-  /* This variable will be the index of the entry of the cache. */
-  int cacheIndex = 0;
-
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  /* REMEMBER TO USE THE AUXILIARY FUNCTIONS ABOVE. */
-  /* Search the cache to guess if there's already an entry for "fileIndex". */
-  /* If the record was already in the cache use that entry. */
-  cacheIndex = searchRecord(fileIndex);
-  if (cacheIndex == -1)
+  int status = 0;
+  for (unsigned int unit = 0; unit <= MYSCH_MAXFIELDS; unit++)
   {
-    /* If not, get an unused or clean entry. */
-    cacheIndex = searchUnusedOrClean();
-    if (cacheIndex == -1)
+    for (uint32_t n = 0; n < Table->numSegments[unit]; n++)
     {
-      /* If not, get a dirty entry, and flush it before writing on it. */
-      cacheIndex = searchAny();
-      if (writeEntry(cacheIndex) == -1)
+      if (Table->segments[unit][n] != -1 && close(Table->segments[unit][n]) == -1)
       {
-        debug_error("Error flushing entry to cache.");
-        return -1;
+        debug_error("Error closing segment %u of %s. %s", n, Table->filename, strerror(errno));
+        status = -1;
       }
     }
-    /* Set the new entry to the current record. */
-    CacheEntries[cacheIndex].id = fileIndex;
+    free(Table->segments[unit]);
+    Table->segments[unit] = NULL;
+    Table->numSegments[unit] = 0;
   }
+  return status;
+}
 
-  /* Overwrite = copy from the record passed as argument to the record inside the bucket.
-     Remember to use the macros at mybucket.h. */
-  /* Be careful with pointers: record is already a pointer (don't use & again). */
-  myb_record2bucket(record, &CacheEntries[cacheIndex]);
-  CacheDirty[cacheIndex] = 1;
-  CacheEntries[cacheIndex].id = fileIndex;
-  /* Remember to update the entry with the index of the file that contains. */
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  debug_debug("Entry %d written to cache.", fileIndex);
-  return 0;
+/**
+ * Get the file holding a page of the cache.
+ * @param pageNumber The number of the page.
+ * @param offset Where to return the offset of the page in its file.
+ * @return The descriptor of the DB file, of a column file or of one of
+ * their segments. -1 if the segment can't be opened.
+ */
+static int
+pageFile(uint32_t pageNumber, off_t *offset)
+{
+  unsigned int unit = 0;
+  uint32_t page = pageNumber;
+  int file = Table->file;
+  if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS && pageNumber >= COLUMN_PAGES)
+  {
+    unit = pageNumber >> COLUMN_SHIFT;
+    page = pageNumber % COLUMN_PAGES;
+    file = Table->columns[unit - 1];
+  }
+  if (Table->fileHeader->segmented && page >= MYC_SEGMENTPAGES)
+  {
+    file = segmentFile(unit, page / MYC_SEGMENTPAGES);
+    page %= MYC_SEGMENTPAGES;
+  }
+  *offset = (off_t)page * MYP_PAGESIZE;
+  return file;
 }
 
 /**
- * Forces the cache to write the contents of the entry containing the record at
- * "fileIndex" in the file.
- * @param fileIndex This is the index of the entry of the file to be flushed.
- * @return -1 in case of I/O error. 0 is OK.
+ * Get the page map of the file holding a page of the cache.
+ * @param pageNumber The number of the page.
+ * @return The map. NULL if the table is not compressed.
  */
-int MYC_flushEntry(int fileIndex)
+static MYPM_MAP_t *
+pageMap(uint32_t pageNumber)
 {
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  /* Go through the cache and search the entry holding the record
-   * number "fileIndex" of the file. */
-  int cacheIndex = searchRecord(fileIndex);
-  /* If the entry is dirty, write it to disk. */
-  if (CacheDirty[cacheIndex])
+  if (!Table->fileHeader->compressed)
+    return NULL;
+  if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS && pageNumber >= COLUMN_PAGES)
+    return Table->maps[pageNumber >> COLUMN_SHIFT];
+  return Table->maps[0];
+}
+
+/**
+ * Ask the kernel to read consecutive pages of a file in the background.
+ * A run crossing segments is asked for in parts, so each device reads its
+ * part at the same time. Compressed pages are not asked for here.
+ * @param pageNumber The number of the first page.
+ * @param count Number of pages. They must be in the same file.
+ * @return 0 is OK. An error number otherwise.
+ */
+static int
+adviseRun(uint32_t pageNumber, uint32_t count)
+{
+  if (pageMap(pageNumber) != NULL)
+    return 0;
+  while (count > 0)
   {
-    if (writeEntry(cacheIndex) == -1)
+    off_t offset;
+    int file = pageFile(pageNumber, &offset);
+    uint32_t pages = count;
+    if (Table->fileHeader->segmented)
     {
-      debug_error("Error flushing entry to cache.");
-      return -1;
+      uint32_t left = MYC_SEGMENTPAGES - pageNumber % MYC_SEGMENTPAGES;
+      pages = left < count ? left : count;
     }
+    if (file == -1)
+      return errno;
+    int status = posix_fadvise(file, offset, (off_t)pages * MYP_PAGESIZE, POSIX_FADV_WILLNEED);
+    if (status != 0)
+      return status;
+    pageNumber += pages;
+    count -= pages;
   }
-  /* Always check errors*/
-  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
-  debug_debug("Entry %d flushed to disk.", fileIndex);
   return 0;
 }
 
 /**
- * Flush any dirty entry in the cache inmediately.
+ * Get the page holding the value of a field of a record in a table stored
+ * by columns. Each page holds a whole number of values.
+ * @param field Number of the field in the schema.
+ * @param fileIndex The index of the record.
+ * @param offset Where to return the offset of the value in the page.
+ * @return The number of the page.
+ */
+static uint32_t
+columnPage(unsigned int field, uint32_t fileIndex, size_t *offset)
+{
+  unsigned int size = Schema->fields[field].size;
+  uint32_t values = MYP_PAGESIZE / size;
+  *offset = (size_t)(fileIndex % values) * size;
+  return COLUMN_PAGE(field, fileIndex / values);
+}
+
+/**
+ * Get the levels of node pages of the directory of a table stored by rows.
+ * @return The levels above the leaf pages.
+ */
+static int
+dirLevels()
+{
+  return MYP_NODELEVELS + (int)Table->fileHeader->extralevels;
+}
+
+/**
+ * Write the header of the DB file in its first page.
+ * @return -1 indicates an error writing the header. 0 success.
+ */
+static int
+writeHeader()
+{
+  unsigned char page[MYP_PAGESIZE];
+  memset(page, 0, sizeof(page));
+  memcpy(page, Table->fileHeader, sizeof(MYC_FILEHEADER_t));
+  if (writeFile(Table->file, page, sizeof(page), 0) == -1)
+  {
+    debug_error("Error writing header of DB file. %s", strerror(errno));
+    return -1;
+  }
+  countStat(&Stats.bytes_written, sizeof(page));
+  Table->headerDirty = 0;
+  return 0;
+}
+
+/**
+ * Read the header of the DB file, or write it if the file is new.
+ * The records of the file must have the schema of the records of the store.
+ * @return -1 if the file is not valid or in case of error. 0 means OK.
+ */
+static int
+readHeader()
+{
+  ssize_t res = readFile(Table->file, Table->fileHeader, sizeof(MYC_FILEHEADER_t), 0);
+  if (res == -1)
+  {
+    debug_error("Error reading header of DB file. %s", strerror(errno));
+    return -1;
+  }
+  if (res == 0)
+  {
+    /* A new file: only the header page. */
+    memset(Table->fileHeader, 0, sizeof(MYC_FILEHEADER_t));
+    Table->fileHeader->magic = MYC_FILE_MAGIC;
+    Table->fileHeader->version = MYC_FILE_VERSION;
+    Table->fileHeader->pagesize = MYP_PAGESIZE;
+    Table->fileHeader->numpages = 1;
+    Table->fileHeader->schema = *Schema;
+    Table->fileHeader->layout = Table->layout == -1 ? MYC_LAYOUT_ROWS : (unsigned int)Table->layout & ~LAYOUT_FLAGS;
+    Table->fileHeader->segmented = Table->layout != -1 && (Table->layout & MYC_SEGMENTED) != 0 &&
+                                   Table->fileHeader->layout != MYC_LAYOUT_LSM;
+    Table->fileHeader->compressed = Table->layout != -1 && (Table->layout & MYC_COMPRESSED) != 0 &&
+                                    Table->fileHeader->layout != MYC_LAYOUT_LSM && !Table->fileHeader->segmented;
+    if (Table->fileHeader->segmented)
+      strcpy(Table->fileHeader->segmentdirs, segmentDirs);
+    debug_info("New DB file. (%s)", Table->filename);
+    return writeHeader();
+  }
+  if (res != sizeof(MYC_FILEHEADER_t) || Table->fileHeader->magic != MYC_FILE_MAGIC ||
+      Table->fileHeader->version != MYC_FILE_VERSION || Table->fileHeader->pagesize != MYP_PAGESIZE ||
+      Table->fileHeader->extralevels > MYP_MAXNODELEVELS - MYP_NODELEVELS ||
+      memchr(Table->fileHeader->segmentdirs, '\0', MYC_SEGMENTDIRS) == NULL)
+  {
+    debug_error("%s is not a DB file of version %d.", Table->filename, MYC_FILE_VERSION);
+    return -1;
+  }
+  if (!MYSCH_compatible(&Table->fileHeader->schema, Schema))
+  {
+    debug_error("The records of %s have another schema.", Table->filename);
+    return -1;
+  }
+  /* Strings may be longer or shorter now. Records are packed the same way,
+   * but values in columns keep the size of their field. */
+  if (memcmp(&Table->fileHeader->schema, Schema, sizeof(MYSCHEMA_t)) != 0)
+  {
+    if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS)
+    {
+      debug_error("The fields of %s have another size.", Table->filename);
+      return -1;
+    }
+    Table->fileHeader->schema = *Schema;
+    Table->headerDirty = 1;
+  }
+  debug_info("DB file has %u pages.", Table->fileHeader->numpages);
+  return 0;
+}
+
+/**
+ * Close the column files of the selected table.
+ * @return -1 if some file could not be closed. 0 means OK.
+ */
+static int
+closeColumns()
+{
+  int status = 0;
+  for (int f = 0; f < MYSCH_MAXFIELDS; f++)
+  {
+    if (Table->columns[f] != -1 && close(Table->columns[f]) == -1)
+    {
+      debug_error("Error closing column file of %s. %s", Table->filename, strerror(errno));
+      status = -1;
+    }
+    Table->columns[f] = -1;
+  }
+  return status;
+}
+
+/**
+ * Check the layout of the DB file and open its column files if it is stored
+ * by columns. Each column file is named after the DB file and its field.
+ * @return -1 if the layout is not the one asked for or in case of error. 0 means OK.
+ */
+static int
+openColumns()
+{
+  static const char *layouts[] = {"by rows", "by columns", "as a log-structured merge tree", "in a B+tree"};
+  unsigned int layout = Table->fileHeader->layout;
+  if (layout > MYC_LAYOUT_BTREE)
+  {
+    debug_error("%s has an unknown layout (%u).", Table->filename, layout);
+    return -1;
+  }
+  if (Table->layout != -1 && ((unsigned int)Table->layout & ~LAYOUT_FLAGS) != layout)
+  {
+    debug_error("%s is stored %s.", Table->filename, layouts[layout]);
+    return -1;
+  }
+  if (layout != MYC_LAYOUT_COLUMNS)
+    return 0;
+  for (unsigned int f = 0; f < Schema->numfields; f++)
+  {
+    /* Every index must fit in the pages of each column. */
+    const MYSCHEMA_FIELD_t *field = &Schema->fields[f];
+    if ((uint64_t)(MYP_PAGESIZE / field->size) * COLUMN_PAGES < MYC_MAXRECORDS)
+    {
+      debug_error("Field %s is too large to be stored in a column.", field->name);
+      return -1;
+    }
+    char name[FILENAME_MAX];
+    if (snprintf(name, sizeof(name), "%s.%s", Table->filename, field->name) >= (int)sizeof(name))
+    {
+      debug_error("Name of column file too long. (%s)", Table->filename);
+      return -1;
+    }
+    Table->columns[f] = open(name, O_RDWR | O_CREAT, S_IRWXU);
+    if (Table->columns[f] == -1)
+    {
+      debug_error("Error opening column file %s. %s", name, strerror(errno));
+      return -1;
+    }
+  }
+  debug_info("%u column files opened. (%s)", Schema->numfields, Table->filename);
+  return 0;
+}
+
+/**
+ * Close the page maps of the selected table without saving them.
+ */
+static void
+closeMaps()
+{
+  for (int m = 0; m <= MYSCH_MAXFIELDS; m++)
+  {
+    if (Table->maps[m] != NULL)
+      MYPM_close(Table->maps[m]);
+    Table->maps[m] = NULL;
+  }
+}
+
+/**
+ * Save the page maps of the selected table.
+ * @param sync 1 to sync them to disk.
+ * @return -1 if some map could not be saved. 0 means OK.
+ */
+static int
+saveMaps(int sync)
+{
+  int status = 0;
+  for (int m = 0; m <= MYSCH_MAXFIELDS; m++)
+  {
+    if (Table->maps[m] != NULL && MYPM_save(Table->maps[m], sync) == -1)
+    {
+      debug_error("Error saving page map of %s. %s", Table->filename, strerror(errno));
+      status = -1;
+    }
+  }
+  return status;
+}
+
+/**
+ * Open the page maps of a compressed table, one for the DB file after its
+ * header page and one for each column file.
+ * @return -1 if a map is lost or damaged or in case of error. 0 means OK.
+ */
+static int
+openMaps()
+{
+  if (Table->fileHeader->compressed != 0 && Table->fileHeader->compressed != 1)
+  {
+    debug_error("%s has an unknown compression (%u).", Table->filename, Table->fileHeader->compressed);
+    return -1;
+  }
+  if (!Table->fileHeader->compressed)
+    return 0;
+  char name[FILENAME_MAX];
+  for (int m = 0; m <= MYSCH_MAXFIELDS; m++)
+  {
+    int length;
+    if (m == 0)
+      length = snprintf(name, sizeof(name), "%s.map", Table->filename);
+    else if (Table->columns[m - 1] != -1)
+      length = snprintf(name, sizeof(name), "%s.%s.map", Table->filename, Schema->fields[m - 1].name);
+    else
+      continue;
+    if (length >= (int)sizeof(name))
+    {
+      debug_error("Name of page map too long. (%s)", Table->filename);
+      return -1;
+    }
+    int fd = m == 0 ? Table->file : Table->columns[m - 1];
+    Table->maps[m] = MYPM_open(name, fd, m == 0 ? MYP_PAGESIZE : 0);
+    if (Table->maps[m] == NULL)
+    {
+      debug_error("Error opening page map %s. %s", name, strerror(errno));
+      return -1;
+    }
+  }
+  debug_info("Pages of %s are compressed.", Table->filename);
+  return 0;
+}
+
+/**
+ * Open the log-structured merge tree of a table stored as one. Its memtable
+ * takes the memory of the pages of the cache.
+ * @return -1 in case of error. 0 means OK.
+ */
+static int
+openLsm()
+{
+  if (Table->fileHeader->layout != MYC_LAYOUT_LSM)
+    return 0;
+  Table->lsm = MYLSM_open(Table->filename, Table->entries, (size_t)Table->numentries * MYP_PAGESIZE,
+                          &Stats.bytes_read, &Stats.bytes_written);
+  if (Table->lsm == NULL)
+  {
+    debug_error("Error opening log-structured merge tree of %s. %s", Table->filename, strerror(errno));
+    return -1;
+  }
+  debug_info("Log-structured merge tree of %s has %d runs.", Table->filename, MYLSM_runs(Table->lsm));
+  return 0;
+}
+
+/**
+ * Close the log-structured merge tree of the selected table, if any. The
+ * log is written but not synced.
+ * @return -1 if the log could not be written. 0 means OK.
+ */
+static int
+closeLsm()
+{
+  if (Table->lsm == NULL)
+    return 0;
+  int status = MYLSM_close(Table->lsm);
+  Table->lsm = NULL;
+  if (status == -1)
+    debug_error("Error writing the log of %s. %s", Table->filename, strerror(errno));
+  return status;
+}
+
+/**
+ * Open the DB file. The cache memory must be already allocated.
+ * @return -1 in case of error. 0 means OK.
+ */
+static int
+openDBFile()
+{
+  /* Records are packed with this schema. The largest one must fit in a page. */
+  Schema = MYSCH_recordSchema();
+  if (MYSCH_maxPacked(Schema) > MYP_PAGESIZE - sizeof(MYPAGE_HEADER_t) - sizeof(MYPAGE_SLOT_t))
+  {
+    debug_error("Records are too large for pages of %d bytes.", MYP_PAGESIZE);
+    return -1;
+  }
+
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* Open the DB file below. */
+  /* Insert here the code to open your DB file and leave it open. */
+  /* Add the flags to: READ/WRITE the file and CREATE it if it does not
+   * exists before.
+   * Add the permission flags to set the flags in case of creation.
+   */
+
+  /* The file is not opened with O_SYNC. Writes are synced in batches when
+   * flushing, and LSNs tell which writes are already on disk. */
+  Table->file = open(Table->filename, O_RDWR | O_CREAT, S_IRWXU);
+  if (Table->file == -1)
+  {
+    debug_error("Error opening DB file. %s", strerror(errno));
+    return -1;
+  }
+
+  debug_info("DB file opened. (%s)", Table->filename);
+  /* Don't forget to check that the open() has succeded. */
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+
+  /* A cache handed over already holds the header with its last changes. */
+  if ((Table->fileHeader->magic != MYC_FILE_MAGIC && readHeader() == -1) || openColumns() == -1 ||
+      openMaps() == -1 || openLsm() == -1)
+  {
+    closeLsm();
+    closeMaps();
+    closeColumns();
+    closeSegments();
+    close(Table->file);
+    Table->file = -1;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Search for an unused entry in the table.
+ * If there's no unused one, just one clean entry.
+ * If there's no clean one, return -1.
+ * @return The index of the selected entry. -1 means that no entry was unused or clean.
+ */
+static int
+searchUnusedOrClean()
+{
+  for (int i = 0; i < Table->numentries; i++)
+  {
+    /* Any entry with page 0 is free. */
+    if (0 == Table->pages[i])
+    {
+      debug_verbose("returns %d.", i);
+      return i;
+    }
+  }
+
+  /* No unused entry in the cache. We have to reuse one clean entry. They are
+   * reused in turn, so pages used one after the other (a page of the
+   * directory and a page of records, or the pages of two columns) don't keep
+   * taking the same entry from each other. */
+  for (int n = 0; n < Table->numentries; n++)
+  {
+    int i = (Table->nextClean + n) % Table->numentries;
+    /* Any entry with Dirty==0 is free. */
+    if (0 == Table->dirty[i])
+    {
+      Table->nextClean = (i + 1) % Table->numentries;
+      debug_verbose("returns %d.", i);
+      return i;
+    }
+  }
+  /* No unused or clean entry */
+  debug_verbose("returns %d.", -1);
+  return -1;
+}
+
+/**
+ * Get a random entry from the cache if all entries are dirty.
+ * @return A random index.
+ */
+static int
+searchAny()
+{
+  int i = rand() % Table->numentries;
+  debug_verbose("returns %d.", i);
+  return i;
+}
+
+/**
+ * Search for an entry already holding a page of the file.
+ * If there's no such entry, return -1.
+ * @param pageNumber The number of the page in the file. 0 finds an unused entry.
+ * @return The index of the entry already containing the page. -1 means that no entry was found.
+ */
+static int
+searchPage(uint32_t pageNumber)
+{
+  for (int i = 0; i < Table->numentries; i++)
+  {
+    /* Check if entry contains the page. */
+    if (pageNumber == Table->pages[i])
+    {
+      debug_verbose("returns %d.", i);
+      return i;
+    }
+  }
+  /* Not found. */
+  return -1;
+}
+
+/**
+ * Get the memory of an entry of the cache.
+ * @param cacheIndex The index of the entry in the cache.
+ * @return The page held by the entry.
+ */
+static unsigned char *
+entryOf(int cacheIndex)
+{
+  return Table->entries + (size_t)cacheIndex * MYP_PAGESIZE;
+}
+
+/**
+ * Read a page of the DB file or of a column file. Pages beyond the end of
+ * the file were never written and read as zeros.
+ * @param pageNumber The number of the page.
+ * @param buffer Where to read the page.
+ * @return -1 indicates an error reading the page. 0 success.
+ */
+static int
+readPage(uint32_t pageNumber, unsigned char *buffer)
+{
+  /* Calculate the offset in bytes of the source on this variable. */
+  off_t offset;
+  int file = pageFile(pageNumber, &offset);
+  MYPM_MAP_t *map = pageMap(pageNumber);
+
+  /* Read the page from the file. A compressed page is read from its chunk. */
+  ssize_t res;
+  if (map != NULL)
+    res = MYPM_read(map, file, offset / MYP_PAGESIZE, buffer);
+  else
+    res = readFile(file, buffer, MYP_PAGESIZE, offset);
+  if (res == -1)
+  {
+    debug_error("Error reading from DB file. %s", strerror(errno));
+    return -1;
+  }
+  if (map == NULL)
+    memset(buffer + res, 0, MYP_PAGESIZE - res);
+  countStat(&Stats.bytes_read, res);
+  return 0;
+}
+
+/**
+ * This function reads one page from the file into the cache.
+ * The entry CachesEntries[cacheIndex] of the cache is read from the page
+ * number "Table->pages[cacheIndex]" of the file. Pages beyond the end of the
+ * file were never written and read as zeros.
+ * @param cacheIndex The index of the entry in the cache.
+ * @return -1 indicates an error reading the entry. 0 success.
+ */
+static int
+readEntry(int cacheIndex)
+{
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* The file contains a table of pages. */
+  /* Check status and return -1 in case of error. */
+  if (readPage(Table->pages[cacheIndex], entryOf(cacheIndex)) == -1)
+    return -1;
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  Table->dirty[cacheIndex] = 0;
+  pageMissed = 1;
+  return 0;
+}
+
+/**
+ * This function writes one page of the cache to the file.
+ * The entry CachesEntries[cacheIndex] of the cache is written on the page
+ * number "Table->pages[cacheIndex]" of the file.
+ * @param cacheIndex The index of the entry in the cache.
+ * @return -1 indicates an error writing the entry. 0 success.
+ */
+static int
+writeEntry(int cacheIndex)
+{
+  /* The memory address of the entry can be obtained with this.*/
+  const unsigned char *src_addr = entryOf(cacheIndex);
+
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* The file contains a table of pages. */
+  /* Calculate the offset in bytes of the destination on this variable. */
+  off_t offset;
+  int file = pageFile(Table->pages[cacheIndex], &offset);
+  MYPM_MAP_t *map = pageMap(Table->pages[cacheIndex]);
+
+  /* Write the page to the file. A compressed page is written to its chunk. */
+  ssize_t res;
+  if (map != NULL)
+    res = MYPM_write(map, file, offset / MYP_PAGESIZE, src_addr);
+  else
+    res = writeFile(file, src_addr, MYP_PAGESIZE, offset) == -1 ? -1 : MYP_PAGESIZE;
+  if (res == -1)
+  {
+    debug_error("Error writing to DB file. %s", strerror(errno));
+    return -1;
+  }
+  countStat(&Stats.bytes_written, res);
+  /* Check status and return -1 in case of error. */
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* The writes of this entry are in the file but not on disk until the next sync. */
+  if (Table->lsn[cacheIndex] != 0 && (Table->unsyncedLSN == 0 || Table->lsn[cacheIndex] < Table->unsyncedLSN))
+    Table->unsyncedLSN = Table->lsn[cacheIndex];
+  Table->lsn[cacheIndex] = 0;
+  Table->dirty[cacheIndex] = 0;
+  return 0;
+}
+
+/**
+ * Count one access to an entry. A page read from the file starts cold.
+ * @param cacheIndex The index of the entry in the cache.
+ * @param loaded The entry was just loaded with another page.
+ */
+static void
+touchEntry(int cacheIndex, int loaded)
+{
+  if (loaded)
+    Table->heat[cacheIndex] = 1;
+  else if (Table->heat[cacheIndex] < UINT32_MAX)
+    Table->heat[cacheIndex]++;
+}
+
+/**
+ * Compare two integers for qsort().
+ */
+static int
+compareInt(const void *a, const void *b)
+{
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Sync one file of syncFiles().
+ * @param arg The file.
+ * @return NULL.
+ */
+static void *
+syncThread(void *arg)
+{
+  sync_t *sync = (sync_t *)arg;
+  sync->status = fdatasync(sync->file);
+  sync->error = errno;
+  return NULL;
+}
+
+/**
+ * Sync the DB file, the column files and the segments of the selected table
+ * to disk. When there are several, each one is synced by its own thread, so
+ * that files on different devices are written at the same time.
+ * @return -1 if some file could not be synced. 0 success.
+ */
+static int
+syncFiles()
+{
+  int count = 1;
+  for (int f = 0; f < MYSCH_MAXFIELDS; f++)
+    count += Table->columns[f] != -1;
+  for (unsigned int unit = 0; unit <= MYSCH_MAXFIELDS; unit++)
+  {
+    for (uint32_t n = 0; n < Table->numSegments[unit]; n++)
+      count += Table->segments[unit][n] != -1;
+  }
+  if (count == 1)
+    return fdatasync(Table->file);
+
+  sync_t *syncs = (sync_t *)calloc(count, sizeof(sync_t));
+  if (syncs == NULL)
+    return -1;
+  count = 0;
+  syncs[count++].file = Table->file;
+  for (int f = 0; f < MYSCH_MAXFIELDS; f++)
+  {
+    if (Table->columns[f] != -1)
+      syncs[count++].file = Table->columns[f];
+  }
+  for (unsigned int unit = 0; unit <= MYSCH_MAXFIELDS; unit++)
+  {
+    for (uint32_t n = 0; n < Table->numSegments[unit]; n++)
+    {
+      if (Table->segments[unit][n] != -1)
+        syncs[count++].file = Table->segments[unit][n];
+    }
+  }
+  /* The DB file is synced here, and so is a file whose thread can't start. */
+  for (int i = 1; i < count; i++)
+  {
+    syncs[i].started = pthread_create(&syncs[i].thread, NULL, syncThread, &syncs[i]) == 0;
+    if (!syncs[i].started)
+      syncThread(&syncs[i]);
+  }
+  syncThread(&syncs[0]);
+  int status = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (syncs[i].started)
+      pthread_join(syncs[i].thread, NULL);
+    if (syncs[i].status == -1)
+    {
+      errno = syncs[i].error;
+      status = -1;
+    }
+  }
+  free(syncs);
+  return status;
+}
+
+/**
+ * Sync the writes done to the file to disk, with the header of the file.
+ * The page maps of a compressed table are saved once the chunks they point
+ * to are on disk. The log of a log-structured merge tree is synced first.
+ * @return -1 indicates an error syncing the file. 0 success.
+ */
+static int
+syncFile()
+{
+  if (Table->lsm != NULL && Table->unsyncedLSN != 0)
+  {
+    /* Every write not in a run is in the log. */
+    uint64_t start = nowNs();
+    if (MYLSM_sync(Table->lsm) == -1)
+    {
+      debug_error("Error syncing the log of %s. %s", Table->filename, strerror(errno));
+      return -1;
+    }
+    countStat(&Stats.syncs, 1);
+    countStat(&Stats.sync_ns, nowNs() - start);
+    Table->unsyncedLSN = 0;
+  }
+  int headerWritten = Table->headerDirty;
+  if (Table->headerDirty && writeHeader() == -1)
+    return -1;
+  if (Table->unsyncedLSN == 0 && !headerWritten)
+    return saveMaps(1);
+  uint64_t start = nowNs();
+  if (syncFiles() == -1)
+  {
+    debug_error("Error syncing DB file. %s", strerror(errno));
+    return -1;
+  }
+  countStat(&Stats.syncs, 1);
+  countStat(&Stats.sync_ns, nowNs() - start);
+  Table->unsyncedLSN = 0;
+  return saveMaps(1);
+}
+
+/**
+ * Mark an entry as changed by the last write. Its LSN is the one of the
+ * oldest write not flushed yet.
+ * @param cacheIndex The index of the entry in the cache.
+ */
+static void
+dirtyEntry(int cacheIndex)
+{
+  if (!Table->dirty[cacheIndex])
+    Table->lsn[cacheIndex] = Table->lastLSN;
+  Table->dirty[cacheIndex] = 1;
+}
+
+/**
+ * Get the bit of a page in the map of the pages copied by the snapshot.
+ * @param pageNumber The number of the page.
+ * @param unit Where to return the file of the image holding the page.
+ * @param bit Where to return the bit.
+ * @return 1 if the page belongs to the image. 0 if it was added later.
+ */
+static int
+snapshotBit(uint32_t pageNumber, unsigned int *unit, uint64_t *bit)
+{
+  snapshot_t *snapshot = Table->snapshot;
+  uint32_t page = pageNumber;
+  *unit = 0;
+  if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS && pageNumber >= COLUMN_PAGES)
+  {
+    *unit = pageNumber >> COLUMN_SHIFT;
+    page = pageNumber % COLUMN_PAGES;
+  }
+  if (*unit > MYSCH_MAXFIELDS || page >= snapshot->pages[*unit] || pageNumber == 0)
+    return 0;
+  *bit = snapshot->first[*unit] + page;
+  return 1;
+}
+
+/**
+ * Stop the snapshot of the selected table. The image of a snapshot that did
+ * not end is removed.
+ * @param ended 1 if every page was copied.
+ */
+static void
+endSnapshot(int ended)
+{
+  snapshot_t *snapshot = Table->snapshot;
+  for (unsigned int f = 0; f <= MYSCH_MAXFIELDS; f++)
+  {
+    if (snapshot->files[f] == -1)
+      continue;
+    close(snapshot->files[f]);
+    if (!ended)
+      unlink(snapshot->names[f]);
+  }
+  free(snapshot->names);
+  free(snapshot->copied);
+  free(snapshot);
+  Table->snapshot = NULL;
+}
+
+/**
+ * End the snapshot of the selected table once every page is copied. The
+ * image is synced and its header is written last, so that an image without
+ * a header is never taken for a complete one.
+ * @return -1 if the snapshot failed and was removed. 0 is OK.
+ */
+static int
+finishSnapshot()
+{
+  snapshot_t *snapshot = Table->snapshot;
+  unsigned char header[MYP_PAGESIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, &snapshot->header, sizeof(MYC_FILEHEADER_t));
+  int status = 0;
+  for (unsigned int f = 1; f <= MYSCH_MAXFIELDS; f++)
+  {
+    if (snapshot->files[f] != -1 && fdatasync(snapshot->files[f]) == -1)
+      status = -1;
+  }
+  if (status == -1 || fdatasync(snapshot->files[0]) == -1 || writeFile(snapshot->files[0], header, sizeof(header), 0) == -1 ||
+      fdatasync(snapshot->files[0]) == -1)
+  {
+    debug_error("Error syncing snapshot %s. %s", snapshot->names[0], strerror(errno));
+    endSnapshot(0);
+    return -1;
+  }
+  debug_info("Snapshot of %s written to %s.", Table->filename, snapshot->names[0]);
+  endSnapshot(1);
+  return 0;
+}
+
+/**
+ * Write a page to the image of the snapshot, unless it is there already or
+ * it was added after the snapshot started.
+ * @param pageNumber The number of the page.
+ * @param page The page as it was when the snapshot started.
+ * @return -1 if the snapshot failed and was removed. 0 is OK.
+ */
+static int
+copyPage(uint32_t pageNumber, const unsigned char *page)
+{
+  snapshot_t *snapshot = Table->snapshot;
+  unsigned int unit;
+  uint64_t bit;
+  if (!snapshotBit(pageNumber, &unit, &bit) || (snapshot->copied[bit / 8] & (1u << (bit % 8))) != 0)
+    return 0;
+  off_t offset = (off_t)(bit - snapshot->first[unit]) * MYP_PAGESIZE;
+  if (writeFile(snapshot->files[unit], page, MYP_PAGESIZE, offset) == -1)
+  {
+    debug_error("Error writing snapshot %s. %s", snapshot->names[unit], strerror(errno));
+    endSnapshot(0);
+    return -1;
+  }
+  countStat(&Stats.bytes_written, MYP_PAGESIZE);
+  snapshot->copied[bit / 8] |= (unsigned char)(1u << (bit % 8));
+  if (--snapshot->left > 0)
+    return 0;
+  return finishSnapshot();
+}
+
+/**
+ * Copy the page of an entry to the snapshot before it changes. It is the
+ * page as it was when the snapshot started: it did not change since, or it
+ * would have been copied then.
+ * @param cacheIndex The index of the entry in the cache.
+ */
+static void
+keepPage(int cacheIndex)
+{
+  copyPage(Table->pages[cacheIndex], entryOf(cacheIndex));
+}
+
+/**
+ * Mark an entry as changing. Readers sharing the cache will retry. A
+ * snapshot running gets the page first, as it was before the change.
+ * @param cacheIndex The index of the entry in the cache.
+ */
+static void
+beginUpdate(int cacheIndex)
+{
+  if (Table->snapshot != NULL && Table->pages[cacheIndex] != 0)
+    keepPage(cacheIndex);
+  __atomic_store_n(&Table->versions[cacheIndex], Table->versions[cacheIndex] + 1, __ATOMIC_RELAXED);
+  /* The odd version must be visible before any change of the entry. */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Mark an entry as stable again after changing it.
+ * @param cacheIndex The index of the entry in the cache.
+ */
+static void
+endUpdate(int cacheIndex)
+{
+  __atomic_store_n(&Table->versions[cacheIndex], Table->versions[cacheIndex] + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the entry of the cache holding a page of the file. If the page is not
+ * in the cache, an unused or clean entry is used, or else a dirty one is
+ * flushed first.
+ * @param pageNumber The number of the page in the file.
+ * @param fresh The page is new: clear it instead of reading it.
+ * @return The index of the entry. -1 in case of I/O error.
+ */
+static int
+fetchPage(uint32_t pageNumber, int fresh)
+{
+  int cacheIndex = searchPage(pageNumber);
+  if (cacheIndex != -1)
+  {
+    touchEntry(cacheIndex, 0);
+    return cacheIndex;
+  }
+  /* If not, get an unused or clean entry to read from the file. */
+  cacheIndex = searchUnusedOrClean();
+  if (cacheIndex == -1)
+  {
+    /* If not, get a dirty entry, and flush its contents before reading from the file. */
+    cacheIndex = searchAny();
+    countStat(&Stats.evictions, 1);
+    if (writeEntry(cacheIndex) == -1)
+    {
+      debug_error("Error flushing entry to cache.");
+      return -1;
+    }
+  }
+  beginUpdate(cacheIndex);
+  Table->pages[cacheIndex] = pageNumber;
+  if (fresh)
+  {
+    memset(entryOf(cacheIndex), 0, MYP_PAGESIZE);
+    Table->dirty[cacheIndex] = 0;
+  }
+  else if (readEntry(cacheIndex) == -1)
+  {
+    /* Leave the entry unused instead of holding a partial page. */
+    Table->pages[cacheIndex] = 0;
+    endUpdate(cacheIndex);
+    debug_error("Error reading page %u.", pageNumber);
+    return -1;
+  }
+  endUpdate(cacheIndex);
+  touchEntry(cacheIndex, 1);
+  return cacheIndex;
+}
+
+/**
+ * Add a page at the end of the file. It is cleared in the cache.
+ * @param pageNumber Where to return the number of the page.
+ * @return The index of the entry holding the page. -1 in case of I/O error.
+ */
+static int
+newPage(uint32_t *pageNumber)
+{
+  *pageNumber = Table->fileHeader->numpages++;
+  Table->headerDirty = 1;
+  int cacheIndex = fetchPage(*pageNumber, 1);
+  if (cacheIndex != -1)
+    dirtyEntry(cacheIndex);
+  return cacheIndex;
+}
+
+/**
+ * Find where a record is stored, going down the directory.
+ * @param fileIndex The index of the record.
+ * @param rid Where to return the page and slot of the record. Page 0 if the
+ * record was never written.
+ * @param span Where to return how many records share the missing page of
+ * the directory when the record was never written, or 1. May be NULL.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+lookupRecord(uint32_t fileIndex, MYPAGE_RID_t *rid, uint64_t *span)
+{
+  rid->page = 0;
+  rid->slot = 0;
+  uint64_t below = MYP_records(dirLevels());
+  if (fileIndex >= below)
+  {
+    /* The directory never grew up to the record, nor to any record after it. */
+    if (span != NULL)
+      *span = (uint64_t)1 << 32;
+    return 0;
+  }
+  uint32_t pageNumber = Table->fileHeader->root;
+  for (int level = dirLevels(); level > 0 && pageNumber != 0; level--)
+  {
+    int cacheIndex = fetchPage(pageNumber, 0);
+    if (cacheIndex == -1)
+      return -1;
+    pageNumber = ((const uint32_t *)entryOf(cacheIndex))[MYP_entry(fileIndex, level)];
+    below /= MYP_NODEENTRIES;
+  }
+  if (span != NULL)
+    *span = pageNumber == 0 ? below : 1;
+  if (pageNumber == 0)
+    return 0;
+  int cacheIndex = fetchPage(pageNumber, 0);
+  if (cacheIndex == -1)
+    return -1;
+  *rid = ((const MYPAGE_RID_t *)entryOf(cacheIndex))[MYP_entry(fileIndex, 0)];
+  return 0;
+}
+
+/**
+ * Add a level at the top of the directory. The old root becomes the first
+ * child of the new one. Readers sharing the cache see no root while it
+ * changes, and read the records from the server.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+growDirectory()
+{
+  uint32_t root = Table->fileHeader->root;
+  if (root != 0)
+  {
+    uint32_t pageNumber;
+    int cacheIndex = newPage(&pageNumber);
+    if (cacheIndex == -1)
+      return -1;
+    beginUpdate(cacheIndex);
+    ((uint32_t *)entryOf(cacheIndex))[0] = root;
+    endUpdate(cacheIndex);
+    root = pageNumber;
+  }
+  __atomic_store_n(&Table->fileHeader->root, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&Table->fileHeader->extralevels, Table->fileHeader->extralevels + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&Table->fileHeader->root, root, __ATOMIC_RELEASE);
+  Table->headerDirty = 1;
+  debug_info("Directory of %s grown to %d levels.", Table->filename, dirLevels());
+  return 0;
+}
+
+/**
+ * Record in the directory where a record is stored. Missing pages of the
+ * directory are added, and levels at the top if the index is beyond it.
+ * Each page is fetched again after adding the one below, as adding it may
+ * have evicted it.
+ * @param fileIndex The index of the record.
+ * @param rid The page and slot of the record.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+storeLocation(uint32_t fileIndex, const MYPAGE_RID_t *rid)
+{
+  while (fileIndex >= MYP_records(dirLevels()))
+  {
+    if (growDirectory() == -1)
+      return -1;
+  }
+  uint32_t pageNumber = Table->fileHeader->root;
+  if (pageNumber == 0)
+  {
+    if (newPage(&pageNumber) == -1)
+      return -1;
+    Table->fileHeader->root = pageNumber;
+  }
+  for (int level = dirLevels(); level > 0; level--)
+  {
+    int cacheIndex = fetchPage(pageNumber, 0);
+    if (cacheIndex == -1)
+      return -1;
+    uint32_t *node = (uint32_t *)entryOf(cacheIndex);
+    uint32_t child = node[MYP_entry(fileIndex, level)];
+    if (child == 0)
+    {
+      if (newPage(&child) == -1)
+        return -1;
+      cacheIndex = fetchPage(pageNumber, 0);
+      if (cacheIndex == -1)
+        return -1;
+      node = (uint32_t *)entryOf(cacheIndex);
+      beginUpdate(cacheIndex);
+      node[MYP_entry(fileIndex, level)] = child;
+      dirtyEntry(cacheIndex);
+      endUpdate(cacheIndex);
+    }
+    pageNumber = child;
+  }
+  int cacheIndex = fetchPage(pageNumber, 0);
+  if (cacheIndex == -1)
+    return -1;
+  beginUpdate(cacheIndex);
+  ((MYPAGE_RID_t *)entryOf(cacheIndex))[MYP_entry(fileIndex, 0)] = *rid;
+  dirtyEntry(cacheIndex);
+  endUpdate(cacheIndex);
+  return 0;
+}
+
+/**
+ * Store a packed record in the page receiving new records. A new page is
+ * added when it is full.
+ * @param fileIndex The index of the record.
+ * @param packed The packed record.
+ * @param length Bytes of the packed record.
+ * @param rid Where to return the page and slot of the record.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+insertRecord(uint32_t fileIndex, const unsigned char *packed, size_t length, MYPAGE_RID_t *rid)
+{
+  uint32_t pageNumber = Table->fileHeader->insertpage;
+  int cacheIndex = -1;
+  if (pageNumber != 0)
+  {
+    cacheIndex = fetchPage(pageNumber, 0);
+    if (cacheIndex == -1)
+      return -1;
+    /* A page never written reads as zeros: start it again. */
+    if (((const MYPAGE_HEADER_t *)entryOf(cacheIndex))->upper == 0)
+    {
+      beginUpdate(cacheIndex);
+      MYP_init(entryOf(cacheIndex));
+      endUpdate(cacheIndex);
+    }
+    if (MYP_room(entryOf(cacheIndex)) < length)
+      cacheIndex = -1;
+  }
+  if (cacheIndex == -1)
+  {
+    cacheIndex = newPage(&pageNumber);
+    if (cacheIndex == -1)
+      return -1;
+    beginUpdate(cacheIndex);
+    MYP_init(entryOf(cacheIndex));
+    endUpdate(cacheIndex);
+    Table->fileHeader->insertpage = pageNumber;
+  }
+  beginUpdate(cacheIndex);
+  int slot = MYP_insert(entryOf(cacheIndex), fileIndex, packed, length);
+  dirtyEntry(cacheIndex);
+  endUpdate(cacheIndex);
+  rid->page = pageNumber;
+  rid->slot = (uint32_t)slot;
+  return 0;
+}
+
+/**
+ * Read the values of some fields of a record from their columns.
+ * @param fileIndex The index of the record.
+ * @param record Where to copy the record. The other fields are left empty.
+ * @param fields Mask of the fields to read (bit i for field i).
+ * @param entries Entry of the cache last used for each column, or -1. The
+ * entries are checked before using them and updated.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+readColumns(uint32_t fileIndex, MYRECORD_RECORD_t *record, unsigned int fields, int *entries)
+{
+  memset(record, 0, sizeof(MYRECORD_RECORD_t));
+  for (unsigned int f = 0; f < Schema->numfields; f++)
+  {
+    if ((fields & (1u << f)) == 0)
+      continue;
+    size_t offset;
+    uint32_t pageNumber = columnPage(f, fileIndex, &offset);
+    /* Reading another column may have evicted the page of this one. */
+    if (entries[f] == -1 || Table->pages[entries[f]] != pageNumber)
+      entries[f] = fetchPage(pageNumber, 0);
+    if (entries[f] == -1)
+      return -1;
+    memcpy((char *)record + Schema->fields[f].offset, entryOf(entries[f]) + offset, Schema->fields[f].size);
+  }
+  return 0;
+}
+
+/**
+ * Write the values of every field of a record in their columns. Strings
+ * are cleared after their end, so their value does not depend on the
+ * bytes left in the record.
+ * @param fileIndex The index of the record.
+ * @param record The record.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+writeColumns(uint32_t fileIndex, const MYRECORD_RECORD_t *record)
+{
+  for (unsigned int f = 0; f < Schema->numfields; f++)
+  {
+    const MYSCHEMA_FIELD_t *field = &Schema->fields[f];
+    size_t offset;
+    int cacheIndex = fetchPage(columnPage(f, fileIndex, &offset), 0);
+    if (cacheIndex == -1)
+      return -1;
+    const char *value = (const char *)record + field->offset;
+    size_t length = field->type == MYSCH_STRING ? strnlen(value, field->size) : field->size;
+    beginUpdate(cacheIndex);
+    memcpy(entryOf(cacheIndex) + offset, value, length);
+    memset(entryOf(cacheIndex) + offset + length, 0, field->size - length);
+    dirtyEntry(cacheIndex);
+    endUpdate(cacheIndex);
+  }
+  if (fileIndex >= Table->fileHeader->numrecords)
+  {
+    Table->fileHeader->numrecords = fileIndex + 1;
+    Table->headerDirty = 1;
+  }
+  return 0;
+}
+
+/**
+ * Call a function with the records of a table stored by rows, skipping the
+ * records never written and the parts of the directory with no pages.
+ * @param first Index of the first record.
+ * @param end Index after the last record.
+ * @param callback The function.
+ * @param arg Argument of the function.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+scanRows(uint64_t first, uint64_t end, MYC_SCAN_f callback, void *arg)
+{
+  MYRECORD_RECORD_t record;
+  for (uint64_t i = first; i < end;)
+  {
+    MYPAGE_RID_t rid;
+    uint64_t span;
+    if (lookupRecord((uint32_t)i, &rid, &span) == -1)
+      return -1;
+    if (rid.page == 0)
+    {
+      i = (i / span + 1) * span;
+      continue;
+    }
+    int cacheIndex = fetchPage(rid.page, 0);
+    if (cacheIndex == -1)
+      return -1;
+    size_t length;
+    const unsigned char *packed = MYP_record(entryOf(cacheIndex), rid.slot, (uint32_t)i, &length);
+    if (packed == NULL || MYSCH_unpack(Schema, packed, length, &record) == -1)
+    {
+      debug_error("Record %llu is damaged in page %u.", (unsigned long long)i, rid.page);
+      return -1;
+    }
+    if (callback((int)i, &record, arg) != 0)
+      break;
+    i++;
+  }
+  return 0;
+}
+
+/**
+ * Ask for the pages of the columns that a scan of a table stored by columns
+ * reads next, when it comes near the last pages asked for. The pages of
+ * every column, and of every segment, are read at the same time.
+ * @param fileIndex The index of the record being read.
+ * @param end Index after the last record of the scan.
+ * @param fields Mask of the fields read.
+ * @param ahead Page after the last one asked for of each column. 0 at first.
+ */
+static void
+readAhead(uint32_t fileIndex, uint64_t end, unsigned int fields, uint32_t *ahead)
+{
+  for (unsigned int f = 0; f < Schema->numfields; f++)
+  {
+    if ((fields & (1u << f)) == 0)
+      continue;
+    size_t offset;
+    uint32_t page = columnPage(f, fileIndex, &offset);
+    uint32_t last = columnPage(f, (uint32_t)(end - 1), &offset);
+    if (page + SCAN_AHEAD / 2 < ahead[f] || ahead[f] > last)
+      continue;
+    uint32_t from = ahead[f] > page ? ahead[f] : page;
+    uint32_t count = last - from + 1 < SCAN_AHEAD ? last - from + 1 : SCAN_AHEAD;
+    adviseRun(from, count);
+    ahead[f] = from + count;
+  }
+}
+
+/**
+ * Call a function with the records of a table stored by columns, reading
+ * only the columns of the fields asked for.
+ * @param first Index of the first record.
+ * @param end Index after the last record.
+ * @param fields Mask of the fields to read.
+ * @param callback The function.
+ * @param arg Argument of the function.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+scanColumns(uint64_t first, uint64_t end, unsigned int fields, MYC_SCAN_f callback, void *arg)
+{
+  MYRECORD_RECORD_t record;
+  int entries[MYSCH_MAXFIELDS];
+  uint32_t ahead[MYSCH_MAXFIELDS];
+  for (int f = 0; f < MYSCH_MAXFIELDS; f++)
+  {
+    entries[f] = -1;
+    ahead[f] = 0;
+  }
+  for (uint64_t i = first; i < end; i++)
+  {
+    readAhead((uint32_t)i, end, fields, ahead);
+    if (readColumns((uint32_t)i, &record, fields, entries) == -1)
+      return -1;
+    if (callback((int)i, &record, arg) != 0)
+      break;
+  }
+  return 0;
+}
+
+/**
+ * Unpack a record met by the scan of a log-structured merge tree and pass
+ * it to the function of the caller.
+ * @param key Index of the record.
+ * @param data The packed record.
+ * @param length Bytes of the packed record.
+ * @param arg The scan.
+ * @return 0 to go on.
+ */
+static int
+unpackLsm(uint32_t key, const unsigned char *data, size_t length, void *arg)
+{
+  lsm_scan_t *scan = (lsm_scan_t *)arg;
+  MYRECORD_RECORD_t record;
+  if (MYSCH_unpack(Schema, data, length, &record) == -1)
+  {
+    debug_error("Record %u is damaged in a run.", key);
+    scan->status = -1;
+    return 1;
+  }
+  return scan->callback((int)key, &record, scan->arg);
+}
+
+/**
+ * Call a function with the records of a table stored as a log-structured
+ * merge tree. Records never written are skipped.
+ * @param first Index of the first record.
+ * @param end Index after the last record.
+ * @param callback The function.
+ * @param arg Argument of the function.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+scanLsm(uint64_t first, uint64_t end, MYC_SCAN_f callback, void *arg)
+{
+  lsm_scan_t scan = {callback, arg, 0};
+  if (MYLSM_scan(Table->lsm, (uint32_t)first, end, unpackLsm, &scan) == -1)
+    return -1;
+  return scan.status;
+}
+
+/**
+ * Copy a node of the B+tree out of the cache.
+ * @param pageNumber The page of the node.
+ * @param node Where to copy the node.
+ * @param level The level of the node. -1 for any level.
+ * @return -1 in case of I/O error or if the node is damaged. 0 is OK.
+ */
+static int
+loadNode(uint32_t pageNumber, void *node, int level)
+{
+  int cacheIndex = fetchPage(pageNumber, 0);
+  if (cacheIndex == -1)
+    return -1;
+  memcpy(node, entryOf(cacheIndex), MYP_PAGESIZE);
+  if (MYBT_check(node, level) == -1)
+  {
+    debug_error("Node %u of the B+tree is damaged.", pageNumber);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Copy a node of the B+tree back into the cache.
+ * @param pageNumber The page of the node.
+ * @param node The node.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+storeNode(uint32_t pageNumber, const void *node)
+{
+  int cacheIndex = fetchPage(pageNumber, 0);
+  if (cacheIndex == -1)
+    return -1;
+  beginUpdate(cacheIndex);
+  memcpy(entryOf(cacheIndex), node, MYP_PAGESIZE);
+  dirtyEntry(cacheIndex);
+  endUpdate(cacheIndex);
+  return 0;
+}
+
+/**
+ * Go down the B+tree to the leaf that holds a key. The tree must have a root.
+ * @param key The key.
+ * @param path Where to return the pages from the root to the leaf.
+ * @param depth Where to return the number of pages of the path.
+ * @return The entry of the cache holding the leaf. -1 in case of I/O error
+ * or if a node is damaged.
+ */
+static int
+findLeaf(uint32_t key, uint32_t *path, int *depth)
+{
+  uint32_t pageNumber = Table->fileHeader->root;
+  int level = -1;
+  for (*depth = 0; *depth < MYBT_MAXLEVELS; (*depth)++)
+  {
+    int cacheIndex = fetchPage(pageNumber, 0);
+    if (cacheIndex == -1)
+      return -1;
+    const unsigned char *node = entryOf(cacheIndex);
+    if (MYBT_check(node, level) == -1)
+      break;
+    path[*depth] = pageNumber;
+    level = ((const MYBT_HEADER_t *)node)->level;
+    if (level == 0)
+    {
+      (*depth)++;
+      return cacheIndex;
+    }
+    pageNumber = MYBT_child(node, key);
+    level--;
+  }
+  debug_error("Node %u of the B+tree is damaged.", pageNumber);
+  return -1;
+}
+
+/**
+ * Read a record from the B+tree.
+ * @param key The key of the record.
+ * @param record Where to unpack the record. It is cleared if the key is not
+ * in the tree.
+ * @return -1 in case of I/O error or if the record is damaged. 0 is OK.
+ */
+static int
+readBtree(uint32_t key, MYRECORD_RECORD_t *record)
+{
+  memset(record, 0, sizeof(MYRECORD_RECORD_t));
+  if (Table->fileHeader->root == 0)
+    return 0;
+  uint32_t path[MYBT_MAXLEVELS];
+  int depth;
+  int cacheIndex = findLeaf(key, path, &depth);
+  if (cacheIndex == -1)
+    return -1;
+  int found;
+  unsigned int position = MYBT_find(entryOf(cacheIndex), key, &found);
+  if (!found)
+    return 0;
+  uint32_t stored;
+  size_t length;
+  const unsigned char *packed = MYBT_record(entryOf(cacheIndex), position, &stored, &length);
+  if (packed == NULL || MYSCH_unpack(Schema, packed, length, record) == -1)
+  {
+    debug_error("Record %u is damaged in page %u.", key, path[depth - 1]);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Store a record in the B+tree. Most records fit in their leaf. A full leaf
+ * is split, and so is every full branch above it, up to the root.
+ * @param key The key of the record.
+ * @param packed The packed record.
+ * @param length Bytes of the packed record.
+ * @return -1 in case of I/O error or if a node is damaged. 0 is OK.
+ */
+static int
+insertBtree(uint32_t key, const unsigned char *packed, size_t length)
+{
+  if (length > MYBT_MAXRECORD)
+  {
+    debug_error("Record %u is too long for a leaf (%zu bytes).", key, length);
+    return -1;
+  }
+  if (Table->fileHeader->root == 0)
+  {
+    uint32_t pageNumber;
+    int cacheIndex = newPage(&pageNumber);
+    if (cacheIndex == -1)
+      return -1;
+    beginUpdate(cacheIndex);
+    MYBT_init(entryOf(cacheIndex), 0);
+    endUpdate(cacheIndex);
+    Table->fileHeader->root = pageNumber;
+  }
+  uint32_t path[MYBT_MAXLEVELS];
+  int depth;
+  int cacheIndex = findLeaf(key, path, &depth);
+  if (cacheIndex == -1)
+    return -1;
+  beginUpdate(cacheIndex);
+  int placed = MYBT_put(entryOf(cacheIndex), key, packed, length) == 0;
+  if (placed)
+    dirtyEntry(cacheIndex);
+  endUpdate(cacheIndex);
+  if (placed)
+    return 0;
+
+  /* Split the full node and add the record or the new child to its half. */
+  unsigned char node[MYP_PAGESIZE];
+  unsigned char right[MYP_PAGESIZE];
+  memcpy(node, entryOf(cacheIndex), MYP_PAGESIZE);
+  uint32_t childKey = key;
+  uint32_t child = 0;
+  for (int d = depth - 1;; d--)
+  {
+    uint32_t rightPage;
+    if (newPage(&rightPage) == -1)
+      return -1;
+    uint32_t separator = MYBT_split(node, right, rightPage);
+    void *half = childKey >= separator ? right : node;
+    if (child == 0)
+      MYBT_put(half, key, packed, length);
+    else
+      MYBT_link(half, childKey, child);
+    if (storeNode(path[d], node) == -1 || storeNode(rightPage, right) == -1)
+      return -1;
+    childKey = separator;
+    child = rightPage;
+    if (d == 0)
+      break;
+    /* The new node goes to the branch above, if it has room. */
+    if (loadNode(path[d - 1], node, -1) == -1)
+      return -1;
+    if (MYBT_link(node, childKey, child) == 0)
+      return storeNode(path[d - 1], node);
+  }
+
+  /* The root was split: a new root holds both halves. */
+  uint32_t rootPage;
+  if (newPage(&rootPage) == -1)
+    return -1;
+  MYBT_init(node, ((const MYBT_HEADER_t *)right)->level + 1u);
+  MYBT_link(node, 0, path[0]);
+  MYBT_link(node, childKey, child);
+  if (storeNode(rootPage, node) == -1)
+    return -1;
+  Table->fileHeader->root = rootPage;
+  Table->headerDirty = 1;
+  return 0;
+}
+
+/**
+ * Call a function with the records of a table stored in a B+tree, going
+ * from leaf to leaf in the order of the keys.
+ * @param first Key of the first record.
+ * @param end Key after the last record.
+ * @param callback The function.
+ * @param arg Argument of the function.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+scanBtree(uint64_t first, uint64_t end, MYC_SCAN_f callback, void *arg)
+{
+  if (Table->fileHeader->root == 0 || first >= end)
+    return 0;
+  uint32_t path[MYBT_MAXLEVELS];
+  int depth;
+  int cacheIndex = findLeaf((uint32_t)first, path, &depth);
+  if (cacheIndex == -1)
+    return -1;
+  /* The callback may use the cache: keep a copy of the leaf. */
+  unsigned char leaf[MYP_PAGESIZE];
+  memcpy(leaf, entryOf(cacheIndex), MYP_PAGESIZE);
+  uint32_t pageNumber = path[depth - 1];
+  int found;
+  unsigned int position = MYBT_find(leaf, (uint32_t)first, &found);
+  MYRECORD_RECORD_t record;
+  for (;;)
+  {
+    const MYBT_HEADER_t *header = (const MYBT_HEADER_t *)leaf;
+    if (position == header->numkeys)
+    {
+      pageNumber = header->next;
+      if (pageNumber == 0)
+        break;
+      if (loadNode(pageNumber, leaf, 0) == -1)
+        return -1;
+      position = 0;
+      continue;
+    }
+    uint32_t key;
+    size_t length;
+    const unsigned char *packed = MYBT_record(leaf, position, &key, &length);
+    if (packed != NULL && key >= end)
+      break;
+    if (packed == NULL || MYSCH_unpack(Schema, packed, length, &record) == -1)
+    {
+      debug_error("Record in slot %u of page %u is damaged.", position, pageNumber);
+      return -1;
+    }
+    if (callback((int)key, &record, arg) != 0)
+      break;
+    position++;
+  }
+  return 0;
+}
+
+/**
+ * Check that a page may belong to the selected table.
+ * @param pageNumber The number of the page.
+ * @return 1 if the page is valid. 0 otherwise.
+ */
+static int
+validPage(uint32_t pageNumber)
+{
+  /* The cache of a log-structured merge tree holds its memtable. */
+  if (Table->lsm != NULL)
+    return 0;
+  if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS)
+    return pageNumber >= COLUMN_PAGES && (pageNumber >> COLUMN_SHIFT) <= Schema->numfields;
+  return pageNumber > 0 && pageNumber < Table->fileHeader->numpages;
+}
+
+/**
+ * Write the page held by an entry to the file if it is dirty.
+ * @param pageNumber The number of the page in the file.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+static int
+flushPage(uint32_t pageNumber)
+{
+  int cacheIndex = pageNumber != 0 ? searchPage(pageNumber) : -1;
+  if (cacheIndex != -1 && Table->dirty[cacheIndex] && writeEntry(cacheIndex) == -1)
+  {
+    debug_error("Error flushing entry to cache.");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Check the index of a record.
+ * @param fileIndex The index of the record.
+ * @return -1 if the table can't hold it. 0 is OK.
+ */
+static int
+checkIndex(int fileIndex)
+{
+  /* Every key of 32 bits may be in a B+tree. */
+  if (Table->fileHeader->layout == MYC_LAYOUT_BTREE)
+    return 0;
+  if (fileIndex < 0)
+  {
+    debug_error("Invalid record index %d.", fileIndex);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Create a table and select it. Its cache is not allocated yet, but its
+ * memory is already counted in the limit of all the tables.
+ * @param filename Name of the DB file.
+ * @param numentries Number of pages of the cache.
+ * @param layout Layout of the table. -1 takes the one of the file.
+ * @return The handle of the table. -1 if there is no free handle or the
+ * cache does not fit in the memory limit.
+ */
+static int
+newTable(const char *filename, int numentries, int layout)
+{
+  if (numentries < 1 || strlen(filename) >= FILENAME_MAX)
+  {
+    debug_error("Invalid table %s with %d pages.", filename, numentries);
+    return -1;
+  }
+  int handle = 0;
+  while (handle < MYC_MAXTABLES && Tables[handle] != NULL)
+    handle++;
+  if (handle == MYC_MAXTABLES)
+  {
+    debug_error("Too many tables open (%d).", MYC_MAXTABLES);
+    return -1;
+  }
+  size_t memory = layoutCache(NULL, numentries);
+  if (memoryUsed + memory > memoryLimit)
+  {
+    debug_error("The cache of %s (%zu bytes) does not fit in the memory limit (%zu of %zu bytes used).", filename,
+                memory, memoryUsed, memoryLimit);
+    return -1;
+  }
+  table_t *table = (table_t *)calloc(1, sizeof(table_t));
+  if (table == NULL)
+  {
+    debug_error("Not enough memory for table %s.", filename);
+    return -1;
+  }
+  strcpy(table->filename, filename);
+  table->file = -1;
+  table->layout = layout;
+  for (int f = 0; f < MYSCH_MAXFIELDS; f++)
+    table->columns[f] = -1;
+  table->shmId = -1;
+  table->numentries = numentries;
+  table->memory = memory;
+  memoryUsed += memory;
+  Tables[handle] = table;
+  Table = table;
+  return handle;
+}
+
+/**
+ * Forget the selected table once its cache and its file are closed.
+ */
+static void
+freeTable()
+{
+  for (int handle = 0; handle < MYC_MAXTABLES; handle++)
+  {
+    if (Tables[handle] == Table)
+      Tables[handle] = NULL;
+  }
+  memoryUsed -= Table->memory;
+  free(Table);
+  Table = NULL;
+}
+
+/**
+ * Allocate the cache of the selected table in private memory.
+ * @return -1 if there is not enough memory. 0 means OK.
+ */
+static int
+allocateCache()
+{
+  /* Allocate memory for the table of pages and the table of flags. */
+  MYC_SHARED_t *header = (MYC_SHARED_t *)calloc(1, Table->memory);
+  /* Always check everything, warn and return an error. */
+  if (header == NULL)
+  {
+    debug_error("Not enough memory for the entry table.");
+    return -1;
+  }
+  layoutCache(header, Table->numentries);
+  attachCache(header);
+  return 0;
+}
+
+/**
+ * Create the cache of the selected table in a System V shared memory segment.
+ * A cache handed over by the last server is adopted instead. A segment left
+ * by a server that died is removed and created again.
+ * @param key Key of the shared memory segment.
+ * @return -1 in case of error. 0 means OK.
+ */
+static int
+createSharedCache(key_t key)
+{
+  size_t size = Table->memory;
+
+  Table->shmId = shmget(key, size, IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR);
+  if (Table->shmId == -1 && errno == EEXIST)
+  {
+    int old = shmget(key, 0, 0);
+    /* A cache handed over keeps dirty entries: use it. */
+    if (old != -1 && adoptSegment(old) == 0)
+    {
+      debug_info("Shared cache handed over by the last server adopted (key=0x%08x).", key);
+      return 0;
+    }
+    /* Remove the stale segment. Clear its magic first so that clients still
+     * attached stop reading records from it. */
+    debug_info("Removing stale shared cache (key=0x%08x).", key);
+    if (old != -1)
+    {
+      MYC_SHARED_t *stale = (MYC_SHARED_t *)shmat(old, NULL, 0);
+      if (stale != (void *)-1)
+      {
+        __atomic_store_n(&stale->magic, 0, __ATOMIC_RELEASE);
+        shmdt(stale);
+      }
+      shmctl(old, IPC_RMID, NULL);
+    }
+    Table->shmId = shmget(key, size, IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR);
+  }
+  if (Table->shmId == -1)
+  {
+    debug_error("Error creating shared cache (key=0x%08x). %s", key, strerror(errno));
+    return -1;
+  }
+
+  MYC_SHARED_t *header = (MYC_SHARED_t *)shmat(Table->shmId, NULL, 0);
+  if (header == (void *)-1)
+  {
+    debug_error("Error attaching shared cache. %s", strerror(errno));
+    shmctl(Table->shmId, IPC_RMID, NULL);
+    Table->shmId = -1;
+    return -1;
+  }
+  /* A new segment is already zeroed. Fill the header last: readers check the magic. */
+  header->owner = getpid();
+  layoutCache(header, Table->numentries);
+  attachCache(header);
+  debug_info("Shared cache created (key=0x%08x, %zu bytes).", key, size);
+  return 0;
+}
+
+/**
+ * Leave the cache of the selected table after failing to open its file.
+ * A shared segment is only detached: it may hold dirty entries handed over,
+ * and the next server removes it if it is stale.
+ */
+static void
+dropCache()
+{
+  if (Table->shmId != -1)
+    shmdt(Table->header);
+  else
+    free(Table->header);
+  Table->shmId = -1;
+  forgetCache();
+}
+
+/**
+ * Open a table with its cache in private memory or in shared memory.
+ * @param filename Name of the DB file.
+ * @param numentries Number of pages of the cache.
+ * @param layout Layout of the table.
+ * @param shared Create the cache in shared memory.
+ * @param key Key of the shared memory segment.
+ * @return The handle of the table. -1 in case of error.
+ */
+static int
+openTable(const char *filename, int numentries, int layout, int shared, key_t key)
+{
+  int base = layout & ~LAYOUT_FLAGS;
+  if (base < MYC_LAYOUT_ROWS || base > MYC_LAYOUT_BTREE)
+  {
+    debug_error("Invalid layout %d of %s.", layout, filename);
+    return -1;
+  }
+  /* The memtable needs two pages at least. */
+  if (base == MYC_LAYOUT_LSM && numentries < 2)
+  {
+    debug_error("The cache of %s is too small for a memtable.", filename);
+    return -1;
+  }
+  int handle = newTable(filename, numentries, layout);
+  if (handle == -1)
+    return -1;
+  if ((shared ? createSharedCache(key) : allocateCache()) == -1)
+  {
+    freeTable();
+    return -1;
+  }
+  if (openDBFile() == -1)
+  {
+    dropCache();
+    freeTable();
+    return -1;
+  }
+  return handle;
+}
+
+/**
+ * Close the selected table. It flushes all the information inside its
+ * cache that is not written to the file yet and closes the file.
+ * @return -1 if the file could not be closed. 0 means OK.
+ */
+static int
+closeTable()
+{
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* A snapshot running is finished first. */
+  while (MYC_snapshotStep(INT_MAX) > 0)
+    ;
+
+  /* Flush all dirty entries in the cache to the file. */
+  MYC_flushAll();
+
+  /* Free memory of the cache and NULLify pointers. */
+  if (Table->shmId != -1)
+  {
+    /* Readers see the magic disappear before the segment is removed. */
+    __atomic_store_n(&Table->header->magic, 0, __ATOMIC_RELEASE);
+    shmdt(Table->header);
+    if (shmctl(Table->shmId, IPC_RMID, NULL) == -1)
+      debug_error("Error removing shared cache. %s", strerror(errno));
+    Table->shmId = -1;
+  }
+  else
+  {
+    free(Table->header);
+  }
+  forgetCache();
+
+  /* Close the DB file here. The page maps and the log were saved by the
+   * flush. */
+  int status = closeLsm();
+  closeMaps();
+  if (closeColumns() == -1 || closeSegments() == -1)
+    status = -1;
+  if (close(Table->file) == -1)
+    status = -1;
+  if (status == -1)
+  {
+    debug_error("Error closing DB file. %s", strerror(errno));
+  }
+  else
+  {
+    debug_info("DB file closed. (%s)", Table->filename);
+  }
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  freeTable();
+  return status;
+}
+
+/**
+ * Leave the shared cache of the selected table to the next server without
+ * flushing it, and close the file.
+ * @return -1 if the file can't be closed. 0 is OK.
+ */
+static int
+handOverTable()
+{
+  /* The next server does not know about a snapshot running. */
+  if (Table->snapshot != NULL)
+  {
+    debug_info("Snapshot of %s abandoned.", Table->filename);
+    endSnapshot(0);
+  }
+  Table->header->last_lsn = Table->lastLSN;
+  Table->header->unsynced_lsn = Table->unsyncedLSN;
+  /* The next server may take the cache as soon as it sees the new state. */
+  __atomic_store_n(&Table->header->state, MYC_SHM_HANDEDOVER, __ATOMIC_RELEASE);
+  shmdt(Table->header);
+  Table->shmId = -1;
+  forgetCache();
+  debug_info("Shared cache of %s handed over (last LSN %llu).", Table->filename, (unsigned long long)Table->lastLSN);
+
+  /* The next server reads the page maps and replays the log, synced or not. */
+  int status = saveMaps(0);
+  closeMaps();
+  if (closeLsm() == -1)
+    status = -1;
+  if (closeColumns() == -1 || closeSegments() == -1)
+    status = -1;
+  if (close(Table->file) == -1)
+  {
+    debug_error("Error closing DB file. %s", strerror(errno));
+    status = -1;
+  }
+  freeTable();
+  return status;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+/* Functions without "static" will be visible from any other C file. */
+
+/**
+ * Set the limit of the memory of the caches of all the tables. Tables
+ * already open keep their caches.
+ * @param bytes The limit in bytes.
+ * @return -1 if the tables open already use more. 0 means OK.
+ */
+int MYC_setMemoryLimit(size_t bytes)
+{
+  if (bytes < memoryUsed)
+  {
+    debug_error("The caches already use %zu bytes, more than %zu.", memoryUsed, bytes);
+    return -1;
+  }
+  memoryLimit = bytes;
+  return 0;
+}
+
+/**
+ * Set the directories of the segments of the segmented tables created from
+ * now on. Tables already created keep their directories.
+ * @param dirs Directories separated by ':'. Empty to keep the segments
+ * beside the DB file.
+ * @return -1 if the list is too long. 0 means OK.
+ */
+int MYC_setSegmentDirs(const char *dirs)
+{
+  if (strlen(dirs) >= MYC_SEGMENTDIRS)
+  {
+    debug_error("The segment directories take more than %d bytes.", MYC_SEGMENTDIRS - 1);
+    return -1;
+  }
+  strcpy(segmentDirs, dirs);
+  return 0;
+}
+
+/**
+ * Open a table with its own DB file and its own cache in private memory,
+ * and select it.
+ * @param filename Name of the DB file. It is created if it does not exist.
+ * @param numentries Number of pages of the cache of the table.
+ * @param layout MYC_LAYOUT_ROWS or MYC_LAYOUT_COLUMNS, plus MYC_COMPRESSED
+ * to compress the pages of a new file. An existing file must have been
+ * created with the same layout and keeps its compression.
+ * @return The handle of the table. -1 in case of error.
+ */
+int MYC_openTable(const char *filename, int numentries, int layout)
+{
+  return openTable(filename, numentries, layout, 0, 0);
+}
+
+/**
+ * Open a table with its cache in a System V shared memory segment, so that
+ * local clients can attach it read-only and read records without asking the
+ * server, and select it. Only one server may own the key. A cache handed
+ * over by the last server is adopted with its dirty entries.
+ * @param filename Name of the DB file. It is created if it does not exist.
+ * @param numentries Number of pages of the cache of the table.
+ * @param layout MYC_LAYOUT_ROWS or MYC_LAYOUT_COLUMNS, plus MYC_COMPRESSED
+ * for a new file. Local clients only read the records of tables stored by
+ * rows.
+ * @param key Key of the shared memory segment.
+ * @return The handle of the table. -1 in case of error.
+ */
+int MYC_openSharedTable(const char *filename, int numentries, int layout, key_t key)
+{
+  return openTable(filename, numentries, layout, 1, key);
+}
+
+/**
+ * Select the table used by the other functions of the cache.
+ * @param table Handle of the table.
+ * @return -1 if the table is not open. 0 means OK.
+ */
+int MYC_useTable(int table)
+{
+  if (table < 0 || table >= MYC_MAXTABLES || Tables[table] == NULL)
+  {
+    debug_error("Table %d is not open.", table);
+    return -1;
+  }
+  Table = Tables[table];
+  return 0;
+}
+
+/**
+ * Close a table. It flushes all the information inside its cache that is
+ * not written to the file yet and closes the file. Its handle may be given
+ * to the next table opened.
+ * @param table Handle of the table.
+ * @return -1 if the table is not open or its file can't be closed. 0 means OK.
+ */
+int MYC_closeTable(int table)
+{
+  if (MYC_useTable(table) == -1)
+    return -1;
+  return closeTable();
+}
+
+/* This function initializes the cache. */
+
+/**
+ * Initialize the cache: allocate RAM, open file, etc. It opens the default
+ * table, MYC_FILENAME with MYC_NUMENTRIES pages.
+ * @return -1 in case of error during initialization. 0 means OK.
+ */
+int MYC_initCache()
+{
+  return MYC_openTable(MYC_FILENAME, MYC_NUMENTRIES, MYC_LAYOUT_ROWS) == -1 ? -1 : 0;
+}
+
+/**
+ * Initialize the cache inside a System V shared memory segment so that local
+ * clients can attach it read-only and read records without asking the server.
+ * It opens the default table like MYC_initCache().
+ * @param key Key of the shared memory segment.
+ * @return -1 in case of error during initialization. 0 means OK.
+ */
+int MYC_initSharedCache(key_t key)
+{
+  return MYC_openSharedTable(MYC_FILENAME, MYC_NUMENTRIES, MYC_LAYOUT_ROWS, key) == -1 ? -1 : 0;
+}
+
+/**
+ * This function finishes the cache. It closes every table, flushing all the
+ * information inside their caches that is not written to the files yet.
+ * @return -1 if some file could not be closed. 0 means OK.
+ */
+int MYC_closeCache()
+{
+  int status = 0;
+  for (int handle = 0; handle < MYC_MAXTABLES; handle++)
+  {
+    if (Tables[handle] != NULL)
+    {
+      Table = Tables[handle];
+      if (closeTable() == -1)
+        status = -1;
+    }
+  }
+  return status;
+}
+
+/**
+ * Record the calling process as the owner of the shared caches, so that a
+ * new server knows which process must hand them over.
+ */
+void MYC_adoptCache()
+{
+  for (int handle = 0; handle < MYC_MAXTABLES; handle++)
+  {
+    if (Tables[handle] != NULL && Tables[handle]->shmId != -1)
+      Tables[handle]->header->owner = getpid();
+  }
+}
+
+/**
+ * Get the server using a shared cache.
+ * @param key Key of the shared memory segment.
+ * @return The process owning the cache. -1 if there is no cache in use.
+ */
+pid_t MYC_sharedOwner(key_t key)
+{
+  int id = shmget(key, 0, 0);
+  if (id == -1)
+    return -1;
+  MYC_SHARED_t *header = (MYC_SHARED_t *)shmat(id, NULL, SHM_RDONLY);
+  if (header == (void *)-1)
+    return -1;
+  pid_t owner = -1;
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == MYC_SHM_MAGIC &&
+      __atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == MYC_SHM_ACTIVE)
+    owner = header->owner;
+  shmdt(header);
+  return owner;
+}
+
+/**
+ * Leave the shared caches to the next server without flushing them. Dirty
+ * entries stay in the segments with their LSNs, and writes not synced yet are
+ * synced by the next server. Local clients keep reading records meanwhile.
+ * The default table (handle 0) is handed over last, so a new server waiting
+ * for it finds the others handed over too. Tables with a private cache are
+ * closed.
+ * @return -1 if the default table is not shared or some file can't be
+ * closed. 0 is OK.
+ */
+int MYC_detachCache()
+{
+  if (Tables[0] == NULL || Tables[0]->shmId == -1)
+  {
+    debug_error("Only a shared cache can be handed over.");
+    return -1;
+  }
+  int status = 0;
+  for (int handle = MYC_MAXTABLES - 1; handle >= 0; handle--)
+  {
+    if (Tables[handle] == NULL)
+      continue;
+    Table = Tables[handle];
+    if ((Table->shmId != -1 ? handOverTable() : closeTable()) == -1)
+      status = -1;
+  }
+  return status;
+}
+
+/**
+ * Attach the shared cache of the default table handed over by the last
+ * server and go on using it with its dirty entries. The other tables are
+ * adopted when they are opened with MYC_openSharedTable().
+ * @param key Key of the shared memory segment.
+ * @return 0 if OK. -2 if the cache is not handed over (yet). -1 in case of error.
+ */
+int MYC_attachSharedCache(key_t key)
+{
+  int id = shmget(key, 0, 0);
+  if (id == -1)
+  {
+    debug_error("No shared cache to attach (key=0x%08x). %s", key, strerror(errno));
+    return -1;
+  }
+  if (newTable(MYC_FILENAME, MYC_NUMENTRIES, MYC_LAYOUT_ROWS) == -1)
+    return -1;
+  int status = adoptSegment(id);
+  if (status != 0)
+  {
+    freeTable();
+    return status;
+  }
+  debug_info("Shared cache attached (key=0x%08x, last LSN %llu).", key, (unsigned long long)Table->lastLSN);
+  if (openDBFile() == -1)
+  {
+    dropCache();
+    freeTable();
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * This function copies into a record passed as argument from the cache.
+ * The pages holding the record will be read from the file if not on the cache.
+ * The record structure is property of the user, so we have to unpack the
+ * record stored in the page onto it.
+ *
+ * @param fileIndex This is the index of the record in the file.
+ * @param record This is a pointer to a record allocated by the user.
+ * @return -1 in case of any error like I/O error when reading. 0 is OK.
+ */
+int MYC_readEntry(int fileIndex, MYRECORD_RECORD_t *record)
+{
+  if (checkIndex(fileIndex) == -1)
+    return -1;
+
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* REMEMBER TO USE THE AUXILIARY FUNCTIONS ABOVE. */
+  /* Go down the directory to the page holding the record, or gather its
+   * values from every column. Pages not in the cache are read from the file. */
+  pageMissed = 0;
+  MYPAGE_RID_t rid;
+  if (Table->lsm != NULL)
+  {
+    /* The newest version is in the memtable or in the newest run holding it. */
+    unsigned char packed[MYP_PAGESIZE];
+    int length = MYLSM_get(Table->lsm, fileIndex, packed, sizeof(packed), &pageMissed);
+    if (length == -1)
+    {
+      debug_error("Error reading entry from the runs. %s", strerror(errno));
+      return -1;
+    }
+    if (length == 0)
+      memset(record, 0, sizeof(MYRECORD_RECORD_t));
+    else if (MYSCH_unpack(Schema, packed, length, record) == -1)
+    {
+      debug_error("Record %d is damaged in a run.", fileIndex);
+      return -1;
+    }
+  }
+  else if (Table->fileHeader->layout == MYC_LAYOUT_BTREE)
+  {
+    if (readBtree((uint32_t)fileIndex, record) == -1)
+    {
+      debug_error("Error reading entry from cache.");
+      return -1;
+    }
+  }
+  else if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS)
+  {
+    int entries[MYSCH_MAXFIELDS];
+    for (int f = 0; f < MYSCH_MAXFIELDS; f++)
+      entries[f] = -1;
+    if (readColumns(fileIndex, record, ~0u, entries) == -1)
+    {
+      debug_error("Error reading entry from cache.");
+      return -1;
+    }
+  }
+  else if (lookupRecord(fileIndex, &rid, NULL) == -1)
+  {
+    debug_error("Error reading entry from cache.");
+    return -1;
+  }
+  else if (rid.page == 0)
+  {
+    /* Records never written are empty. */
+    memset(record, 0, sizeof(MYRECORD_RECORD_t));
+  }
+  else
+  {
+    int cacheIndex = fetchPage(rid.page, 0);
+    if (cacheIndex == -1)
+    {
+      debug_error("Error reading entry from cache.");
+      return -1;
+    }
+    /* Unpack from the record inside the page to the record passed as argument. */
+    size_t length;
+    const unsigned char *packed = MYP_record(entryOf(cacheIndex), rid.slot, fileIndex, &length);
+    if (packed == NULL || MYSCH_unpack(Schema, packed, length, record) == -1)
+    {
+      debug_error("Record %d is damaged in page %u.", fileIndex, rid.page);
+      return -1;
+    }
+  }
+  lastHit = !pageMissed;
+  countStat(lastHit ? &Stats.hits : &Stats.misses, 1);
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  debug_debug("Entry %d read from cache.", fileIndex);
+  return 0;
+}
+
+/*
+ * This function copies a record passed as argument into the cache.
+ * The record will be written at the given index of the file LATER.
+ * This funtions does not write the cache entry to the file inmediately.
+ * The record structure is property of the user, so we have to copy its
+ * content to the entry as the record can be deallocated by the user.
+ * The record is packed: it takes only the bytes it uses. It stays in its
+ * page while it fits there, or else it moves to the page for new records.
+ *
+ * @param fileIndex This is the index of the record in the file.
+ * @param record This is a pointer to a record allocated by the user.
+ * @return -1 in case of any error like I/O error when writing. 0 is OK.
+ */
+int MYC_writeEntry(int fileIndex, MYRECORD_RECORD_t *record)
+{
+  if (checkIndex(fileIndex) == -1)
+    return -1;
+  unsigned char packed[MYP_PAGESIZE];
+  int length = MYSCH_pack(Schema, record, packed, sizeof(packed));
+  if (length == -1)
+  {
+    debug_error("Record %d can't be packed.", fileIndex);
+    return -1;
+  }
+
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* REMEMBER TO USE THE AUXILIARY FUNCTIONS ABOVE. */
+  pageMissed = 0;
+  if (Table->lsm != NULL)
+  {
+    /* The record goes to the memtable and to the log. A memtable written to
+     * a run takes every earlier write to disk. */
+    Table->lastLSN++;
+    int res = MYLSM_put(Table->lsm, fileIndex, packed, length);
+    if (res == -1)
+    {
+      debug_error("Error writing entry to the memtable. %s", strerror(errno));
+      return -1;
+    }
+    if (res == 1 || Table->unsyncedLSN == 0)
+      Table->unsyncedLSN = Table->lastLSN;
+    if (MYLSM_maintain(Table->lsm) == -1)
+      debug_error("Error merging the runs of %s. %s", Table->filename, strerror(errno));
+    lastHit = 1;
+    countStat(&Stats.hits, 1);
+    debug_debug("Entry %d written to the memtable.", fileIndex);
+    return 0;
+  }
+  if (Table->fileHeader->layout == MYC_LAYOUT_BTREE)
+  {
+    Table->lastLSN++;
+    if (insertBtree((uint32_t)fileIndex, packed, length) == -1)
+    {
+      debug_error("Error flushing entry to cache.");
+      return -1;
+    }
+    lastHit = !pageMissed;
+    countStat(lastHit ? &Stats.hits : &Stats.misses, 1);
+    debug_debug("Entry %d written to cache.", fileIndex);
+    return 0;
+  }
+  if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS)
+  {
+    /* Every value goes to its place in its column. */
+    Table->lastLSN++;
+    if (writeColumns(fileIndex, record) == -1)
+    {
+      debug_error("Error flushing entry to cache.");
+      return -1;
+    }
+    lastHit = !pageMissed;
+    countStat(lastHit ? &Stats.hits : &Stats.misses, 1);
+    debug_debug("Entry %d written to cache.", fileIndex);
+    return 0;
+  }
+  /* Search the directory to guess if the record is already in some page. */
+  MYPAGE_RID_t rid;
+  if (lookupRecord(fileIndex, &rid, NULL) == -1)
+  {
+    debug_error("Error flushing entry to cache.");
+    return -1;
+  }
+  /* Every page changed remembers the oldest write not flushed. */
+  Table->lastLSN++;
+  int placed = 0;
+  if (rid.page != 0)
+  {
+    int cacheIndex = fetchPage(rid.page, 0);
+    if (cacheIndex == -1)
+      return -1;
+    size_t oldLength;
+    if (MYP_record(entryOf(cacheIndex), rid.slot, fileIndex, &oldLength) == NULL)
+    {
+      debug_error("Record %d is damaged in page %u.", fileIndex, rid.page);
+      return -1;
+    }
+    /* Overwrite the record in its page, or take it out if it does not fit. */
+    beginUpdate(cacheIndex);
+    placed = MYP_update(entryOf(cacheIndex), rid.slot, packed, length) == 0;
+    if (!placed)
+      MYP_delete(entryOf(cacheIndex), rid.slot);
+    dirtyEntry(cacheIndex);
+    endUpdate(cacheIndex);
+  }
+  if (!placed)
+  {
+    if (insertRecord(fileIndex, packed, length, &rid) == -1 || storeLocation(fileIndex, &rid) == -1)
+    {
+      debug_error("Error flushing entry to cache.");
+      return -1;
+    }
+  }
+  lastHit = !pageMissed;
+  countStat(lastHit ? &Stats.hits : &Stats.misses, 1);
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  debug_debug("Entry %d written to cache.", fileIndex);
+  return 0;
+}
+
+/**
+ * Forces the cache to write the pages holding the record at "fileIndex" in
+ * the file: its page and the pages of the directory leading to it.
+ * @param fileIndex This is the index of the entry of the file to be flushed.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+int MYC_flushEntry(int fileIndex)
+{
+  if (checkIndex(fileIndex) == -1)
+    return -1;
+  /* Every write to a log-structured merge tree is in the log. */
+  if (Table->lsm != NULL)
+    return syncFile();
+  if (Table->fileHeader->layout == MYC_LAYOUT_BTREE)
+  {
+    /* Write the leaf of the record, then the branches above it. */
+    uint32_t path[MYBT_MAXLEVELS];
+    int depth = 0;
+    if (Table->fileHeader->root != 0 && findLeaf((uint32_t)fileIndex, path, &depth) == -1)
+      return -1;
+    while (depth > 0)
+    {
+      if (flushPage(path[--depth]) == -1)
+        return -1;
+    }
+    return syncFile();
+  }
+  if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS)
+  {
+    /* Write the page of each column holding a value of the record. */
+    for (unsigned int f = 0; f < Schema->numfields; f++)
+    {
+      size_t offset;
+      if (flushPage(columnPage(f, fileIndex, &offset)) == -1)
+        return -1;
+    }
+    return syncFile();
+  }
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  /* Go down the directory to the page of the record. Then write the dirty
+   * pages found on the way, the record first, so that the directory on disk
+   * never leads to a page not written yet. */
+  uint32_t path[MYP_MAXNODELEVELS + 2];
+  int depth = 0;
+  uint32_t pageNumber = (uint32_t)fileIndex < MYP_records(dirLevels()) ? Table->fileHeader->root : 0;
+  for (int level = dirLevels(); level >= 0 && pageNumber != 0; level--)
+  {
+    int cacheIndex = fetchPage(pageNumber, 0);
+    if (cacheIndex == -1)
+      return -1;
+    path[depth++] = pageNumber;
+    if (level > 0)
+      pageNumber = ((const uint32_t *)entryOf(cacheIndex))[MYP_entry(fileIndex, level)];
+    else
+      pageNumber = ((const MYPAGE_RID_t *)entryOf(cacheIndex))[MYP_entry(fileIndex, 0)].page;
+  }
+  if (pageNumber != 0)
+    path[depth++] = pageNumber;
+  while (depth > 0)
+  {
+    if (flushPage(path[--depth]) == -1)
+      return -1;
+  }
+  if (syncFile() == -1)
+    return -1;
+  /* Always check errors*/
+  /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  debug_debug("Entry %d flushed to disk.", fileIndex);
+  return 0;
+}
+
+/**
+ * Flush any dirty entry in the cache inmediately.
  * @return
  */
 int MYC_flushAll()
 {
   /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
   /* Go through the cache and write all dirty entries to the file. */
-  for (int cacheIndex = 0; cacheIndex < MYC_NUMENTRIES; cacheIndex++)
+  for (int cacheIndex = 0; cacheIndex < Table->numentries; cacheIndex++)
   {
-    if (CacheDirty[cacheIndex])
+    if (Table->dirty[cacheIndex])
     {
       if (writeEntry(cacheIndex) == -1)
       {
@@ -464,11 +3020,475 @@ int MYC_flushAll()
       }
     }
   }
+  if (syncFile() == -1)
+    return -1;
   /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
   debug_debug("All entries flushed to disk.");
   return 0;
 }
 
+/**
+ * Call a function with the records of a range of indices, in order. A table
+ * stored by columns reads only the columns of the fields asked for, so a
+ * scan of a few fields reads a fraction of the pages. A table stored by rows
+ * reads every record written in the range. A table stored in a B+tree reads
+ * only the leaves holding the range, however sparse its keys are.
+ * @param first Index of the first record.
+ * @param count Number of indices to scan.
+ * @param fields Mask of the fields needed (bit i for field i of the schema).
+ * The other fields may be left empty.
+ * @param callback Function called with each record. It returns 0 to go on.
+ * @param arg Argument passed to the function.
+ * @return -1 in case of I/O error or invalid range. 0 is OK.
+ */
+int MYC_scan(int first, int count, unsigned int fields, MYC_SCAN_f callback, void *arg)
+{
+  if (checkIndex(first) == -1 || count < 0)
+    return -1;
+  /* The keys of a B+tree are unsigned. The indices of the other layouts
+   * are not negative. */
+  uint64_t end = (uint64_t)(uint32_t)first + count;
+  int status;
+  if (Table->fileHeader->layout == MYC_LAYOUT_COLUMNS)
+  {
+    /* Nothing was written beyond the last record. */
+    if (end > Table->fileHeader->numrecords)
+      end = Table->fileHeader->numrecords;
+    status = scanColumns(first, end, fields, callback, arg);
+  }
+  else if (Table->lsm != NULL)
+  {
+    if (end > MYC_MAXRECORDS)
+      end = MYC_MAXRECORDS;
+    status = scanLsm(first, end, callback, arg);
+  }
+  else if (Table->fileHeader->layout == MYC_LAYOUT_BTREE)
+    status = scanBtree((uint32_t)first, end, callback, arg);
+  else
+  {
+    if (end > MYC_MAXRECORDS)
+      end = MYC_MAXRECORDS;
+    status = scanRows(first, end, callback, arg);
+  }
+  if (status == -1)
+  {
+    debug_error("Error scanning records %d to %llu.", first, (unsigned long long)end);
+    return -1;
+  }
+  debug_debug("Records %d to %llu scanned.", first, (unsigned long long)end);
+  return 0;
+}
+
+/**
+ * Get the LSN of the last write accepted by the cache.
+ * @return The LSN. 0 if no write was done yet.
+ */
+uint64_t MYC_lastLSN()
+{
+  return Table->lastLSN;
+}
+
+/**
+ * Get the highest LSN such that every write up to it is already on disk.
+ * It is just below the oldest write that is still dirty in the cache or
+ * written to the file but not synced.
+ * @return The durable LSN.
+ */
+uint64_t MYC_durableLSN()
+{
+  uint64_t oldest = Table->unsyncedLSN;
+  for (int cacheIndex = 0; cacheIndex < Table->numentries; cacheIndex++)
+  {
+    if (Table->dirty[cacheIndex] && (oldest == 0 || Table->lsn[cacheIndex] < oldest))
+      oldest = Table->lsn[cacheIndex];
+  }
+  return oldest == 0 ? Table->lastLSN : oldest - 1;
+}
+
+/**
+ * Write and sync to disk every write up to the given LSN. Entries holding
+ * only newer writes stay dirty in the cache.
+ * @param lsn LSN that must be durable when returning.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+int MYC_flushUpTo(uint64_t lsn)
+{
+  if (MYC_durableLSN() >= lsn)
+    return 0;
+  for (int cacheIndex = 0; cacheIndex < Table->numentries; cacheIndex++)
+  {
+    if (Table->dirty[cacheIndex] && Table->lsn[cacheIndex] <= lsn)
+    {
+      if (writeEntry(cacheIndex) == -1)
+      {
+        debug_error("Error flushing entry to cache.");
+        return -1;
+      }
+    }
+  }
+  if (syncFile() == -1)
+    return -1;
+  debug_debug("Entries up to LSN %llu flushed to disk.", (unsigned long long)lsn);
+  return 0;
+}
+
+/**
+ * Tell whether the last call to MYC_readEntry() or MYC_writeEntry() found
+ * its record in the cache.
+ * @return 1 if it was a hit. 0 if the record was not in the cache.
+ */
+int MYC_lastHit()
+{
+  return lastHit;
+}
+
+/**
+ * Get the counters of the activity of the cache. They keep changing: read
+ * them with __atomic_load_n() from other threads.
+ * @return The counters.
+ */
+const MYC_STATS_t *MYC_stats()
+{
+  return &Stats;
+}
+
+/**
+ * Write the pages in the cache, hottest first, to a file. The file is
+ * replaced atomically, so a crash leaves the previous hot set.
+ * The accesses of every entry are halved afterwards.
+ * @param path Name of the file.
+ * @return -1 in case of I/O error. 0 is OK.
+ */
+int MYC_saveHotSet(const char *path)
+{
+  int *pages = (int *)malloc(Table->numentries * sizeof(int));
+  unsigned int *heat = (unsigned int *)malloc(Table->numentries * sizeof(unsigned int));
+  if (pages == NULL || heat == NULL)
+  {
+    debug_error("Not enough memory to save the hot set.");
+    free(pages);
+    free(heat);
+    return -1;
+  }
+  int count = 0;
+  for (int cacheIndex = 0; cacheIndex < Table->numentries; cacheIndex++)
+  {
+    if (Table->pages[cacheIndex] == 0)
+      continue;
+    /* Insertion sort by heat: the table is small. */
+    int i = count++;
+    while (i > 0 && heat[i - 1] < Table->heat[cacheIndex])
+    {
+      pages[i] = pages[i - 1];
+      heat[i] = heat[i - 1];
+      i--;
+    }
+    pages[i] = Table->pages[cacheIndex];
+    heat[i] = Table->heat[cacheIndex];
+    Table->heat[cacheIndex] /= 2;
+  }
+
+  char tmp[FILENAME_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *file = fopen(tmp, "w");
+  if (file == NULL)
+  {
+    debug_error("Error creating hot set file %s. %s", tmp, strerror(errno));
+    free(pages);
+    free(heat);
+    return -1;
+  }
+  hotset_header_t header = {MYC_HOT_MAGIC, (unsigned int)count};
+  int status = fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+  if (status == 0 && count > 0 && fwrite(pages, sizeof(int), count, file) != (size_t)count)
+    status = -1;
+  free(pages);
+  free(heat);
+  if (fclose(file) != 0)
+    status = -1;
+  if (status == 0 && rename(tmp, path) == -1)
+    status = -1;
+  if (status == -1)
+  {
+    debug_error("Error writing hot set file %s. %s", path, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  debug_info("Hot set of %d pages saved to %s.", count, path);
+  return 0;
+}
+
+/**
+ * Read a hot set saved by MYC_saveHotSet() and start reading its pages in
+ * the background. The kernel is asked to read them sorted by number, merging
+ * consecutive pages in one large read. MYC_prefetchHotSet() then loads them
+ * into the cache without waiting for the disk.
+ * @param path Name of the file.
+ * @return Number of pages to prefetch. 0 if there is no hot set. -1 in case
+ * of error.
+ */
+int MYC_loadHotSet(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    if (errno == ENOENT)
+    {
+      debug_info("No hot set to prefetch (%s).", path);
+      return 0;
+    }
+    debug_error("Error opening hot set file %s. %s", path, strerror(errno));
+    return -1;
+  }
+  hotset_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != MYC_HOT_MAGIC)
+  {
+    debug_error("%s is not a hot set file.", path);
+    fclose(file);
+    return -1;
+  }
+  /* Only the hottest pages fit in the cache. */
+  int count = header.count < Table->numentries ? (int)header.count : Table->numentries;
+  free(Table->hotSet);
+  Table->hotSet = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+  if (Table->hotSet == NULL || fread(Table->hotSet, sizeof(int), count, file) != (size_t)count)
+  {
+    debug_error("Error reading hot set file %s.", path);
+    fclose(file);
+    free(Table->hotSet);
+    Table->hotSet = NULL;
+    Table->hotCount = Table->hotNext = 0;
+    return -1;
+  }
+  fclose(file);
+  Table->hotCount = count;
+  Table->hotNext = 0;
+
+  /* Start reading the runs of consecutive pages in order. Without memory to
+   * sort them, the pages are just read when they are loaded. */
+  int *sorted = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+  if (sorted == NULL)
+    return count;
+  memcpy(sorted, Table->hotSet, count * sizeof(int));
+  qsort(sorted, count, sizeof(int), compareInt);
+  int runs = 0;
+  for (int i = 0; i < count;)
+  {
+    if (!validPage(sorted[i]))
+    {
+      i++;
+      continue;
+    }
+    int j = i + 1;
+    /* Runs don't cross from one file to the next one. */
+    while (j < count && sorted[j] <= sorted[j - 1] + 1 && (sorted[j] >> COLUMN_SHIFT) == (sorted[i] >> COLUMN_SHIFT))
+      j++;
+    off_t offset;
+    int fd = pageFile(sorted[i], &offset);
+    MYPM_MAP_t *map = pageMap(sorted[i]);
+    int status = 0;
+    if (map == NULL)
+      status = adviseRun(sorted[i], sorted[j - 1] - sorted[i] + 1);
+    /* Compressed pages are in chunks anywhere in the file. */
+    uint32_t first = offset / MYP_PAGESIZE;
+    for (int k = i; map != NULL && k < j && status == 0; k++)
+    {
+      off_t chunk;
+      size_t size;
+      if (MYPM_locate(map, first + (k - i), &chunk, &size) == 0)
+        status = posix_fadvise(fd, chunk, size, POSIX_FADV_WILLNEED);
+    }
+    if (status != 0)
+      debug_error("Error prefetching pages %d-%d. %s", sorted[i], sorted[j - 1], strerror(status));
+    runs++;
+    i = j;
+  }
+  free(sorted);
+  debug_info("Prefetching hot set of %d pages in %d runs from %s.", count, runs, path);
+  return count;
+}
+
+/**
+ * Load the next pages of the hot set into unused entries of the cache.
+ * Pages which are already in the cache (a client asked for them first) are
+ * skipped. Nothing is evicted: when no unused entry is left, the prefetch ends.
+ * @param max Maximum number of pages to load.
+ * @return Number of pages of the hot set left. -1 in case of I/O error.
+ */
+int MYC_prefetchHotSet(int max)
+{
+  int loaded = 0;
+  while (Table->hotNext < Table->hotCount && loaded < max)
+  {
+    int pageNumber = Table->hotSet[Table->hotNext];
+    if (pageNumber <= 0 || !validPage(pageNumber) || searchPage(pageNumber) != -1)
+    {
+      Table->hotNext++;
+      continue;
+    }
+    int cacheIndex = searchPage(0);
+    if (cacheIndex == -1)
+    {
+      debug_info("Cache full. Hot set prefetch ended after %d pages.", Table->hotNext);
+      Table->hotNext = Table->hotCount;
+      break;
+    }
+    beginUpdate(cacheIndex);
+    Table->pages[cacheIndex] = pageNumber;
+    if (readEntry(cacheIndex) == -1)
+    {
+      Table->pages[cacheIndex] = 0;
+      endUpdate(cacheIndex);
+      debug_error("Error prefetching page %d.", pageNumber);
+      return -1;
+    }
+    endUpdate(cacheIndex);
+    /* Keep the order of the hot set for the next save. */
+    Table->heat[cacheIndex] = Table->hotCount - Table->hotNext;
+    Table->hotNext++;
+    loaded++;
+  }
+  if (Table->hotNext == Table->hotCount && Table->hotSet != NULL)
+  {
+    debug_info("Hot set prefetched.");
+    free(Table->hotSet);
+    Table->hotSet = NULL;
+    Table->hotCount = Table->hotNext = 0;
+  }
+  return Table->hotCount - Table->hotNext;
+}
+
+/**
+ * Start a snapshot of the selected table: an image of its files as they are
+ * now, written to other files while the table keeps changing. Each page is
+ * copied to the image before it changes, and MYC_snapshotStep() copies the
+ * others. The image is a table of the same layout, neither compressed nor
+ * segmented, and its column files are named after it. Its header is written last.
+ * @param path Name of the DB file of the image.
+ * @return -1 if a snapshot is running, the table is stored as a
+ * log-structured merge tree or in case of error. 0 is OK.
+ */
+int MYC_startSnapshot(const char *path)
+{
+  if (Table->snapshot != NULL || Table->lsm != NULL)
+  {
+    debug_error("Can't start a snapshot of %s.", Table->filename);
+    return -1;
+  }
+  snapshot_t *snapshot = (snapshot_t *)calloc(1, sizeof(snapshot_t));
+  if (snapshot != NULL)
+    snapshot->names = calloc(MYSCH_MAXFIELDS + 1, FILENAME_MAX);
+  if (snapshot == NULL || snapshot->names == NULL)
+  {
+    free(snapshot);
+    debug_error("Not enough memory for a snapshot of %s.", Table->filename);
+    return -1;
+  }
+  snapshot->header = *Table->fileHeader;
+  snapshot->header.compressed = 0;
+  snapshot->header.segmented = 0;
+  memset(snapshot->header.segmentdirs, 0, MYC_SEGMENTDIRS);
+  snapshot->pages[0] = Table->fileHeader->numpages;
+  uint32_t numrecords = Table->fileHeader->numrecords;
+  for (unsigned int f = 0; f <= MYSCH_MAXFIELDS; f++)
+  {
+    snapshot->files[f] = -1;
+    if (f > 0 && Table->fileHeader->layout == MYC_LAYOUT_COLUMNS && f <= Schema->numfields && numrecords > 0)
+    {
+      size_t offset;
+      snapshot->pages[f] = (columnPage(f - 1, numrecords - 1, &offset) & (COLUMN_PAGES - 1)) + 1;
+    }
+    snapshot->first[f] = snapshot->left;
+    snapshot->left += snapshot->pages[f];
+  }
+  snapshot->copied = calloc(snapshot->left / 8 + 1, 1);
+  Table->snapshot = snapshot;
+  if (snapshot->copied == NULL)
+  {
+    debug_error("Not enough memory for a snapshot of %s.", Table->filename);
+    endSnapshot(0);
+    return -1;
+  }
+
+  /* Page 0 of the DB file is the header, written at the end. */
+  snapshot->left--;
+  snapshot->next = 1;
+  for (unsigned int f = 0; f <= MYSCH_MAXFIELDS; f++)
+  {
+    if (f > 0 && snapshot->pages[f] == 0)
+      continue;
+    int length;
+    if (f == 0)
+      length = snprintf(snapshot->names[f], FILENAME_MAX, "%s", path);
+    else
+      length = snprintf(snapshot->names[f], FILENAME_MAX, "%s.%s", path, Schema->fields[f - 1].name);
+    if (length >= FILENAME_MAX)
+    {
+      debug_error("Name of snapshot too long. (%s)", path);
+      endSnapshot(0);
+      return -1;
+    }
+    snapshot->files[f] = open(snapshot->names[f], O_RDWR | O_CREAT | O_TRUNC, S_IRWXU);
+    if (snapshot->files[f] == -1)
+    {
+      debug_error("Error creating snapshot %s. %s", snapshot->names[f], strerror(errno));
+      endSnapshot(0);
+      return -1;
+    }
+  }
+  debug_info("Snapshot of %s started to %s (%llu pages).", Table->filename, path,
+             (unsigned long long)snapshot->left);
+  /* A table without pages is only its header. */
+  if (snapshot->left == 0)
+    return finishSnapshot();
+  return 0;
+}
+
+/**
+ * Copy the next pages of the snapshot of the selected table that did not
+ * change yet. Pages in the cache are copied from it, the others are read.
+ * When every page is copied, the image is synced to disk and closed.
+ * @param max Maximum number of pages to copy.
+ * @return Number of pages left. 0 if the snapshot ended or none is running.
+ * -1 if it failed: the image is removed.
+ */
+int MYC_snapshotStep(int max)
+{
+  unsigned char page[MYP_PAGESIZE];
+  int copied = 0;
+  while (Table->snapshot != NULL && copied < max)
+  {
+    snapshot_t *snapshot = Table->snapshot;
+    if (snapshot->next >= snapshot->pages[snapshot->unit])
+    {
+      snapshot->unit++;
+      snapshot->next = 0;
+      continue;
+    }
+    uint32_t pageNumber = snapshot->next++;
+    if (snapshot->unit > 0)
+      pageNumber = COLUMN_PAGE(snapshot->unit - 1, pageNumber);
+    unsigned int unit;
+    uint64_t bit;
+    if (!snapshotBit(pageNumber, &unit, &bit) || (snapshot->copied[bit / 8] & (1u << (bit % 8))) != 0)
+      continue;
+    int cacheIndex = searchPage(pageNumber);
+    if (cacheIndex != -1)
+      memcpy(page, entryOf(cacheIndex), MYP_PAGESIZE);
+    else if (readPage(pageNumber, page) == -1)
+    {
+      endSnapshot(0);
+      return -1;
+    }
+    if (copyPage(pageNumber, page) == -1)
+      return -1;
+    copied++;
+  }
+  if (Table->snapshot == NULL)
+    return 0;
+  return Table->snapshot->left > INT_MAX ? INT_MAX : (int)Table->snapshot->left;
+}
+
 /* Increases current debug level or reset to 0 if maximum is reached. */
 void MYC_debuglevel_rotate()
 {
@@ -0,0 +1,256 @@
+/*
+ * File:   libmylog.c
+ *
+ * This file implements the asynchronous backend of the debug macros.
+ *
+ * Each thread owns a ring of bytes holding messages prefixed by their
+ * length. The thread only moves the head of its ring and the writer only
+ * moves the tail, so neither takes a lock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "mylog.h"
+
+/************************************************************
+ PRIVATE VARIABLES
+ ************************************************************/
+
+/* Ring of messages of one thread. */
+typedef struct
+{
+  uint32_t head; /* Bytes written by the thread. */
+  uint32_t tail; /* Bytes written to stderr by the writer. */
+  char data[MYL_BUFFERSIZE];
+} log_buffer_t;
+
+/* Buffers of the threads which logged something. */
+static log_buffer_t *Buffers[MYL_MAXTHREADS];
+static int numBuffers = 0;
+
+/* Buffer of the calling thread. */
+static __thread log_buffer_t *myBuffer = NULL;
+
+/* Messages dropped because a buffer was full. */
+static uint64_t dropped = 0;
+
+/* The writer thread is running. */
+static int running = 0;
+/* Set to stop the writer thread. */
+static int stopping = 0;
+static pthread_t writer;
+
+/* Time the writer sleeps when there is nothing to write. */
+#define WRITER_IDLE_NS 5000000
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Get the buffer of the calling thread. It is created the first time.
+ * @return The buffer. NULL if there is no room for another thread.
+ */
+static log_buffer_t *
+getBuffer()
+{
+  if (myBuffer != NULL)
+    return myBuffer;
+  int slot = __atomic_fetch_add(&numBuffers, 1, __ATOMIC_RELAXED);
+  if (slot >= MYL_MAXTHREADS)
+    return NULL;
+  log_buffer_t *buffer = (log_buffer_t *)calloc(1, sizeof(log_buffer_t));
+  if (buffer == NULL)
+    return NULL;
+  __atomic_store_n(&Buffers[slot], buffer, __ATOMIC_RELEASE);
+  myBuffer = buffer;
+  return buffer;
+}
+
+/**
+ * Copy bytes into a ring, wrapping around its end.
+ * @param buffer The ring.
+ * @param pos Position of the first byte (not wrapped).
+ * @param src The bytes.
+ * @param size Number of bytes.
+ */
+static void
+ringWrite(log_buffer_t *buffer, uint32_t pos, const void *src, uint32_t size)
+{
+  uint32_t off = pos & (MYL_BUFFERSIZE - 1);
+  uint32_t first = MYL_BUFFERSIZE - off < size ? MYL_BUFFERSIZE - off : size;
+  memcpy(buffer->data + off, src, first);
+  memcpy(buffer->data, (const char *)src + first, size - first);
+}
+
+/**
+ * Copy bytes out of a ring, wrapping around its end.
+ * @param buffer The ring.
+ * @param pos Position of the first byte (not wrapped).
+ * @param dst Where to copy the bytes.
+ * @param size Number of bytes.
+ */
+static void
+ringRead(const log_buffer_t *buffer, uint32_t pos, void *dst, uint32_t size)
+{
+  uint32_t off = pos & (MYL_BUFFERSIZE - 1);
+  uint32_t first = MYL_BUFFERSIZE - off < size ? MYL_BUFFERSIZE - off : size;
+  memcpy(dst, buffer->data + off, first);
+  memcpy((char *)dst + first, buffer->data, size - first);
+}
+
+/**
+ * Write to stderr every message in the buffers.
+ * @return Number of messages written.
+ */
+static int
+drainBuffers()
+{
+  static uint64_t reported = 0;
+  int written = 0;
+  int n = __atomic_load_n(&numBuffers, __ATOMIC_RELAXED);
+  if (n > MYL_MAXTHREADS)
+    n = MYL_MAXTHREADS;
+  for (int i = 0; i < n; i++)
+  {
+    log_buffer_t *buffer = __atomic_load_n(&Buffers[i], __ATOMIC_ACQUIRE);
+    if (buffer == NULL)
+      continue;
+    uint32_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = buffer->tail;
+    while (tail != head)
+    {
+      uint32_t length;
+      char message[MYL_MAXMESSAGE];
+      ringRead(buffer, tail, &length, sizeof(length));
+      ringRead(buffer, tail + sizeof(length), message, length);
+      fwrite(message, 1, length, stderr);
+      tail += sizeof(length) + length;
+      written++;
+    }
+    /* Give the space back to the thread. */
+    __atomic_store_n(&buffer->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  uint64_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+  if (lost != reported)
+  {
+    fprintf(stderr, "libmylog.c:drainBuffers()::ERROR %llu log messages dropped.\n", (unsigned long long)(lost - reported));
+    reported = lost;
+    written++;
+  }
+  if (written > 0)
+    fflush(stderr);
+  return written;
+}
+
+/**
+ * Body of the writer thread.
+ * @param arg Not used.
+ * @return NULL
+ */
+static void *
+writerMain(void *arg)
+{
+  (void)arg;
+  while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+  {
+    if (drainBuffers() == 0)
+    {
+      struct timespec idle = {0, WRITER_IDLE_NS};
+      nanosleep(&idle, NULL);
+    }
+  }
+  drainBuffers();
+  return NULL;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+void MYL_log(const char *file, const char *function, const char *level, const char *suffix, const char *format, ...)
+{
+  char message[MYL_MAXMESSAGE];
+  va_list args;
+  int length = snprintf(message, sizeof(message), "%s:%s()::%s ", file, function, level);
+  va_start(args, format);
+  if (length < (int)sizeof(message))
+    length += vsnprintf(message + length, sizeof(message) - length, format, args);
+  va_end(args);
+  if (suffix != NULL && length < (int)sizeof(message))
+    length += snprintf(message + length, sizeof(message) - length, "%s", suffix);
+  /* Truncate long messages, keeping the end of line. */
+  if (length > (int)sizeof(message) - 1)
+    length = sizeof(message) - 1;
+  message[length++] = '\n';
+
+  log_buffer_t *buffer = NULL;
+  if (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    buffer = getBuffer();
+  if (buffer == NULL)
+  {
+    /* Not started yet or no buffer for this thread: write it now. */
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+      fwrite(message, 1, length, stderr);
+    else
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  uint32_t size = (uint32_t)length;
+  uint32_t head = buffer->head;
+  uint32_t tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+  if (MYL_BUFFERSIZE - (head - tail) < sizeof(size) + size)
+  {
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  ringWrite(buffer, head, &size, sizeof(size));
+  ringWrite(buffer, head + sizeof(size), message, size);
+  /* The message must be complete before the writer sees it. */
+  __atomic_store_n(&buffer->head, head + sizeof(size) + size, __ATOMIC_RELEASE);
+}
+
+int MYL_start()
+{
+  static int registered = 0;
+  if (running)
+    return 0;
+  stopping = 0;
+  int status = pthread_create(&writer, NULL, writerMain, NULL);
+  if (status != 0)
+  {
+    fprintf(stderr, "libmylog.c:MYL_start()::ERROR Error creating log writer thread. %s\n", strerror(status));
+    return -1;
+  }
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+  /* Messages still buffered are written when the program exits. */
+  if (!registered)
+  {
+    atexit(MYL_stop);
+    registered = 1;
+  }
+  return 0;
+}
+
+void MYL_stop()
+{
+  if (!running)
+    return;
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(writer, NULL);
+  /* From now on messages are written directly. */
+  __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+  drainBuffers();
+}
+
+uint64_t MYL_dropped()
+{
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,1431 @@
+/*
+ * File:   libmylsm.c
+ *
+ * This file implements the log-structured merge tree of a table.
+ *
+ * The memtable is laid out like a slotted page: the records fill its memory
+ * from the start and the array of their offsets, sorted by index, grows
+ * down from the end. A record written again stays in place if it fits in
+ * the room of the old one, or else it is added again and the old one is
+ * left unused until the next run.
+ *
+ * Every record of the log carries the epoch of the memtable it belongs to.
+ * The epoch grows each time the memtable is written to a run, and it is
+ * saved with the list of runs. Records left in the log from an older epoch
+ * are already in some run, so the log is read only up to the first record
+ * of another epoch, or the first one damaged by a crash.
+ *
+ * A run starts with its header page, then its pages of records, then the
+ * first index of each page and the bloom filter.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "mylsm.h"
+
+/************************************************************
+ PRIVATE VARIABLES
+ ************************************************************/
+
+/* Record of the log. Its data follows it. */
+typedef struct
+{
+  uint32_t key; /* Index of the record. */
+  uint16_t length; /* Bytes of the data. */
+  uint16_t reserved; /* Must be 0. */
+  uint32_t epoch; /* Epoch of the memtable. */
+  uint32_t check; /* Checksum of the record with this field at 0, and of the data. */
+} log_record_t;
+
+/* Record of the memtable. Its data follows it. */
+typedef struct
+{
+  uint32_t key; /* Index of the record. */
+  uint16_t length; /* Bytes of the data. */
+  uint16_t room; /* Bytes after the header, used or not. */
+} mem_record_t;
+
+/* Header of a run, at the start of its first page. */
+typedef struct
+{
+  uint32_t magic; /* MYLSM_RUN_MAGIC */
+  uint32_t version; /* MYLSM_VERSION */
+  uint32_t count; /* Records of the run. */
+  uint32_t pages; /* Pages of records, after the header page. */
+  uint32_t bloombits; /* Bits of the bloom filter, a multiple of 64. */
+  uint32_t lastkey; /* Highest index of the run. */
+  uint64_t fences; /* Offset of the first index of each page. */
+  uint64_t bloom; /* Offset of the bloom filter. */
+} run_header_t;
+
+/* Header of the list of runs. The numbers of the runs follow, newest first. */
+typedef struct
+{
+  uint32_t magic; /* MYLSM_MAGIC */
+  uint32_t version; /* MYLSM_VERSION */
+  uint32_t count; /* Runs in the list. */
+  uint32_t epoch; /* Epoch of the memtable. */
+  uint64_t next; /* Number of the next run. */
+} list_header_t;
+
+/* A run open. */
+typedef struct
+{
+  uint64_t number; /* Number in its file name. */
+  int fd; /* Descriptor of the file. */
+  uint32_t count; /* Records. */
+  uint32_t pages; /* Pages of records. */
+  uint32_t bloombits; /* Bits of the bloom filter. */
+  uint32_t lastkey; /* Highest index. */
+  uint32_t *fences; /* First index of each page. */
+  uint64_t *bloom; /* Bloom filter. */
+} run_t;
+
+/* A run being written. */
+typedef struct
+{
+  run_t *run; /* The run. Its fences grow as pages are added. */
+  uint32_t capacity; /* Room of the array of fences. */
+  int records; /* Records in the page being filled. */
+  unsigned char page[MYP_PAGESIZE]; /* Page being filled. */
+} writer_t;
+
+/* Merge of runs in the background. */
+typedef struct
+{
+  pthread_t thread;
+  int running; /* Started and not taken yet. */
+  int done; /* Set by the thread when it ends. */
+  int status; /* -1 if the merge failed. */
+  int error; /* errno of the failure. */
+  run_t *inputs[MYLSM_MAXRUNS]; /* Runs merged, newest first. */
+  int count; /* Number of runs merged. */
+  writer_t *output; /* The run made. */
+} merge_t;
+
+struct MYLSM_TREE
+{
+  char path[FILENAME_MAX]; /* Name of the DB file. */
+
+  /* The memtable. The offsets of its records are at the end of its memory. */
+  unsigned char *memory;
+  size_t size;
+  size_t used; /* Bytes of records from the start. */
+  uint32_t count; /* Records. */
+  uint32_t epoch; /* Epoch of the records. */
+
+  /* The log: bytes written and bytes kept in memory. */
+  int log;
+  off_t logOffset;
+  size_t logBuffered;
+  int logUnsynced;
+  unsigned char logBuffer[MYLSM_LOGBUFFER];
+
+  /* The runs, newest first, and the number of the next one. */
+  run_t *runs[MYLSM_MAXRUNS];
+  int numruns;
+  uint64_t next;
+
+  merge_t merge;
+
+  /* Counters of the bytes read and written. */
+  uint64_t *bytesRead;
+  uint64_t *bytesWritten;
+};
+
+/* A cursor going through the records of a run. */
+typedef struct
+{
+  run_t *run;
+  uint32_t pageNumber; /* Page loaded. */
+  uint32_t slot; /* Slot of the current record. */
+  int valid; /* 0 after the last record. */
+  uint32_t key; /* Current record. */
+  const unsigned char *data;
+  size_t length;
+  unsigned char page[MYP_PAGESIZE];
+} cursor_t;
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Get the name of a file of the tree.
+ * @param tree The tree.
+ * @param name Where to write the name: FILENAME_MAX bytes.
+ * @param suffix Suffix added to the name of the DB file.
+ * @param number Number of a run, added after the suffix. 0 adds nothing.
+ * @return -1 if the name is too long. 0 is OK.
+ */
+static int
+fileName(const MYLSM_TREE_t *tree, char *name, const char *suffix, uint64_t number)
+{
+  int length;
+  if (number == 0)
+    length = snprintf(name, FILENAME_MAX, "%s%s", tree->path, suffix);
+  else
+    length = snprintf(name, FILENAME_MAX, "%s%s%llu", tree->path, suffix, (unsigned long long)number);
+  if (length >= FILENAME_MAX)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Read from a file, retrying interrupted and partial reads.
+ * @param tree The tree counting the bytes read.
+ * @param fd Descriptor of the file.
+ * @param buffer Where to read.
+ * @param size Bytes to read.
+ * @param offset Offset in the file.
+ * @return -1 in case of error or if the file ends before (EIO). 0 success.
+ */
+static int
+readFully(MYLSM_TREE_t *tree, int fd, void *buffer, size_t size, off_t offset)
+{
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t res = pread(fd, (char *)buffer + done, size - done, offset + done);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res == -1)
+      return -1;
+    if (res == 0)
+    {
+      errno = EIO;
+      return -1;
+    }
+    done += res;
+  }
+  __atomic_fetch_add(tree->bytesRead, size, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/**
+ * Write to a file, retrying interrupted and partial writes.
+ * @param tree The tree counting the bytes written.
+ * @param fd Descriptor of the file.
+ * @param buffer What to write.
+ * @param size Bytes to write.
+ * @param offset Offset in the file.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+writeFully(MYLSM_TREE_t *tree, int fd, const void *buffer, size_t size, off_t offset)
+{
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t res = pwrite(fd, (const char *)buffer + done, size - done, offset + done);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res == -1)
+      return -1;
+    done += res;
+  }
+  __atomic_fetch_add(tree->bytesWritten, size, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/**
+ * Compute the checksum of a record of the log (FNV-1a).
+ * @param record The record, with its checksum at 0.
+ * @param data Its data.
+ * @return The checksum.
+ */
+static uint32_t
+checksum(const log_record_t *record, const unsigned char *data)
+{
+  uint32_t hash = 2166136261U;
+  const unsigned char *bytes = (const unsigned char *)record;
+  for (size_t i = 0; i < sizeof(*record); i++)
+    hash = (hash ^ bytes[i]) * 16777619U;
+  for (size_t i = 0; i < record->length; i++)
+    hash = (hash ^ data[i]) * 16777619U;
+  return hash;
+}
+
+/**
+ * Mix the bits of an index for the bloom filter.
+ * @param key The index.
+ * @return 64 bits: two hashes of 32 bits.
+ */
+static uint64_t
+mixKey(uint32_t key)
+{
+  uint64_t x = key;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/**
+ * Add an index to the bloom filter of a run.
+ * @param run The run.
+ * @param key The index.
+ */
+static void
+bloomAdd(run_t *run, uint32_t key)
+{
+  uint64_t hash = mixKey(key);
+  uint32_t h1 = (uint32_t)hash;
+  uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+  for (uint32_t i = 0; i < MYLSM_BLOOMHASHES; i++)
+  {
+    uint32_t bit = (h1 + i * h2) % run->bloombits;
+    run->bloom[bit / 64] |= (uint64_t)1 << (bit % 64);
+  }
+}
+
+/**
+ * Check the bloom filter of a run.
+ * @param run The run.
+ * @param key The index.
+ * @return 0 if the run does not have the index. 1 if it may have it.
+ */
+static int
+bloomTest(const run_t *run, uint32_t key)
+{
+  uint64_t hash = mixKey(key);
+  uint32_t h1 = (uint32_t)hash;
+  uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+  for (uint32_t i = 0; i < MYLSM_BLOOMHASHES; i++)
+  {
+    uint32_t bit = (h1 + i * h2) % run->bloombits;
+    if ((run->bloom[bit / 64] & ((uint64_t)1 << (bit % 64))) == 0)
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * Free a run and close its file.
+ * @param run The run. May be NULL.
+ */
+static void
+freeRun(run_t *run)
+{
+  if (run == NULL)
+    return;
+  if (run->fd != -1)
+    close(run->fd);
+  free(run->fences);
+  free(run->bloom);
+  free(run);
+}
+
+/**
+ * Open a run of the list.
+ * @param tree The tree.
+ * @param number Number of the run.
+ * @return The run. NULL in case of error (EINVAL if the file is damaged).
+ */
+static run_t *
+openRun(MYLSM_TREE_t *tree, uint64_t number)
+{
+  char name[FILENAME_MAX];
+  if (fileName(tree, name, ".run.", number) == -1)
+    return NULL;
+  run_t *run = calloc(1, sizeof(run_t));
+  if (run == NULL)
+    return NULL;
+  run->number = number;
+  run->fd = open(name, O_RDONLY);
+  if (run->fd == -1)
+  {
+    freeRun(run);
+    return NULL;
+  }
+  run_header_t header;
+  if (readFully(tree, run->fd, &header, sizeof(header), 0) == -1)
+  {
+    freeRun(run);
+    return NULL;
+  }
+  if (header.magic != MYLSM_RUN_MAGIC || header.version != MYLSM_VERSION || header.bloombits == 0 ||
+      header.bloombits % 64 != 0)
+  {
+    freeRun(run);
+    errno = EINVAL;
+    return NULL;
+  }
+  run->count = header.count;
+  run->pages = header.pages;
+  run->bloombits = header.bloombits;
+  run->lastkey = header.lastkey;
+  run->fences = malloc((header.pages > 0 ? header.pages : 1) * sizeof(uint32_t));
+  run->bloom = malloc(header.bloombits / 8);
+  if (run->fences == NULL || run->bloom == NULL ||
+      readFully(tree, run->fd, run->fences, header.pages * sizeof(uint32_t), header.fences) == -1 ||
+      readFully(tree, run->fd, run->bloom, header.bloombits / 8, header.bloom) == -1)
+  {
+    freeRun(run);
+    return NULL;
+  }
+  return run;
+}
+
+/**
+ * Start writing a new run.
+ * @param tree The tree. The run takes the next number.
+ * @param expected Number of records expected, to size the bloom filter.
+ * @return The writer. NULL in case of error.
+ */
+static writer_t *
+openWriter(MYLSM_TREE_t *tree, uint64_t expected)
+{
+  writer_t *writer = calloc(1, sizeof(writer_t));
+  if (writer == NULL)
+    return NULL;
+  writer->run = calloc(1, sizeof(run_t));
+  if (writer->run == NULL)
+  {
+    free(writer);
+    return NULL;
+  }
+  run_t *run = writer->run;
+  run->number = tree->next++;
+  run->fd = -1;
+  /* The filter takes a multiple of 64 bits that fits in 32 bits. */
+  uint64_t bits = expected * MYLSM_BLOOMBITS;
+  if (bits > UINT32_MAX / 64 * 64)
+    bits = UINT32_MAX / 64 * 64;
+  run->bloombits = bits > 64 ? (uint32_t)((bits + 63) / 64 * 64) : 64;
+  run->bloom = calloc(run->bloombits / 64, sizeof(uint64_t));
+  writer->capacity = 64;
+  run->fences = malloc(writer->capacity * sizeof(uint32_t));
+  char name[FILENAME_MAX];
+  if (run->bloom == NULL || run->fences == NULL || fileName(tree, name, ".run.", run->number) == -1 ||
+      (run->fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1)
+  {
+    freeRun(run);
+    free(writer);
+    return NULL;
+  }
+  MYP_init(writer->page);
+  return writer;
+}
+
+/**
+ * Give up a run being written and remove its file.
+ * @param tree The tree.
+ * @param writer The writer. May be NULL.
+ */
+static void
+abortWriter(MYLSM_TREE_t *tree, writer_t *writer)
+{
+  if (writer == NULL)
+    return;
+  char name[FILENAME_MAX];
+  if (fileName(tree, name, ".run.", writer->run->number) == 0)
+    unlink(name);
+  freeRun(writer->run);
+  free(writer);
+}
+
+/**
+ * Write the page being filled after the pages already written.
+ * @param tree The tree.
+ * @param writer The writer.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+writePage(MYLSM_TREE_t *tree, writer_t *writer)
+{
+  run_t *run = writer->run;
+  if (writeFully(tree, run->fd, writer->page, MYP_PAGESIZE, (off_t)(run->pages + 1) * MYP_PAGESIZE) == -1)
+    return -1;
+  run->pages++;
+  writer->records = 0;
+  MYP_init(writer->page);
+  return 0;
+}
+
+/**
+ * Add a record to a run. Records are added in order of their indices.
+ * @param tree The tree.
+ * @param writer The writer.
+ * @param key Index of the record.
+ * @param data The packed record.
+ * @param length Bytes of the packed record.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+addRecord(MYLSM_TREE_t *tree, writer_t *writer, uint32_t key, const unsigned char *data, size_t length)
+{
+  run_t *run = writer->run;
+  if (writer->records > 0 && MYP_room(writer->page) < length && writePage(tree, writer) == -1)
+    return -1;
+  if (writer->records == 0)
+  {
+    /* The first record of a page gives its fence. */
+    if (run->pages == writer->capacity)
+    {
+      uint32_t *fences = realloc(run->fences, 2 * writer->capacity * sizeof(uint32_t));
+      if (fences == NULL)
+        return -1;
+      run->fences = fences;
+      writer->capacity *= 2;
+    }
+    run->fences[run->pages] = key;
+  }
+  if (MYP_insert(writer->page, key, data, length) == -1)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  writer->records++;
+  bloomAdd(run, key);
+  run->count++;
+  run->lastkey = key;
+  return 0;
+}
+
+/**
+ * End a run: write its last page, its fences, its bloom filter and then
+ * its header, and sync it to disk.
+ * @param tree The tree.
+ * @param writer The writer.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+closeWriter(MYLSM_TREE_t *tree, writer_t *writer)
+{
+  run_t *run = writer->run;
+  if (writer->records > 0 && writePage(tree, writer) == -1)
+    return -1;
+  unsigned char page[MYP_PAGESIZE];
+  memset(page, 0, sizeof(page));
+  run_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = MYLSM_RUN_MAGIC;
+  header.version = MYLSM_VERSION;
+  header.count = run->count;
+  header.pages = run->pages;
+  header.bloombits = run->bloombits;
+  header.lastkey = run->lastkey;
+  header.fences = (uint64_t)(run->pages + 1) * MYP_PAGESIZE;
+  header.bloom = header.fences + run->pages * sizeof(uint32_t);
+  memcpy(page, &header, sizeof(header));
+  if (writeFully(tree, run->fd, run->fences, run->pages * sizeof(uint32_t), header.fences) == -1 ||
+      writeFully(tree, run->fd, run->bloom, run->bloombits / 8, header.bloom) == -1 ||
+      writeFully(tree, run->fd, page, sizeof(page), 0) == -1 || fdatasync(run->fd) == -1)
+    return -1;
+  return 0;
+}
+
+/**
+ * Save the list of runs, replacing it atomically.
+ * @param tree The tree.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+saveList(MYLSM_TREE_t *tree)
+{
+  char name[FILENAME_MAX];
+  char tmp[FILENAME_MAX];
+  if (fileName(tree, name, ".lsm", 0) == -1 || fileName(tree, tmp, ".lsm.tmp", 0) == -1)
+    return -1;
+  FILE *file = fopen(tmp, "w");
+  if (file == NULL)
+    return -1;
+  list_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = MYLSM_MAGIC;
+  header.version = MYLSM_VERSION;
+  header.count = tree->numruns;
+  header.epoch = tree->epoch;
+  header.next = tree->next;
+  int res = fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+  for (int r = 0; r < tree->numruns && res == 0; r++)
+  {
+    if (fwrite(&tree->runs[r]->number, sizeof(uint64_t), 1, file) != 1)
+      res = -1;
+  }
+  if (res == 0 && (fflush(file) != 0 || fdatasync(fileno(file)) == -1))
+    res = -1;
+  if (fclose(file) != 0)
+    res = -1;
+  if (res == 0)
+    res = rename(tmp, name);
+  if (res == -1)
+    unlink(tmp);
+  return res;
+}
+
+/**
+ * Read the list of runs and open them, or create an empty list if the tree
+ * is new.
+ * @param tree The tree.
+ * @return -1 if the list is lost or damaged or in case of error. 0 success.
+ */
+static int
+loadList(MYLSM_TREE_t *tree)
+{
+  char name[FILENAME_MAX];
+  if (fileName(tree, name, ".lsm", 0) == -1)
+    return -1;
+  FILE *file = fopen(name, "r");
+  if (file == NULL)
+  {
+    if (errno != ENOENT)
+      return -1;
+    /* Without the list, a log tells that the tree existed. */
+    struct stat st;
+    if (fileName(tree, name, ".log", 0) == -1)
+      return -1;
+    if (stat(name, &st) == 0)
+    {
+      errno = ENOENT;
+      return -1;
+    }
+    tree->next = 1;
+    tree->epoch = 1;
+    return saveList(tree);
+  }
+  list_header_t header;
+  int res = 0;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != MYLSM_MAGIC ||
+      header.version != MYLSM_VERSION || header.count > MYLSM_MAXRUNS)
+  {
+    errno = EINVAL;
+    res = -1;
+  }
+  else
+  {
+    tree->next = header.next;
+    tree->epoch = header.epoch;
+  }
+  for (uint32_t r = 0; r < header.count && res == 0; r++)
+  {
+    uint64_t number;
+    if (fread(&number, sizeof(number), 1, file) != 1)
+    {
+      errno = EINVAL;
+      res = -1;
+    }
+    else if ((tree->runs[r] = openRun(tree, number)) == NULL)
+      res = -1;
+    else
+      tree->numruns++;
+  }
+  fclose(file);
+  return res;
+}
+
+/**
+ * Get the array of offsets of the records of the memtable.
+ * @param tree The tree.
+ * @return The offsets, sorted by index.
+ */
+static uint32_t *
+memIndex(const MYLSM_TREE_t *tree)
+{
+  return (uint32_t *)(tree->memory + tree->size) - tree->count;
+}
+
+/**
+ * Get the header of a record of the memtable.
+ * @param tree The tree.
+ * @param offset Offset of the record.
+ * @return The header.
+ */
+static mem_record_t
+memRecord(const MYLSM_TREE_t *tree, uint32_t offset)
+{
+  mem_record_t record;
+  memcpy(&record, tree->memory + offset, sizeof(record));
+  return record;
+}
+
+/**
+ * Search an index in the memtable.
+ * @param tree The tree.
+ * @param key The index.
+ * @param position Where to return the position of the record or where it
+ * would be inserted.
+ * @return 1 if the record is there. 0 if not.
+ */
+static int
+memFind(const MYLSM_TREE_t *tree, uint32_t key, uint32_t *position)
+{
+  const uint32_t *index = memIndex(tree);
+  uint32_t low = 0;
+  uint32_t high = tree->count;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (memRecord(tree, index[middle]).key < key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  *position = low;
+  return low < tree->count && memRecord(tree, index[low]).key == key;
+}
+
+/**
+ * Check that a record fits in the memtable.
+ * @param tree The tree.
+ * @param key Index of the record.
+ * @param length Bytes of the packed record.
+ * @return 1 if it fits. 0 if not.
+ */
+static int
+memFits(const MYLSM_TREE_t *tree, uint32_t key, size_t length)
+{
+  uint32_t position;
+  if (memFind(tree, key, &position))
+  {
+    if (memRecord(tree, memIndex(tree)[position]).room >= length)
+      return 1;
+    return tree->used + sizeof(mem_record_t) + length <= tree->size - tree->count * sizeof(uint32_t);
+  }
+  return tree->used + sizeof(mem_record_t) + length + sizeof(uint32_t) <=
+         tree->size - tree->count * sizeof(uint32_t);
+}
+
+/**
+ * Store a record in the memtable. It must fit.
+ * @param tree The tree.
+ * @param key Index of the record.
+ * @param data The packed record.
+ * @param length Bytes of the packed record.
+ */
+static void
+memPut(MYLSM_TREE_t *tree, uint32_t key, const unsigned char *data, size_t length)
+{
+  uint32_t position;
+  int found = memFind(tree, key, &position);
+  uint32_t *index = memIndex(tree);
+  mem_record_t record;
+  if (found)
+  {
+    record = memRecord(tree, index[position]);
+    if (record.room >= length)
+    {
+      /* Overwrite the old record in place. */
+      record.length = (uint16_t)length;
+      memcpy(tree->memory + index[position], &record, sizeof(record));
+      memcpy(tree->memory + index[position] + sizeof(record), data, length);
+      return;
+    }
+  }
+  record.key = key;
+  record.length = (uint16_t)length;
+  record.room = (uint16_t)length;
+  uint32_t offset = (uint32_t)tree->used;
+  memcpy(tree->memory + offset, &record, sizeof(record));
+  memcpy(tree->memory + offset + sizeof(record), data, length);
+  tree->used += sizeof(record) + length;
+  if (found)
+  {
+    index[position] = offset;
+    return;
+  }
+  /* The array grows down: the offsets before the position move down. */
+  memmove(index - 1, index, position * sizeof(uint32_t));
+  tree->count++;
+  memIndex(tree)[position] = offset;
+}
+
+/**
+ * Write the log kept in memory.
+ * @param tree The tree.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+writeLog(MYLSM_TREE_t *tree)
+{
+  if (tree->logBuffered == 0)
+    return 0;
+  if (writeFully(tree, tree->log, tree->logBuffer, tree->logBuffered, tree->logOffset) == -1)
+    return -1;
+  tree->logOffset += tree->logBuffered;
+  tree->logBuffered = 0;
+  return 0;
+}
+
+/**
+ * Add a write to the log.
+ * @param tree The tree.
+ * @param key Index of the record.
+ * @param data The packed record.
+ * @param length Bytes of the packed record.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+appendLog(MYLSM_TREE_t *tree, uint32_t key, const unsigned char *data, size_t length)
+{
+  log_record_t record;
+  memset(&record, 0, sizeof(record));
+  record.key = key;
+  record.length = (uint16_t)length;
+  record.epoch = tree->epoch;
+  record.check = checksum(&record, data);
+  if (tree->logBuffered + sizeof(record) + length > sizeof(tree->logBuffer) && writeLog(tree) == -1)
+    return -1;
+  memcpy(tree->logBuffer + tree->logBuffered, &record, sizeof(record));
+  memcpy(tree->logBuffer + tree->logBuffered + sizeof(record), data, length);
+  tree->logBuffered += sizeof(record) + length;
+  tree->logUnsynced = 1;
+  return 0;
+}
+
+/**
+ * Empty the log once its records are in a run.
+ * @param tree The tree.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+resetLog(MYLSM_TREE_t *tree)
+{
+  tree->logBuffered = 0;
+  tree->logOffset = 0;
+  tree->logUnsynced = 0;
+  return ftruncate(tree->log, 0);
+}
+
+/**
+ * Take the run made by the merge. The runs merged are removed.
+ * @param tree The tree.
+ * @return -1 if the merge failed. 0 success.
+ */
+static int
+endMerge(MYLSM_TREE_t *tree)
+{
+  merge_t *merge = &tree->merge;
+  pthread_join(merge->thread, NULL);
+  merge->running = 0;
+  if (merge->status == -1)
+  {
+    abortWriter(tree, merge->output);
+    merge->output = NULL;
+    errno = merge->error;
+    return -1;
+  }
+  /* The runs written since the merge started stay in front of its run. */
+  run_t *merged[MYLSM_MAXRUNS];
+  int count = tree->numruns;
+  memcpy(merged, tree->runs, count * sizeof(run_t *));
+  tree->numruns = count - merge->count;
+  tree->runs[tree->numruns++] = merge->output->run;
+  if (saveList(tree) == -1)
+  {
+    int error = errno;
+    memcpy(tree->runs, merged, count * sizeof(run_t *));
+    tree->numruns = count;
+    abortWriter(tree, merge->output);
+    merge->output = NULL;
+    errno = error;
+    return -1;
+  }
+  free(merge->output);
+  merge->output = NULL;
+  for (int r = 0; r < merge->count; r++)
+  {
+    char name[FILENAME_MAX];
+    if (fileName(tree, name, ".run.", merge->inputs[r]->number) == 0)
+      unlink(name);
+    freeRun(merge->inputs[r]);
+  }
+  return 0;
+}
+
+/**
+ * Load a page of a run into a cursor.
+ * @param tree The tree.
+ * @param cursor The cursor.
+ * @param pageNumber The page.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+loadPage(MYLSM_TREE_t *tree, cursor_t *cursor, uint32_t pageNumber)
+{
+  cursor->pageNumber = pageNumber;
+  cursor->slot = 0;
+  return readFully(tree, cursor->run->fd, cursor->page, MYP_PAGESIZE, (off_t)(pageNumber + 1) * MYP_PAGESIZE);
+}
+
+/**
+ * Move a cursor to its slot or to the first record after it.
+ * @param tree The tree.
+ * @param cursor The cursor.
+ * @return -1 in case of error (EIO if the page is damaged). 0 success.
+ */
+static int
+settleCursor(MYLSM_TREE_t *tree, cursor_t *cursor)
+{
+  for (;;)
+  {
+    MYPAGE_HEADER_t header;
+    memcpy(&header, cursor->page, sizeof(header));
+    if (cursor->slot < header.numslots)
+      break;
+    if (cursor->pageNumber + 1 >= cursor->run->pages)
+    {
+      cursor->valid = 0;
+      return 0;
+    }
+    if (loadPage(tree, cursor, cursor->pageNumber + 1) == -1)
+      return -1;
+  }
+  MYPAGE_SLOT_t slot;
+  memcpy(&slot, cursor->page + sizeof(MYPAGE_HEADER_t) + cursor->slot * sizeof(MYPAGE_SLOT_t), sizeof(slot));
+  cursor->data = MYP_record(cursor->page, cursor->slot, slot.id, &cursor->length);
+  if (cursor->data == NULL)
+  {
+    errno = EIO;
+    return -1;
+  }
+  cursor->key = slot.id;
+  cursor->valid = 1;
+  return 0;
+}
+
+/**
+ * Get the page of a run which may hold an index.
+ * @param run The run. It has some page.
+ * @param key The index.
+ * @return The last page whose first index is not above the index.
+ */
+static uint32_t
+findPage(const run_t *run, uint32_t key)
+{
+  uint32_t low = 0;
+  uint32_t high = run->pages;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (run->fences[middle] <= key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low > 0 ? low - 1 : 0;
+}
+
+/**
+ * Find the slot of the first record of a page not below an index.
+ * @param page The page.
+ * @param key The index.
+ * @return The slot. The number of slots if every record is below.
+ */
+static uint32_t
+findSlot(const unsigned char *page, uint32_t key)
+{
+  MYPAGE_HEADER_t header;
+  memcpy(&header, page, sizeof(header));
+  uint32_t numslots = header.numslots;
+  if (sizeof(MYPAGE_HEADER_t) + numslots * sizeof(MYPAGE_SLOT_t) > MYP_PAGESIZE)
+    numslots = 0;
+  uint32_t low = 0;
+  uint32_t high = numslots;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    MYPAGE_SLOT_t slot;
+    memcpy(&slot, page + sizeof(MYPAGE_HEADER_t) + middle * sizeof(MYPAGE_SLOT_t), sizeof(slot));
+    if (slot.id < key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+/**
+ * Place a cursor on the first record of its run not below an index.
+ * @param tree The tree.
+ * @param cursor The cursor. Its run is set.
+ * @param key The index.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+seekCursor(MYLSM_TREE_t *tree, cursor_t *cursor, uint32_t key)
+{
+  cursor->valid = 0;
+  if (cursor->run->pages == 0 || key > cursor->run->lastkey)
+    return 0;
+  if (loadPage(tree, cursor, findPage(cursor->run, key)) == -1)
+    return -1;
+  cursor->slot = findSlot(cursor->page, key);
+  return settleCursor(tree, cursor);
+}
+
+/**
+ * Call a function with the records of some runs and maybe the memtable in
+ * order of their indices. The newest version of each record is taken.
+ * @param tree The tree.
+ * @param runs The runs, newest first.
+ * @param count Number of runs.
+ * @param memtable 1 to take the memtable too, newer than every run.
+ * @param first First index.
+ * @param end Index after the last one.
+ * @param callback The function.
+ * @param arg Argument of the function.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+mergeRecords(MYLSM_TREE_t *tree, run_t *const *runs, int count, int memtable, uint32_t first, uint64_t end,
+             MYLSM_SCAN_f callback, void *arg)
+{
+  cursor_t *cursors = malloc((count > 0 ? count : 1) * sizeof(cursor_t));
+  if (cursors == NULL)
+    return -1;
+  int status = 0;
+  for (int r = 0; r < count && status == 0; r++)
+  {
+    cursors[r].run = runs[r];
+    status = seekCursor(tree, &cursors[r], first);
+  }
+  /* A merge in the background does not touch the memtable. */
+  uint32_t position = 0;
+  uint32_t memCount = memtable ? tree->count : 0;
+  const uint32_t *index = memtable ? memIndex(tree) : NULL;
+  if (memtable)
+    memFind(tree, first, &position);
+  while (status == 0)
+  {
+    /* The lowest index of every source. */
+    uint64_t key = end;
+    if (position < memCount)
+      key = memRecord(tree, index[position]).key;
+    for (int r = 0; r < count; r++)
+    {
+      if (cursors[r].valid && cursors[r].key < key)
+        key = cursors[r].key;
+    }
+    if (key >= end)
+      break;
+    /* The newest source with the index gives the record. */
+    const unsigned char *data = NULL;
+    size_t length = 0;
+    if (position < memCount && memRecord(tree, index[position]).key == key)
+    {
+      data = tree->memory + index[position] + sizeof(mem_record_t);
+      length = memRecord(tree, index[position]).length;
+      position++;
+    }
+    for (int r = 0; r < count && status == 0; r++)
+    {
+      if (!cursors[r].valid || cursors[r].key != key)
+        continue;
+      if (data == NULL)
+      {
+        data = cursors[r].data;
+        length = cursors[r].length;
+      }
+      else
+      {
+        cursors[r].slot++;
+        status = settleCursor(tree, &cursors[r]);
+      }
+    }
+    if (status == -1)
+      break;
+    if (callback((uint32_t)key, data, length, arg) != 0)
+      break;
+    /* The cursor giving the record moves after calling the function. */
+    for (int r = 0; r < count && status == 0; r++)
+    {
+      if (cursors[r].valid && cursors[r].key == key)
+      {
+        cursors[r].slot++;
+        status = settleCursor(tree, &cursors[r]);
+      }
+    }
+  }
+  int error = errno;
+  free(cursors);
+  errno = error;
+  return status;
+}
+
+/**
+ * Add a record to the run written by a merge.
+ */
+static int
+mergeRecord(uint32_t key, const unsigned char *data, size_t length, void *arg)
+{
+  MYLSM_TREE_t *tree = (MYLSM_TREE_t *)arg;
+  if (addRecord(tree, tree->merge.output, key, data, length) == -1)
+  {
+    tree->merge.status = -1;
+    tree->merge.error = errno;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Merge runs in the background. Only the runs merged and the run written
+ * are used: they are not touched by the other functions meanwhile.
+ * @param arg The tree.
+ * @return NULL.
+ */
+static void *
+mergeMain(void *arg)
+{
+  MYLSM_TREE_t *tree = (MYLSM_TREE_t *)arg;
+  merge_t *merge = &tree->merge;
+  if (mergeRecords(tree, merge->inputs, merge->count, 0, 0, UINT64_MAX, mergeRecord, tree) == -1)
+  {
+    merge->status = -1;
+    merge->error = errno;
+  }
+  if (merge->status == 0 && closeWriter(tree, merge->output) == -1)
+  {
+    merge->status = -1;
+    merge->error = errno;
+  }
+  __atomic_store_n(&merge->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/**
+ * Start merging every run in the background.
+ * @param tree The tree.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+startMerge(MYLSM_TREE_t *tree)
+{
+  merge_t *merge = &tree->merge;
+  uint64_t expected = 0;
+  for (int r = 0; r < tree->numruns; r++)
+    expected += tree->runs[r]->count;
+  merge->output = openWriter(tree, expected);
+  if (merge->output == NULL)
+    return -1;
+  memcpy(merge->inputs, tree->runs, tree->numruns * sizeof(run_t *));
+  merge->count = tree->numruns;
+  merge->status = 0;
+  merge->done = 0;
+  int status = pthread_create(&merge->thread, NULL, mergeMain, tree);
+  if (status != 0)
+  {
+    abortWriter(tree, merge->output);
+    merge->output = NULL;
+    errno = status;
+    return -1;
+  }
+  merge->running = 1;
+  return 0;
+}
+
+/**
+ * Write the memtable to a new run, and empty it.
+ * @param tree The tree.
+ * @param save 0 to leave the list of runs and the log as they are: the log
+ * is being read and the list is saved when it ends.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+flushMemtable(MYLSM_TREE_t *tree, int save)
+{
+  if (tree->count == 0)
+    return 0;
+  /* Make room for the run: reads must not go through too many runs. */
+  if (tree->numruns == MYLSM_MAXRUNS)
+  {
+    if (!tree->merge.running && startMerge(tree) == -1)
+      return -1;
+    if (endMerge(tree) == -1)
+      return -1;
+  }
+  writer_t *writer = openWriter(tree, tree->count);
+  if (writer == NULL)
+    return -1;
+  const uint32_t *index = memIndex(tree);
+  for (uint32_t i = 0; i < tree->count; i++)
+  {
+    mem_record_t record = memRecord(tree, index[i]);
+    if (addRecord(tree, writer, record.key, tree->memory + index[i] + sizeof(record), record.length) == -1)
+    {
+      abortWriter(tree, writer);
+      return -1;
+    }
+  }
+  if (closeWriter(tree, writer) == -1)
+  {
+    abortWriter(tree, writer);
+    return -1;
+  }
+  run_t *run = writer->run;
+  free(writer);
+  memmove(tree->runs + 1, tree->runs, tree->numruns * sizeof(run_t *));
+  tree->runs[0] = run;
+  tree->numruns++;
+  tree->used = 0;
+  tree->count = 0;
+  if (!save)
+    return 0;
+  tree->epoch++;
+  if (saveList(tree) == -1)
+    return -1;
+  return resetLog(tree);
+}
+
+/**
+ * Read the log into the memtable, up to its first record of another epoch
+ * or damaged. The rest of the log is cut.
+ * @param tree The tree. The memtable is empty.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+replayLog(MYLSM_TREE_t *tree)
+{
+  struct stat st;
+  if (fstat(tree->log, &st) == -1)
+    return -1;
+  int flushed = 0;
+  off_t offset = 0;
+  unsigned char data[MYP_PAGESIZE];
+  while (offset + (off_t)sizeof(log_record_t) <= st.st_size)
+  {
+    log_record_t record;
+    if (readFully(tree, tree->log, &record, sizeof(record), offset) == -1)
+      return -1;
+    if (record.epoch != tree->epoch || record.length > sizeof(data) ||
+        offset + (off_t)sizeof(record) + record.length > st.st_size ||
+        readFully(tree, tree->log, data, record.length, offset + sizeof(record)) == -1)
+      break;
+    uint32_t check = record.check;
+    record.check = 0;
+    if (checksum(&record, data) != check)
+      break;
+    /* A log longer than the memtable goes to runs. */
+    if (!memFits(tree, record.key, record.length))
+    {
+      if (flushMemtable(tree, 0) == -1)
+        return -1;
+      flushed = 1;
+    }
+    memPut(tree, record.key, data, record.length);
+    offset += sizeof(record) + record.length;
+  }
+  if (flushed)
+  {
+    /* The runs written take the place of the whole log. */
+    if (flushMemtable(tree, 0) == -1)
+      return -1;
+    tree->epoch++;
+    if (saveList(tree) == -1)
+      return -1;
+    return resetLog(tree);
+  }
+  tree->logOffset = offset;
+  return offset < st.st_size ? ftruncate(tree->log, offset) : 0;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+/**
+ * Open the tree of a DB file.
+ * @param path Name of the DB file.
+ * @param memory Memory of the memtable.
+ * @param size Bytes of the memory: two pages at least.
+ * @param bytesRead Counter of the bytes read.
+ * @param bytesWritten Counter of the bytes written.
+ * @return The tree. NULL in case of error.
+ */
+MYLSM_TREE_t *MYLSM_open(const char *path, void *memory, size_t size, uint64_t *bytesRead,
+                         uint64_t *bytesWritten)
+{
+  if (strlen(path) >= FILENAME_MAX || size < 2 * MYP_PAGESIZE)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  MYLSM_TREE_t *tree = calloc(1, sizeof(MYLSM_TREE_t));
+  if (tree == NULL)
+    return NULL;
+  strcpy(tree->path, path);
+  tree->memory = (unsigned char *)memory;
+  tree->size = size / sizeof(uint32_t) * sizeof(uint32_t);
+  tree->bytesRead = bytesRead;
+  tree->bytesWritten = bytesWritten;
+  tree->log = -1;
+  char name[FILENAME_MAX];
+  if (loadList(tree) == -1 || fileName(tree, name, ".log", 0) == -1 ||
+      (tree->log = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1 || replayLog(tree) == -1)
+  {
+    int error = errno;
+    MYLSM_close(tree);
+    errno = error;
+    return NULL;
+  }
+  return tree;
+}
+
+/**
+ * Close a tree.
+ * @param tree The tree.
+ * @return -1 if the log could not be written. 0 success.
+ */
+int MYLSM_close(MYLSM_TREE_t *tree)
+{
+  int status = 0;
+  if (tree->merge.running)
+    endMerge(tree);
+  if (tree->log != -1)
+  {
+    status = writeLog(tree);
+    close(tree->log);
+  }
+  for (int r = 0; r < tree->numruns; r++)
+    freeRun(tree->runs[r]);
+  free(tree);
+  return status;
+}
+
+/**
+ * Read a record.
+ * @param tree The tree.
+ * @param key Index of the record.
+ * @param buffer Where to copy the packed record.
+ * @param size Bytes of the buffer.
+ * @param missed Set to 1 if some page was read from a run.
+ * @return Bytes of the packed record. 0 if it was never written. -1 in
+ * case of error.
+ */
+int MYLSM_get(MYLSM_TREE_t *tree, uint32_t key, unsigned char *buffer, size_t size, int *missed)
+{
+  uint32_t position;
+  if (memFind(tree, key, &position))
+  {
+    uint32_t offset = memIndex(tree)[position];
+    mem_record_t record = memRecord(tree, offset);
+    if (record.length > size)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    memcpy(buffer, tree->memory + offset + sizeof(record), record.length);
+    return record.length;
+  }
+  unsigned char page[MYP_PAGESIZE];
+  for (int r = 0; r < tree->numruns; r++)
+  {
+    const run_t *run = tree->runs[r];
+    if (run->pages == 0 || key < run->fences[0] || key > run->lastkey || !bloomTest(run, key))
+      continue;
+    uint32_t pageNumber = findPage(run, key);
+    if (readFully(tree, run->fd, page, sizeof(page), (off_t)(pageNumber + 1) * MYP_PAGESIZE) == -1)
+      return -1;
+    *missed = 1;
+    uint32_t slot = findSlot(page, key);
+    size_t length;
+    const unsigned char *data = MYP_record(page, slot, key, &length);
+    if (data == NULL)
+      continue;
+    if (length > size)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    memcpy(buffer, data, length);
+    return (int)length;
+  }
+  return 0;
+}
+
+/**
+ * Write a record: to the memtable and to the log.
+ * @param tree The tree.
+ * @param key Index of the record.
+ * @param data The packed record.
+ * @param length Bytes of the packed record, less than a page.
+ * @return 1 if the memtable was written to a run first. 0 if not. -1 in
+ * case of error.
+ */
+int MYLSM_put(MYLSM_TREE_t *tree, uint32_t key, const unsigned char *data, size_t length)
+{
+  if (length >= MYP_PAGESIZE)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  int flushed = 0;
+  if (!memFits(tree, key, length))
+  {
+    if (flushMemtable(tree, 1) == -1)
+      return -1;
+    flushed = 1;
+  }
+  if (appendLog(tree, key, data, length) == -1)
+    return -1;
+  memPut(tree, key, data, length);
+  return flushed;
+}
+
+/**
+ * Write the log and sync it to disk.
+ * @param tree The tree.
+ * @return -1 in case of error. 0 success.
+ */
+int MYLSM_sync(MYLSM_TREE_t *tree)
+{
+  if (writeLog(tree) == -1)
+    return -1;
+  if (tree->logUnsynced && fdatasync(tree->log) == -1)
+    return -1;
+  tree->logUnsynced = 0;
+  return 0;
+}
+
+/**
+ * Call a function with the records of a range of indices, in order.
+ * @param tree The tree.
+ * @param first First index.
+ * @param end Index after the last one.
+ * @param callback The function. It must not write to the tree.
+ * @param arg Argument of the function.
+ * @return -1 in case of error. 0 success.
+ */
+int MYLSM_scan(MYLSM_TREE_t *tree, uint32_t first, uint64_t end, MYLSM_SCAN_f callback, void *arg)
+{
+  return mergeRecords(tree, tree->runs, tree->numruns, 1, first, end, callback, arg);
+}
+
+/**
+ * Take the run of a merge that ended, and start a merge if there are too
+ * many runs.
+ * @param tree The tree.
+ * @return -1 if the merge failed or could not start. 0 success.
+ */
+int MYLSM_maintain(MYLSM_TREE_t *tree)
+{
+  int status = 0;
+  if (tree->merge.running && __atomic_load_n(&tree->merge.done, __ATOMIC_ACQUIRE))
+    status = endMerge(tree);
+  if (!tree->merge.running && tree->numruns >= MYLSM_MERGERUNS && status == 0)
+    status = startMerge(tree);
+  return status;
+}
+
+/**
+ * Get the number of runs of a tree.
+ * @param tree The tree.
+ * @return The number of runs.
+ */
+int MYLSM_runs(const MYLSM_TREE_t *tree)
+{
+  return tree->numruns;
+}
@@ -0,0 +1,241 @@
+/*
+ * File:   libmylz.c
+ *
+ * This file implements the compressor of the pages of the DB file, in the
+ * LZ4 block format.
+ *
+ * Each sequence starts with a token: the high 4 bits are the number of
+ * literals and the low 4 bits the length of the match minus 4. A field of 15
+ * goes on in the next bytes, adding 255 per byte until a byte below 255. The
+ * literals follow, then the offset of the match (2 bytes, lowest first). The
+ * last sequence has only literals.
+ *
+ * The compressor looks for matches through a hash of the next 4 bytes, which
+ * keeps the last position where they were seen.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "mylz.h"
+
+/************************************************************
+ PRIVATE VARIABLES
+ ************************************************************/
+
+/* Shortest match. */
+#define MINMATCH 4
+/* The last bytes are always literals, and no match starts so near the end. */
+#define LASTLITERALS 5
+#define MFLIMIT 12
+/* Bits of the hash of the next 4 bytes. */
+#define HASHBITS 12
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Read 4 bytes at any address.
+ * @param p The address.
+ * @return The bytes as a number.
+ */
+static uint32_t
+read32(const unsigned char *p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/**
+ * Hash 4 bytes to an entry of the table of positions.
+ * @param value The bytes.
+ * @return The entry.
+ */
+static unsigned int
+hash32(uint32_t value)
+{
+  return (value * 2654435761U) >> (32 - HASHBITS);
+}
+
+/**
+ * Write the part of a length beyond the 15 of its token field.
+ * @param op Where to write it.
+ * @param end End of the output.
+ * @param length The rest of the length.
+ * @return The next byte of the output. NULL if there is no room.
+ */
+static unsigned char *
+putLength(unsigned char *op, const unsigned char *end, size_t length)
+{
+  while (length >= 255)
+  {
+    if (op >= end)
+      return NULL;
+    *op++ = 255;
+    length -= 255;
+  }
+  if (op >= end)
+    return NULL;
+  *op++ = (unsigned char)length;
+  return op;
+}
+
+/**
+ * Read the part of a length beyond the 15 of its token field.
+ * @param ip The next byte of the input. It is moved past the length.
+ * @param end End of the input.
+ * @param length The length to add it to.
+ * @return -1 if the input ends before the length. 0 is OK.
+ */
+static int
+getLength(const unsigned char **ip, const unsigned char *end, size_t *length)
+{
+  unsigned char byte;
+  do
+  {
+    if (*ip >= end)
+      return -1;
+    byte = *(*ip)++;
+    *length += byte;
+  } while (byte == 255);
+  return 0;
+}
+
+/**
+ * Write a sequence: its literals and its match.
+ * @param op Where to write it.
+ * @param end End of the output.
+ * @param literals The literals.
+ * @param count Number of literals.
+ * @param offset Distance back to the match.
+ * @param length Length of the match. 0 for the last sequence.
+ * @return The next byte of the output. NULL if there is no room.
+ */
+static unsigned char *
+putSequence(unsigned char *op, const unsigned char *end, const unsigned char *literals, size_t count,
+            size_t offset, size_t length)
+{
+  if (op >= end)
+    return NULL;
+  unsigned char *token = op++;
+  *token = (unsigned char)((count < 15 ? count : 15) << 4);
+  if (count >= 15 && (op = putLength(op, end, count - 15)) == NULL)
+    return NULL;
+  if ((size_t)(end - op) < count)
+    return NULL;
+  memcpy(op, literals, count);
+  op += count;
+  if (length == 0)
+    return op;
+  if (end - op < 2)
+    return NULL;
+  op[0] = (unsigned char)(offset & 0xff);
+  op[1] = (unsigned char)(offset >> 8);
+  op += 2;
+  size_t code = length - MINMATCH;
+  *token |= (unsigned char)(code < 15 ? code : 15);
+  if (code >= 15 && (op = putLength(op, end, code - 15)) == NULL)
+    return NULL;
+  return op;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+/**
+ * Compress a buffer.
+ * @param src The data.
+ * @param size Bytes of the data, up to MYLZ_MAXINPUT.
+ * @param dst Where to write the compressed data.
+ * @param capacity Bytes of the output. MYLZ_BOUND(size) is always enough.
+ * @return Bytes of the compressed data. -1 if they don't fit.
+ */
+int MYLZ_compress(const void *src, size_t size, void *dst, size_t capacity)
+{
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *op = (unsigned char *)dst;
+  const unsigned char *end = op + capacity;
+  if (size > MYLZ_MAXINPUT)
+    return -1;
+
+  int positions[1 << HASHBITS];
+  for (int i = 0; i < (1 << HASHBITS); i++)
+    positions[i] = -1;
+  size_t anchor = 0;
+  if (size > MFLIMIT)
+  {
+    size_t ip = 0;
+    while (ip < size - MFLIMIT)
+    {
+      uint32_t sequence = read32(in + ip);
+      unsigned int h = hash32(sequence);
+      int ref = positions[h];
+      positions[h] = (int)ip;
+      if (ref < 0 || read32(in + ref) != sequence)
+      {
+        ip++;
+        continue;
+      }
+      size_t length = MINMATCH;
+      while (ip + length < size - LASTLITERALS && in[ref + length] == in[ip + length])
+        length++;
+      op = putSequence(op, end, in + anchor, ip - anchor, ip - ref, length);
+      if (op == NULL)
+        return -1;
+      ip += length;
+      anchor = ip;
+    }
+  }
+  op = putSequence(op, end, in + anchor, size - anchor, 0, 0);
+  return op == NULL ? -1 : (int)(op - (unsigned char *)dst);
+}
+
+/**
+ * Decompress a buffer compressed with MYLZ_compress().
+ * @param src The compressed data.
+ * @param size Bytes of the compressed data.
+ * @param dst Where to write the data.
+ * @param capacity Bytes of the output.
+ * @return Bytes of the data. -1 if the compressed data is malformed or the
+ * data does not fit.
+ */
+int MYLZ_decompress(const void *src, size_t size, void *dst, size_t capacity)
+{
+  const unsigned char *ip = (const unsigned char *)src;
+  const unsigned char *end = ip + size;
+  unsigned char *out = (unsigned char *)dst;
+  size_t op = 0;
+  while (ip < end)
+  {
+    unsigned int token = *ip++;
+    size_t length = token >> 4;
+    if (length == 15 && getLength(&ip, end, &length) == -1)
+      return -1;
+    if ((size_t)(end - ip) < length || capacity - op < length)
+      return -1;
+    memcpy(out + op, ip, length);
+    ip += length;
+    op += length;
+    /* The last sequence has no match. */
+    if (ip == end)
+      break;
+    if (end - ip < 2)
+      return -1;
+    size_t offset = ip[0] | (size_t)ip[1] << 8;
+    ip += 2;
+    if (offset == 0 || offset > op)
+      return -1;
+    length = token & 15;
+    if (length == 15 && getLength(&ip, end, &length) == -1)
+      return -1;
+    length += MINMATCH;
+    if (capacity - op < length)
+      return -1;
+    /* The match may overlap the bytes it writes: copy byte by byte. */
+    for (size_t i = 0; i < length; i++, op++)
+      out[op] = out[op - offset];
+  }
+  return (int)op;
+}
@@ -0,0 +1,241 @@
+/*
+ * File:   libmypage.c
+ *
+ * This file implements the slotted pages holding the records.
+ *
+ * Removing a record or making it shorter leaves a hole among the records.
+ * Holes are only reclaimed when a record does not fit in the free space
+ * between the slots and the records: then the records are moved together
+ * to the end of the page.
+ */
+
+#include <string.h>
+#include "mypage.h"
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Get the array of slots of a page.
+ * @param page The page.
+ * @return The first slot.
+ */
+static MYPAGE_SLOT_t *
+slotsOf(const void *page)
+{
+  return (MYPAGE_SLOT_t *)((char *)page + sizeof(MYPAGE_HEADER_t));
+}
+
+/**
+ * Get the bytes between the last slot and the first record.
+ * @param header Header of the page.
+ * @return The number of bytes.
+ */
+static size_t
+gapOf(const MYPAGE_HEADER_t *header)
+{
+  return header->upper - sizeof(MYPAGE_HEADER_t) - header->numslots * sizeof(MYPAGE_SLOT_t);
+}
+
+/**
+ * Move every record to the end of the page, so that all the free bytes are
+ * between the slots and the records.
+ * @param page The page.
+ */
+static void
+compactPage(void *page)
+{
+  unsigned char copy[MYP_PAGESIZE];
+  memcpy(copy, page, MYP_PAGESIZE);
+  MYPAGE_HEADER_t *header = (MYPAGE_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  unsigned int upper = MYP_PAGESIZE;
+  for (unsigned int i = 0; i < header->numslots; i++)
+  {
+    if (slots[i].offset == 0)
+      continue;
+    upper -= slots[i].length;
+    memcpy((char *)page + upper, copy + slots[i].offset, slots[i].length);
+    slots[i].offset = (uint16_t)upper;
+  }
+  header->upper = (uint16_t)upper;
+}
+
+/**
+ * Copy a record to the free space of a page. There must be room for it.
+ * @param page The page.
+ * @param slot The slot of the record.
+ * @param data The record.
+ * @param length Bytes of the record.
+ */
+static void
+placeRecord(void *page, uint32_t slot, const void *data, size_t length)
+{
+  MYPAGE_HEADER_t *header = (MYPAGE_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  if (gapOf(header) < length)
+    compactPage(page);
+  header->upper -= (uint16_t)length;
+  memcpy((char *)page + header->upper, data, length);
+  slots[slot].offset = header->upper;
+  slots[slot].length = (uint16_t)length;
+  header->freebytes -= (uint16_t)length;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+/**
+ * Get the entry of the directory that leads to a record.
+ * @param fileIndex Index of the record.
+ * @param level Level of the directory page. 0 for leaf pages.
+ * @return The entry in the page of that level.
+ */
+unsigned int MYP_entry(uint32_t fileIndex, int level)
+{
+  if (level == 0)
+    return fileIndex % MYP_LEAFENTRIES;
+  uint32_t above = fileIndex / MYP_LEAFENTRIES;
+  for (int i = 1; i < level; i++)
+    above /= MYP_NODEENTRIES;
+  return above % MYP_NODEENTRIES;
+}
+
+/**
+ * Get the number of records indexed by a directory.
+ * @param levels Levels of node pages above the leaf pages.
+ * @return Records with indices from 0 to this number - 1.
+ */
+uint64_t MYP_records(int levels)
+{
+  uint64_t records = MYP_LEAFENTRIES;
+  for (int i = 0; i < levels; i++)
+    records *= MYP_NODEENTRIES;
+  return records;
+}
+
+/**
+ * Initialize an empty slotted page.
+ * @param page The page.
+ */
+void MYP_init(void *page)
+{
+  memset(page, 0, MYP_PAGESIZE);
+  MYPAGE_HEADER_t *header = (MYPAGE_HEADER_t *)page;
+  header->upper = MYP_PAGESIZE;
+  header->freebytes = MYP_PAGESIZE - sizeof(MYPAGE_HEADER_t);
+}
+
+/**
+ * Find a record in a page.
+ * @param page The page.
+ * @param slot The slot of the record.
+ * @param id The index of the record.
+ * @param length Where to return the length of the record.
+ * @return The record. NULL if the slot does not hold it.
+ */
+const unsigned char *MYP_record(const void *page, uint32_t slot, uint32_t id, size_t *length)
+{
+  const MYPAGE_HEADER_t *header = (const MYPAGE_HEADER_t *)page;
+  if (slot >= header->numslots || sizeof(MYPAGE_HEADER_t) + (slot + 1) * sizeof(MYPAGE_SLOT_t) > MYP_PAGESIZE)
+    return NULL;
+  const MYPAGE_SLOT_t *entry = &slotsOf(page)[slot];
+  if (entry->offset == 0 || entry->id != id || entry->offset + entry->length > MYP_PAGESIZE)
+    return NULL;
+  *length = entry->length;
+  return (const unsigned char *)page + entry->offset;
+}
+
+/**
+ * Get the room for a new record in a page, after reclaiming the holes.
+ * @param page The page.
+ * @return Bytes of the largest record that fits.
+ */
+size_t MYP_room(const void *page)
+{
+  const MYPAGE_HEADER_t *header = (const MYPAGE_HEADER_t *)page;
+  /* A new record may need a new slot. */
+  return header->freebytes > sizeof(MYPAGE_SLOT_t) ? header->freebytes - sizeof(MYPAGE_SLOT_t) : 0;
+}
+
+/**
+ * Store a new record in a page. Unused slots are used again.
+ * @param page The page.
+ * @param id The index of the record.
+ * @param data The record.
+ * @param length Bytes of the record. It must not be 0.
+ * @return The slot of the record. -1 if there is no room.
+ */
+int MYP_insert(void *page, uint32_t id, const void *data, size_t length)
+{
+  MYPAGE_HEADER_t *header = (MYPAGE_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  uint32_t slot = 0;
+  while (slot < header->numslots && slots[slot].offset != 0)
+    slot++;
+  size_t needed = length + (slot == header->numslots ? sizeof(MYPAGE_SLOT_t) : 0);
+  if (length == 0 || needed > header->freebytes)
+    return -1;
+  if (slot == header->numslots)
+  {
+    /* The new slot takes its bytes from the gap, which may be full of holes. */
+    if (gapOf(header) < sizeof(MYPAGE_SLOT_t))
+      compactPage(page);
+    header->numslots++;
+    header->freebytes -= sizeof(MYPAGE_SLOT_t);
+  }
+  slots[slot].id = id;
+  placeRecord(page, slot, data, length);
+  return (int)slot;
+}
+
+/**
+ * Replace the record in a slot. A record that grows may move inside the page.
+ * @param page The page.
+ * @param slot The slot of the record.
+ * @param data The new record.
+ * @param length Bytes of the new record. It must not be 0.
+ * @return 0 if OK. -1 if there is no room.
+ */
+int MYP_update(void *page, uint32_t slot, const void *data, size_t length)
+{
+  MYPAGE_HEADER_t *header = (MYPAGE_HEADER_t *)page;
+  MYPAGE_SLOT_t *entry = &slotsOf(page)[slot];
+  if (length == 0 || length > header->freebytes + entry->length)
+    return -1;
+  if (length <= entry->length)
+  {
+    /* Shorter records stay in place and leave a hole. */
+    memcpy((char *)page + entry->offset, data, length);
+    header->freebytes += entry->length - (uint16_t)length;
+    entry->length = (uint16_t)length;
+    return 0;
+  }
+  /* Free the old record first, so that compacting the page reclaims it. */
+  header->freebytes += entry->length;
+  entry->offset = 0;
+  entry->length = 0;
+  placeRecord(page, slot, data, length);
+  return 0;
+}
+
+/**
+ * Remove the record in a slot. The slot can be used by another record.
+ * @param page The page.
+ * @param slot The slot of the record.
+ */
+void MYP_delete(void *page, uint32_t slot)
+{
+  MYPAGE_HEADER_t *header = (MYPAGE_HEADER_t *)page;
+  MYPAGE_SLOT_t *slots = slotsOf(page);
+  header->freebytes += slots[slot].length;
+  memset(&slots[slot], 0, sizeof(MYPAGE_SLOT_t));
+  /* Unused slots at the end are given back. */
+  while (header->numslots > 0 && slots[header->numslots - 1].offset == 0)
+  {
+    header->numslots--;
+    header->freebytes += sizeof(MYPAGE_SLOT_t);
+  }
+}
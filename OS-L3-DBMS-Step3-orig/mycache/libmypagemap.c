@@ -0,0 +1,361 @@
+/*
+ * File:   libmypagemap.c
+ *
+ * This file implements the page translation map of a file of compressed pages.
+ *
+ * A chunk starts with its header: the bytes of the data and whether the data
+ * is compressed. The map file holds a header with the number of pages and
+ * the end of the chunks, followed by the location of each page.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "mylz.h"
+#include "mypagemap.h"
+
+/************************************************************
+ PRIVATE VARIABLES
+ ************************************************************/
+
+/* Header of a chunk. */
+typedef struct
+{
+  uint16_t length; /* Bytes of the data after the header. */
+  uint16_t raw; /* 1 if the data is the page as it is. */
+} chunk_header_t;
+
+/* Header of a map file. */
+typedef struct
+{
+  uint32_t magic; /* MYPM_MAGIC */
+  uint32_t version; /* MYPM_VERSION */
+  uint32_t count; /* Entries after the header. */
+  uint32_t reserved; /* Must be 0. */
+  uint64_t end; /* End of the last chunk of the data file. */
+  uint64_t unused; /* Bytes of the chunks left by pages that moved. */
+} map_header_t;
+
+/* Largest chunk: a page stored as it is. */
+#define MAX_CHUNK (sizeof(chunk_header_t) + MYP_PAGESIZE)
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Read from the data file, retrying interrupted and partial reads.
+ * @param fd Descriptor of the file.
+ * @param buffer Where to read.
+ * @param size Bytes to read.
+ * @param offset Offset in the file.
+ * @return Bytes read. Less than size at the end of the file. -1 in case of error.
+ */
+static ssize_t
+readChunk(int fd, void *buffer, size_t size, off_t offset)
+{
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t res = pread(fd, (char *)buffer + done, size - done, offset + done);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res == -1)
+      return -1;
+    if (res == 0)
+      break;
+    done += res;
+  }
+  return done;
+}
+
+/**
+ * Write to the data file, retrying interrupted and partial writes.
+ * @param fd Descriptor of the file.
+ * @param buffer What to write.
+ * @param size Bytes to write.
+ * @param offset Offset in the file.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+writeChunk(int fd, const void *buffer, size_t size, off_t offset)
+{
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t res = pwrite(fd, (const char *)buffer + done, size - done, offset + done);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res == -1)
+      return -1;
+    done += res;
+  }
+  return 0;
+}
+
+/**
+ * Make room in the map for a page.
+ * @param map The map.
+ * @param page The number of the page.
+ * @return -1 in case of error. 0 success.
+ */
+static int
+growMap(MYPM_MAP_t *map, uint32_t page)
+{
+  if (page < map->count)
+    return 0;
+  if (page >= map->capacity)
+  {
+    uint32_t capacity = map->capacity == 0 ? 1024 : map->capacity;
+    while (capacity <= page)
+      capacity *= 2;
+    MYPM_ENTRY_t *entries = realloc(map->entries, capacity * sizeof(MYPM_ENTRY_t));
+    if (entries == NULL)
+      return -1;
+    map->entries = entries;
+    map->capacity = capacity;
+  }
+  memset(&map->entries[map->count], 0, (page + 1 - map->count) * sizeof(MYPM_ENTRY_t));
+  map->count = page + 1;
+  return 0;
+}
+
+/**
+ * Read the saved map.
+ * @param map The map. Its path is set.
+ * @param file The map file.
+ * @return -1 if the file is damaged or in case of error. 0 success.
+ */
+static int
+loadMap(MYPM_MAP_t *map, FILE *file)
+{
+  map_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != MYPM_MAGIC ||
+      header.version != MYPM_VERSION)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (header.count > 0)
+  {
+    if (growMap(map, header.count - 1) == -1)
+      return -1;
+    if (fread(map->entries, sizeof(MYPM_ENTRY_t), header.count, file) != header.count)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  map->end = header.end;
+  map->unused = header.unused;
+  return 0;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+/**
+ * Open the map of a data file.
+ * @param path Name of the map file.
+ * @param fd Descriptor of the data file.
+ * @param start Offset of the first chunk in the data file.
+ * @return The map. NULL in case of error.
+ */
+MYPM_MAP_t *MYPM_open(const char *path, int fd, off_t start)
+{
+  if (strlen(path) >= FILENAME_MAX)
+  {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  MYPM_MAP_t *map = calloc(1, sizeof(MYPM_MAP_t));
+  if (map == NULL)
+    return NULL;
+  strcpy(map->path, path);
+  map->end = start;
+
+  FILE *file = fopen(path, "r");
+  if (file != NULL)
+  {
+    int res = loadMap(map, file);
+    fclose(file);
+    if (res == 0)
+      return map;
+  }
+  else if (errno == ENOENT)
+  {
+    /* A new map is only right if no chunk was written. It is saved at once
+     * so that the chunks written before the next save are not taken for a
+     * lost map after a crash. */
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size <= start)
+    {
+      map->dirty = 1;
+      if (MYPM_save(map, 1) == 0)
+        return map;
+    }
+    else if (errno == ENOENT)
+      errno = EINVAL;
+  }
+  MYPM_close(map);
+  return NULL;
+}
+
+/**
+ * Save a map to its file if it changed. The file is written aside and then
+ * renamed, so that a crash leaves the previous map.
+ * @param map The map.
+ * @param sync 1 to sync the file to disk.
+ * @return -1 in case of error. 0 success.
+ */
+int MYPM_save(MYPM_MAP_t *map, int sync)
+{
+  if (!map->dirty)
+    return 0;
+  char tmp[FILENAME_MAX + 4];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", map->path);
+  FILE *file = fopen(tmp, "w");
+  if (file == NULL)
+    return -1;
+  map_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = MYPM_MAGIC;
+  header.version = MYPM_VERSION;
+  header.count = map->count;
+  header.end = map->end;
+  header.unused = map->unused;
+  int res = 0;
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(map->entries, sizeof(MYPM_ENTRY_t), map->count, file) != map->count || fflush(file) != 0 ||
+      (sync && fdatasync(fileno(file)) == -1))
+    res = -1;
+  if (fclose(file) != 0)
+    res = -1;
+  if (res == 0)
+    res = rename(tmp, map->path);
+  if (res == -1)
+  {
+    unlink(tmp);
+    return -1;
+  }
+  map->dirty = 0;
+  return 0;
+}
+
+/**
+ * Free a map.
+ * @param map The map.
+ */
+void MYPM_close(MYPM_MAP_t *map)
+{
+  free(map->entries);
+  free(map);
+}
+
+/**
+ * Read a page and decompress it.
+ * @param map The map of the data file.
+ * @param fd Descriptor of the data file.
+ * @param page The number of the page.
+ * @param buffer Where to write the page: MYP_PAGESIZE bytes.
+ * @return Bytes read from the file. -1 in case of error.
+ */
+ssize_t MYPM_read(MYPM_MAP_t *map, int fd, uint32_t page, void *buffer)
+{
+  if (page >= map->count || map->entries[page].size == 0)
+  {
+    memset(buffer, 0, MYP_PAGESIZE);
+    return 0;
+  }
+  const MYPM_ENTRY_t *entry = &map->entries[page];
+  unsigned char chunk[MAX_CHUNK + MYPM_GRAIN];
+  size_t size = entry->size < sizeof(chunk) ? entry->size : sizeof(chunk);
+  ssize_t res = readChunk(fd, chunk, size, entry->offset);
+  if (res == -1)
+    return -1;
+  chunk_header_t header;
+  memcpy(&header, chunk, sizeof(header));
+  if ((size_t)res < sizeof(header) + header.length)
+  {
+    errno = EIO;
+    return -1;
+  }
+  if (header.raw)
+  {
+    if (header.length != MYP_PAGESIZE)
+    {
+      errno = EIO;
+      return -1;
+    }
+    memcpy(buffer, chunk + sizeof(header), MYP_PAGESIZE);
+  }
+  else if (MYLZ_decompress(chunk + sizeof(header), header.length, buffer, MYP_PAGESIZE) != MYP_PAGESIZE)
+  {
+    errno = EIO;
+    return -1;
+  }
+  return res;
+}
+
+/**
+ * Compress a page and write it. The page stays in its chunk if it fits.
+ * @param map The map of the data file.
+ * @param fd Descriptor of the data file.
+ * @param page The number of the page.
+ * @param buffer The page: MYP_PAGESIZE bytes.
+ * @return Bytes written to the file. -1 in case of error.
+ */
+ssize_t MYPM_write(MYPM_MAP_t *map, int fd, uint32_t page, const void *buffer)
+{
+  if (growMap(map, page) == -1)
+    return -1;
+  unsigned char chunk[sizeof(chunk_header_t) + MYLZ_BOUND(MYP_PAGESIZE)];
+  chunk_header_t header;
+  int length = MYLZ_compress(buffer, MYP_PAGESIZE, chunk + sizeof(header), sizeof(chunk) - sizeof(header));
+  if (length == -1 || length >= MYP_PAGESIZE)
+  {
+    /* The page does not compress: keep it as it is. */
+    length = MYP_PAGESIZE;
+    header.raw = 1;
+    memcpy(chunk + sizeof(header), buffer, MYP_PAGESIZE);
+  }
+  else
+    header.raw = 0;
+  header.length = (uint16_t)length;
+  memcpy(chunk, &header, sizeof(header));
+  size_t size = sizeof(header) + length;
+
+  MYPM_ENTRY_t *entry = &map->entries[page];
+  if (size > entry->size)
+  {
+    /* The page moves to a new chunk at the end of the file. */
+    map->unused += entry->size;
+    entry->offset = map->end;
+    entry->size = (size + MYPM_GRAIN - 1) / MYPM_GRAIN * MYPM_GRAIN;
+    map->end += entry->size;
+    map->dirty = 1;
+  }
+  if (writeChunk(fd, chunk, size, entry->offset) == -1)
+    return -1;
+  return size;
+}
+
+/**
+ * Get the chunk of a page.
+ * @param map The map of the data file.
+ * @param page The number of the page.
+ * @param offset Where to return the offset of the chunk.
+ * @param size Where to return the bytes of the chunk.
+ * @return -1 if the page was never written. 0 success.
+ */
+int MYPM_locate(const MYPM_MAP_t *map, uint32_t page, off_t *offset, size_t *size)
+{
+  if (page >= map->count || map->entries[page].size == 0)
+    return -1;
+  *offset = map->entries[page].offset;
+  *size = map->entries[page].size;
+  return 0;
+}
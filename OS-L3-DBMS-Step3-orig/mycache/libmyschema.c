@@ -0,0 +1,349 @@
+/*
+ * File:   libmyschema.c
+ *
+ * This file implements the schema of the records and their packed format.
+ *
+ * Fields are packed one after the other in the order of the schema.
+ * Integers are written 7 bits per byte, lowest first, with the high bit set
+ * in every byte but the last one. Signed integers are first mapped to
+ * unsigned ones so that small negative values are short too (0, -1, 1, -2...
+ * become 0, 1, 2, 3...). Strings are written as their length followed by
+ * their characters.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "myschema.h"
+
+/************************************************************
+ PRIVATE VARIABLES
+ ************************************************************/
+
+/* Schema of MYRECORD_RECORD_t. It is filled the first time it is used. */
+static MYSCHEMA_t RecordSchema;
+
+/* Longest integer packed: 64 bits in groups of 7. */
+#define MAX_VARINT 10
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Read an integer field of a record.
+ * @param field The field.
+ * @param record The record.
+ * @return The value, sign extended for signed fields.
+ */
+static uint64_t
+loadInteger(const MYSCHEMA_FIELD_t *field, const void *record)
+{
+  const char *addr = (const char *)record + field->offset;
+  int signedField = field->type == MYSCH_INT;
+  switch (field->size)
+  {
+  case 1:
+  {
+    uint8_t value;
+    memcpy(&value, addr, sizeof(value));
+    return signedField ? (uint64_t)(int64_t)(int8_t)value : value;
+  }
+  case 2:
+  {
+    uint16_t value;
+    memcpy(&value, addr, sizeof(value));
+    return signedField ? (uint64_t)(int64_t)(int16_t)value : value;
+  }
+  case 4:
+  {
+    uint32_t value;
+    memcpy(&value, addr, sizeof(value));
+    return signedField ? (uint64_t)(int64_t)(int32_t)value : value;
+  }
+  default:
+  {
+    uint64_t value;
+    memcpy(&value, addr, sizeof(value));
+    return value;
+  }
+  }
+}
+
+/**
+ * Write an integer field of a record. Higher bits that don't fit are lost.
+ * @param field The field.
+ * @param record The record.
+ * @param value The value.
+ */
+static void
+storeInteger(const MYSCHEMA_FIELD_t *field, void *record, uint64_t value)
+{
+  char *addr = (char *)record + field->offset;
+  switch (field->size)
+  {
+  case 1:
+  {
+    uint8_t v = (uint8_t)value;
+    memcpy(addr, &v, sizeof(v));
+    break;
+  }
+  case 2:
+  {
+    uint16_t v = (uint16_t)value;
+    memcpy(addr, &v, sizeof(v));
+    break;
+  }
+  case 4:
+  {
+    uint32_t v = (uint32_t)value;
+    memcpy(addr, &v, sizeof(v));
+    break;
+  }
+  default:
+    memcpy(addr, &value, sizeof(value));
+    break;
+  }
+}
+
+/**
+ * Pack an unsigned number 7 bits per byte.
+ * @param buffer Where to write it.
+ * @param size Bytes left in the buffer.
+ * @param value The number.
+ * @return Bytes used. -1 if they don't fit.
+ */
+static int
+putVarint(unsigned char *buffer, size_t size, uint64_t value)
+{
+  size_t n = 0;
+  do
+  {
+    if (n == size)
+      return -1;
+    unsigned char byte = value & 0x7f;
+    value >>= 7;
+    buffer[n++] = value != 0 ? byte | 0x80 : byte;
+  } while (value != 0);
+  return (int)n;
+}
+
+/**
+ * Unpack a number packed with putVarint().
+ * @param buffer Where to read it.
+ * @param size Bytes left in the buffer.
+ * @param value Where to return the number.
+ * @return Bytes used. -1 if the number is malformed.
+ */
+static int
+getVarint(const unsigned char *buffer, size_t size, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (size_t n = 0; n < size && n < MAX_VARINT; n++)
+  {
+    result |= (uint64_t)(buffer[n] & 0x7f) << (7 * n);
+    if ((buffer[n] & 0x80) == 0)
+    {
+      *value = result;
+      return (int)(n + 1);
+    }
+  }
+  return -1;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+/**
+ * Get the schema of the records of the store.
+ * @return The schema of MYRECORD_RECORD_t.
+ */
+const MYSCHEMA_t *MYSCH_recordSchema()
+{
+  if (RecordSchema.numfields == 0)
+  {
+    MYSCHEMA_t schema;
+    memset(&schema, 0, sizeof(schema));
+    schema.recordsize = sizeof(MYRECORD_RECORD_t);
+    MYSCH_addField(&schema, "registerid", MYSCH_UINT, offsetof(MYRECORD_RECORD_t, registerid), sizeof(unsigned int));
+    MYSCH_addField(&schema, "age", MYSCH_INT, offsetof(MYRECORD_RECORD_t, age), sizeof(int));
+    MYSCH_addField(&schema, "gender", MYSCH_INT, offsetof(MYRECORD_RECORD_t, gender), sizeof(int));
+    MYSCH_addField(&schema, "name", MYSCH_STRING, offsetof(MYRECORD_RECORD_t, name), MYRECORD_NAMELENGTH);
+    RecordSchema = schema;
+  }
+  return &RecordSchema;
+}
+
+/**
+ * Add a field at the end of a schema.
+ * @param schema The schema. Set its recordsize before.
+ * @param name Name of the field.
+ * @param type Type of the field.
+ * @param offset Offset of the field inside the record structure.
+ * @param size Bytes of the field inside the record structure.
+ * @return -1 if the field is not valid or there is no room. 0 is OK.
+ */
+int MYSCH_addField(MYSCHEMA_t *schema, const char *name, MYSCHEMA_TYPE type, size_t offset, size_t size)
+{
+  if (schema->numfields == MYSCH_MAXFIELDS || strlen(name) >= MYSCH_NAMELENGTH || size == 0 ||
+      offset + size > schema->recordsize)
+    return -1;
+  if (type != MYSCH_STRING && size != 1 && size != 2 && size != 4 && size != 8)
+    return -1;
+  MYSCHEMA_FIELD_t *field = &schema->fields[schema->numfields++];
+  memset(field, 0, sizeof(*field));
+  strcpy(field->name, name);
+  field->type = type;
+  field->offset = (unsigned int)offset;
+  field->size = (unsigned int)size;
+  return 0;
+}
+
+/**
+ * Get the size of the largest record packed with a schema.
+ * @param schema The schema.
+ * @return The size in bytes.
+ */
+size_t MYSCH_maxPacked(const MYSCHEMA_t *schema)
+{
+  size_t size = 0;
+  for (unsigned int i = 0; i < schema->numfields; i++)
+  {
+    const MYSCHEMA_FIELD_t *field = &schema->fields[i];
+    if (field->type == MYSCH_STRING)
+      size += MAX_VARINT + field->size;
+    else
+      size += MAX_VARINT;
+  }
+  return size;
+}
+
+/**
+ * Pack a record: each field takes only the bytes it uses.
+ * @param schema The schema of the record.
+ * @param record The record.
+ * @param buffer Where to write the packed record.
+ * @param size Bytes of the buffer.
+ * @return Bytes used. -1 if the buffer is too small.
+ */
+int MYSCH_pack(const MYSCHEMA_t *schema, const void *record, unsigned char *buffer, size_t size)
+{
+  size_t off = 0;
+  for (unsigned int i = 0; i < schema->numfields; i++)
+  {
+    const MYSCHEMA_FIELD_t *field = &schema->fields[i];
+    int n;
+    if (field->type == MYSCH_STRING)
+    {
+      const char *text = (const char *)record + field->offset;
+      size_t length = strnlen(text, field->size);
+      n = putVarint(buffer + off, size - off, length);
+      if (n == -1 || off + n + length > size)
+        return -1;
+      memcpy(buffer + off + n, text, length);
+      n += (int)length;
+    }
+    else
+    {
+      uint64_t value = loadInteger(field, record);
+      /* Interleave negative and positive values. */
+      if (field->type == MYSCH_INT)
+        value = (value << 1) ^ (uint64_t)((int64_t)value >> 63);
+      n = putVarint(buffer + off, size - off, value);
+      if (n == -1)
+        return -1;
+    }
+    off += n;
+  }
+  return (int)off;
+}
+
+/**
+ * Unpack a record packed with MYSCH_pack().
+ * @param schema The schema of the record.
+ * @param buffer The packed record.
+ * @param length Bytes of the packed record.
+ * @param record Where to write the record.
+ * @return -1 if the packed record is malformed. 0 is OK.
+ */
+int MYSCH_unpack(const MYSCHEMA_t *schema, const unsigned char *buffer, size_t length, void *record)
+{
+  memset(record, 0, schema->recordsize);
+  size_t off = 0;
+  for (unsigned int i = 0; i < schema->numfields && off < length; i++)
+  {
+    const MYSCHEMA_FIELD_t *field = &schema->fields[i];
+    uint64_t value;
+    int n = getVarint(buffer + off, length - off, &value);
+    if (n == -1)
+      return -1;
+    off += n;
+    if (field->type == MYSCH_STRING)
+    {
+      if (value > length - off)
+        return -1;
+      /* Longer strings are cut to the size of the array. */
+      size_t copy = value < field->size ? (size_t)value : field->size;
+      memcpy((char *)record + field->offset, buffer + off, copy);
+      off += (size_t)value;
+    }
+    else
+    {
+      if (field->type == MYSCH_INT)
+        value = (value >> 1) ^ (uint64_t)-(int64_t)(value & 1);
+      storeInteger(field, record, value);
+    }
+  }
+  return off == length ? 0 : -1;
+}
+
+/**
+ * Find a field of a schema by its name.
+ * @param schema The schema.
+ * @param name Name of the field.
+ * @return The number of the field. -1 if there is no such field.
+ */
+int MYSCH_findField(const MYSCHEMA_t *schema, const char *name)
+{
+  for (unsigned int i = 0; i < schema->numfields; i++)
+  {
+    if (strncmp(schema->fields[i].name, name, MYSCH_NAMELENGTH) == 0)
+      return (int)i;
+  }
+  return -1;
+}
+
+/**
+ * Get the value of an integer field of a record.
+ * @param schema The schema of the record.
+ * @param field Number of the field.
+ * @param record The record.
+ * @param value Where to return the value. Unsigned values above INT64_MAX wrap.
+ * @return -1 if the field is not an integer. 0 is OK.
+ */
+int MYSCH_getInteger(const MYSCHEMA_t *schema, int field, const void *record, int64_t *value)
+{
+  if (field < 0 || (unsigned int)field >= schema->numfields || schema->fields[field].type == MYSCH_STRING)
+    return -1;
+  *value = (int64_t)loadInteger(&schema->fields[field], record);
+  return 0;
+}
+
+/**
+ * Check that records packed with a schema can be read with another one.
+ * @param stored The schema used to pack the records.
+ * @param schema The schema to unpack them.
+ * @return 1 if they are compatible. 0 otherwise.
+ */
+int MYSCH_compatible(const MYSCHEMA_t *stored, const MYSCHEMA_t *schema)
+{
+  if (stored->numfields != schema->numfields)
+    return 0;
+  for (unsigned int i = 0; i < schema->numfields; i++)
+  {
+    if (stored->fields[i].type != schema->fields[i].type ||
+        strncmp(stored->fields[i].name, schema->fields[i].name, MYSCH_NAMELENGTH) != 0)
+      return 0;
+  }
+  return 1;
+}
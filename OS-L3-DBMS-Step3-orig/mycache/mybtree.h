@@ -0,0 +1,91 @@
+/*
+ * File:   mybtree.h
+ *
+ * This file defines the nodes of a B+tree holding packed records by key.
+ * Each node is one page of the DB file (see mypage.h).
+ *
+ * Leaves hold the records. Their slots grow upwards after the header, sorted
+ * by key, and the records fill the page from its end downwards. Each leaf
+ * knows the next one, so that a range of keys is read in order leaf after
+ * leaf.
+ *
+ * Branches hold the keys that divide their children. The child in entry i
+ * has the keys from the key of entry i up to the key of entry i + 1. The
+ * key of the first entry is not used: it takes every key below the second.
+ *
+ * A full node is split in two halves and the first key of the new one goes
+ * up to the branch above. A full root gets a new root above it.
+ */
+
+#ifndef MYBTREE_H
+#define MYBTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mypage.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Header of a node. */
+  typedef struct
+  {
+    uint16_t numkeys; /* Slots of a leaf or entries of a branch. */
+    uint16_t level; /* 0 for a leaf. Levels above the leaves for a branch. */
+    uint16_t upper; /* Leaves: offset of the first byte of the records. */
+    uint16_t freebytes; /* Leaves: bytes not used, between the slots and the records or among the records. */
+    uint32_t next; /* Leaves: page of the next leaf. 0 for the last one. */
+    uint32_t reserved; /* Must be 0. */
+  } MYBT_HEADER_t;
+
+  /* Entry of a branch. */
+  typedef struct
+  {
+    uint32_t key; /* Lowest key of the child. */
+    uint32_t page; /* Page of the child. */
+  } MYBT_ENTRY_t;
+
+  /* Entries of a branch. */
+#define MYBT_ENTRIES ((MYP_PAGESIZE - sizeof(MYBT_HEADER_t)) / sizeof(MYBT_ENTRY_t))
+  /* Longest record of a leaf. After a split both halves have room for it. */
+#define MYBT_MAXRECORD ((MYP_PAGESIZE - sizeof(MYBT_HEADER_t)) / 4 - sizeof(MYPAGE_SLOT_t))
+  /* Levels of a tree of 2^32 keys, with half full nodes. */
+#define MYBT_MAXLEVELS 8
+
+  /* This function initializes an empty node of the given level. */
+  void MYBT_init(void *page, unsigned int level);
+  /* This function checks the header of a node read from the file. It
+   * returns -1 if it is not a node of the given level, or any level if
+   * level is -1. */
+  int MYBT_check(const void *page, int level);
+
+  /* This function returns the position of the first slot of a leaf with a
+   * key not below the given one. found is set to 1 if the slot has the key. */
+  unsigned int MYBT_find(const void *page, uint32_t key, int *found);
+  /* This function returns the record in a position of a leaf and its key,
+   * or NULL if the position is past the last slot or the slot is damaged. */
+  const unsigned char *MYBT_record(const void *page, unsigned int position, uint32_t *key, size_t *length);
+  /* This function stores a record in a leaf, replacing the one with the
+   * same key. It returns -1 if there is no room, and then the leaf is left
+   * unchanged. */
+  int MYBT_put(void *page, uint32_t key, const void *data, size_t length);
+
+  /* This function returns the child of a branch holding the given key. */
+  uint32_t MYBT_child(const void *page, uint32_t key);
+  /* This function adds a child to a branch. It returns -1 if the branch is
+   * full. */
+  int MYBT_link(void *page, uint32_t key, uint32_t child);
+
+  /* This function moves the upper half of a node to the empty page right,
+   * initialized at the same level. The next leaf of a leaf becomes page
+   * number rightPage. It returns the lowest key of the right node. */
+  uint32_t MYBT_split(void *page, void *right, uint32_t rightPage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYBTREE_H */
@@ -7,8 +7,39 @@
  * The RAM cache is a RAM buffer between a program using records and the DB file.
  * When we want to use a record from the DB file, this library must read it from disk to RAM.
  * 
- * The RAM cache is a table of BUCKETS. Each bucket may contain one register of
- * the DB file. As it is a cache, the record contained on each bucket may change.
+ * The DB file and the RAM cache are divided in pages (see mypage.h). Records
+ * are stored packed (see myschema.h) in slotted pages and found through a
+ * directory of pages. Each entry of the cache may contain one page of the DB
+ * file. As it is a cache, the page contained on each entry may change.
+ *
+ * The cache may serve several tables. Each table has its own DB file and its
+ * own cache, with its own number of pages. The caches of all the tables
+ * share a memory limit.
+ *
+ * A table may store its records by columns instead: each field of the schema
+ * is kept in its own column file (the name of the DB file followed by a dot
+ * and the name of the field) as an array of values of fixed size, a whole
+ * number of them in each page. The DB file holds only the header. Scans that
+ * need a few fields read only the pages of their columns.
+ *
+ * A table written much more than it is read may be stored as a log-structured
+ * merge tree instead (see mylsm.h): writes go to memory and to a log, and
+ * reach the disk in sorted runs written sequentially and merged in the
+ * background. Nothing is overwritten in place. The DB file holds only the
+ * header and the memory of the cache of the table holds the memtable.
+ *
+ * A table whose records are keyed by sparse registerids may keep them in a
+ * B+tree of pages of the DB file (see mybtree.h), served through the cache
+ * like any other page. The index of a record is its registerid, any value
+ * of 32 bits, and the file grows with the records written, not with the
+ * highest key.
+ *
+ * The pages of a table may be compressed (see mypagemap.h). The DB file and
+ * each column file then keep their pages in chunks of variable size, found
+ * through a page map saved in a file of their own (the name of the data file
+ * followed by ".map"). Pages are decompressed when they are read into the
+ * cache and compressed when they are written back, so the cache always holds
+ * whole pages. The header of the DB file is never compressed.
  */
 
 #ifndef MYCACHE_H
@@ -16,26 +47,186 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/ipc.h>
 
-#include "mybucket.h"
+#include "myrecord.h"
+#include "myschema.h"
+#include "mypage.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-  /* This is the size of our cache in buckets.  */
+  /* This is the size of our cache in pages.  */
 #define MYC_NUMENTRIES 64
 
   /* This is the default name of the DB file. */
 #define MYC_FILENAME "myDBtable.dat"
 
-  /* This function initializes the cache. */
+  /* Maximum number of tables open at the same time. */
+#define MYC_MAXTABLES 16
+
+  /* Default limit of the memory of the caches of all the tables, in bytes. */
+#define MYC_MEMORYLIMIT ((size_t)64 * 1024 * 1024)
+
+  /* Records of a table: every index of the API that is not negative. Indices
+   * are ints in this API, in the client API and in the protocol, which sets
+   * this limit. The directory of pages and the 64-bit file offsets are not
+   * the limit: 32-bit page numbers address many more records than this. */
+#define MYC_MAXRECORDS ((uint64_t)1 << 31)
+
+  /* Layouts of the records of a table. */
+#define MYC_LAYOUT_ROWS 0 /* Packed records in slotted pages of the DB file. */
+#define MYC_LAYOUT_COLUMNS 1 /* Each field in its own column file. */
+#define MYC_LAYOUT_LSM 2 /* Packed records in the runs of a log-structured merge tree. */
+#define MYC_LAYOUT_BTREE 3 /* Packed records in the leaves of a B+tree keyed by registerid. */
+  /* Flag added to the layout of a new table to compress its pages. Runs of a
+   * log-structured merge tree are not compressed. */
+#define MYC_COMPRESSED 0x100
+  /* Flag added to the layout of a new table to split its DB file and its
+   * column files in segments of MYC_SEGMENTPAGES pages, spread over the
+   * directories given to MYC_setSegmentDirs(). Segmented tables are not
+   * compressed, and a log-structured merge tree is not segmented. */
+#define MYC_SEGMENTED 0x200
+#define MYC_SEGMENTPAGES ((uint32_t)1 << 18)
+  /* Bytes of the list of directories of the segments. */
+#define MYC_SEGMENTDIRS 1024
+
+  /* Magic number and version of the header of the DB file. */
+#define MYC_FILE_MAGIC 0x4d594442
+#define MYC_FILE_VERSION 2
+
+  /**
+   * Header of the DB file, at the start of its first page. The rest of the
+   * pages hold the records and the directory of a table stored by rows.
+   */
+  typedef struct
+  {
+    unsigned int magic; /* MYC_FILE_MAGIC */
+    unsigned int version; /* MYC_FILE_VERSION */
+    unsigned int pagesize; /* MYP_PAGESIZE */
+    uint32_t numpages; /* Pages of the file, this one included. */
+    uint32_t root; /* Root page of the directory or of the B+tree. 0 if there are no records. */
+    uint32_t insertpage; /* Page receiving new records. 0 if none yet. */
+    MYSCHEMA_t schema; /* Schema of the records. */
+    unsigned int layout; /* MYC_LAYOUT_ROWS, MYC_LAYOUT_COLUMNS, MYC_LAYOUT_LSM or MYC_LAYOUT_BTREE. */
+    uint32_t numrecords; /* Highest index written plus one, by columns only. */
+    unsigned int compressed; /* 1 if the pages are compressed. */
+    unsigned int extralevels; /* Levels of node pages added above the MYP_NODELEVELS of the directory. */
+    unsigned int segmented; /* 1 if the files are split in segments. */
+    char segmentdirs[MYC_SEGMENTDIRS]; /* Directories of the segments, separated by ':'. Empty for the one of the file. */
+  } MYC_FILEHEADER_t;
+
+  /* Magic number at the start of a cache shared with local clients. */
+#define MYC_SHM_MAGIC 0x4d594331
+
+  /* States of a shared cache. */
+#define MYC_SHM_ACTIVE 0 /* Used by the server which owns it. */
+#define MYC_SHM_HANDEDOVER 1 /* Left by its owner for the next server. */
+
+  /**
+   * Header of the memory holding the cache. When the cache is shared with
+   * local clients, they attach it read-only and search records themselves.
+   * The arrays follow the header at the given offsets in bytes.
+   * Each entry has a version number. The server makes it odd before changing
+   * the entry and even again afterwards, so a reader that sees the same even
+   * version before and after copying an entry got a consistent copy.
+   */
+  typedef struct
+  {
+    unsigned int magic; /* MYC_SHM_MAGIC */
+    unsigned int numentries; /* Number of pages in the cache. */
+    unsigned int state; /* MYC_SHM_ACTIVE or MYC_SHM_HANDEDOVER. */
+    pid_t owner; /* Process of the server using the cache. */
+    uint64_t last_lsn; /* LSN of the last write, when handed over. */
+    uint64_t unsynced_lsn; /* Lowest LSN not synced to disk, when handed over. */
+    MYC_FILEHEADER_t file; /* Header of the DB file, with the changes not written yet. */
+    size_t versions_off; /* unsigned int[numentries]: version of each entry. */
+    size_t pages_off; /* uint32_t[numentries]: page of the file in each entry. 0 if unused. */
+    size_t entries_off; /* unsigned char[numentries][MYP_PAGESIZE]: the pages. */
+    size_t dirty_off; /* int[numentries]: dirty flag of each entry. */
+    size_t lsn_off; /* uint64_t[numentries]: LSN of the oldest write not flushed of each entry. */
+    size_t heat_off; /* unsigned int[numentries]: recent accesses of each entry. */
+  } MYC_SHARED_t;
+
+  /* These macros get the arrays of a shared cache from its header. */
+#define MYC_SHM_VERSIONS(h) ((unsigned int *)((char *)(h) + (h)->versions_off))
+#define MYC_SHM_PAGES(h) ((uint32_t *)((char *)(h) + (h)->pages_off))
+#define MYC_SHM_ENTRY(h, i) ((unsigned char *)(h) + (h)->entries_off + (size_t)(i) * MYP_PAGESIZE)
+#define MYC_SHM_DIRTY(h) ((int *)((char *)(h) + (h)->dirty_off))
+#define MYC_SHM_LSN(h) ((uint64_t *)((char *)(h) + (h)->lsn_off))
+#define MYC_SHM_HEAT(h) ((unsigned int *)((char *)(h) + (h)->heat_off))
+
+  /* Tables are identified by the handle returned when they are opened. Every
+   * function below acts on the table selected last: the one opened last or
+   * the one given to MYC_useTable(). LSNs, the hot set and the shared cache
+   * belong to each table. */
+  /* This function sets the limit of the memory of the caches of all the
+   * tables (MYC_MEMORYLIMIT by default). Opening a table whose cache does not
+   * fit fails. */
+  int MYC_setMemoryLimit (size_t bytes);
+  /* This function sets the directories of the segments of the tables
+   * created from now on with MYC_SEGMENTED, separated by ':'. Segment n of
+   * a file holds its pages from n * MYC_SEGMENTPAGES on. The first segment
+   * is the file itself, and segment n > 0 is "<dir>/<file>.<n>" in the
+   * directory (n - 1) modulo their number, so consecutive segments are on
+   * different devices when each directory is on its own. The directories
+   * are kept in the header of the file and must not move. By default the
+   * segments are beside the file. It returns -1 if the list is too long. */
+  int MYC_setSegmentDirs (const char *dirs);
+  /* This function opens a table with its DB file and a cache of the given
+   * number of pages. A new table gets the given layout, with its pages
+   * compressed if MYC_COMPRESSED is added to it or its files segmented if
+   * MYC_SEGMENTED is. An existing one must have the layout and keeps its
+   * own compression and segments. The cache of a log-structured
+   * merge tree holds its memtable and needs two pages at least. It returns
+   * the handle of the table or -1. */
+  int MYC_openTable (const char *filename, int numentries, int layout);
+  /* This function opens a table like MYC_openTable() with its cache inside a
+   * System V shared memory segment with the given key so that local clients
+   * can read it. Local clients only read tables stored by rows. */
+  int MYC_openSharedTable (const char *filename, int numentries, int layout, key_t key);
+  /* This function selects the table used by the other functions. */
+  int MYC_useTable (int table);
+  /* This function closes a table. It flushes all the information inside its
+   * cache that is not written to the file yet. */
+  int MYC_closeTable (int table);
+
+  /* This function initializes the cache. It opens the default table
+   * (MYC_FILENAME with MYC_NUMENTRIES pages, stored by rows). */
   int MYC_initCache ();
-  /* This function closes the cache. It flushes all the information inside the
-     cache that is not written to the file yet. */
+  /* This function initializes the cache inside a System V shared memory
+   * segment with the given key so that local clients can read it. It opens
+   * the default table too. */
+  int MYC_initSharedCache (key_t key);
+  /* This function closes the cache: every table. It flushes all the
+     information inside the caches that is not written to the files yet. */
   int MYC_closeCache ();
 
+  /* A shared cache can be handed over to a new server without flushing it.
+   * The old server detaches it and the new one attaches it with its dirty
+   * entries and LSNs. A server started normally adopts a cache handed over
+   * too, so dirty entries are never lost. */
+  /* This function records the calling process as the owner of the shared
+   * caches. Call it after fork() when running as a daemon. */
+  void MYC_adoptCache ();
+  /* This function returns the process owning the shared cache with the given
+   * key, or -1 if there is none. */
+  pid_t MYC_sharedOwner (key_t key);
+  /* This function leaves the shared caches of every table, dirty entries
+   * included, to the next server and closes the files. The default table is
+   * handed over last. */
+  int MYC_detachCache ();
+  /* This function attaches the shared cache of the default table handed over
+   * by the last server. It returns -2 if the cache is still used by its
+   * owner. The other tables are adopted by MYC_openSharedTable(). */
+  int MYC_attachSharedCache (key_t key);
+
+  /* Records have indices from 0 to MYC_MAXRECORDS - 1. A record never
+   * written reads as an empty record. In a B+tree the index of a record is
+   * its registerid: any value of 32 bits, negative indices being the keys
+   * from 2^31 up. */
   /* This function reads a record from the file (at given index)
    * inside the record passed as argument. */
   int MYC_readEntry (int fileIndex, MYRECORD_RECORD_t *record);
@@ -44,12 +235,87 @@ extern "C"
    * The record will be written at the given index of the file later.
    * This funtions does not write the cache entry to the file inmediately. */
   int MYC_writeEntry (int fileIndex, MYRECORD_RECORD_t *record);
-  /* This function flushes one cache entry containing one record to be written
-   * at the given index. */
+  /* This function flushes the pages of the cache holding the record at the
+   * given index. */
   int MYC_flushEntry (int fileIndex);
   /* This function flushes all the entries of the cache to the file. */
   int MYC_flushAll ();
 
+  /* Function called by MYC_scan() with each record. It returns 0 to go on
+   * and any other value to stop the scan. */
+  typedef int (*MYC_SCAN_f) (int fileIndex, const MYRECORD_RECORD_t *record, void *arg);
+  /* This function calls a function with the records from index first to
+   * first + count - 1, in order. Only the fields in the mask (bit i for field
+   * i of the schema) are needed: a table stored by columns reads only their
+   * columns and leaves the other fields empty. Tables stored by rows, in a
+   * log-structured merge tree or in a B+tree skip the records never
+   * written. Tables stored by columns give every record below the highest
+   * one written. A B+tree scans the keys from first, taken as unsigned, in
+   * the order of the keys. */
+  int MYC_scan (int first, int count, unsigned int fields, MYC_SCAN_f callback, void *arg);
+
+  /* Every write accepted by the cache gets a log sequence number (LSN).
+   * LSNs start at 1 and grow by one with each write. */
+  /* This function returns the LSN of the last write accepted by the cache. */
+  uint64_t MYC_lastLSN ();
+  /* This function returns the highest LSN such that every write up to it is
+   * already stored on disk. */
+  uint64_t MYC_durableLSN ();
+  /* This function writes and syncs to disk every write up to the given LSN. */
+  int MYC_flushUpTo (uint64_t lsn);
+
+  /* This function returns 1 if the last read or write found its record in
+   * the cache and 0 otherwise. */
+  int MYC_lastHit ();
+
+  /* Counters of the activity of the caches of all the tables since they were initialized. */
+  typedef struct
+  {
+    uint64_t hits; /* Reads and writes with every page needed in the cache. */
+    uint64_t misses; /* Reads and writes that had to read some page from the file. */
+    uint64_t evictions; /* Dirty entries written to make room for other pages. */
+    uint64_t bytes_read; /* Bytes read from the file. */
+    uint64_t bytes_written; /* Bytes written to the file. */
+    uint64_t syncs; /* Syncs of the file to disk. */
+    uint64_t sync_ns; /* Time spent syncing the file (ns). */
+  } MYC_STATS_t;
+
+  /* This function returns the counters of the activity of the cache. They keep
+   * changing while the cache is used: other threads must read them with
+   * __atomic_load_n(). */
+  const MYC_STATS_t *MYC_stats ();
+
+  /* The hot set is the list of pages in the cache, hottest first. Saving it
+   * before stopping and loading it after starting lets a new server warm its
+   * cache with the pages the old one was using. */
+  /* This function writes the hot set to a file. Accesses are aged afterwards,
+   * so the next hot set favours recent accesses. */
+  int MYC_saveHotSet (const char *path);
+  /* This function reads a hot set and asks the kernel to read its pages in
+   * the background, sorted and in runs of consecutive pages. It returns the
+   * number of pages to prefetch (0 if there is no file) or -1. */
+  int MYC_loadHotSet (const char *path);
+  /* This function loads into unused entries of the cache up to max pages of
+   * the hot set, hottest first. Pages already in the cache are skipped and
+   * no entry is evicted. It returns the number of pages left or -1. */
+  int MYC_prefetchHotSet (int max);
+
+  /* A snapshot is an image of the files of a table at one point in time,
+   * written while the table keeps changing. Each page is copied to the image
+   * before its first change and the others are copied in the background, so
+   * the table is never stopped. The image opens as a table of the same
+   * layout, neither compressed nor segmented. Tables stored as a log-structured merge tree
+   * have no snapshots. */
+  /* This function starts a snapshot of the selected table to the given DB
+   * file. It returns -1 if one is running already or in case of error. */
+  int MYC_startSnapshot (const char *path);
+  /* This function copies up to max pages of the snapshot of the selected
+   * table that did not change yet. The header of the image is written and
+   * synced last. It returns the number of pages left, 0 when the snapshot
+   * ended or none is running, or -1 if it failed and the image was removed.
+   * Closing the table finishes the snapshot. */
+  int MYC_snapshotStep (int max);
+
   /* Increases current debug level or reset to 0 if maximum is reached. */
   void MYC_debuglevel_rotate ();
 
@@ -0,0 +1,50 @@
+/*
+ * File:   mylog.h
+ *
+ * This file defines an asynchronous backend for the macros of debug.h.
+ *
+ * When a program is compiled with DEBUG_ASYNC, the debug macros format the
+ * messages into a buffer of the calling thread and return. A background
+ * thread writes the buffers to stderr. When a buffer is full, messages are
+ * dropped and counted instead of blocking the caller.
+ * Until MYL_start() is called, messages are written directly to stderr.
+ */
+
+#ifndef MYLOG_H
+#define MYLOG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Bytes of the buffer of each thread. It must be a power of two. */
+#define MYL_BUFFERSIZE 65536
+  /* Maximum number of threads with a buffer. */
+#define MYL_MAXTHREADS 16
+  /* Longest message. Longer ones are truncated. */
+#define MYL_MAXMESSAGE 512
+
+  /* This function logs one message like the debug macros do:
+   * "file:function()::LEVEL message[suffix]\n". The suffix may be NULL. */
+  void MYL_log (const char *file, const char *function, const char *level, const char *suffix, const char *format, ...)
+  __attribute__ ((format (printf, 5, 6)));
+
+  /* This function starts the writer thread. Call it after fork() when
+   * running as a daemon. The buffers are written at exit. */
+  int MYL_start ();
+
+  /* This function writes every buffered message and stops the writer thread. */
+  void MYL_stop ();
+
+  /* This function returns the number of messages dropped because the buffer
+   * of their thread was full. */
+  uint64_t MYL_dropped ();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYLOG_H */
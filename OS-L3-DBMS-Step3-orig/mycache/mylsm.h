@@ -0,0 +1,99 @@
+/*
+ * File:   mylsm.h
+ *
+ * This file defines a log-structured merge tree (LSM) holding the packed
+ * records of a table by their index.
+ *
+ * New records go to the memtable: a buffer in memory kept sorted by index.
+ * Each write is appended to a log too, so the memtable can be rebuilt after
+ * a crash. When the memtable is full it is written in one go to a new run:
+ * an immutable file of slotted pages (see mypage.h) sorted by index, with
+ * the first index of each page and a bloom filter of its indices. The log
+ * is emptied then. Files are only written sequentially and never
+ * overwritten.
+ *
+ * Reads look in the memtable and then in the runs, newest first. The bloom
+ * filter of a run skips most runs without the record, and the first indices
+ * of its pages lead to the only page to read. When there are too many runs,
+ * a thread merges them into one in the background, keeping the newest
+ * version of each record.
+ *
+ * The files are named after the DB file: the list of runs in "<file>.lsm",
+ * the log in "<file>.log" and each run in "<file>.run.<number>".
+ */
+
+#ifndef MYLSM_H
+#define MYLSM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mypage.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Magic numbers and version of the list of runs and of a run. */
+#define MYLSM_MAGIC 0x4d594c53
+#define MYLSM_RUN_MAGIC 0x4d595255
+#define MYLSM_VERSION 1
+
+  /* Runs that start a merge in the background, and runs that make writes
+   * wait for the merge to end. */
+#define MYLSM_MERGERUNS 4
+#define MYLSM_MAXRUNS 16
+
+  /* Bytes of the log kept in memory before they are written. */
+#define MYLSM_LOGBUFFER 65536
+
+  /* Bits of the bloom filter of a run per record, and bits tested. */
+#define MYLSM_BLOOMBITS 10
+#define MYLSM_BLOOMHASHES 7
+
+  /* A tree. */
+  typedef struct MYLSM_TREE MYLSM_TREE_t;
+
+  /* Function called by MYLSM_scan() with each record. It returns 0 to go on
+   * and any other value to stop the scan. */
+  typedef int (*MYLSM_SCAN_f)(uint32_t key, const unsigned char *data, size_t length, void *arg);
+
+  /* This function opens the tree of a DB file, or creates it if neither
+   * the list of runs nor the log exist. The memtable takes the given memory,
+   * two pages at least, and the log is replayed into it. The bytes read from
+   * and written to the files are added to the counters. It returns NULL in
+   * case of error. */
+  MYLSM_TREE_t *MYLSM_open(const char *path, void *memory, size_t size, uint64_t *bytesRead,
+                           uint64_t *bytesWritten);
+  /* This function closes a tree. It waits for the merge running and writes
+   * the log, without syncing it. It returns -1 in case of error. */
+  int MYLSM_close(MYLSM_TREE_t *tree);
+
+  /* This function reads a record. It sets missed to 1 if some page was read
+   * from a run. It returns the bytes of the record, 0 if it was never
+   * written or -1 in case of error. */
+  int MYLSM_get(MYLSM_TREE_t *tree, uint32_t key, unsigned char *buffer, size_t size, int *missed);
+  /* This function writes a record. It returns 1 if the memtable was written
+   * to a run first, so every earlier write is on disk, 0 if not or -1 in case
+   * of error. */
+  int MYLSM_put(MYLSM_TREE_t *tree, uint32_t key, const unsigned char *data, size_t length);
+  /* This function writes the log and syncs it to disk. */
+  int MYLSM_sync(MYLSM_TREE_t *tree);
+  /* This function calls a function with the records from key first to end - 1
+   * in order, skipping the records never written. It returns -1 in case of
+   * error. */
+  int MYLSM_scan(MYLSM_TREE_t *tree, uint32_t first, uint64_t end, MYLSM_SCAN_f callback, void *arg);
+
+  /* This function takes the run made by a merge that ended and starts a new
+   * merge if there are too many runs. It returns -1 if the last merge failed:
+   * the runs are left as they were. */
+  int MYLSM_maintain(MYLSM_TREE_t *tree);
+  /* This function returns the number of runs. */
+  int MYLSM_runs(const MYLSM_TREE_t *tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYLSM_H */
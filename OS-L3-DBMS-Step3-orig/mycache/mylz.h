@@ -0,0 +1,41 @@
+/*
+ * File:   mylz.h
+ *
+ * This file defines a fast compressor for the pages of the DB file, built in
+ * so that the store needs no external library.
+ *
+ * The compressed format is the LZ4 block format: a list of sequences, each one
+ * a token, some literal bytes copied as they are and a match copying bytes
+ * already written from up to 64 KiB before. It favours speed over ratio:
+ * zeros and repeated bytes compress well, other data barely.
+ */
+
+#ifndef MYLZ_H
+#define MYLZ_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Largest input of the compressor: matches only go 64 KiB back. */
+#define MYLZ_MAXINPUT 65535
+  /* Largest compressed size of n bytes, for data which does not compress. */
+#define MYLZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+  /* This function compresses a buffer of up to MYLZ_MAXINPUT bytes. It
+   * returns the compressed size or -1 if it does not fit in the output. */
+  int MYLZ_compress(const void *src, size_t size, void *dst, size_t capacity);
+
+  /* This function decompresses a buffer. Everything is checked, so a damaged
+   * buffer never writes outside the output. It returns the decompressed size
+   * or -1 if the buffer is malformed or does not fit in the output. */
+  int MYLZ_decompress(const void *src, size_t size, void *dst, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYLZ_H */
@@ -0,0 +1,95 @@
+/*
+ * File:   mypage.h
+ *
+ * This file defines the pages of the DB file. The file and the cache are
+ * divided in pages of the same size.
+ *
+ * Records are stored packed in slotted pages. A slotted page starts with a
+ * header and an array of slots growing upwards. The records fill the page
+ * from its end downwards. Each slot holds the offset and length of one
+ * record, so records can change their size and move inside their page
+ * without changing their slot.
+ *
+ * The records of the file are found through a directory: a tree of pages
+ * indexed by the bits of the index of a record. Node pages hold numbers of
+ * pages of the next level and leaf pages hold the page and slot of each
+ * record. Number 0 means that there is nothing below.
+ */
+
+#ifndef MYPAGE_H
+#define MYPAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Size of a page in bytes. */
+#define MYP_PAGESIZE 4096
+
+  /* Header of a slotted page. */
+  typedef struct
+  {
+    uint16_t numslots; /* Slots in the array, used or not. */
+    uint16_t upper; /* Offset of the first byte of the records. */
+    uint16_t freebytes; /* Bytes not used, between the slots and the records or among the records. */
+    uint16_t reserved; /* Must be 0. */
+  } MYPAGE_HEADER_t;
+
+  /* Slot of a slotted page. */
+  typedef struct
+  {
+    uint16_t offset; /* Offset of the record in the page. 0 if the slot is not used. */
+    uint16_t length; /* Bytes of the record. */
+    uint32_t id; /* Index of the record in the file. */
+  } MYPAGE_SLOT_t;
+
+  /* Location of a record: its page and its slot. */
+  typedef struct
+  {
+    uint32_t page; /* 0 if there is no record. */
+    uint32_t slot;
+  } MYPAGE_RID_t;
+
+  /* Entries of a node page and of a leaf page of the directory. */
+#define MYP_NODEENTRIES (MYP_PAGESIZE / sizeof(uint32_t))
+#define MYP_LEAFENTRIES (MYP_PAGESIZE / sizeof(MYPAGE_RID_t))
+  /* Levels of node pages above the leaf pages of a new directory. A record
+   * beyond them adds a level at the top, up to MYP_MAXNODELEVELS levels,
+   * which index every record of 32 bits. Only the indices below MYC_MAXRECORDS
+   * reach them through the API. */
+#define MYP_NODELEVELS 2
+#define MYP_MAXNODELEVELS 3
+
+  /* This function returns the entry of a directory page of the given level
+   * (0 is the leaf level) for the record with the given index. */
+  unsigned int MYP_entry(uint32_t fileIndex, int level);
+  /* This function returns the number of records indexed by a directory with
+   * the given levels of node pages. */
+  uint64_t MYP_records(int levels);
+
+  /* This function initializes an empty slotted page. */
+  void MYP_init(void *page);
+  /* This function returns the record stored in a slot of a page, or NULL if
+   * the slot does not hold the record with the given index. The page may be
+   * read while it changes, so everything is checked. */
+  const unsigned char *MYP_record(const void *page, uint32_t slot, uint32_t id, size_t *length);
+  /* This function returns the room for one more record in a page. */
+  size_t MYP_room(const void *page);
+  /* This function stores a new record in a page. It returns its slot or -1
+   * if there is no room. */
+  int MYP_insert(void *page, uint32_t id, const void *data, size_t length);
+  /* This function replaces the record in a slot of a page. It returns -1 if
+   * there is no room, and then the page is left unchanged. */
+  int MYP_update(void *page, uint32_t slot, const void *data, size_t length);
+  /* This function removes the record in a slot of a page. */
+  void MYP_delete(void *page, uint32_t slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYPAGE_H */
@@ -0,0 +1,85 @@
+/*
+ * File:   mypagemap.h
+ *
+ * This file defines the page translation map of a file of compressed pages.
+ *
+ * Each page is compressed (see mylz.h) and stored in a chunk of the file: a
+ * small header with the length of the data, then the data. Pages that do not
+ * compress are stored as they are. Chunks take a multiple of MYPM_GRAIN
+ * bytes. A page written again stays in its chunk while it fits, or else it
+ * moves to a new chunk at the end of the file and its old chunk is left
+ * unused.
+ *
+ * The map holds the offset and the size of the chunk of every page. It is
+ * kept in memory and saved to its own file, replaced atomically, after the
+ * chunks it points to are on disk.
+ */
+
+#ifndef MYPAGEMAP_H
+#define MYPAGEMAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "mypage.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Chunks take a multiple of this number of bytes. */
+#define MYPM_GRAIN 256
+
+  /* Magic number and version of a map file. */
+#define MYPM_MAGIC 0x4d59504d
+#define MYPM_VERSION 1
+
+  /* Location of the chunk of a page. */
+  typedef struct
+  {
+    uint64_t offset; /* Offset of the chunk in the data file. */
+    uint32_t size; /* Bytes of the chunk. 0 if the page was never written. */
+    uint32_t reserved; /* Must be 0. */
+  } MYPM_ENTRY_t;
+
+  /* Map of the pages of one data file. */
+  typedef struct
+  {
+    char path[FILENAME_MAX]; /* Name of the map file. */
+    MYPM_ENTRY_t *entries; /* Location of each page. */
+    uint32_t count; /* Pages in the array. */
+    uint32_t capacity; /* Room of the array. */
+    uint64_t end; /* End of the last chunk of the data file. */
+    uint64_t unused; /* Bytes of the chunks left by pages that moved. */
+    int dirty; /* The map changed since it was saved. */
+  } MYPM_MAP_t;
+
+  /* This function opens the map saved in a file. Without the file, a new map
+   * is created whose chunks start at the given offset of the data file. It
+   * returns NULL if the data file already has chunks (the map was lost), the
+   * map file is damaged or in case of error. */
+  MYPM_MAP_t *MYPM_open(const char *path, int fd, off_t start);
+  /* This function saves the map to its file if it changed, synced to disk
+   * or not. It returns -1 in case of error. */
+  int MYPM_save(MYPM_MAP_t *map, int sync);
+  /* This function frees a map without saving it. */
+  void MYPM_close(MYPM_MAP_t *map);
+
+  /* This function reads a page from the data file and decompresses it. A page
+   * never written reads as zeros. It returns the bytes read from the file or
+   * -1 in case of error (EIO if the chunk is damaged). */
+  ssize_t MYPM_read(MYPM_MAP_t *map, int fd, uint32_t page, void *buffer);
+  /* This function compresses a page and writes it to the data file. It
+   * returns the bytes written to the file or -1 in case of error. */
+  ssize_t MYPM_write(MYPM_MAP_t *map, int fd, uint32_t page, const void *buffer);
+  /* This function gets the chunk of a page. It returns -1 if the page was
+   * never written. */
+  int MYPM_locate(const MYPM_MAP_t *map, uint32_t page, off_t *offset, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYPAGEMAP_H */
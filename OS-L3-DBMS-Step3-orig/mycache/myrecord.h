@@ -7,6 +7,8 @@
  * Records are managed on RAM and preserved on DISK.
  * 
  * You can change the fields of the record to personalize your database table.
+ * Records are stored packed (see myschema.h), so the size of the name array
+ * only limits the longest name: short names don't waste space.
  */
 
 #ifndef MYRECORD_H
@@ -19,7 +21,7 @@ extern "C"
 {
 #endif
 
-#define MYRECORD_NAMELENGTH 16
+#define MYRECORD_NAMELENGTH 64
 
   /* This is the definition of one record in my database. */
   typedef struct
@@ -0,0 +1,94 @@
+/*
+ * File:   myschema.h
+ *
+ * This file defines the schema of the records of a table: the list of its
+ * fields with their types and where they are inside the record structure used
+ * by the programs.
+ *
+ * Records are stored packed: each field takes only the bytes it uses.
+ * Integers are stored as variable length numbers (1 byte for small values)
+ * and strings as their length followed by their characters, without the
+ * unused part of their array. The cache, the file and the compact wire format
+ * carry packed records, so the size of the arrays of the record structure
+ * only limits the longest value.
+ */
+
+#ifndef MYSCHEMA_H
+#define MYSCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "myrecord.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Maximum number of fields of a record. */
+#define MYSCH_MAXFIELDS 16
+  /* Longest name of a field, with the final '\0'. */
+#define MYSCH_NAMELENGTH 16
+
+  /* Types of the fields. */
+  typedef enum
+  {
+    MYSCH_UINT = 1, /* Unsigned integer of 1, 2, 4 or 8 bytes. */
+    MYSCH_INT, /* Signed integer of 1, 2, 4 or 8 bytes. */
+    MYSCH_STRING /* Array of characters ended by '\0' unless it is full. */
+  } MYSCHEMA_TYPE;
+
+  /* Description of one field. */
+  typedef struct
+  {
+    char name[MYSCH_NAMELENGTH]; /* Name of the field. */
+    unsigned int type; /* MYSCHEMA_TYPE */
+    unsigned int offset; /* Offset of the field inside the record structure. */
+    unsigned int size; /* Bytes of the field inside the record structure. */
+  } MYSCHEMA_FIELD_t;
+
+  /* Description of a record. It is stored in the header of the DB file. */
+  typedef struct
+  {
+    unsigned int numfields; /* Fields used in the array below. */
+    unsigned int recordsize; /* Bytes of the record structure. */
+    MYSCHEMA_FIELD_t fields[MYSCH_MAXFIELDS];
+  } MYSCHEMA_t;
+
+  /* This function returns the schema of MYRECORD_RECORD_t. */
+  const MYSCHEMA_t *MYSCH_recordSchema();
+
+  /* This function adds a field to a schema. It returns -1 if the field is
+   * not valid or there is no room for it. */
+  int MYSCH_addField(MYSCHEMA_t *schema, const char *name, MYSCHEMA_TYPE type, size_t offset, size_t size);
+
+  /* This function returns the size of the largest packed record of a schema. */
+  size_t MYSCH_maxPacked(const MYSCHEMA_t *schema);
+
+  /* This function packs a record into a buffer. It returns the bytes used or
+   * -1 if they don't fit. */
+  int MYSCH_pack(const MYSCHEMA_t *schema, const void *record, unsigned char *buffer, size_t size);
+
+  /* This function unpacks a record. Fields are cleared first, so an empty
+   * buffer gives an empty record. Strings longer than their array are cut.
+   * It returns -1 if the buffer is malformed. */
+  int MYSCH_unpack(const MYSCHEMA_t *schema, const unsigned char *buffer, size_t length, void *record);
+
+  /* This function returns the number of the field with the given name, or -1. */
+  int MYSCH_findField(const MYSCHEMA_t *schema, const char *name);
+
+  /* This function gets the value of an integer field of a record. It returns
+   * -1 if the field is not an integer. */
+  int MYSCH_getInteger(const MYSCHEMA_t *schema, int field, const void *record, int64_t *value);
+
+  /* This function tells whether records packed with the stored schema can be
+   * unpacked with another one: the fields must have the same names and types,
+   * in the same order. Their sizes may change. */
+  int MYSCH_compatible(const MYSCHEMA_t *stored, const MYSCHEMA_t *schema);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYSCHEMA_H */
@@ -35,7 +35,14 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
-	${OBJECTDIR}/libmycache.o
+	${OBJECTDIR}/libmybtree.o \
+	${OBJECTDIR}/libmycache.o \
+	${OBJECTDIR}/libmylog.o \
+	${OBJECTDIR}/libmylsm.o \
+	${OBJECTDIR}/libmylz.o \
+	${OBJECTDIR}/libmypage.o \
+	${OBJECTDIR}/libmypagemap.o \
+	${OBJECTDIR}/libmyschema.o
 
 
 # C Compiler Flags
@@ -64,10 +71,45 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/libmycache.a: ${OBJECTFILES}
 	${AR} -rv ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/libmycache.a ${OBJECTFILES} 
 	$(RANLIB) ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/libmycache.a
 
+${OBJECTDIR}/libmybtree.o: libmybtree.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmybtree.o libmybtree.c
+
 ${OBJECTDIR}/libmycache.o: libmycache.c nbproject/Makefile-${CND_CONF}.mk
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -g -Werror -DDEBUG_LIB -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmycache.o libmycache.c
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmycache.o libmycache.c
+
+${OBJECTDIR}/libmylog.o: libmylog.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmylog.o libmylog.c
+
+${OBJECTDIR}/libmylsm.o: libmylsm.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmylsm.o libmylsm.c
+
+${OBJECTDIR}/libmylz.o: libmylz.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmylz.o libmylz.c
+
+${OBJECTDIR}/libmypage.o: libmypage.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmypage.o libmypage.c
+
+${OBJECTDIR}/libmypagemap.o: libmypagemap.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmypagemap.o libmypagemap.c
+
+${OBJECTDIR}/libmyschema.o: libmyschema.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmyschema.o libmyschema.c
 
 # Subprojects
 .build-subprojects:
@@ -35,7 +35,14 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
-	${OBJECTDIR}/libmycache.o
+	${OBJECTDIR}/libmybtree.o \
+	${OBJECTDIR}/libmycache.o \
+	${OBJECTDIR}/libmylog.o \
+	${OBJECTDIR}/libmylsm.o \
+	${OBJECTDIR}/libmylz.o \
+	${OBJECTDIR}/libmypage.o \
+	${OBJECTDIR}/libmypagemap.o \
+	${OBJECTDIR}/libmyschema.o
 
 
 # C Compiler Flags
@@ -62,10 +69,45 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/libmycache.${CND_DLIB_EXT}: ${OBJECTF
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
 	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/libmycache.${CND_DLIB_EXT} ${OBJECTFILES} ${LDLIBSOPTIONS} -shared -fPIC
 
+${OBJECTDIR}/libmybtree.o: libmybtree.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmybtree.o libmybtree.c
+
 ${OBJECTDIR}/libmycache.o: libmycache.c
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -O2 -fPIC  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmycache.o libmycache.c
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmycache.o libmycache.c
+
+${OBJECTDIR}/libmylog.o: libmylog.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmylog.o libmylog.c
+
+${OBJECTDIR}/libmylsm.o: libmylsm.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmylsm.o libmylsm.c
+
+${OBJECTDIR}/libmylz.o: libmylz.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmylz.o libmylz.c
+
+${OBJECTDIR}/libmypage.o: libmypage.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmypage.o libmypage.c
+
+${OBJECTDIR}/libmypagemap.o: libmypagemap.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmypagemap.o libmypagemap.c
+
+${OBJECTDIR}/libmyschema.o: libmyschema.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -fPIC -D_FILE_OFFSET_BITS=64 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmyschema.o libmyschema.c
 
 # Subprojects
 .build-subprojects:
@@ -13,8 +13,13 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/shm.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #include "mystore_cli.h"
 #include "messages.h"
+#include "mycache.h"
 #include "debug.h"
 
 /************************************************************
@@ -31,6 +36,74 @@ static int message_queue = -1;
 /* Debug level for messages */
 static int debug_level = DEBUG_INIT;
 
+/* This is one request sent to the server which has not been gathered yet. */
+typedef struct
+{
+  int used; /* The slot holds a request. */
+  int done; /* The answer has already been received. */
+  unsigned int seq; /* Sequence number sent in the request. */
+  int status; /* Status from the server once done. */
+  MYRECORD_RECORD_t *record; /* Where to copy the record for reads. NULL for writes. */
+  STORC_LATENCY_t *latency; /* Where to copy the latency report for statistics. */
+  STORC_AGGREGATE_t *aggregate; /* Where to copy the aggregate of a field. */
+  int internal; /* Cumulative acknowledgement gathered by the library, not by the user. */
+  int op; /* Requested operation. */
+  int table; /* Table of the request. */
+  uint64_t deadline; /* CLOCK_MONOTONIC time when it times out (ns). 0 if never. */
+} pending_request_t;
+
+/* Table of requests submitted and not gathered yet. */
+static pending_request_t Pending[STORC_MAXWINDOW];
+
+/* Number of requests sent and not answered yet. */
+static int in_flight = 0;
+
+/* Maximum number of requests in flight. */
+static int window = STORC_DEFAULTWINDOW;
+
+/* Next sequence number to use. It is never 0. */
+static unsigned int next_seq = 1;
+
+/* How STORC_write() waits for the server. */
+static int write_mode = STORC_WRITE_ACK;
+
+/* Unacknowledged writes between cumulative acknowledgements. */
+static int ack_every = 1;
+
+/* Unacknowledged writes sent since the last acknowledgement was requested. */
+static int unacked_writes = 0;
+
+/* First error reported by a cumulative acknowledgement not returned to the user yet. */
+static int deferred_status = 0;
+
+/* LSN of the last write of this client acknowledged by the server in each table. */
+static uint64_t last_lsn[STORC_MAXTABLES];
+
+/* Table of the next requests. */
+static int current_table = 0;
+
+/* Wire format of the requests. */
+static int wire_format = MYSWIRE_COMPACT;
+
+/* Message type of the requests: the priority class. */
+static long request_type = MYSAPMT_REQUEST;
+
+/* Milliseconds a request may take before giving up. 0 means forever. */
+static int timeout_ms = 0;
+
+/* Longest sleep between checks for an answer when waiting with a timeout. */
+#define MAX_POLL_NS 1000000
+
+/* Cache of each table of the server attached read-only. NULL if the server
+ * does not share it (or it was not attached yet). */
+static const MYC_SHARED_t *shared_cache[STORC_MAXTABLES];
+
+/* Read records from the shared cache when possible. */
+static int local_reads = 1;
+
+/* Times to retry reading an entry that the server is changing. */
+#define LOCAL_READ_RETRIES 8
+
 /************************************************************
  PRIVATE FUNCTIONS
  ************************************************************/
@@ -40,6 +113,730 @@ static int debug_level = DEBUG_INIT;
 
 /* Use the keyword "static" before a function which is only used inside this file */
 
+/**
+ * Tags are the sequence numbers without the sign bit so that they can be
+ * returned as a non negative int.
+ */
+static int
+seq2tag (unsigned int seq)
+{
+  return (int) (seq & 0x7fffffff);
+}
+
+/**
+ * Get the time of the monotonic clock. The server uses the same clock.
+ * @return Time in nanoseconds.
+ */
+static uint64_t
+nowNs ()
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Sleep before checking the queue again, doubling the pause each time.
+ * @param pause Current pause (ns). It is updated.
+ * @param until Never sleep past this time (ns).
+ */
+static void
+backoff (uint64_t *pause, uint64_t until)
+{
+  uint64_t now = nowNs ();
+  uint64_t ns = *pause;
+  if (until > now && until - now < ns)
+    ns = until - now;
+  struct timespec delay = {(time_t) (ns / 1000000000ULL), (long) (ns % 1000000000ULL)};
+  nanosleep (&delay, NULL);
+  if (*pause < MAX_POLL_NS)
+    *pause *= 2;
+}
+
+/**
+ * Complete with STORC_TIMEDOUT every request in flight whose deadline passed.
+ * Their answers, if they ever come, are discarded.
+ */
+static void
+expirePending ()
+{
+  uint64_t now = nowNs ();
+  for (int i = 0; i < STORC_MAXWINDOW; i++)
+    {
+      if (Pending[i].used && !Pending[i].done && Pending[i].deadline != 0 && now >= Pending[i].deadline)
+        {
+          in_flight--;
+          debug_info ("Request timed out (seq=%u).", Pending[i].seq);
+          if (Pending[i].internal)
+            {
+              /* The writes of the batch may or may not have been done. */
+              if (deferred_status == 0)
+                deferred_status = STORC_TIMEDOUT;
+              Pending[i].used = 0;
+              continue;
+            }
+          Pending[i].status = STORC_TIMEDOUT;
+          Pending[i].done = 1;
+        }
+    }
+}
+
+/**
+ * Search the pending table for the slot holding the given tag.
+ * @return The index of the slot. -1 means that the tag is unknown.
+ */
+static int
+searchPending (int tag)
+{
+  for (int i = 0; i < STORC_MAXWINDOW; i++)
+    {
+      if (Pending[i].used && seq2tag (Pending[i].seq) == tag)
+        return i;
+    }
+  return -1;
+}
+
+/**
+ * Encode a request in the compact wire format. Only the fields meaningful
+ * for the operation are included.
+ * @param request The request to encode.
+ * @param wire The message to fill.
+ * @return Size of the text of the message to send.
+ */
+static size_t
+encodeRequest (const request_message_t *request, wire_request_t *wire)
+{
+  wire_header_t *header = &wire->header;
+  size_t off = 0;
+
+  wire->mtype = request->mtype;
+  wire->return_to = (int32_t) request->return_to;
+  header->magic = MYSTORE_WIRE_MAGIC;
+  header->seq = request->seq;
+  header->op = (uint8_t) request->requested_op;
+  header->flags = (uint8_t) request->flags;
+  header->fields = 0;
+  header->reserved = 0;
+
+  /* The fields follow in the order of their bits. */
+  if (request->requested_op == MYSCOP_READ || request->requested_op == MYSCOP_WRITE
+      || request->requested_op == MYSCOP_FLUSH || request->requested_op == MYSCOP_STATS
+      || request->requested_op == MYSCOP_SETWEIGHT || request->requested_op == MYSCOP_AGGREGATE)
+    {
+      int32_t index = request->index;
+      memcpy (wire->payload + off, &index, sizeof (index));
+      off += sizeof (index);
+      header->fields |= MYSWF_INDEX;
+    }
+  if (request->requested_op == MYSCOP_WRITE)
+    {
+      /* Packed records are always shorter than the payload. */
+      uint16_t length = (uint16_t) MYSCH_pack (MYSCH_recordSchema (), &request->data,
+                                               wire->payload + off + sizeof (length),
+                                               MYSTORE_WIRE_MAXPAYLOAD - off - sizeof (length));
+      memcpy (wire->payload + off, &length, sizeof (length));
+      off += sizeof (length) + length;
+      header->fields |= MYSWF_RECORD;
+    }
+  if (request->requested_op == MYSCOP_DURABLE)
+    {
+      memcpy (wire->payload + off, &request->lsn, sizeof (request->lsn));
+      off += sizeof (request->lsn);
+      header->fields |= MYSWF_LSN;
+    }
+  memcpy (wire->payload + off, &request->sent, sizeof (request->sent));
+  off += sizeof (request->sent);
+  header->fields |= MYSWF_TIME;
+  if (request->deadline != 0)
+    {
+      memcpy (wire->payload + off, &request->deadline, sizeof (request->deadline));
+      off += sizeof (request->deadline);
+      header->fields |= MYSWF_DEADLINE;
+    }
+  if (request->table != 0)
+    {
+      uint16_t table = (uint16_t) request->table;
+      memcpy (wire->payload + off, &table, sizeof (table));
+      off += sizeof (table);
+      header->fields |= MYSWF_TABLE;
+    }
+  if (request->requested_op == MYSCOP_AGGREGATE)
+    {
+      int32_t count = request->count;
+      uint16_t field = (uint16_t) request->field;
+      memcpy (wire->payload + off, &count, sizeof (count));
+      memcpy (wire->payload + off + sizeof (count), &field, sizeof (field));
+      off += sizeof (count) + sizeof (field);
+      header->fields |= MYSWF_RANGE;
+    }
+  header->length = (uint16_t) off;
+  return MYSTORE_WIRESIZE (wire_request_t, off);
+}
+
+/**
+ * Decode an answer received in the compact wire format.
+ * @param wire The message received.
+ * @param size Size of the text of the message received.
+ * @param answer The answer to fill.
+ * @return 0 if OK. -1 if the message is malformed.
+ */
+static int
+decodeAnswer (const wire_answer_t *wire, size_t size, answer_message_t *answer)
+{
+  const wire_header_t *header = &wire->header;
+  if (size < MYSTORE_WIRESIZE (wire_answer_t, 0)
+      || size != MYSTORE_WIRESIZE (wire_answer_t, header->length))
+    return -1;
+
+  memset (answer, 0, sizeof (*answer));
+  answer->mtype = wire->mtype;
+  answer->status = wire->status;
+  answer->seq = header->seq;
+  answer->requested_op = (MYSTORE_CLI_OP) header->op;
+  answer->format = MYSWIRE_COMPACT;
+
+  size_t off = 0;
+  if (header->fields & MYSWF_RECORD)
+    {
+      uint16_t length;
+      if (off + sizeof (length) > header->length)
+        return -1;
+      memcpy (&length, wire->payload + off, sizeof (length));
+      off += sizeof (length);
+      if (off + length > header->length
+          || MYSCH_unpack (MYSCH_recordSchema (), wire->payload + off, length, &answer->data) == -1)
+        return -1;
+      off += length;
+    }
+  if (header->fields & MYSWF_LSN)
+    {
+      if (off + sizeof (answer->lsn) > header->length)
+        return -1;
+      memcpy (&answer->lsn, wire->payload + off, sizeof (answer->lsn));
+      off += sizeof (answer->lsn);
+    }
+  if (header->fields & MYSWF_ACK)
+    {
+      uint32_t counts[2];
+      if (off + sizeof (counts) > header->length)
+        return -1;
+      memcpy (counts, wire->payload + off, sizeof (counts));
+      answer->acked = counts[0];
+      answer->failed = counts[1];
+      off += sizeof (counts);
+    }
+  if (header->fields & MYSWF_LATENCY)
+    {
+      if (off + sizeof (answer->latency) > header->length)
+        return -1;
+      memcpy (&answer->latency, wire->payload + off, sizeof (answer->latency));
+      off += sizeof (answer->latency);
+    }
+  if (header->fields & MYSWF_AGGREGATE)
+    {
+      if (off + sizeof (answer->aggregate) > header->length)
+        return -1;
+      memcpy (&answer->aggregate, wire->payload + off, sizeof (answer->aggregate));
+      off += sizeof (answer->aggregate);
+    }
+  return 0;
+}
+
+/**
+ * Copy a latency report received from the server to the structure of the user.
+ * @param report The report received.
+ * @param latency The structure of the user.
+ */
+static void
+copyLatency (const latency_report_t *report, STORC_LATENCY_t *latency)
+{
+  latency->count = report->count;
+  for (int p = 0; p < STORC_PERCENTILES; p++)
+    {
+      latency->queue[p] = report->queue[p];
+      latency->service[p] = report->service[p];
+      latency->total[p] = report->total[p];
+    }
+}
+
+/**
+ * Receive one answer from the server and complete the pending request it
+ * belongs to. Answers for unknown sequence numbers are discarded.
+ * @param flags Flags for msgrcv(). IPC_NOWAIT to avoid blocking.
+ * @return 1 if an answer was received. 0 if no answer was waiting (only
+ * with IPC_NOWAIT). -1 means some error using the queue. -2 means that the
+ * queue was removed.
+ */
+static int
+receiveAnswer (int flags)
+{
+  answer_message_t answer;
+  /* Answers come in the format of the request. */
+  union
+  {
+    answer_message_t legacy;
+    wire_answer_t compact;
+  } msg;
+
+  debug_verbose ("Receiving answer from server (client id=%ld).", MYSTORE_API_CLIENT);
+  /* Receive the answer using the message client identifier. */
+  ssize_t status = msgrcv (message_queue, &msg, MYSTORE_MSGSIZE (msg), MYSTORE_API_CLIENT, flags);
+  if (status == -1)
+    {
+      if (errno == ENOMSG)
+        return 0;
+      if (errno == EIDRM || errno == EINVAL)
+        {
+          debug_error ("Message queue removed. Server is not running.");
+          return -2;
+        }
+      debug_perror ("Error receiving answer.");
+      return -1;
+    }
+  if (msg.compact.header.magic == MYSTORE_WIRE_MAGIC)
+    {
+      if (decodeAnswer (&msg.compact, status, &answer) == -1)
+        {
+          debug_error ("Discarding malformed answer (size=%zd).", status);
+          return 1;
+        }
+    }
+  else
+    {
+      answer = msg.legacy;
+    }
+  debug_debug ("Answer received from server (seq=%u, status=%d).", answer.seq, answer.status);
+
+  for (int i = 0; i < STORC_MAXWINDOW; i++)
+    {
+      if (Pending[i].used && !Pending[i].done && Pending[i].seq == answer.seq)
+        {
+          in_flight--;
+          /* Writes and acknowledgements carry the LSN of the last write. */
+          if ((Pending[i].op == MYSCOP_WRITE || Pending[i].op == MYSCOP_SYNC) && answer.lsn > last_lsn[Pending[i].table])
+            last_lsn[Pending[i].table] = answer.lsn;
+          if (Pending[i].internal)
+            {
+              /* A cumulative acknowledgement. Remember the first error. */
+              debug_debug ("Acknowledged %u writes (%u failed).", answer.acked, answer.failed);
+              if (answer.status != 0 && deferred_status == 0)
+                deferred_status = answer.status;
+              Pending[i].used = 0;
+              return 1;
+            }
+          /* Copy the contents of the answer, not the pointer!!!! */
+          if (answer.status == 0 && Pending[i].record != NULL)
+            *Pending[i].record = answer.data;
+          if (answer.status == 0 && Pending[i].latency != NULL)
+            copyLatency (&answer.latency, Pending[i].latency);
+          if (answer.status == 0 && Pending[i].aggregate != NULL)
+            {
+              Pending[i].aggregate->count = answer.aggregate.count;
+              Pending[i].aggregate->sum = answer.aggregate.sum;
+              Pending[i].aggregate->min = answer.aggregate.min;
+              Pending[i].aggregate->max = answer.aggregate.max;
+            }
+          Pending[i].status = answer.status;
+          Pending[i].done = 1;
+          return 1;
+        }
+    }
+  /* Late answers of requests that timed out end here too. */
+  debug_info ("Discarding answer with unknown sequence number (seq=%u).", answer.seq);
+  return 1;
+}
+
+/**
+ * Receive one answer, waiting at most until the given time. Without a
+ * deadline msgrcv() blocks. With one, the queue is polled with growing pauses.
+ * @param until CLOCK_MONOTONIC time to give up (ns). 0 means never.
+ * @return 1 if an answer was received. 0 if the time passed. -1 means some
+ * error using the queue. -2 means that the queue was removed.
+ */
+static int
+waitAnswer (uint64_t until)
+{
+  if (until == 0)
+    return receiveAnswer (0);
+  uint64_t pause = 20000;
+  for (;;)
+    {
+      int status = receiveAnswer (IPC_NOWAIT);
+      if (status != 0)
+        return status;
+      if (nowNs () >= until)
+        return 0;
+      backoff (&pause, until);
+    }
+}
+
+/**
+ * Send a request to the server. The answer (if any) is not waited for.
+ * @param request The request to send. The sequence number is set here.
+ * @return 0 if OK. -1 means some error using the queue. -2 means that the
+ * queue was removed.
+ */
+static int
+sendRequest (request_message_t *request)
+{
+  request->seq = next_seq++;
+  if (next_seq == 0)
+    next_seq = 1;
+  /* The type tells the server the priority of the request. */
+  request->mtype = request_type;
+  request->table = current_table;
+
+  debug_verbose ("Sending request to server (idx=%d, seq=%u).", request->index, request->seq);
+  /* The server measures the time spent in the queue from here. */
+  request->sent = nowNs ();
+  /* The server drops the request if it can't start it before the deadline. */
+  request->deadline = timeout_ms > 0 ? request->sent + (uint64_t) timeout_ms * 1000000ULL : 0;
+
+  /* Send the request to the server in the selected wire format. */
+  wire_request_t wire;
+  const void *msg = request;
+  size_t size = MYSTORE_MSGSIZE (request_message_t);
+  if (wire_format == MYSWIRE_COMPACT)
+    {
+      size = encodeRequest (request, &wire);
+      msg = &wire;
+    }
+  /* With a deadline, don't block on a full queue past it either. */
+  int flags = request->deadline != 0 ? IPC_NOWAIT : 0;
+  uint64_t pause = 20000;
+  int status;
+  while ((status = msgsnd (message_queue, msg, size, flags)) == -1 && errno == EAGAIN)
+    {
+      if (nowNs () >= request->deadline)
+        {
+          debug_info ("Request timed out before it could be sent (seq=%u).", request->seq);
+          return STORC_TIMEDOUT;
+        }
+      backoff (&pause, request->deadline);
+    }
+  if (status == -1)
+    {
+      if (errno == EIDRM || errno == EINVAL)
+        {
+          debug_error ("Message queue removed. Server is not running.");
+          return -2;
+        }
+      debug_perror ("Error sending message.");
+      return -1;
+    }
+  return 0;
+}
+
+/**
+ * Wait for answers until no more than the given number of requests are in
+ * flight. Requests which time out are not in flight any more either.
+ * @param max Number of requests that may stay in flight.
+ * @return 0 if OK. -1 means some error using the queue. -2 means that the
+ * queue was removed.
+ */
+static int
+waitInFlight (int max)
+{
+  while (in_flight > max)
+    {
+      uint64_t until = 0;
+      for (int i = 0; i < STORC_MAXWINDOW; i++)
+        {
+          if (Pending[i].used && !Pending[i].done && Pending[i].deadline != 0
+              && (until == 0 || Pending[i].deadline < until))
+            until = Pending[i].deadline;
+        }
+      int status = waitAnswer (until);
+      if (status < 0)
+        return status;
+      if (status == 0)
+        expirePending ();
+    }
+  return 0;
+}
+
+/**
+ * Send a request to the server and register it in the pending table.
+ * If the window is full, wait for answers before sending.
+ * @param request The request to send. The sequence number is set here.
+ * @param record Where to copy the record of the answer. NULL for writes.
+ * @param internal The answer is a cumulative acknowledgement gathered by the library.
+ * @return The tag of the request. -1 means some error using the queue.
+ * -2 means that the queue was removed.
+ */
+static int
+submitRequest (request_message_t *request, MYRECORD_RECORD_t *record, int internal)
+{
+  /* Wait until there is room for another request in flight. */
+  int status = waitInFlight (window - 1);
+  if (status < 0)
+    return status;
+
+  /* Get a free slot. Completed requests keep their slot until gathered. */
+  int slot = -1;
+  for (int i = 0; i < STORC_MAXWINDOW; i++)
+    {
+      if (!Pending[i].used)
+        {
+          slot = i;
+          break;
+        }
+    }
+  if (slot == -1)
+    {
+      debug_error ("Too many completed requests not gathered yet.");
+      return -1;
+    }
+
+  status = sendRequest (request);
+  if (status < 0)
+    return status;
+
+  Pending[slot].used = 1;
+  Pending[slot].done = 0;
+  Pending[slot].seq = request->seq;
+  Pending[slot].status = 0;
+  Pending[slot].record = record;
+  Pending[slot].latency = NULL;
+  Pending[slot].aggregate = NULL;
+  Pending[slot].internal = internal;
+  Pending[slot].op = request->requested_op;
+  Pending[slot].table = request->table;
+  Pending[slot].deadline = request->deadline;
+  in_flight++;
+  return seq2tag (request->seq);
+}
+
+
+/**
+ * Attach the cache of the current table shared by the server, if any.
+ * Without it, every read of the table is sent to the server.
+ */
+static void
+attachSharedCache ()
+{
+  int shm = shmget (MYSTORE_TABLE_KEY (current_table), 0, 0);
+  if (shm == -1)
+    {
+      debug_info ("Server does not share the cache of table %d. Local reads disabled.", current_table);
+      return;
+    }
+  const MYC_SHARED_t *header = (const MYC_SHARED_t *) shmat (shm, NULL, SHM_RDONLY);
+  if (header == (void *) -1)
+    {
+      debug_perror ("Error attaching shared cache.");
+      return;
+    }
+  if (__atomic_load_n (&header->magic, __ATOMIC_ACQUIRE) != MYC_SHM_MAGIC)
+    {
+      debug_error ("Shared cache is not valid.");
+      shmdt (header);
+      return;
+    }
+  shared_cache[current_table] = header;
+  debug_info ("Shared cache of table %d attached (%u entries).", current_table, header->numentries);
+}
+
+/**
+ * Copy some bytes of a page from the shared cache. The bytes are copied
+ * between two reads of the version of the entry holding the page. The copy
+ * is only valid if both versions are the same and even (no update in between).
+ * @param header The shared cache.
+ * @param pageNumber The page of the file.
+ * @param offset Offset of the bytes in the page.
+ * @param copy Where to copy the bytes.
+ * @param size Bytes to copy.
+ * @return 0 if copied. -1 if the page is not in the cache.
+ */
+static int
+copyShared (const MYC_SHARED_t *header, uint32_t pageNumber, size_t offset, void *copy, size_t size)
+{
+  const unsigned int *versions = MYC_SHM_VERSIONS (header);
+  const uint32_t *pages = MYC_SHM_PAGES (header);
+  for (unsigned int i = 0; i < header->numentries; i++)
+    {
+      if (pages[i] != pageNumber)
+        continue;
+      for (int retry = 0; retry < LOCAL_READ_RETRIES; retry++)
+        {
+          unsigned int before = __atomic_load_n (&versions[i], __ATOMIC_ACQUIRE);
+          if (before & 1)
+            continue;
+          if (pages[i] != pageNumber)
+            return -1;
+          memcpy (copy, MYC_SHM_ENTRY (header, i) + offset, size);
+          /* The copy must be finished before reading the version again. */
+          __atomic_thread_fence (__ATOMIC_ACQUIRE);
+          if (__atomic_load_n (&versions[i], __ATOMIC_RELAXED) == before)
+            return 0;
+        }
+      return -1;
+    }
+  return -1;
+}
+
+/**
+ * Copy a packed record from a page of the shared cache, like copyShared().
+ * @param header The shared cache.
+ * @param rid The page and slot of the record.
+ * @param fileIndex The index of the record.
+ * @param packed Where to copy the record. It must hold a page.
+ * @return Bytes of the record. -1 if the page is not in the cache or the
+ * slot does not hold the record any more.
+ */
+static int
+copySharedRecord (const MYC_SHARED_t *header, const MYPAGE_RID_t *rid, int fileIndex, unsigned char *packed)
+{
+  const unsigned int *versions = MYC_SHM_VERSIONS (header);
+  const uint32_t *pages = MYC_SHM_PAGES (header);
+  for (unsigned int i = 0; i < header->numentries; i++)
+    {
+      if (pages[i] != rid->page)
+        continue;
+      for (int retry = 0; retry < LOCAL_READ_RETRIES; retry++)
+        {
+          unsigned int before = __atomic_load_n (&versions[i], __ATOMIC_ACQUIRE);
+          if (before & 1)
+            continue;
+          if (pages[i] != rid->page)
+            return -1;
+          /* The page may be changing: the slot is checked before copying. */
+          size_t length;
+          const unsigned char *record = MYP_record (MYC_SHM_ENTRY (header, i), rid->slot, fileIndex, &length);
+          if (record != NULL)
+            memcpy (packed, record, length);
+          __atomic_thread_fence (__ATOMIC_ACQUIRE);
+          if (__atomic_load_n (&versions[i], __ATOMIC_RELAXED) == before)
+            return record != NULL ? (int) length : -1;
+        }
+      return -1;
+    }
+  return -1;
+}
+
+/**
+ * Copy a record from the shared cache without asking the server. The
+ * directory is followed down to the page of the record. Every page on the
+ * way must be in the cache.
+ * @param fileIndex This is the index of the record to read.
+ * @param record This is a pointer to a record allocated by the user.
+ * @return 0 if the record was in the cache. -1 means it must be read from
+ * the server.
+ */
+static int
+readShared (int fileIndex, MYRECORD_RECORD_t *record)
+{
+  const MYC_SHARED_t *header = shared_cache[current_table];
+
+  /* The server clears the magic number when it stops sharing the cache. */
+  if (__atomic_load_n (&header->magic, __ATOMIC_ACQUIRE) != MYC_SHM_MAGIC)
+    return -1;
+  /* The server checks the indices it can't hold. */
+  if (fileIndex < 0)
+    return -1;
+  /* Only tables stored by rows have a directory: the server reads the others. */
+  if (header->file.layout != MYC_LAYOUT_ROWS)
+    return -1;
+
+  /* The server clears the root while the directory grows a level: the
+   * levels read before and after a root must be the same. */
+  unsigned int extra = __atomic_load_n (&header->file.extralevels, __ATOMIC_ACQUIRE);
+  uint32_t pageNumber = __atomic_load_n (&header->file.root, __ATOMIC_ACQUIRE);
+  int levels = MYP_NODELEVELS + (int) extra;
+  if (__atomic_load_n (&header->file.extralevels, __ATOMIC_ACQUIRE) != extra
+      || (uint64_t) fileIndex >= MYP_records (levels))
+    return -1;
+  for (int level = levels; level > 0; level--)
+    {
+      size_t offset = MYP_entry (fileIndex, level) * sizeof (uint32_t);
+      if (pageNumber == 0 || copyShared (header, pageNumber, offset, &pageNumber, sizeof (pageNumber)) == -1)
+        return -1;
+    }
+  MYPAGE_RID_t rid;
+  if (pageNumber == 0
+      || copyShared (header, pageNumber, MYP_entry (fileIndex, 0) * sizeof (rid), &rid, sizeof (rid)) == -1
+      || rid.page == 0)
+    return -1;
+
+  unsigned char packed[MYP_PAGESIZE];
+  int length = copySharedRecord (header, &rid, fileIndex, packed);
+  if (length == -1 || MYSCH_unpack (MYSCH_recordSchema (), packed, length, record) == -1)
+    return -1;
+  debug_debug ("Entry %d read from shared cache.", fileIndex);
+  return 0;
+}
+
+/**
+ * Send a write without waiting for its answer. Every ack_every writes the
+ * server is asked for a cumulative acknowledgement which is gathered later.
+ * @param fileIndex This is the index of the record to write.
+ * @param record This is a pointer to a record allocated by the user.
+ * @return The first error reported by an acknowledgement since the last
+ * call, 0 if none. -1 means some error using the queue. -2 means that the
+ * queue was removed.
+ */
+static int
+writeNoack (int fileIndex, MYRECORD_RECORD_t *record)
+{
+  request_message_t request;
+  request.mtype = MYSAPMT_REQUEST;
+  request.return_to = MYSTORE_API_CLIENT;
+  request.requested_op = MYSCOP_WRITE;
+  request.flags = MYSCFL_NOACK;
+  request.index = fileIndex;
+  request.data = *record;
+
+  int status;
+  if (++unacked_writes >= ack_every)
+    {
+      /* Close the batch. The acknowledgement is gathered by later receptions. */
+      request.flags |= MYSCFL_ACKNOW;
+      unacked_writes = 0;
+      status = submitRequest (&request, NULL, 1);
+      if (status >= 0)
+        {
+          /* Gather acknowledgements already received without blocking. */
+          while (in_flight > 0 && (status = receiveAnswer (IPC_NOWAIT)) > 0)
+            ;
+        }
+    }
+  else
+    {
+      status = sendRequest (&request);
+    }
+  if (status < 0)
+    return status;
+
+  /* Report errors from previous acknowledgements only once. */
+  status = deferred_status;
+  deferred_status = 0;
+  return status;
+}
+
+/**
+ * Send a request without record and wait for its answer.
+ * @param op Operation to request.
+ * @param fileIndex Index argument of the operation.
+ * @param lsn LSN argument of the operation.
+ * @return Return the status from the server. -1 means some error using the
+ * queue. -2 means that the queue was removed.
+ */
+static int
+requestAndWait (MYSTORE_CLI_OP op, int fileIndex, uint64_t lsn)
+{
+  request_message_t request;
+  request.mtype = MYSAPMT_REQUEST;
+  request.return_to = MYSTORE_API_CLIENT;
+  request.requested_op = op;
+  request.flags = 0;
+  request.index = fileIndex;
+  request.lsn = lsn;
+
+  int tag = submitRequest (&request, NULL, 0);
+  if (tag < 0)
+    return tag;
+  return STORC_wait (tag);
+}
 
 /************************************************************
  PUBLIC FUNCTIONS
@@ -77,6 +874,9 @@ STORC_init ()
   /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
 
   debug_info ("Message queue opened in client API. (key=0x%08x)", key);
+
+  if (local_reads)
+    attachSharedCache ();
   /* Everything is OK */
   return 0;
 }
@@ -94,6 +894,23 @@ STORC_close ()
   /*    ==> No need to do anything in the client. Queue can't be closed. */
   debug_info ("Message queue closed in client API.");
 
+  /* Forget requests not gathered. Their answers will be discarded. */
+  if (in_flight > 0)
+    debug_error ("Closing client API with %d requests in flight.", in_flight);
+  memset (Pending, 0, sizeof (Pending));
+  in_flight = 0;
+  unacked_writes = 0;
+  deferred_status = 0;
+
+  for (int i = 0; i < STORC_MAXTABLES; i++)
+    {
+      if (shared_cache[i] != NULL)
+        {
+          shmdt (shared_cache[i]);
+          shared_cache[i] = NULL;
+        }
+    }
+
   /* Set the message queue descriptor to -1 to indicate it is not open. */
   message_queue = -1;
   return 0;
@@ -110,9 +927,71 @@ STORC_close ()
 int
 STORC_read (int fileIndex, MYRECORD_RECORD_t *record)
 {
-  /* Remember to create a unique number for each client and add it to the request.
-   * The PID of the process is OK as identifier by now. */
+  /* Records in the shared cache are copied without asking the server.
+   * Previous requests must be answered so that the cache includes our writes. */
+  if (shared_cache[current_table] != NULL && local_reads && in_flight == 0 && unacked_writes == 0)
+    {
+      if (readShared (fileIndex, record) == 0)
+        return 0;
+    }
+
+  /* A synchronous read is an asynchronous one followed by a wait. */
+  int tag = STORC_submitRead (fileIndex, record);
+  if (tag < 0)
+    return tag;
+  return STORC_wait (tag);
+}
+
+/**
+ * This function writes a record to the store server.
+ * @param fileIndex This is the index of the record to write.
+ * @param record This is a pointer to a record allocated by the user.
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue. -2 means that the queue was removed (server is not running).
+ */
+int
+STORC_write (int fileIndex, MYRECORD_RECORD_t *record)
+{
+  if (write_mode == STORC_WRITE_NOACK)
+    return writeNoack (fileIndex, record);
 
+  /* A synchronous write is an asynchronous one followed by a wait. */
+  int tag = STORC_submitWrite (fileIndex, record);
+  if (tag < 0)
+    return tag;
+  return STORC_wait (tag);
+}
+
+/**
+ * Set the number of asynchronous requests that may be waiting for an answer
+ * at the same time.
+ * @param new_window Number of requests in flight (1..STORC_MAXWINDOW).
+ * @return -1 if the window is out of range. 0 means OK.
+ */
+int
+STORC_setWindow (int new_window)
+{
+  if (new_window < 1 || new_window > STORC_MAXWINDOW)
+    {
+      debug_error ("Invalid window size (%d).", new_window);
+      return -1;
+    }
+  window = new_window;
+  debug_info ("Client window set to %d requests.", window);
+  return 0;
+}
+
+/**
+ * This function sends a read request to the store server without waiting
+ * for the answer.
+ * @param fileIndex This is the index of the record to read.
+ * @param record This is a pointer to a record allocated by the user.
+ * @return A tag (>=0) identifying the request. -1 means some error
+ * using the queue. -2 means that the queue was removed (server is not running).
+ */
+int
+STORC_submitRead (int fileIndex, MYRECORD_RECORD_t *record)
+{
   /* Send a request message to the server indicating the index to read. */
   request_message_t request;
   /* The server will be receiving only on this type. */
@@ -122,59 +1001,26 @@ STORC_read (int fileIndex, MYRECORD_RECORD_t *record)
   request.return_to = MYSTORE_API_CLIENT;
   /* This is the operation code. */
   request.requested_op = MYSCOP_READ;
+  request.flags = 0;
   /* This is the argument to the read operation. */
   request.index = fileIndex;
 
-  debug_verbose ("Sending request to server (idx=%d).", fileIndex);
-
-  /* Send the request to the server. */
-  int status = msgsnd (message_queue, &request, sizeof (request), 0);
-  if (status == -1)
-    {
-      debug_perror ("Error sending message.");
-      return -1;
-    }
-
-  /* Wait for an answer message from the server. This client should wait using its unique
-   number to avoid that other clients steal the answer to this client. */
-  answer_message_t answer;
-
-  debug_verbose ("Receiving answer from server (client id=%d).", request.return_to);
-  /* Receive the answer using the message client identifier. */
-  status = msgrcv (message_queue, &answer, sizeof (answer), request.return_to, 0);
-  if (status == -1)
-    {
-      debug_perror ("Error receiving answer.");
-      return -1;
-    }
-  debug_debug ("Answer received from server (status=%d).", answer.status);
-  /* Check return status and copy the record from the message if OK. */
-  if (answer.status == 0)
-    {
-      /* Copy the contents of the answer, not the pointer!!!! */
-      *record = answer.data;
-    }
-  /* Copy return status from server. */
-  return answer.status;
+  return submitRequest (&request, record, 0);
 }
 
 /**
- * This function writes a record to the store server.
+ * This function sends a write request to the store server without waiting
+ * for the answer.
  * @param fileIndex This is the index of the record to write.
  * @param record This is a pointer to a record allocated by the user.
- * @return Return the status from the server. 0 is OK. -1 means some error
+ * @return A tag (>=0) identifying the request. -1 means some error
  * using the queue. -2 means that the queue was removed (server is not running).
  */
 int
-STORC_write (int fileIndex, MYRECORD_RECORD_t *record)
+STORC_submitWrite (int fileIndex, MYRECORD_RECORD_t *record)
 {
   /* Send a request message to the server indicating the index to write and
    * include the record data to write. */
-
-  /* Remember to create a unique number for each client and add it to the request.
-   * The PID of the process is OK as identifier by now. */
-
-  /* Send a request message to the server indicating the index to read. */
   request_message_t request;
   /* The server will be receiving only on this type. */
   request.mtype = MYSAPMT_REQUEST;
@@ -183,33 +1029,355 @@ STORC_write (int fileIndex, MYRECORD_RECORD_t *record)
   request.return_to = MYSTORE_API_CLIENT;
   /* This is the operation code. */
   request.requested_op = MYSCOP_WRITE;
+  request.flags = 0;
   /* This are the arguments to the write operation. */
   request.index = fileIndex;
   request.data = *record;
 
-  debug_verbose ("Sending request to server (idx=%d).", fileIndex);
+  return submitRequest (&request, NULL, 0);
+}
 
-  /* Send the request to the server. */
-  int status = msgsnd (message_queue, &request, sizeof (request), 0);
-  if (status == -1)
+/**
+ * This function gathers the requests already completed without blocking.
+ * @param tags Array to return the tags of the completed requests.
+ * @param statuses Array to return the status from the server of each request.
+ * @param max Size of both arrays.
+ * @return Number of completions returned. -1 means some error using the
+ * queue. -2 means that the queue was removed (server is not running).
+ */
+int
+STORC_poll (int *tags, int *statuses, int max)
+{
+  /* Drain every answer already waiting in the queue. */
+  int status;
+  while (in_flight > 0 && (status = receiveAnswer (IPC_NOWAIT)) != 0)
     {
-      debug_perror ("Error sending message.");
+      if (status < 0)
+        return status;
+    }
+  expirePending ();
+
+  int n = 0;
+  for (int i = 0; i < STORC_MAXWINDOW && n < max; i++)
+    {
+      if (Pending[i].used && Pending[i].done)
+        {
+          tags[n] = seq2tag (Pending[i].seq);
+          statuses[n] = Pending[i].status;
+          Pending[i].used = 0;
+          n++;
+        }
+    }
+  return n;
+}
+
+/**
+ * This function waits until the request identified by tag is completed.
+ * @param tag Tag returned by STORC_submitRead() or STORC_submitWrite().
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue or an unknown tag. -2 means that the queue was removed.
+ */
+int
+STORC_wait (int tag)
+{
+  int slot = searchPending (tag);
+  if (slot == -1)
+    {
+      debug_error ("Unknown request tag (%d).", tag);
       return -1;
     }
 
-  /* Wait for an answer message from the server. This client should wait using its unique
-   number to avoid that other clients steal the answer to this client. */
-  answer_message_t answer;
+  /* Answers for other requests may arrive first. They are kept in their slots. */
+  while (!Pending[slot].done)
+    {
+      int status = waitAnswer (Pending[slot].deadline);
+      if (status < 0)
+        return status;
+      if (status == 0)
+        expirePending ();
+    }
 
-  debug_verbose ("Receiving answer from server (client id=%d).", request.return_to);
-  /* Receive the answer using the message client identifier. */
-  status = msgrcv (message_queue, &answer, sizeof (answer), request.return_to, 0);
-  if (status == -1)
+  Pending[slot].used = 0;
+  return Pending[slot].status;
+}
+
+/**
+ * Select how STORC_write() waits for the server.
+ * @param mode STORC_WRITE_ACK or STORC_WRITE_NOACK.
+ * @param new_ack_every Number of writes between acknowledgements (>=1).
+ * @return -1 if the arguments are not valid. Otherwise, like STORC_sync().
+ */
+int
+STORC_setWriteMode (int mode, int new_ack_every)
+{
+  if ((mode != STORC_WRITE_ACK && mode != STORC_WRITE_NOACK) || new_ack_every < 1)
     {
-      debug_perror ("Error receiving answer.");
+      debug_error ("Invalid write mode (mode=%d, ack_every=%d).", mode, new_ack_every);
       return -1;
     }
-  debug_debug ("Answer received from server (status=%d).", answer.status);
-  /* Copy return status from server. */
-  return answer.status;
+
+  int status = 0;
+  /* Leaving the unacknowledged mode needs every write to be acknowledged. */
+  if (write_mode == STORC_WRITE_NOACK && mode == STORC_WRITE_ACK)
+    status = STORC_sync ();
+
+  write_mode = mode;
+  ack_every = new_ack_every;
+  debug_info ("Write mode set to %d (ack every %d writes).", write_mode, ack_every);
+  return status;
+}
+
+/**
+ * This function waits until the server has processed every write sent
+ * by this client.
+ * @return 0 if every unacknowledged write succeeded. Otherwise, the status
+ * of the first failed write. -1 means some error using the queue. -2 means
+ * that the queue was removed (server is not running).
+ */
+int
+STORC_sync ()
+{
+  /* The server answers requests of a client in order, so the answer to this
+   * request comes after every previous acknowledgement. */
+  int status = requestAndWait (MYSCOP_SYNC, 0, 0);
+  if (status == -2)
+    return status;
+
+  unacked_writes = 0;
+  if (status == 0)
+    status = deferred_status;
+  deferred_status = 0;
+  return status;
+}
+
+/**
+ * Enable or disable local reads from the cache shared by the server.
+ * @param enable 0 to disable local reads. Otherwise, enable them.
+ */
+void
+STORC_setLocalReads (int enable)
+{
+  local_reads = enable;
+  /* The cache is attached at initialization if local reads are enabled. */
+  if (local_reads && shared_cache[current_table] == NULL && message_queue != -1)
+    attachSharedCache ();
+  debug_info ("Local reads %s.", local_reads ? "enabled" : "disabled");
+}
+
+/**
+ * This function flushes this record index inside the storage server.
+ * @param fileIndex This is the index of the record to flush.
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue. -2 means that the queue was removed (server is not running).
+ */
+int
+STORC_flush (int fileIndex)
+{
+  return requestAndWait (MYSCOP_FLUSH, fileIndex, 0);
+}
+
+/**
+ * This function flushes all the entries in the storage server.
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue. -2 means that the queue was removed (server is not running).
+ */
+int
+STORC_flushAll ()
+{
+  return requestAndWait (MYSCOP_FLUSHALL, 0, 0);
+}
+
+/**
+ * Get the LSN of the last write of this client acknowledged by the server in
+ * the current table.
+ * @return The LSN. 0 if no write was acknowledged yet.
+ */
+uint64_t
+STORC_lastLSN ()
+{
+  return last_lsn[current_table];
+}
+
+/**
+ * This function waits until every write up to the given LSN is stored on
+ * disk by the server.
+ * @param lsn LSN returned by STORC_lastLSN().
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue. -2 means that the queue was removed (server is not running).
+ */
+int
+STORC_waitDurable (uint64_t lsn)
+{
+  return requestAndWait (MYSCOP_DURABLE, 0, lsn);
+}
+
+/**
+ * Select the wire format of the requests sent to the server.
+ * @param format STORC_WIRE_LEGACY or STORC_WIRE_COMPACT.
+ * @return -1 if the format is not valid. 0 means OK.
+ */
+int
+STORC_setWireFormat (int format)
+{
+  if (format == STORC_WIRE_LEGACY)
+    wire_format = MYSWIRE_LEGACY;
+  else if (format == STORC_WIRE_COMPACT)
+    wire_format = MYSWIRE_COMPACT;
+  else
+    {
+      debug_error ("Invalid wire format (%d).", format);
+      return -1;
+    }
+  debug_info ("Wire format set to %d.", wire_format);
+  return 0;
+}
+
+/**
+ * Set the share of the server this client gets while other clients have
+ * requests waiting too.
+ * @param weight Requests served per turn, from 1 to STORC_MAXWEIGHT.
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue or an invalid weight. -2 means that the queue was removed.
+ */
+int
+STORC_setWeight (int weight)
+{
+  return requestAndWait (MYSCOP_SETWEIGHT, weight, 0);
+}
+
+/**
+ * Set the priority class of the next requests. The server keeps the order
+ * of the requests of a client only within a class, so the requests already
+ * sent are served before switching: unacknowledged writes are synced and
+ * every request in flight is answered.
+ * @param priority STORC_PRIORITY_INTERACTIVE, STORC_PRIORITY_NORMAL or
+ * STORC_PRIORITY_BULK.
+ * @return -1 if the priority is not valid. Otherwise, like STORC_sync().
+ */
+int
+STORC_setPriority (int priority)
+{
+  if (priority < STORC_PRIORITY_INTERACTIVE || priority > STORC_PRIORITY_BULK)
+    {
+      debug_error ("Invalid priority (%d).", priority);
+      return -1;
+    }
+  if (request_type == MYSAPMT_INTERACTIVE + priority)
+    return 0;
+
+  int status = 0;
+  /* Writes without acknowledgement are not in flight: the answer to a sync
+   * comes after them. */
+  if (unacked_writes > 0)
+    status = STORC_sync ();
+  if (status != -2)
+    {
+      int drained = waitInFlight (0);
+      if (drained < 0)
+        status = drained;
+    }
+
+  request_type = MYSAPMT_INTERACTIVE + priority;
+  debug_info ("Request priority set to %d.", priority);
+  return status;
+}
+
+/**
+ * Select the table of the next requests.
+ * @param table Table of the server, from 0 to STORC_MAXTABLES - 1.
+ * @return -1 if the table is out of range. 0 means OK.
+ */
+int
+STORC_setTable (int table)
+{
+  if (table < 0 || table >= STORC_MAXTABLES)
+    {
+      debug_error ("Invalid table (%d).", table);
+      return -1;
+    }
+  current_table = table;
+  /* Each table has its own shared cache. */
+  if (local_reads && shared_cache[current_table] == NULL && message_queue != -1)
+    attachSharedCache ();
+  debug_info ("Table set to %d.", current_table);
+  return 0;
+}
+
+/**
+ * Set how long the next requests may take before the client gives up.
+ * @param ms Milliseconds from sending each request. 0 means forever.
+ * @return -1 if the timeout is negative. 0 means OK.
+ */
+int
+STORC_setTimeout (int ms)
+{
+  if (ms < 0)
+    {
+      debug_error ("Invalid timeout (%d ms).", ms);
+      return -1;
+    }
+  timeout_ms = ms;
+  debug_info ("Request timeout set to %d ms.", timeout_ms);
+  return 0;
+}
+
+/**
+ * Get the latency percentiles measured by the server for a class of requests.
+ * @param latencyClass One of the STORC_LAT_* classes.
+ * @param latency Structure to fill with the percentiles.
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue or an invalid class. -2 means that the queue was removed.
+ */
+int
+STORC_stats (int latencyClass, STORC_LATENCY_t *latency)
+{
+  request_message_t request;
+  request.mtype = MYSAPMT_REQUEST;
+  request.return_to = MYSTORE_API_CLIENT;
+  request.requested_op = MYSCOP_STATS;
+  request.flags = 0;
+  request.index = latencyClass;
+  request.lsn = 0;
+
+  int tag = submitRequest (&request, NULL, 0);
+  if (tag < 0)
+    return tag;
+  Pending[searchPending (tag)].latency = latency;
+  return STORC_wait (tag);
+}
+
+/**
+ * Aggregate an integer field over a range of records of the current table.
+ * @param field Name of the field in the schema of the records.
+ * @param fileIndex Index of the first record.
+ * @param count Number of records.
+ * @param aggregate Structure to fill with the aggregate.
+ * @return Return the status from the server. 0 is OK. -1 means some error
+ * using the queue, an unknown field or an invalid range. -2 means that the
+ * queue was removed (server is not running).
+ */
+int
+STORC_aggregate (const char *field, int fileIndex, int count, STORC_AGGREGATE_t *aggregate)
+{
+  int number = MYSCH_findField (MYSCH_recordSchema (), field);
+  if (number == -1 || count < 0)
+    {
+      debug_error ("Invalid aggregate of field %s over %d records.", field, count);
+      return -1;
+    }
+  request_message_t request;
+  request.mtype = MYSAPMT_REQUEST;
+  request.return_to = MYSTORE_API_CLIENT;
+  request.requested_op = MYSCOP_AGGREGATE;
+  request.flags = 0;
+  request.index = fileIndex;
+  request.lsn = 0;
+  request.count = count;
+  request.field = number;
+
+  int tag = submitRequest (&request, NULL, 0);
+  if (tag < 0)
+    return tag;
+  Pending[searchPending (tag)].aggregate = aggregate;
+  return STORC_wait (tag);
 }
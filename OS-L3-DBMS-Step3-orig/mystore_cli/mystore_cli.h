@@ -31,12 +31,26 @@ extern "C"
    */
   int STORC_close ();
 
+  /* Status returned by reads and writes rejected because the server is
+   * overloaded. Nothing was done: retry later. */
+#define STORC_OVERLOADED -5
+
+  /* Status returned by requests not answered before their timeout (see
+   * STORC_setTimeout()). A write may or may not have been done. */
+#define STORC_TIMEDOUT -7
+
+  /* Record indices are ints: a table of rows, columns or an LSM tree holds
+   * the records from 0 to INT_MAX. A B+tree takes any 32-bit registerid,
+   * negative indices being the keys from 2^31 up. */
+
   /**
    * This function reads a record from the store server.
    * @param fileIndex This is the index of the record to read.
    * @param record This is a pointer to a record allocated by the user.
    * @return Return the status from the server. 0 is OK. -1 means some error
    * using the queue. -2 means that the queue was removed (server is not running).
+   * STORC_OVERLOADED means that the server rejected the read.
+   * STORC_TIMEDOUT means that it was not answered in time.
    */
   int STORC_read (int fileIndex, MYRECORD_RECORD_t *record);
 
@@ -46,15 +60,267 @@ extern "C"
    * @param record This is a pointer to a record allocated by the user.
    * @return Return the status from the server. 0 is OK. -1 means some error
    * using the queue. -2 means that the queue was removed (server is not running).
+   * STORC_OVERLOADED means that the server rejected the write.
+   * STORC_TIMEDOUT means that it was not answered in time.
+   * In STORC_WRITE_NOACK mode the status is the one of some previous write
+   * reported by a cumulative acknowledgement.
    */
   int STORC_write (int fileIndex, MYRECORD_RECORD_t *record);
 
-  /* This function flushes this record index inside the storage server. */
+  /* Maximum number of requests that a client may keep in flight at once. */
+#define STORC_MAXWINDOW 64
+  /* Default number of requests in flight for the asynchronous API. */
+#define STORC_DEFAULTWINDOW 16
+
+  /**
+   * Set the number of asynchronous requests that may be waiting for an answer
+   * at the same time. Submitting more requests blocks until an answer arrives.
+   * @param window Number of requests in flight (1..STORC_MAXWINDOW).
+   * @return -1 if the window is out of range. 0 means OK.
+   */
+  int STORC_setWindow (int window);
+
+  /**
+   * This function sends a read request to the store server without waiting
+   * for the answer. The record is filled in when the answer is gathered.
+   * @param fileIndex This is the index of the record to read.
+   * @param record This is a pointer to a record allocated by the user. It must
+   * stay valid until the request completes.
+   * @return A tag (>=0) identifying the request. -1 means some error
+   * using the queue. -2 means that the queue was removed (server is not running).
+   */
+  int STORC_submitRead (int fileIndex, MYRECORD_RECORD_t *record);
+
+  /**
+   * This function sends a write request to the store server without waiting
+   * for the answer. The record is copied before returning.
+   * @param fileIndex This is the index of the record to write.
+   * @param record This is a pointer to a record allocated by the user.
+   * @return A tag (>=0) identifying the request. -1 means some error
+   * using the queue. -2 means that the queue was removed (server is not running).
+   */
+  int STORC_submitWrite (int fileIndex, MYRECORD_RECORD_t *record);
+
+  /**
+   * This function gathers the requests already completed without blocking.
+   * @param tags Array to return the tags of the completed requests.
+   * @param statuses Array to return the status from the server of each request.
+   * @param max Size of both arrays.
+   * @return Number of completions returned. -1 means some error using the
+   * queue. -2 means that the queue was removed (server is not running).
+   */
+  int STORC_poll (int *tags, int *statuses, int max);
+
+  /**
+   * This function waits until the request identified by tag is completed.
+   * @param tag Tag returned by STORC_submitRead() or STORC_submitWrite().
+   * @return Return the status from the server. 0 is OK. -1 means some error
+   * using the queue or an unknown tag. -2 means that the queue was removed.
+   * STORC_TIMEDOUT means that the request timed out.
+   */
+  int STORC_wait (int tag);
+
+  /* Every write waits for its answer from the server (default). */
+#define STORC_WRITE_ACK 0
+  /* Writes get no answer. The server acknowledges them in batches. */
+#define STORC_WRITE_NOACK 1
+
+  /**
+   * Select how STORC_write() waits for the server.
+   * In STORC_WRITE_NOACK mode each write is a single message to the server and
+   * every ack_every writes the server sends back a cumulative acknowledgement
+   * that is gathered later without blocking the caller. Errors reported in
+   * an acknowledgement are returned by the next STORC_write() or STORC_sync().
+   * Switching back to STORC_WRITE_ACK calls STORC_sync() first.
+   * @param mode STORC_WRITE_ACK or STORC_WRITE_NOACK.
+   * @param ack_every Number of writes between acknowledgements (>=1).
+   * @return -1 if the arguments are not valid. Otherwise, like STORC_sync().
+   */
+  int STORC_setWriteMode (int mode, int ack_every);
+
+  /**
+   * This function waits until the server has processed every write sent
+   * by this client.
+   * @return 0 if every unacknowledged write succeeded. Otherwise, the status
+   * of the first failed write. -1 means some error using the queue. -2 means
+   * that the queue was removed (server is not running).
+   */
+  int STORC_sync ();
+
+  /* Requests and answers are sent as fixed size structures. */
+#define STORC_WIRE_LEGACY 0
+  /* Requests and answers carry a small header and only the fields needed (default). */
+#define STORC_WIRE_COMPACT 2
+
+  /**
+   * Select the wire format of the requests sent to the server. The server
+   * answers in the format of each request.
+   * @param format STORC_WIRE_LEGACY or STORC_WIRE_COMPACT.
+   * @return -1 if the format is not valid. 0 means OK.
+   */
+  int STORC_setWireFormat (int format);
+
+  /**
+   * Enable or disable local reads. When the server runs on the same machine
+   * and shares its cache, STORC_read() copies records already in the cache
+   * directly from the shared memory without sending any message. Local reads
+   * are only used when every previous request of this client was answered.
+   * They are enabled by default.
+   * @param enable 0 to disable local reads. Otherwise, enable them.
+   */
+  void STORC_setLocalReads (int enable);
+
+  /**
+   * This function flushes this record index inside the storage server.
+   * @param fileIndex This is the index of the record to flush.
+   * @return Return the status from the server. 0 is OK. -1 means some error
+   * using the queue. -2 means that the queue was removed (server is not running).
+   */
   int STORC_flush (int fileIndex);
 
-  /* This function flushes all the entries in the storage server. */
+  /**
+   * This function flushes all the entries in the storage server, in every table.
+   * @return Return the status from the server. 0 is OK. -1 means some error
+   * using the queue. -2 means that the queue was removed (server is not running).
+   */
   int STORC_flushAll ();
 
+  /**
+   * Each write accepted by the server gets a log sequence number (LSN) that
+   * grows with every write of its table. This function returns the LSN of the
+   * last write of this client to the current table acknowledged by the
+   * server (0 if none).
+   * Passing it to STORC_waitDurable() makes every previous write durable.
+   */
+  uint64_t STORC_lastLSN ();
+
+  /**
+   * This function waits until every write to the current table up to the
+   * given LSN is stored on disk by the server. Writes already durable cost a single round trip.
+   * @param lsn LSN returned by STORC_lastLSN().
+   * @return Return the status from the server. 0 is OK. -1 means some error
+   * using the queue. -2 means that the queue was removed (server is not running).
+   */
+  int STORC_waitDurable (uint64_t lsn);
+
+  /* Classes of requests measured by the server. */
+#define STORC_LAT_READHIT 0
+#define STORC_LAT_READMISS 1
+#define STORC_LAT_WRITEHIT 2
+#define STORC_LAT_WRITEMISS 3
+#define STORC_LAT_OTHER 4
+
+  /* Percentiles reported for each latency, in this order: p50, p99, p999. */
+#define STORC_PERCENTILES 3
+
+  /**
+   * Latency percentiles of one class of requests, in nanoseconds.
+   */
+  typedef struct
+  {
+    uint64_t count; /* Requests served. */
+    uint64_t queue[STORC_PERCENTILES]; /* Waiting in the queue until the server starts serving it. */
+    uint64_t service[STORC_PERCENTILES]; /* Serving the request. */
+    uint64_t total[STORC_PERCENTILES]; /* From sending the request to sending back its answer. */
+  } STORC_LATENCY_t;
+
+  /**
+   * This function gets the latency percentiles measured by the server for
+   * a class of requests since it started.
+   * @param latencyClass One of the STORC_LAT_* classes.
+   * @param latency Structure to fill with the percentiles.
+   * @return Return the status from the server. 0 is OK. -1 means some error
+   * using the queue or an invalid class. -2 means that the queue was removed
+   * (server is not running).
+   */
+  int STORC_stats (int latencyClass, STORC_LATENCY_t *latency);
+
+  /* Largest weight of a client. */
+#define STORC_MAXWEIGHT 64
+
+  /**
+   * This function sets the share of the server this client gets. The server
+   * queues the requests of each client apart and the clients with requests
+   * waiting take turns: each turn a client is served up to its weight of
+   * requests (1 by default). Give interactive clients a higher weight than
+   * bulk loaders so they are not stuck behind them.
+   * @param weight Requests served per turn, from 1 to STORC_MAXWEIGHT.
+   * @return Return the status from the server. 0 is OK. -1 means some error
+   * using the queue or an invalid weight. -2 means that the queue was removed
+   * (server is not running).
+   */
+  int STORC_setWeight (int weight);
+
+  /**
+   * This function sets how long the next requests may take. Each request
+   * carries its deadline: the server drops it without doing it if it can't
+   * start it in time, and the client stops waiting for it then. Calls return
+   * STORC_TIMEDOUT instead of blocking forever if the server is stalled.
+   * Waiting with a timeout polls the queue instead of blocking in it.
+   * @param ms Milliseconds from sending each request. 0 (default) means forever.
+   * @return -1 if the timeout is negative. 0 means OK.
+   */
+  int STORC_setTimeout (int ms);
+
+  /* Maximum number of tables of the server. */
+#define STORC_MAXTABLES 16
+
+  /**
+   * This function selects the table of the next requests. The server may
+   * serve several tables, each one with its own file and its own cache.
+   * Table 0 (default) is the table of the server started without options.
+   * Requests to a table the server does not serve fail with -1.
+   * @param table Table of the server, from 0 to STORC_MAXTABLES - 1.
+   * @return -1 if the table is out of range. 0 means OK.
+   */
+  int STORC_setTable (int table);
+
+  /**
+   * Aggregate of an integer field over a range of records.
+   */
+  typedef struct
+  {
+    uint64_t count; /* Records scanned. */
+    int64_t sum; /* Sum of the values. */
+    int64_t min; /* Lowest value. 0 if no record. */
+    int64_t max; /* Highest value. 0 if no record. */
+  } STORC_AGGREGATE_t;
+
+  /**
+   * This function asks the server to count, add up and find the lowest and
+   * highest values of an integer field over the records of the current table
+   * from fileIndex to fileIndex + count - 1. Records never written are
+   * skipped in tables stored by rows or as log-structured merge trees and
+   * count as empty in tables stored by columns. The server reads only the column of the field when the table
+   * is stored by columns.
+   * @param field Name of the field (see myschema.h), like "age".
+   * @param fileIndex Index of the first record.
+   * @param count Number of records.
+   * @param aggregate Structure to fill with the aggregate.
+   * @return Return the status from the server. 0 is OK. -1 means some error
+   * using the queue, an unknown field, a field which is not an integer or an
+   * invalid range. -2 means that the queue was removed (server is not running).
+   */
+  int STORC_aggregate (const char *field, int fileIndex, int count, STORC_AGGREGATE_t *aggregate);
+
+  /* Priority classes of the requests. */
+#define STORC_PRIORITY_INTERACTIVE 0
+#define STORC_PRIORITY_NORMAL 1
+#define STORC_PRIORITY_BULK 2
+
+  /**
+   * This function sets the priority class of the next requests of this client
+   * (STORC_PRIORITY_NORMAL by default). The server serves the waiting requests
+   * of higher classes first, but lower classes are never starved: they get
+   * one turn every few while they have requests waiting. Requests of one
+   * client are served in order whatever their class: changing the class
+   * waits until every request sent before is served, syncing the writes
+   * not acknowledged yet (see STORC_sync()).
+   * @param priority One of the STORC_PRIORITY_* classes.
+   * @return -1 if the priority is not valid. Otherwise, like STORC_sync().
+   */
+  int STORC_setPriority (int priority);
+
 #ifdef __cplusplus
 }
 #endif
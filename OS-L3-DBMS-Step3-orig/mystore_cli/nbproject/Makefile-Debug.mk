@@ -67,7 +67,7 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/libmystore_cli.a: ${OBJECTFILES}
 ${OBJECTDIR}/libmystore_cli.o: libmystore_cli.c nbproject/Makefile-${CND_CONF}.mk
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -g -Werror -DDEBUG_LIB -D_XOPEN_SOURCE -I../mycache -I../mystore_srv -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmystore_cli.o libmystore_cli.c
+	$(COMPILE.c) -g -Werror -DDEBUG_LIB -D_GNU_SOURCE -D_XOPEN_SOURCE -I../mycache -I../mystore_srv -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmystore_cli.o libmystore_cli.c
 
 # Subprojects
 .build-subprojects:
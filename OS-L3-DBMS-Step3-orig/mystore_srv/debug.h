@@ -28,11 +28,22 @@ extern "C"
 #define debuglevel_decrease() {if(debug_level>DEBUG_ERROR) debug_level--;}
 #define debuglevel_rotate() {if(debug_level<DEBUG_VERBOSE) debug_level++;else debug_level=DEBUG_ERROR;}
 
+#ifdef DEBUG_ASYNC
+  /* Messages are formatted into a buffer and written by a background thread. */
+#include "mylog.h"
+#define debug_error(...) {if(debug_level>=DEBUG_ERROR){MYL_log(__FILE__,__func__,"ERROR",NULL,__VA_ARGS__);}}
+#define debug_perror(...) {if(debug_level>=DEBUG_ERROR){MYL_log(__FILE__,__func__,"ERROR",strerror(errno),__VA_ARGS__);}}
+#define debug_info(...) {if(debug_level>=DEBUG_INFO){MYL_log(__FILE__,__func__,"INFO",NULL,__VA_ARGS__);}}
+#else
 #define debug_error(...) {if(debug_level>=DEBUG_ERROR){fprintf(stderr,"%s:%s()::ERROR ",__FILE__,__func__);fprintf(stderr, __VA_ARGS__);fputc('\n',stderr);}}
 #define debug_perror(...) {if(debug_level>=DEBUG_ERROR){fprintf(stderr,"%s:%s()::ERROR ",__FILE__,__func__);fprintf(stderr, __VA_ARGS__);fputs(strerror(errno),stderr);fputc('\n',stderr);}}
 #define debug_info(...) {if(debug_level>=DEBUG_INFO){fprintf(stderr,"%s:%s()::INFO ",__FILE__,__func__);fprintf(stderr, __VA_ARGS__);fputc('\n',stderr);}}
+#endif
   /* Use conditional compilation to remove this code from program. */
-#ifdef DEBUG_LIB
+#if defined(DEBUG_LIB) && defined(DEBUG_ASYNC)
+#define debug_debug(...) {if(debug_level>=DEBUG_DEBUG){MYL_log(__FILE__,__func__,"DEBUG",NULL,__VA_ARGS__);}}
+#define debug_verbose(...) {if(debug_level>=DEBUG_VERBOSE){MYL_log(__FILE__,__func__,"VERBOSE",NULL,__VA_ARGS__);}}
+#elif defined(DEBUG_LIB)
 #define debug_debug(...) {if(debug_level>=DEBUG_DEBUG){fprintf(stderr,"%s:%s()::DEBUG ",__FILE__,__func__);fprintf(stderr, __VA_ARGS__);fputc('\n',stderr);}}
 #define debug_verbose(...) {if(debug_level>=DEBUG_VERBOSE){fprintf(stderr,"%s:%s()::VERBOSE ",__FILE__,__func__);fprintf(stderr, __VA_ARGS__);fputc('\n',stderr);}}
 #else
@@ -0,0 +1,96 @@
+/*
+ * File:   libmyhist.c
+ *
+ * This file implements the latency histograms of the store server.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+#include "myhist.h"
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Get the bucket of a value. Values below MYH_SUBBUCKETS have a bucket each.
+ * Above, the bucket is given by the highest bit and the MYH_SUBBITS bits
+ * following it.
+ * @param value The value.
+ * @return Index of the bucket.
+ */
+static int
+bucketOf (uint64_t value)
+{
+  if (value < MYH_SUBBUCKETS)
+    return (int) value;
+  int msb = 63 - __builtin_clzll (value);
+  int shift = msb - MYH_SUBBITS;
+  return (shift + 1) * MYH_SUBBUCKETS + (int) ((value >> shift) - MYH_SUBBUCKETS);
+}
+
+/**
+ * Get the highest value recorded in a bucket.
+ * @param bucket Index of the bucket.
+ * @return The value.
+ */
+static uint64_t
+highestOf (int bucket)
+{
+  if (bucket < MYH_SUBBUCKETS)
+    return (uint64_t) bucket;
+  int shift = bucket / MYH_SUBBUCKETS - 1;
+  uint64_t lowest = (uint64_t) (bucket % MYH_SUBBUCKETS + MYH_SUBBUCKETS) << shift;
+  return lowest + ((uint64_t) 1 << shift) - 1;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+uint64_t
+MYH_now ()
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void
+MYH_reset (MYH_HISTOGRAM_t *histogram)
+{
+  memset (histogram, 0, sizeof (*histogram));
+}
+
+void
+MYH_record (MYH_HISTOGRAM_t *histogram, uint64_t value)
+{
+  histogram->buckets[bucketOf (value)]++;
+  histogram->count++;
+  if (value > histogram->max)
+    histogram->max = value;
+}
+
+uint64_t
+MYH_percentile (const MYH_HISTOGRAM_t *histogram, double percentile)
+{
+  if (histogram->count == 0)
+    return 0;
+  /* Number of values that must be at or below the result (at least one). */
+  uint64_t wanted = (uint64_t) (percentile / 100.0 * (double) histogram->count + 0.5);
+  if (wanted == 0)
+    wanted = 1;
+
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < MYH_BUCKETS; bucket++)
+    {
+      seen += histogram->buckets[bucket];
+      if (seen >= wanted)
+        {
+          uint64_t value = highestOf (bucket);
+          return value < histogram->max ? value : histogram->max;
+        }
+    }
+  return histogram->max;
+}
@@ -0,0 +1,201 @@
+/*
+ * File:   libmymetrics.c
+ *
+ * This file implements the metrics exporter of the store server.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "mymetrics.h"
+#include "debug.h"
+
+/************************************************************
+ PRIVATE VARIABLES
+ ************************************************************/
+
+/* Debug level for messages */
+static int debug_level = DEBUG_INIT;
+
+/* One metric registered. */
+typedef struct
+{
+  const char *name; /* Name with labels. */
+  const char *help; /* Description. */
+  MYM_TYPE type; /* Kind of metric. */
+  const uint64_t *value; /* Integer holding the value or NULL. */
+  uint64_t (*read) (); /* Function computing the value if value is NULL. */
+} metric_t;
+
+/* Metrics registered, in the order they are written. */
+static metric_t Metrics[MYM_MAXMETRICS];
+static int num_metrics = 0;
+
+/* Exporter thread. */
+static pthread_t exporter;
+static int exporter_running = 0;
+/* These only synchronize the exporter with MYM_stop(). */
+static pthread_mutex_t exporter_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t exporter_wakeup = PTHREAD_COND_INITIALIZER;
+static int exporter_stop = 0;
+static const char *exporter_path = NULL;
+static int exporter_period = 0;
+
+/************************************************************
+ PRIVATE FUNCTIONS
+ ************************************************************/
+
+/**
+ * Add a metric to the table.
+ * @return -1 if there is no room for more metrics. 0 means OK.
+ */
+static int
+addMetric (const char *name, const char *help, MYM_TYPE type, const uint64_t *value, uint64_t (*read) ())
+{
+  if (num_metrics == MYM_MAXMETRICS)
+    {
+      debug_error ("Too many metrics registered (%s).", name);
+      return -1;
+    }
+  Metrics[num_metrics].name = name;
+  Metrics[num_metrics].help = help;
+  Metrics[num_metrics].type = type;
+  Metrics[num_metrics].value = value;
+  Metrics[num_metrics].read = read;
+  num_metrics++;
+  return 0;
+}
+
+/**
+ * Get the length of the name of a metric without its labels.
+ * @param name The name.
+ * @return Length of the name.
+ */
+static size_t
+familyLength (const char *name)
+{
+  const char *labels = strchr (name, '{');
+  return labels == NULL ? strlen (name) : (size_t) (labels - name);
+}
+
+/**
+ * Body of the exporter thread.
+ * @param arg Not used.
+ * @return NULL
+ */
+static void *
+exporterMain (void *arg)
+{
+  (void) arg;
+  pthread_mutex_lock (&exporter_lock);
+  while (!exporter_stop)
+    {
+      struct timespec until;
+      clock_gettime (CLOCK_REALTIME, &until);
+      until.tv_sec += exporter_period;
+      while (!exporter_stop
+             && pthread_cond_timedwait (&exporter_wakeup, &exporter_lock, &until) != ETIMEDOUT)
+        ;
+      pthread_mutex_unlock (&exporter_lock);
+      MYM_write (exporter_path);
+      pthread_mutex_lock (&exporter_lock);
+    }
+  pthread_mutex_unlock (&exporter_lock);
+  return NULL;
+}
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+int
+MYM_register (const char *name, const char *help, MYM_TYPE type, const uint64_t *value)
+{
+  return addMetric (name, help, type, value, NULL);
+}
+
+int
+MYM_registerFunction (const char *name, const char *help, MYM_TYPE type, uint64_t (*read) ())
+{
+  return addMetric (name, help, type, NULL, read);
+}
+
+int
+MYM_write (const char *path)
+{
+  /* Write a temporary file and rename it over the old one. */
+  char tmp_path[1024];
+  snprintf (tmp_path, sizeof (tmp_path), "%s.tmp", path);
+  FILE *file = fopen (tmp_path, "w");
+  if (file == NULL)
+    {
+      debug_perror ("Error creating metrics file %s. ", tmp_path);
+      return -1;
+    }
+
+  for (int i = 0; i < num_metrics; i++)
+    {
+      metric_t *metric = &Metrics[i];
+      size_t length = familyLength (metric->name);
+      /* HELP and TYPE are written once for all the labels of a metric. */
+      if (i == 0 || familyLength (Metrics[i - 1].name) != length
+          || strncmp (Metrics[i - 1].name, metric->name, length) != 0)
+        {
+          fprintf (file, "# HELP %.*s %s\n", (int) length, metric->name, metric->help);
+          fprintf (file, "# TYPE %.*s %s\n", (int) length, metric->name,
+                   metric->type == MYM_GAUGE ? "gauge" : "counter");
+        }
+      uint64_t value = metric->value != NULL ? __atomic_load_n (metric->value, __ATOMIC_RELAXED) : metric->read ();
+      if (metric->type == MYM_SECONDS)
+        fprintf (file, "%s %.9f\n", metric->name, (double) value / 1e9);
+      else
+        fprintf (file, "%s %llu\n", metric->name, (unsigned long long) value);
+    }
+
+  if (fclose (file) != 0)
+    {
+      debug_perror ("Error writing metrics file %s. ", tmp_path);
+      return -1;
+    }
+  if (rename (tmp_path, path) == -1)
+    {
+      debug_perror ("Error renaming metrics file %s. ", tmp_path);
+      return -1;
+    }
+  return 0;
+}
+
+int
+MYM_start (const char *path, int period)
+{
+  exporter_path = path;
+  exporter_period = period;
+  exporter_stop = 0;
+  int status = pthread_create (&exporter, NULL, exporterMain, NULL);
+  if (status != 0)
+    {
+      errno = status;
+      debug_perror ("Error creating metrics exporter thread. ");
+      return -1;
+    }
+  exporter_running = 1;
+  debug_info ("Metrics exported to %s every %d seconds.", path, period);
+  return 0;
+}
+
+void
+MYM_stop ()
+{
+  if (!exporter_running)
+    return;
+  pthread_mutex_lock (&exporter_lock);
+  exporter_stop = 1;
+  pthread_cond_signal (&exporter_wakeup);
+  pthread_mutex_unlock (&exporter_lock);
+  pthread_join (exporter, NULL);
+  exporter_running = 0;
+}
@@ -15,8 +15,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include "mystore_srv.h"
 #include "messages.h"
+#include "myschema.h"
+#include "myhist.h"
 #include "debug.h"
 
 /************************************************************
@@ -33,6 +38,74 @@ static int message_queue = -1;
 /* Debug level for messages */
 static int debug_level = DEBUG_INIT;
 
+/* Answers that did not fit in the queue. They are sent in order later. */
+static answer_message_t *backlog = NULL;
+static int backlog_first = 0;
+static int backlog_count = 0;
+static int backlog_size = 0;
+
+/* Requests received by the receiver thread and not read by the server yet.
+ * They are kept in a queue per client, linked through "next". */
+typedef struct
+{
+  request_message_t request;
+  int next; /* Next node of the same queue or of the free list. -1 if none. */
+} request_node_t;
+static request_node_t Nodes[STORS_RINGSIZE];
+static int free_node = -1;
+static int ring_count = 0;
+
+/* Requests of a client kept aside until it takes a node, in the order they
+ * were received. */
+typedef struct deferred_request
+{
+  request_message_t request;
+  struct deferred_request *next;
+} deferred_request_t;
+static int deferred_count = 0;
+
+/* Queue of the requests of one client. The clients with requests take turns
+ * in a round (deficit round-robin with a cost of one per request): each turn
+ * a client may take as many requests as its weight. */
+typedef struct
+{
+  long client; /* Identifier (return_to) of the client. 0 if the slot is free. */
+  int weight; /* Requests per turn. */
+  int credit; /* Requests it may still take in this turn. */
+  int head; /* First node. -1 if empty. */
+  int tail; /* Last node. */
+  int count; /* Nodes taken. */
+  deferred_request_t *deferred; /* Requests kept aside. NULL if none. */
+  deferred_request_t *deferred_tail;
+  int prev; /* Previous and next clients of the round. -1 if not in the round. */
+  int next;
+} client_queue_t;
+/* The last slot is shared by the clients which find no free slot. */
+static client_queue_t Clients[STORS_MAXCLIENTS + 1];
+/* Client whose turn it is. -1 if no client has requests. */
+static int current_client = -1;
+/* Weight of the clients without one of their own. */
+#define DEFAULT_WEIGHT 1
+
+/* The queues are shared between the receiver thread and the server thread. */
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_notfull = PTHREAD_COND_INITIALIZER;
+
+/* The receiver thread writes here to wake up the server when requests arrive. */
+static int event_fd = -1;
+
+/* Thread receiving requests from the message queue. */
+static pthread_t receiver;
+static int receiver_running = 0;
+/* Set to stop the receiver thread. */
+static volatile int receiver_stop = 0;
+/* Set by the receiver thread if it ended because of an error. */
+static volatile int receiver_failed = 0;
+/* The stop message of a handover must still be sent. */
+static int handover_pending = 0;
+/* Set by the receiver thread when it ended because of a handover. */
+static volatile int receiver_handedover = 0;
+
 /************************************************************
  PRIVATE FUNCTIONS
  ************************************************************/
@@ -42,6 +115,670 @@ static int debug_level = DEBUG_INIT;
 
 /* Use the keyword "static" before a function which is only used inside this file */
 
+/**
+ * Decode a request received in the compact wire format.
+ * @param wire The message received.
+ * @param size Size of the text of the message received.
+ * @param request The request to fill.
+ * @return 0 if OK. -1 if the message is malformed.
+ */
+static int
+decodeRequest (const wire_request_t *wire, size_t size, request_message_t *request)
+{
+  const wire_header_t *header = &wire->header;
+  if (size < MYSTORE_WIRESIZE (wire_request_t, 0)
+      || size != MYSTORE_WIRESIZE (wire_request_t, header->length))
+    return -1;
+
+  memset (request, 0, sizeof (*request));
+  request->mtype = wire->mtype;
+  request->requested_op = (MYSTORE_CLI_OP) header->op;
+  request->flags = header->flags;
+  request->seq = header->seq;
+  request->return_to = wire->return_to;
+  request->format = MYSWIRE_COMPACT;
+
+  /* The fields follow in the order of their bits. */
+  size_t off = 0;
+  if (header->fields & MYSWF_INDEX)
+    {
+      int32_t index;
+      if (off + sizeof (index) > header->length)
+        return -1;
+      memcpy (&index, wire->payload + off, sizeof (index));
+      request->index = index;
+      off += sizeof (index);
+    }
+  if (header->fields & MYSWF_RECORD)
+    {
+      uint16_t length;
+      if (off + sizeof (length) > header->length)
+        return -1;
+      memcpy (&length, wire->payload + off, sizeof (length));
+      off += sizeof (length);
+      if (off + length > header->length
+          || MYSCH_unpack (MYSCH_recordSchema (), wire->payload + off, length, &request->data) == -1)
+        return -1;
+      off += length;
+    }
+  if (header->fields & MYSWF_LSN)
+    {
+      if (off + sizeof (request->lsn) > header->length)
+        return -1;
+      memcpy (&request->lsn, wire->payload + off, sizeof (request->lsn));
+      off += sizeof (request->lsn);
+    }
+  if (header->fields & MYSWF_TIME)
+    {
+      if (off + sizeof (request->sent) > header->length)
+        return -1;
+      memcpy (&request->sent, wire->payload + off, sizeof (request->sent));
+      off += sizeof (request->sent);
+    }
+  if (header->fields & MYSWF_DEADLINE)
+    {
+      if (off + sizeof (request->deadline) > header->length)
+        return -1;
+      memcpy (&request->deadline, wire->payload + off, sizeof (request->deadline));
+      off += sizeof (request->deadline);
+    }
+  if (header->fields & MYSWF_TABLE)
+    {
+      uint16_t table;
+      if (off + sizeof (table) > header->length)
+        return -1;
+      memcpy (&table, wire->payload + off, sizeof (table));
+      request->table = table;
+      off += sizeof (table);
+    }
+  if (header->fields & MYSWF_RANGE)
+    {
+      int32_t count;
+      uint16_t field;
+      if (off + sizeof (count) + sizeof (field) > header->length)
+        return -1;
+      memcpy (&count, wire->payload + off, sizeof (count));
+      memcpy (&field, wire->payload + off + sizeof (count), sizeof (field));
+      request->count = count;
+      request->field = field;
+      off += sizeof (count) + sizeof (field);
+    }
+  return 0;
+}
+
+/**
+ * Encode an answer in the compact wire format. Only the fields meaningful
+ * for the operation answered are included.
+ * @param answer The answer to encode.
+ * @param wire The message to fill.
+ * @return Size of the text of the message to send.
+ */
+static size_t
+encodeAnswer (const answer_message_t *answer, wire_answer_t *wire)
+{
+  wire_header_t *header = &wire->header;
+  size_t off = 0;
+
+  wire->mtype = answer->mtype;
+  wire->status = answer->status;
+  header->magic = MYSTORE_WIRE_MAGIC;
+  header->seq = answer->seq;
+  header->op = (uint8_t) answer->requested_op;
+  header->flags = 0;
+  header->fields = 0;
+  header->reserved = 0;
+
+  if (answer->requested_op == MYSCOP_READ && answer->status == 0)
+    {
+      /* Packed records are always shorter than the payload. */
+      uint16_t length = (uint16_t) MYSCH_pack (MYSCH_recordSchema (), &answer->data,
+                                               wire->payload + off + sizeof (length),
+                                               MYSTORE_WIRE_MAXPAYLOAD - off - sizeof (length));
+      memcpy (wire->payload + off, &length, sizeof (length));
+      off += sizeof (length) + length;
+      header->fields |= MYSWF_RECORD;
+    }
+  if (answer->lsn != 0)
+    {
+      memcpy (wire->payload + off, &answer->lsn, sizeof (answer->lsn));
+      off += sizeof (answer->lsn);
+      header->fields |= MYSWF_LSN;
+    }
+  if (answer->acked != 0 || answer->failed != 0)
+    {
+      uint32_t counts[2] = {answer->acked, answer->failed};
+      memcpy (wire->payload + off, counts, sizeof (counts));
+      off += sizeof (counts);
+      header->fields |= MYSWF_ACK;
+    }
+  if (answer->requested_op == MYSCOP_STATS && answer->status == 0)
+    {
+      memcpy (wire->payload + off, &answer->latency, sizeof (answer->latency));
+      off += sizeof (answer->latency);
+      header->fields |= MYSWF_LATENCY;
+    }
+  if (answer->requested_op == MYSCOP_AGGREGATE && answer->status == 0)
+    {
+      memcpy (wire->payload + off, &answer->aggregate, sizeof (answer->aggregate));
+      off += sizeof (answer->aggregate);
+      header->fields |= MYSWF_AGGREGATE;
+    }
+  header->length = (uint16_t) off;
+  return MYSTORE_WIRESIZE (wire_answer_t, off);
+}
+
+/**
+ * Send an answer without blocking.
+ * @param answer The answer to send.
+ * @return 0 if sent. 1 if the queue is full. -1 in case of error.
+ */
+static int
+trySend (answer_message_t *answer)
+{
+  wire_answer_t wire;
+  const void *msg = answer;
+  size_t size = MYSTORE_MSGSIZE (answer_message_t);
+  /* Answer in the format of the request. */
+  if (answer->format == MYSWIRE_COMPACT)
+    {
+      size = encodeAnswer (answer, &wire);
+      msg = &wire;
+    }
+
+  int status;
+  do
+    {
+      status = msgsnd (message_queue, msg, size, IPC_NOWAIT);
+    }
+  while (status == -1 && errno == EINTR);
+  if (status == -1)
+    {
+      if (errno == EAGAIN)
+        return 1;
+      debug_perror ("Error sending answer message. ");
+      return -1;
+    }
+  debug_debug ("Answer sent to client (cliend id=%ld, status=%d).", answer->mtype, answer->status);
+  return 0;
+}
+
+/**
+ * Keep an answer to send it when there is room in the queue.
+ * The server must not block sending answers: clients sending requests may be
+ * blocked too because the queue is full, and only the server frees room.
+ * @param answer The answer to keep.
+ * @return 0 if OK. -1 if there is no memory.
+ */
+static int
+pushBacklog (answer_message_t *answer)
+{
+  if (backlog_count == backlog_size)
+    {
+      int new_size = backlog_size ? 2 * backlog_size : 64;
+      answer_message_t *new_backlog = (answer_message_t *) malloc (new_size * sizeof (answer_message_t));
+      if (new_backlog == NULL)
+        {
+          debug_error ("Not enough memory for the backlog of answers.");
+          return -1;
+        }
+      for (int i = 0; i < backlog_count; i++)
+        new_backlog[i] = backlog[(backlog_first + i) % backlog_size];
+      free (backlog);
+      backlog = new_backlog;
+      backlog_first = 0;
+      backlog_size = new_size;
+    }
+  backlog[(backlog_first + backlog_count) % backlog_size] = *answer;
+  backlog_count++;
+  debug_verbose ("Answer kept in backlog (%d answers waiting).", backlog_count);
+  return 0;
+}
+
+/**
+ * Send the answers of the backlog while there is room in the queue.
+ * @return 0 if OK (some answers may still wait). -1 in case of error.
+ */
+static int
+flushBacklog ()
+{
+  while (backlog_count > 0)
+    {
+      int status = trySend (&backlog[backlog_first]);
+      if (status == 1)
+        return 0;
+      if (status == -1)
+        return -1;
+      backlog_first = (backlog_first + 1) % backlog_size;
+      backlog_count--;
+    }
+  return 0;
+}
+
+
+/**
+ * Send to the receiver thread, through the message queue, the message that
+ * stops it. Requests sent before it are received, the rest are left.
+ * @return 0 if OK (or the queue is full and it is retried later). -1 in case of error.
+ */
+static int
+sendHandover ()
+{
+  if (!handover_pending)
+    return 0;
+  request_message_t msg;
+  memset (&msg, 0, sizeof (msg));
+  msg.mtype = MYSAPMT_REQUEST;
+  msg.return_to = MYSTORE_API_CLIENT;
+  msg.requested_op = MYSCOP_HANDOVER;
+  msg.format = MYSWIRE_LEGACY;
+  int status;
+  do
+    {
+      status = msgsnd (message_queue, &msg, MYSTORE_MSGSIZE (request_message_t), IPC_NOWAIT);
+    }
+  while (status == -1 && errno == EINTR);
+  if (status == -1)
+    {
+      if (errno == EAGAIN)
+        return 0;
+      debug_perror ("Error sending the handover message. ");
+      return -1;
+    }
+  handover_pending = 0;
+  debug_info ("Handover message sent.");
+  return 0;
+}
+
+/**
+ * Empty the queues of requests and put every node in the free list.
+ * Call it with ring_lock held.
+ */
+static void
+resetQueues ()
+{
+  for (int i = 0; i < STORS_RINGSIZE; i++)
+    Nodes[i].next = i + 1 < STORS_RINGSIZE ? i + 1 : -1;
+  free_node = 0;
+  ring_count = 0;
+  for (int i = 0; i <= STORS_MAXCLIENTS; i++)
+    {
+      while (Clients[i].deferred != NULL)
+        {
+          deferred_request_t *entry = Clients[i].deferred;
+          Clients[i].deferred = entry->next;
+          free (entry);
+        }
+      Clients[i].client = 0;
+      Clients[i].count = 0;
+      Clients[i].head = Clients[i].prev = Clients[i].next = -1;
+    }
+  deferred_count = 0;
+  Clients[STORS_MAXCLIENTS].client = -1;
+  Clients[STORS_MAXCLIENTS].weight = DEFAULT_WEIGHT;
+  current_client = -1;
+}
+
+/**
+ * Get the queue of a client. Call it with ring_lock held.
+ * @param client Identifier of the client.
+ * @param create Take a free slot if the client has none.
+ * @return Index of the slot. The shared slot if there is no room and create
+ * is set. -1 if the client has no slot and create is not set.
+ */
+static int
+searchClient (long client, int create)
+{
+  int unused = -1;
+  for (int i = 0; i < STORS_MAXCLIENTS; i++)
+    {
+      if (Clients[i].client == client)
+        return i;
+      if (unused == -1 && Clients[i].client == 0)
+        unused = i;
+    }
+  if (!create)
+    return -1;
+  if (unused == -1)
+    {
+      /* Reuse the slot of an idle client which only kept its weight. */
+      for (int i = 0; i < STORS_MAXCLIENTS && unused == -1; i++)
+        if (Clients[i].head == -1 && Clients[i].deferred == NULL)
+          unused = i;
+    }
+  if (unused == -1)
+    return STORS_MAXCLIENTS;
+  Clients[unused].client = client;
+  Clients[unused].weight = DEFAULT_WEIGHT;
+  Clients[unused].credit = 0;
+  Clients[unused].count = 0;
+  Clients[unused].head = Clients[unused].prev = Clients[unused].next = -1;
+  return unused;
+}
+
+/**
+ * Put a request in a free node at the end of the queue of a client. Call it
+ * with ring_lock held and a free node.
+ * @param slot The slot of the client.
+ * @param request The request.
+ */
+static void
+linkRequest (int slot, const request_message_t *request)
+{
+  int node = free_node;
+  free_node = Nodes[node].next;
+  Nodes[node].request = *request;
+  Nodes[node].next = -1;
+
+  client_queue_t *queue = &Clients[slot];
+  if (queue->head == -1)
+    {
+      queue->head = node;
+      /* The client joins the round just before the client whose turn it is. */
+      if (current_client == -1)
+        {
+          queue->prev = queue->next = slot;
+          queue->credit = queue->weight;
+          current_client = slot;
+        }
+      else
+        {
+          queue->next = current_client;
+          queue->prev = Clients[current_client].prev;
+          Clients[queue->prev].next = slot;
+          Clients[current_client].prev = slot;
+          queue->credit = 0;
+        }
+    }
+  else
+    Nodes[queue->tail].next = node;
+  queue->tail = node;
+  queue->count++;
+  ring_count++;
+}
+
+/**
+ * Queue a request received. A client takes nodes up to its share. Its next
+ * requests, and the requests received while the ring is full, are kept
+ * aside until it takes a node, so that the requests of the other clients are
+ * still received. Call it with ring_lock held.
+ * @param request The request.
+ * @return 0 if OK. -1 if there is no room: the request must wait.
+ */
+static int
+enqueueRequest (const request_message_t *request)
+{
+  int slot = searchClient (request->return_to, 1);
+  client_queue_t *queue = &Clients[slot];
+  if (free_node != -1 && queue->count < STORS_CLIENTSHARE && queue->deferred == NULL)
+    {
+      linkRequest (slot, request);
+      return 0;
+    }
+  if (deferred_count >= STORS_MAXDEFERRED)
+    return -1;
+  deferred_request_t *entry = (deferred_request_t *) malloc (sizeof (deferred_request_t));
+  if (entry == NULL)
+    {
+      debug_error ("Not enough memory to keep a request aside.");
+      return -1;
+    }
+  entry->request = *request;
+  entry->next = NULL;
+  if (queue->deferred == NULL)
+    queue->deferred = entry;
+  else
+    queue->deferred_tail->next = entry;
+  queue->deferred_tail = entry;
+  deferred_count++;
+  return 0;
+}
+
+/**
+ * Give a free node to the next client, after the given one, with requests
+ * kept aside and below its share. Clients kept aside while the ring was full
+ * take turns with the ones whose share is full. Call it with ring_lock held
+ * and a free node.
+ * @param slot The slot of the client whose node was freed.
+ */
+static void
+refillRing (int slot)
+{
+  if (deferred_count == 0)
+    return;
+  for (int i = 1; i <= STORS_MAXCLIENTS + 1; i++)
+    {
+      int next = (slot + i) % (STORS_MAXCLIENTS + 1);
+      client_queue_t *queue = &Clients[next];
+      if (queue->deferred != NULL && queue->count < STORS_CLIENTSHARE)
+        {
+          deferred_request_t *entry = queue->deferred;
+          queue->deferred = entry->next;
+          deferred_count--;
+          linkRequest (next, &entry->request);
+          free (entry);
+          return;
+        }
+    }
+}
+
+/**
+ * Get the class that has the next turn: the normal and bulk classes get one
+ * turn every STORS_NORMALTURN and STORS_BULKTURN turns. Otherwise the most
+ * urgent class goes first.
+ * @param turns Counter of turns. It is increased.
+ * @return The type of the class with the turn. 0 for the most urgent one.
+ */
+static long
+classTurn (unsigned int *turns)
+{
+  (*turns)++;
+  if (*turns % STORS_BULKTURN == 0)
+    return MYSAPMT_BULK;
+  if (*turns % STORS_NORMALTURN == 0)
+    return MYSAPMT_REQUEST;
+  return 0;
+}
+
+/**
+ * Get the priority class of the first request of a client.
+ * @param slot The slot of the client. It must have requests.
+ * @return The type of the class. Lower is more urgent.
+ */
+static long
+headClass (int slot)
+{
+  return Nodes[Clients[slot].head].request.mtype;
+}
+
+/**
+ * Take the next request in fair order. Call it with ring_lock held and some
+ * request queued. Clients whose first request is of the class with the turn
+ * take turns; the others wait. The requests of one client keep their order.
+ * @param request Where to copy the request.
+ */
+static void
+dequeueRequest (request_message_t *request)
+{
+  static unsigned int turns = 0;
+  long turn = classTurn (&turns);
+  long best = headClass (current_client);
+  for (int slot = Clients[current_client].next; slot != current_client && best != turn; slot = Clients[slot].next)
+    {
+      long class = headClass (slot);
+      if (class == turn || class < best)
+        best = class;
+    }
+  /* Move to the next client of that class when the current one used its
+   * turn or has other requests. */
+  if (Clients[current_client].credit <= 0 || headClass (current_client) != best)
+    {
+      do
+        current_client = Clients[current_client].next;
+      while (headClass (current_client) != best);
+      Clients[current_client].credit = Clients[current_client].weight;
+    }
+  int slot = current_client;
+  client_queue_t *queue = &Clients[slot];
+  int node = queue->head;
+  *request = Nodes[node].request;
+  queue->head = Nodes[node].next;
+  queue->credit--;
+  queue->count--;
+  Nodes[node].next = free_node;
+  free_node = node;
+  ring_count--;
+  refillRing (slot);
+
+  if (queue->head == -1)
+    {
+      /* Leave the round. The next client starts a full turn. */
+      if (queue->next == slot)
+        current_client = -1;
+      else
+        {
+          Clients[queue->prev].next = queue->next;
+          Clients[queue->next].prev = queue->prev;
+          current_client = queue->next;
+          Clients[current_client].credit = Clients[current_client].weight;
+        }
+      queue->prev = queue->next = -1;
+      /* Only clients with a weight of their own or requests kept aside keep
+       * their slot. */
+      if (slot != STORS_MAXCLIENTS && queue->weight == DEFAULT_WEIGHT && queue->deferred == NULL)
+        queue->client = 0;
+    }
+}
+
+/**
+ * Create the descriptor signaling requests and empty the queues of requests.
+ * @return -1 in case of error. 0 means OK.
+ */
+static int
+initReceiver ()
+{
+  /* The server waits on this descriptor for requests received by the receiver thread. */
+  event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd == -1)
+    {
+      debug_perror ("Error creating eventfd in server API. ");
+      return -1;
+    }
+  receiver_handedover = 0;
+  handover_pending = 0;
+  pthread_mutex_lock (&ring_lock);
+  resetQueues ();
+  pthread_mutex_unlock (&ring_lock);
+  return 0;
+}
+
+/**
+ * Receive one request from the message queue and decode it.
+ * This function blocks until a request arrives.
+ * @param request The request to fill.
+ * @return 0 if OK. -1 in case of error. -2 if interrupted by a signal.
+ * -3 if a malformed message was received and discarded.
+ */
+static int
+receiveRequest (request_message_t *request)
+{
+  /* Requests may come in any wire format. */
+  union
+  {
+    request_message_t legacy;
+    wire_request_t compact;
+  } msg;
+
+  /* Lower classes get a turn every so often, if they have requests. */
+  static unsigned int receptions = 0;
+  long type = classTurn (&receptions);
+  ssize_t status = -1;
+  if (type != 0)
+    status = msgrcv (message_queue, &msg, MYSTORE_MSGSIZE (msg), type, IPC_NOWAIT);
+
+  debug_verbose ("Receiving request from client (types<=%d).", MYSAPMT_BULK);
+  /* Wait for a request received from a client through the message queue.
+   * The lowest type (the most urgent class) comes first.
+   */
+  if (status == -1)
+    status = msgrcv (message_queue, &msg, MYSTORE_MSGSIZE (msg), -MYSAPMT_BULK, 0);
+  if (status == -1)
+    {
+      if (errno == EINTR)
+        return -2;
+      if (!receiver_stop)
+        debug_perror ("Error receiving request from message queue. ");
+      return -1;
+    }
+  uint64_t received = MYH_now ();
+  if (msg.compact.header.magic == MYSTORE_WIRE_MAGIC)
+    {
+      if (decodeRequest (&msg.compact, status, request) == -1)
+        {
+          debug_error ("Malformed request received (size=%zd).", status);
+          return -3;
+        }
+    }
+  else
+    {
+      *request = msg.legacy;
+      request->format = MYSWIRE_LEGACY;
+    }
+  request->received = received;
+  debug_debug ("Request received from client (cliend id=%ld, op=%d, idx=%d).", request->return_to, request->requested_op, request->index);
+  return 0;
+}
+
+/**
+ * Body of the receiver thread. It moves requests from the message queue to
+ * the ring and wakes up the server through the eventfd. A client flooding the
+ * server fills its share of the ring and then memory aside, while the
+ * requests of the other clients still reach the ring. Only when that memory
+ * is full it stops receiving, so requests wait in the message queue and
+ * clients block sending them.
+ * @param arg Not used.
+ * @return NULL
+ */
+static void *
+receiverMain (void *arg)
+{
+  (void) arg;
+  while (!receiver_stop)
+    {
+      request_message_t request;
+      int status = receiveRequest (&request);
+      if (status == -2 || status == -3)
+        continue;
+      if (status == -1)
+        {
+          /* The queue was removed or is not usable any more. */
+          receiver_failed = !receiver_stop;
+          break;
+        }
+      /* The queue is being handed over: the next requests are for the next server. */
+      if (request.requested_op == MYSCOP_HANDOVER && request.return_to == MYSTORE_API_CLIENT)
+        {
+          receiver_handedover = 1;
+          break;
+        }
+
+      pthread_mutex_lock (&ring_lock);
+      int queued;
+      while ((queued = enqueueRequest (&request)) == -1 && !receiver_stop)
+        pthread_cond_wait (&ring_notfull, &ring_lock);
+      pthread_mutex_unlock (&ring_lock);
+      if (queued == -1)
+        break;
+
+      uint64_t one = 1;
+      if (write (event_fd, &one, sizeof (one)) != sizeof (one))
+        debug_perror ("Error signaling a request. ");
+    }
+  /* Wake up the server so that it notices the end of the receiver. */
+  uint64_t one = 1;
+  if (write (event_fd, &one, sizeof (one)) != sizeof (one))
+    debug_perror ("Error signaling the end of the receiver. ");
+  return NULL;
+}
 
 /************************************************************
  PUBLIC FUNCTIONS
@@ -82,6 +819,13 @@ STORS_init ()
   /* Don't forget to check status of system calls. */
   /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
 
+  if (initReceiver () == -1)
+    {
+      msgctl (message_queue, IPC_RMID, NULL);
+      message_queue = -1;
+      return -1;
+    }
+
   debug_info ("Message queue opened in server API. (key=0x%08x)", key);
   /* Everything is OK */
   return 0;
@@ -95,6 +839,12 @@ STORS_init ()
 int
 STORS_close ()
 {
+  /* Removing the queue makes the receiver thread fail in msgrcv() and end. */
+  receiver_stop = 1;
+  pthread_mutex_lock (&ring_lock);
+  pthread_cond_broadcast (&ring_notfull);
+  pthread_mutex_unlock (&ring_lock);
+
   /* Close the message queue. Remove it! */
   int status = msgctl (message_queue, IPC_RMID, NULL);
   if (status != 0)
@@ -104,6 +854,29 @@ STORS_close ()
 
   debug_info ("Message queue removed in server API. (key=0x%08x)", MYSTORE_API_KEY);
 
+  if (receiver_running)
+    {
+      pthread_join (receiver, NULL);
+      receiver_running = 0;
+    }
+  if (ring_count + deferred_count > 0)
+    debug_error ("Dropping %d requests not served.", ring_count + deferred_count);
+  pthread_mutex_lock (&ring_lock);
+  resetQueues ();
+  pthread_mutex_unlock (&ring_lock);
+  if (event_fd != -1)
+    {
+      close (event_fd);
+      event_fd = -1;
+    }
+
+  /* Answers not sent can't be delivered any more. */
+  if (backlog_count > 0)
+    debug_error ("Dropping %d answers not sent.", backlog_count);
+  free (backlog);
+  backlog = NULL;
+  backlog_first = backlog_count = backlog_size = 0;
+
   /* Set the message queue descriptor to -1 to indicate it is not open. */
   message_queue = -1;
   return 0;
@@ -111,39 +884,278 @@ STORS_close ()
 }
 
 /**
- * This function reads a request from the message queue.
- * This function will wait blocked until it receives a request.
- * When returning, the request passed by reference as pameter will contain the
- * data of the request received from the message queue.
+ * Start the receiver thread. Call it after fork() when running as a daemon,
+ * and after blocking the signals that the server handles synchronously:
+ * the thread inherits the signal mask.
+ * @return -1 if the thread could not be created. 0 means OK.
+ */
+int
+STORS_start ()
+{
+  receiver_stop = 0;
+  receiver_failed = 0;
+  int status = pthread_create (&receiver, NULL, receiverMain, NULL);
+  if (status != 0)
+    {
+      errno = status;
+      debug_perror ("Error creating receiver thread. ");
+      return -1;
+    }
+  receiver_running = 1;
+  debug_info ("Receiver thread started.");
+  return 0;
+}
+
+/**
+ * Get a descriptor to wait for requests with poll(), select() or epoll.
+ * It becomes readable when requests are received. The server must drain
+ * requests with STORS_readrequest() until it returns -4.
+ * @return The descriptor.
+ */
+int
+STORS_eventfd ()
+{
+  return event_fd;
+}
+
+/**
+ * Initialize the server library with the existing message queue of a server
+ * handing it over. Requests sent meanwhile wait in the queue.
+ * @return -1 if there is no queue or in case of error. 0 means OK.
+ */
+int
+STORS_attach ()
+{
+  key_t key = MYSTORE_API_KEY;
+  message_queue = msgget (key, 0);
+  if (message_queue == -1)
+    {
+      debug_perror ("Error opening message queue in server API (key=0x%08x).", key);
+      return -1;
+    }
+  if (initReceiver () == -1)
+    {
+      message_queue = -1;
+      return -1;
+    }
+  debug_info ("Message queue taken over in server API. (key=0x%08x)", key);
+  return 0;
+}
+
+/**
+ * Stop receiving requests to hand the message queue over to the next server.
+ * The receiver thread stops when it receives a message sent to itself, so
+ * every request sent before is still served by this server.
+ * @return -1 in case of error. 0 means OK.
+ */
+int
+STORS_handover ()
+{
+  if (!receiver_running)
+    {
+      debug_error ("The receiver thread is not running.");
+      return -1;
+    }
+  handover_pending = 1;
+  return sendHandover ();
+}
+
+/**
+ * Write the answers waiting for room in the queue to a file.
+ * @param file The file.
+ * @return -1 in case of error. 0 means OK.
+ */
+int
+STORS_saveanswers (FILE *file)
+{
+  int count = backlog_count;
+  if (fwrite (&count, sizeof (count), 1, file) != 1)
+    return -1;
+  for (int i = 0; i < count; i++)
+    {
+      if (fwrite (&backlog[(backlog_first + i) % backlog_size], sizeof (answer_message_t), 1, file) != 1)
+        return -1;
+    }
+  debug_info ("%d answers not sent saved for the next server.", count);
+  return 0;
+}
+
+/**
+ * Read the answers saved by the last server and keep them to send them
+ * before any other.
+ * @param file The file.
+ * @return -1 in case of error. 0 means OK.
+ */
+int
+STORS_loadanswers (FILE *file)
+{
+  int count;
+  if (fread (&count, sizeof (count), 1, file) != 1 || count < 0)
+    return -1;
+  for (int i = 0; i < count; i++)
+    {
+      answer_message_t answer;
+      if (fread (&answer, sizeof (answer), 1, file) != 1 || pushBacklog (&answer) == -1)
+        return -1;
+    }
+  debug_info ("%d answers of the last server loaded.", count);
+  return 0;
+}
+
+/**
+ * Finish the server side of the library after a handover, leaving the message
+ * queue and the requests in it to the next server.
+ * @return -1 if the queue was not handed over. 0 means OK.
+ */
+int
+STORS_release ()
+{
+  if (receiver_running && !receiver_handedover)
+    {
+      debug_error ("The message queue was not handed over.");
+      return -1;
+    }
+  if (receiver_running)
+    {
+      pthread_join (receiver, NULL);
+      receiver_running = 0;
+    }
+  pthread_mutex_lock (&ring_lock);
+  resetQueues ();
+  pthread_mutex_unlock (&ring_lock);
+  close (event_fd);
+  event_fd = -1;
+  free (backlog);
+  backlog = NULL;
+  backlog_first = backlog_count = backlog_size = 0;
+  message_queue = -1;
+  debug_info ("Message queue released in server API.");
+  return 0;
+}
+
+/**
+ * This function takes the next request received by the receiver thread.
+ * It never blocks: use STORS_eventfd() to wait for requests.
  * The request will be processes outside this library.
  * @param request Is a pointer to a request structure to return a request
  * received from the client.
- * @return Return 0 if OK. -1 in case of some error receiving.
- * -2 indicates that a signal interrupted the reception of a message.
+ * @return Return 0 if OK. -1 if requests can't be received any more.
+ * -4 indicates that no request is waiting.
  */
 int
 STORS_readrequest (request_message_t *request)
 {
-  debug_verbose ("Receiving request from client (type=%d).", MYSAPMT_REQUEST);
+  /* Send the answers waiting for room in the queue first. */
+  if (flushBacklog () == -1 || sendHandover () == -1)
+    return -1;
 
-  /* Wait for a request received from a client through the message queue.
-   */
-  int status = msgrcv (message_queue, request, sizeof (request_message_t), MYSAPMT_REQUEST, 0);
-  if (status == -1)
+  pthread_mutex_lock (&ring_lock);
+  if (ring_count == 0)
     {
-      if (errno == EINTR)
+      pthread_mutex_unlock (&ring_lock);
+      /* Reset the eventfd. The receiver writes again after the next request. */
+      uint64_t count;
+      if (read (event_fd, &count, sizeof (count)) == -1 && errno != EAGAIN)
+        debug_perror ("Error reading eventfd. ");
+      /* A request may have arrived between both checks. */
+      pthread_mutex_lock (&ring_lock);
+      if (ring_count == 0)
         {
-          debug_info ("Signal received while reading a request.");
-          return -2;
+          pthread_mutex_unlock (&ring_lock);
+          if (receiver_handedover)
+            return STORS_HANDEDOVER;
+          if (receiver_failed)
+            {
+              debug_error ("Receiver thread ended. No more requests.");
+              return -1;
+            }
+          return -4;
         }
-      debug_perror ("Error receiving request from message queue. %s");
-      return -1;
     }
-  debug_debug ("Request received from client (cliend id=%d, op=%d, idx=%d).", request->return_to, request->requested_op, request->index);
+  dequeueRequest (request);
+  pthread_cond_signal (&ring_notfull);
+  pthread_mutex_unlock (&ring_lock);
+
   /* If no error, return 0 and the request contains the received one. */
   return 0;
 }
 
+/**
+ * Get the number of answers waiting for room in the message queue.
+ * While there are some, the server should call STORS_readrequest() or
+ * STORS_sendanswer() periodically to send them.
+ * @return The number of answers waiting.
+ */
+int
+STORS_pendinganswers ()
+{
+  /* Other threads may ask too. */
+  return __atomic_load_n (&backlog_count, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the number of requests received by the receiver thread and not read
+ * by the server yet. It can be called from any thread.
+ * @return The number of requests.
+ */
+int
+STORS_bufferedrequests ()
+{
+  return __atomic_load_n (&ring_count, __ATOMIC_RELAXED) + __atomic_load_n (&deferred_count, __ATOMIC_RELAXED);
+}
+
+/**
+ * Set the share of a client: while several clients have requests waiting,
+ * each one is served up to its weight of requests per turn.
+ * @param client Identifier of the client (return_to of its requests).
+ * @param weight Requests per turn, from 1 to STORS_MAXWEIGHT.
+ * @return 0 if OK. -1 if the weight is not valid or there is no room to
+ * remember it.
+ */
+int
+STORS_setweight (long client, int weight)
+{
+  if (weight < 1 || weight > STORS_MAXWEIGHT)
+    {
+      debug_error ("Invalid weight %d for client %ld.", weight, client);
+      return -1;
+    }
+  pthread_mutex_lock (&ring_lock);
+  int slot = searchClient (client, 1);
+  if (slot == STORS_MAXCLIENTS)
+    {
+      pthread_mutex_unlock (&ring_lock);
+      debug_error ("No room to set the weight of client %ld.", client);
+      return -1;
+    }
+  Clients[slot].weight = weight;
+  if (Clients[slot].credit > weight)
+    Clients[slot].credit = weight;
+  /* An idle client with the default weight needs no slot. */
+  if (Clients[slot].head == -1 && Clients[slot].deferred == NULL && weight == DEFAULT_WEIGHT)
+    Clients[slot].client = 0;
+  pthread_mutex_unlock (&ring_lock);
+  debug_info ("Weight of client %ld set to %d.", client, weight);
+  return 0;
+}
+
+/**
+ * Get the number of messages in the message queue: requests not received
+ * yet plus answers not collected by their clients yet.
+ * @return The number of messages. -1 in case of error.
+ */
+int
+STORS_queuedmessages ()
+{
+  struct msqid_ds info;
+  if (msgctl (message_queue, IPC_STAT, &info) == -1)
+    {
+      debug_perror ("Error getting the state of the message queue. ");
+      return -1;
+    }
+  return (int) info.msg_qnum;
+}
+
 /**
  * This function sends an answer structure to a client through a message queue.
  * @param answer This structure is already initialized and ready to be sent.
@@ -160,15 +1172,17 @@ STORS_sendanswer (answer_message_t *answer)
 
   /* Remember to create a unique number for each client and add it to the request in the client side.
    */
-  int status = msgsnd (message_queue, answer, sizeof (answer_message_t), 0);
-  if (status == -1)
-    {
-      debug_perror ("Error sending answer message. %s");
-      return -1;
-    }
-  debug_debug ("Answer sent to client (cliend id=%d, status=%d).", answer->mtype, answer->status);
+  /* Keep the order of answers: if some are waiting, this one waits too. */
+  if (flushBacklog () == -1)
+    return -1;
+  if (backlog_count > 0)
+    return pushBacklog (answer);
+
+  int status = trySend (answer);
+  if (status == 1)
+    return pushBacklog (answer);
   /* If no error, return 0 and the request contains the received one. */
-  return 0;
+  return status;
 }
 
 /* Increases current debug level or reset to 0 if maximum is reached. */
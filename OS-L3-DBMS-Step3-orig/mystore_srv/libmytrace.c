@@ -0,0 +1,86 @@
+/*
+ * File:   libmytrace.c
+ *
+ * This file implements the request trace of the store server.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "mytrace.h"
+#include "debug.h"
+
+/************************************************************
+ PRIVATE VARIABLES
+ ************************************************************/
+
+/* Debug level for messages */
+static int debug_level = DEBUG_INIT;
+
+/* The ring of events. Event number n is stored at Ring[n % MYT_EVENTS]. */
+static MYT_EVENT_t Ring[MYT_EVENTS];
+
+/* Number of events recorded since the start. Published after each event. */
+static uint64_t head = 0;
+
+/************************************************************
+ PUBLIC FUNCTIONS
+ ************************************************************/
+
+void
+MYT_record (const MYT_EVENT_t *event)
+{
+  uint64_t n = __atomic_load_n (&head, __ATOMIC_RELAXED);
+  Ring[n & (MYT_EVENTS - 1)] = *event;
+  /* The event must be complete before readers see the new head. */
+  __atomic_store_n (&head, n + 1, __ATOMIC_RELEASE);
+}
+
+int
+MYT_dump (const char *path)
+{
+  MYT_EVENT_t *copy = malloc (sizeof (Ring));
+  if (copy == NULL)
+    {
+      debug_error ("Not enough memory to dump the trace.");
+      return -1;
+    }
+
+  /* Events before the first head are complete. The ones the writer may have
+   * overwritten during the copy are before the second head minus the ring,
+   * and the event at the second head may be half written in its slot, the
+   * slot of the event one ring before. */
+  uint64_t end = __atomic_load_n (&head, __ATOMIC_ACQUIRE);
+  memcpy (copy, Ring, sizeof (Ring));
+  uint64_t last = __atomic_load_n (&head, __ATOMIC_ACQUIRE);
+  uint64_t first = last + 1 > MYT_EVENTS ? last + 1 - MYT_EVENTS : 0;
+  if (first > end)
+    first = end;
+
+  FILE *file = fopen (path, "w");
+  if (file == NULL)
+    {
+      debug_perror ("Error creating trace file %s. ", path);
+      free (copy);
+      return -1;
+    }
+  MYT_FILEHEADER_t header = {MYT_MAGIC, MYT_VERSION, sizeof (MYT_EVENT_t), (uint32_t) (end - first), first};
+  int status = fwrite (&header, sizeof (header), 1, file) == 1 ? 0 : -1;
+  for (uint64_t n = first; n < end && status == 0; n++)
+    {
+      if (fwrite (&copy[n & (MYT_EVENTS - 1)], sizeof (MYT_EVENT_t), 1, file) != 1)
+        status = -1;
+    }
+  if (fclose (file) != 0)
+    status = -1;
+  free (copy);
+  if (status == -1)
+    {
+      debug_perror ("Error writing trace file %s. ", path);
+      return -1;
+    }
+  debug_info ("%u trace events dumped to %s.", header.count, path);
+  return (int) header.count;
+}
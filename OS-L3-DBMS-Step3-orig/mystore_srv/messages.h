@@ -14,6 +14,8 @@ extern "C"
 {
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
@@ -21,18 +23,30 @@ extern "C"
 
   /* This is the default to get a unique message queue key for each user. */
 #define MYSTORE_API_KEY ((key_t)getuid())
-  /* This is the type to identify each client with a unique type. */
-#define MYSTORE_API_CLIENT ((long)getpid())
+  /* Key of the shared cache of each table. Table 0 (the default table) uses
+   * the key of the queue. The others set the table in the high bits. */
+#define MYSTORE_TABLE_KEY(table) ((key_t)(MYSTORE_API_KEY ^ ((key_t)(table) << 24)))
+  /* Maximum number of tables of a server. */
+#define MYSTORE_MAXTABLES 16
+  /* This is the type to identify each client with a unique type. It is above
+   * the types of the requests, so the server never receives an answer. */
+#define MYSTORE_API_CLIENT ((long)getpid() + MYSAPMT_FIRSTCLIENT)
 
   typedef enum
   {
-    /* Request from client to server. */
-    MYSAPMT_REQUEST = 1,
+    /* Requests from client to server, one type per priority class. The server
+     * receives the lowest type first (msgrcv() with a negative type). */
+    MYSAPMT_INTERACTIVE = 1,
+    /* Request from client to server of the normal class. */
+    MYSAPMT_REQUEST = 2,
+    MYSAPMT_BULK = 3,
     /* Request a client identifier for threads. */
-    MYSPMT_GETCLID = 2,
+    MYSPMT_GETCLID = 4,
     /* Send to any client using this destination tag.
      * Only the first waiting will get the mesage. */
-    MYSAPMT_ANYCLIENT = 3
+    MYSAPMT_ANYCLIENT = 5,
+    /* Types of the answers to each client start here. */
+    MYSAPMT_FIRSTCLIENT = 16
   } MYSTORE_API_MTYPES;
 
   /**
@@ -42,10 +56,86 @@ extern "C"
   typedef enum
   {
     MYSCOP_READ = 0,
-    MYSCOP_WRITE
+    MYSCOP_WRITE,
+    /* Ask for a cumulative acknowledgement of the unacknowledged writes. */
+    MYSCOP_SYNC,
+    /* Flush the record at index to disk. */
+    MYSCOP_FLUSH,
+    /* Flush every record in the cache to disk. */
+    MYSCOP_FLUSHALL,
+    /* Wait until every write up to the given LSN is on disk. */
+    MYSCOP_DURABLE,
+    /* Get the latency percentiles of the class of requests given as index. */
+    MYSCOP_STATS,
+    /* Set the weight (given as index) of the client in the fair scheduling. */
+    MYSCOP_SETWEIGHT,
+    /* Sent by the server to itself to stop receiving before handing over. */
+    MYSCOP_HANDOVER,
+    /* Count, add up and find the range of a field over count records from index. */
+    MYSCOP_AGGREGATE
     /* Any other operation will have its own number here. */
   } MYSTORE_CLI_OP;
 
+  /**
+   * Flags modifying how the server handles a request.
+   */
+  typedef enum
+  {
+    /* The server sends no answer for this write. Its result is accumulated. */
+    MYSCFL_NOACK = 0x1,
+    /* Answer this unacknowledged write with a cumulative acknowledgement. */
+    MYSCFL_ACKNOW = 0x2
+  } MYSTORE_CLI_FLAGS;
+
+  /* Status of a read or write rejected because too many requests are waiting.
+   * Nothing was done: the client may retry later. */
+#define MYSTORE_OVERLOADED -5
+
+  /* Status of a request whose deadline passed before the server started it.
+   * Nothing was done and no answer is sent: the client already gave up. */
+#define MYSTORE_EXPIRED -7
+
+  /**
+   * Classes of requests with their own latency histograms.
+   */
+  typedef enum
+  {
+    MYSLAT_READHIT = 0, /* Reads of records found in the cache. */
+    MYSLAT_READMISS, /* Reads of records read from the file. */
+    MYSLAT_WRITEHIT, /* Writes of records found in the cache. */
+    MYSLAT_WRITEMISS, /* Writes of records not in the cache. */
+    MYSLAT_OTHER, /* Any other operation. */
+    MYSLAT_CLASSES /* Number of classes. */
+  } MYSTORE_LATENCY_CLASS;
+
+  /* Percentiles reported for each latency, in this order. */
+#define MYSLAT_P50 0
+#define MYSLAT_P99 1
+#define MYSLAT_P999 2
+#define MYSLAT_PERCENTILES 3
+
+  /**
+   * Latency percentiles of one class of requests, in nanoseconds.
+   */
+  typedef struct
+  {
+    uint64_t count; /* Requests served. */
+    uint64_t queue[MYSLAT_PERCENTILES]; /* From sending the request to starting serving it. */
+    uint64_t service[MYSLAT_PERCENTILES]; /* Serving the request. */
+    uint64_t total[MYSLAT_PERCENTILES]; /* From sending the request to sending its answer. */
+  } latency_report_t;
+
+  /**
+   * Aggregate of an integer field over a range of records.
+   */
+  typedef struct
+  {
+    uint64_t count; /* Records scanned. */
+    int64_t sum; /* Sum of the values. */
+    int64_t min; /* Lowest value. 0 if no record. */
+    int64_t max; /* Highest value. 0 if no record. */
+  } aggregate_report_t;
+
   /**
    * Message for a request from the client.
    */
@@ -56,6 +146,16 @@ extern "C"
     long return_to; /* The client sends a type to address the reply to because we may have several clients. */
     MYRECORD_RECORD_t data; /* This field contains a record only when writing. */
     int index; /* Record index to read or write */
+    int table; /* Table of the record. 0 is the default table. */
+    unsigned int seq; /* Sequence number chosen by the client. The server echoes it back in the answer. */
+    int flags; /* Combination of MYSTORE_CLI_FLAGS. */
+    uint64_t lsn; /* LSN that must be durable (only for MYSCOP_DURABLE). */
+    int count; /* Records from index (only for MYSCOP_AGGREGATE). */
+    int field; /* Number of the field in the schema (only for MYSCOP_AGGREGATE). */
+    uint64_t sent; /* CLOCK_MONOTONIC time when the client sent the request (ns). 0 if unknown. */
+    uint64_t deadline; /* CLOCK_MONOTONIC time when the client gives up (ns). 0 if never. */
+    int format; /* Wire format the request was received in (MYSTORE_WIRE_FORMAT). Not sent. */
+    uint64_t received; /* Time when the server received the request (ns). Not sent. */
 
     /* Did you forget some other field? Add it to the message. */
   } request_message_t;
@@ -67,10 +167,95 @@ extern "C"
   {
     long mtype; /* This type distinguishes messages to server from messages to clients. */
     int status; /* This status passes back the result of each operation. */
+    MYSTORE_CLI_OP requested_op; /* Operation answered. */
     MYRECORD_RECORD_t data; /* This field contains a record only when reading. */
+    unsigned int seq; /* Copy of the sequence number of the request being answered. */
+    unsigned int acked; /* Unacknowledged writes covered by a cumulative acknowledgement. */
+    unsigned int failed; /* How many of the acknowledged writes failed. Status holds the first error. */
+    uint64_t lsn; /* LSN of the write for writes and acknowledgements. Durable LSN for flushes. */
+    latency_report_t latency; /* Latency percentiles, only for MYSCOP_STATS. */
+    aggregate_report_t aggregate; /* Aggregate of a field, only for MYSCOP_AGGREGATE. */
+    int format; /* Wire format to send the answer in. Copy it from the request. Not sent. */
     /* Did you forget some other field? Add it to the message. */
   } answer_message_t;
 
+  /**
+   * Wire formats. The legacy format sends the structures above as they are.
+   * The compact format sends a small header and only the fields needed.
+   * Both sides decode the compact messages into the structures above.
+   */
+  typedef enum
+  {
+    MYSWIRE_LEGACY = 0,
+    MYSWIRE_COMPACT = 2
+  } MYSTORE_WIRE_FORMAT;
+
+  /* Compact messages start with this number where legacy ones have a small
+   * operation number or status. */
+#define MYSTORE_WIRE_MAGIC 0x4d595732
+
+  /* Maximum size of the fields of a compact message. */
+#define MYSTORE_WIRE_MAXPAYLOAD 512
+
+  /**
+   * Fields present in the payload of a compact message. They are stored in
+   * this order, one after the other, without padding.
+   */
+  typedef enum
+  {
+    MYSWF_INDEX = 0x1, /* int32_t: index of the record. */
+    MYSWF_RECORD = 0x2, /* uint16_t length, then the record packed with its schema (myschema.h). */
+    MYSWF_LSN = 0x4, /* uint64_t: log sequence number. */
+    MYSWF_ACK = 0x8, /* uint32_t acked, uint32_t failed: cumulative acknowledgement. */
+    MYSWF_TIME = 0x10, /* uint64_t: time when the request was sent. */
+    MYSWF_LATENCY = 0x20, /* latency_report_t: latency percentiles. */
+    MYSWF_DEADLINE = 0x40, /* uint64_t: time when the client gives up. */
+    MYSWF_TABLE = 0x80, /* uint16_t: table of the request. Absent for table 0. */
+    MYSWF_RANGE = 0x100, /* int32_t count, uint16_t field: records and field to aggregate. */
+    MYSWF_AGGREGATE = 0x200 /* aggregate_report_t: aggregate of a field. */
+  } MYSTORE_WIRE_FIELDS;
+
+  /**
+   * Header of every compact message, after the message type.
+   */
+  typedef struct
+  {
+    uint32_t magic; /* MYSTORE_WIRE_MAGIC */
+    uint32_t seq; /* Sequence number of the request. */
+    uint16_t length; /* Bytes of payload after the fixed part of the message. */
+    uint8_t op; /* MYSTORE_CLI_OP */
+    uint8_t flags; /* MYSTORE_CLI_FLAGS */
+    uint16_t fields; /* MYSTORE_WIRE_FIELDS present in the payload. */
+    uint16_t reserved; /* Must be 0. */
+  } wire_header_t;
+
+  /**
+   * Compact request. Only the header, the client and the payload length are sent.
+   */
+  typedef struct
+  {
+    long mtype;
+    wire_header_t header;
+    int32_t return_to; /* Type to address the reply to. */
+    unsigned char payload[MYSTORE_WIRE_MAXPAYLOAD];
+  } wire_request_t;
+
+  /**
+   * Compact answer. Only the header, the status and the payload length are sent.
+   */
+  typedef struct
+  {
+    long mtype;
+    wire_header_t header;
+    int32_t status; /* Result of the operation. */
+    unsigned char payload[MYSTORE_WIRE_MAXPAYLOAD];
+  } wire_answer_t;
+
+  /* Size of the text of a message to pass to msgsnd() and msgrcv(): the type is not counted. */
+#define MYSTORE_MSGSIZE(type) (sizeof(type) - sizeof(long))
+  /* Size of the text of a compact message with the given payload length. */
+#define MYSTORE_WIRESIZE(type, length) (offsetof(type, payload) - sizeof(long) + (length))
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,74 @@
+/*
+ * File:   myhist.h
+ *
+ * This file defines latency histograms for the store server.
+ *
+ * Histograms are log-linear like HDR histograms: values are grouped by their
+ * highest bit and each group is split in MYH_SUBBUCKETS linear buckets, so
+ * every value is recorded with a relative error below 1/MYH_SUBBUCKETS
+ * whatever its magnitude. Recording a value is a few instructions and needs
+ * no memory allocation.
+ *
+ */
+
+#ifndef MYHIST_H
+#define MYHIST_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Bits of each value kept below its highest bit. */
+#define MYH_SUBBITS 5
+  /* Linear buckets inside each power of two. */
+#define MYH_SUBBUCKETS (1 << MYH_SUBBITS)
+  /* Buckets needed to cover every 64 bit value. */
+#define MYH_BUCKETS ((64 - MYH_SUBBITS + 1) * MYH_SUBBUCKETS)
+
+  /**
+   * A histogram of values (nanoseconds for latencies).
+   */
+  typedef struct
+  {
+    uint64_t count; /* Number of values recorded. */
+    uint64_t max; /* Highest value recorded. */
+    uint64_t buckets[MYH_BUCKETS]; /* Values recorded in each bucket. */
+  } MYH_HISTOGRAM_t;
+
+  /**
+   * Get the time of a monotonic clock shared by every process of the system.
+   * @return Time in nanoseconds.
+   */
+  uint64_t MYH_now ();
+
+  /**
+   * Empty a histogram.
+   * @param histogram The histogram.
+   */
+  void MYH_reset (MYH_HISTOGRAM_t *histogram);
+
+  /**
+   * Record one value.
+   * @param histogram The histogram.
+   * @param value The value to record.
+   */
+  void MYH_record (MYH_HISTOGRAM_t *histogram, uint64_t value);
+
+  /**
+   * Get the value below which a given percentage of the recorded values are.
+   * The value returned is the highest one of its bucket, so the real
+   * percentile is never above it.
+   * @param histogram The histogram.
+   * @param percentile Percentage between 0 and 100 (99.9 for p999).
+   * @return The value. 0 if the histogram is empty.
+   */
+  uint64_t MYH_percentile (const MYH_HISTOGRAM_t *histogram, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYHIST_H */
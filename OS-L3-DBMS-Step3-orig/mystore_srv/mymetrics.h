@@ -0,0 +1,85 @@
+/*
+ * File:   mymetrics.h
+ *
+ * This file defines a metrics exporter for the store server.
+ *
+ * The server registers its counters once. A background thread reads them
+ * periodically and rewrites a file in the Prometheus text exposition format,
+ * so a scraper (for example the textfile collector of node_exporter) can
+ * collect them. Counters are plain 64 bit integers updated atomically by
+ * their owners: the exporter never takes a lock that the request path takes.
+ *
+ */
+
+#ifndef MYMETRICS_H
+#define MYMETRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Maximum number of metrics registered. */
+#define MYM_MAXMETRICS 64
+
+  /**
+   * Kinds of metrics.
+   */
+  typedef enum
+  {
+    MYM_COUNTER = 0, /* Value that only grows. */
+    MYM_GAUGE, /* Value that goes up and down. */
+    MYM_SECONDS /* Counter of nanoseconds exported as seconds. */
+  } MYM_TYPE;
+
+  /**
+   * Register a metric read from a 64 bit integer. The name may include
+   * labels like in mystore_requests_total{op="read"}. Metrics with the same
+   * name and different labels must be registered one after the other.
+   * @param name Name of the metric (with labels if any).
+   * @param help Description of the metric.
+   * @param type Kind of metric.
+   * @param value The integer, updated by its owner with atomic operations.
+   * @return -1 if there is no room for more metrics. 0 means OK.
+   */
+  int MYM_register (const char *name, const char *help, MYM_TYPE type, const uint64_t *value);
+
+  /**
+   * Register a metric computed by a function when the file is written.
+   * The function is called from the exporter thread.
+   * @param name Name of the metric (with labels if any).
+   * @param help Description of the metric.
+   * @param type Kind of metric.
+   * @param read Function returning the value.
+   * @return -1 if there is no room for more metrics. 0 means OK.
+   */
+  int MYM_registerFunction (const char *name, const char *help, MYM_TYPE type, uint64_t (*read) ());
+
+  /**
+   * Write every metric registered to a file. The file is replaced
+   * atomically, so readers never see it half written.
+   * @param path Name of the file.
+   * @return -1 in case of error. 0 means OK.
+   */
+  int MYM_write (const char *path);
+
+  /**
+   * Start the thread that writes the metrics periodically.
+   * @param path Name of the file.
+   * @param period Seconds between writes.
+   * @return -1 if the thread could not be created. 0 means OK.
+   */
+  int MYM_start (const char *path, int period);
+
+  /**
+   * Stop the exporter thread. The file is written a last time.
+   */
+  void MYM_stop ();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYMETRICS_H */
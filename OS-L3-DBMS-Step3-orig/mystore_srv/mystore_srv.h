@@ -11,6 +11,7 @@
 #ifndef MYSTORE_CLI_H
 #define MYSTORE_CLI_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -39,18 +40,131 @@ extern "C"
    */
   int STORS_close ();
 
+  /* A server can hand the message queue over to a new server without removing
+   * it, so clients go on sending requests while the new server starts. */
+
+  /* Status of STORS_readrequest() when every request received before
+   * STORS_handover() was read. The rest wait in the queue for the next server. */
+#define STORS_HANDEDOVER -6
+
+  /**
+   * Initialize the server library with the message queue of a server that
+   * is handing it over.
+   * @return -1 if there is no queue or in case of error. 0 means OK.
+   */
+  int STORS_attach ();
+
+  /**
+   * Stop receiving requests to hand the message queue over. The requests
+   * already received are still read with STORS_readrequest() until it
+   * returns STORS_HANDEDOVER.
+   * @return -1 in case of error. 0 means OK.
+   */
+  int STORS_handover ();
+
+  /**
+   * Write the answers waiting for room in the queue to a file. The next
+   * server sends them after loading them with STORS_loadanswers().
+   * @param file The file.
+   * @return -1 in case of error. 0 means OK.
+   */
+  int STORS_saveanswers (FILE *file);
+
+  /**
+   * Read the answers saved by the last server. They are sent before any other.
+   * @param file The file.
+   * @return -1 in case of error. 0 means OK.
+   */
+  int STORS_loadanswers (FILE *file);
+
+  /**
+   * Finish the server side of the library after STORS_readrequest() returned
+   * STORS_HANDEDOVER. The message queue is left for the next server.
+   * @return -1 if the queue was not handed over. 0 means OK.
+   */
+  int STORS_release ();
+
+  /* Number of requests received and kept in the ring until the server reads
+   * them. Each client takes up to STORS_CLIENTSHARE of them. Its next
+   * requests, and the requests received while the ring is full, are kept
+   * aside in memory, up to STORS_MAXDEFERRED for all the clients. Only when
+   * that memory is full too do requests wait in the message queue. */
+#define STORS_RINGSIZE 256
+#define STORS_CLIENTSHARE 64
+#define STORS_MAXDEFERRED 16384
+  /* Clients with a queue of their own. Requests of other clients share one. */
+#define STORS_MAXCLIENTS 64
+  /* Largest weight of a client. */
+#define STORS_MAXWEIGHT 64
+
+  /* Priority classes. Requests of higher classes are received from the queue
+   * and read by the server first. To avoid starving the lower classes, one
+   * turn every STORS_NORMALTURN (STORS_BULKTURN) goes to the normal (bulk)
+   * class first, both when receiving and when reading requests. */
+#define STORS_NORMALTURN 4
+#define STORS_BULKTURN 16
+
   /**
-   * This function reads a request from the message queue.
-   * This function will wait blocked until it receives a request.
-   * When returning, the request passed by reference as pameter will contain the
-   * data of the request received from the message queue.
+   * Start the receiver thread that moves requests from the message queue
+   * to memory. Call it after fork() when running as a daemon, and after
+   * blocking the signals that the server handles synchronously.
+   * @return -1 if the thread could not be created. 0 means OK.
+   */
+  int STORS_start ();
+
+  /**
+   * Get a descriptor to wait for requests with poll(), select() or epoll.
+   * It becomes readable when requests are received.
+   * @return The descriptor.
+   */
+  int STORS_eventfd ();
+
+  /**
+   * This function takes the next request received from the message queue.
+   * It never blocks: wait on STORS_eventfd() and then call it until it
+   * returns -4.
    * The request will be processes outside this library.
    * @param request Is a pointer to a request structure to return a request
    * received from the client.
-   * @return Return 0 if OK. -1 in case of some error receiving.
+   * @return Return 0 if OK. -1 if requests can't be received any more.
+   * -4 indicates that no request is waiting. STORS_HANDEDOVER after a
+   * handover.
    */
   int STORS_readrequest (request_message_t *request);
 
+  /**
+   * Get the number of answers waiting for room in the message queue.
+   * While there are some, call STORS_readrequest() or STORS_sendanswer()
+   * periodically to send them.
+   * @return The number of answers waiting.
+   */
+  int STORS_pendinganswers ();
+
+  /**
+   * Get the number of requests received from the queue and not read by the
+   * server yet. It can be called from any thread.
+   * @return The number of requests.
+   */
+  int STORS_bufferedrequests ();
+
+  /**
+   * Set the share of a client. Requests received are queued per client and
+   * the clients with requests take turns, each one served up to its weight
+   * of requests per turn (1 by default). Requests of one client keep their
+   * order.
+   * @param client Identifier of the client (return_to of its requests).
+   * @param weight Requests per turn, from 1 to STORS_MAXWEIGHT.
+   * @return -1 if the weight is not valid or there is no room. 0 means OK.
+   */
+  int STORS_setweight (long client, int weight);
+
+  /**
+   * Get the number of messages in the message queue: requests not received
+   * yet plus answers not collected by their clients yet.
+   * @return The number of messages. -1 in case of error.
+   */
+  int STORS_queuedmessages ();
+
   /**
    * This function sends an answer structure to a client through a message queue.
    * @param answer This structure is already initialized and ready to be sent.
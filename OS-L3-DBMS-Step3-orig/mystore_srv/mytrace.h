@@ -0,0 +1,83 @@
+/*
+ * File:   mytrace.h
+ *
+ * This file defines the request trace of the store server.
+ *
+ * The server records one fixed size binary event per request in a ring in
+ * memory. Recording is a copy and an atomic store: no locks, no system calls
+ * and no formatting, so it is always enabled. The ring is dumped to a file on
+ * demand and the file is decoded offline with the store_trace program.
+ *
+ */
+
+#ifndef MYTRACE_H
+#define MYTRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Events kept in the ring. It must be a power of two. */
+#define MYT_EVENTS 65536
+
+  /* Magic number at the start of a trace file. */
+#define MYT_MAGIC 0x4d595452
+  /* Version of the format of trace files. */
+#define MYT_VERSION 1
+
+  /* Values of the hit field of an event. */
+#define MYT_MISS 0
+#define MYT_HIT 1
+#define MYT_NOCACHE 2 /* The operation does not access a record. */
+
+  /**
+   * One request served. Times are CLOCK_MONOTONIC nanoseconds.
+   */
+  typedef struct
+  {
+    uint64_t time; /* When the server started serving the request. */
+    int32_t client; /* Client that sent the request. */
+    uint32_t seq; /* Sequence number of the request. */
+    int32_t index; /* Index of the record. */
+    uint32_t queue_ns; /* Time from sending the request to starting serving it. */
+    uint32_t service_ns; /* Time serving the request and sending its answer. */
+    uint8_t op; /* MYSTORE_CLI_OP */
+    uint8_t hit; /* MYT_HIT, MYT_MISS or MYT_NOCACHE. */
+    int16_t status; /* Status of the answer. */
+  } MYT_EVENT_t;
+
+  /**
+   * Header of a trace file. The events follow it, oldest first.
+   */
+  typedef struct
+  {
+    uint32_t magic; /* MYT_MAGIC */
+    uint32_t version; /* MYT_VERSION */
+    uint32_t event_size; /* sizeof(MYT_EVENT_t) */
+    uint32_t count; /* Number of events in the file. */
+    uint64_t first; /* Number of the first event since the server started. */
+  } MYT_FILEHEADER_t;
+
+  /**
+   * Record an event. Only one thread may record events.
+   * @param event The event.
+   */
+  void MYT_record (const MYT_EVENT_t *event);
+
+  /**
+   * Write the events in the ring to a file. It can be called from any
+   * thread while events are being recorded: events overwritten while
+   * copying the ring are left out.
+   * @param path Name of the file.
+   * @return Number of events written. -1 in case of error.
+   */
+  int MYT_dump (const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYTRACE_H */
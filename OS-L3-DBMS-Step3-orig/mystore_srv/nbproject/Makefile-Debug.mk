@@ -35,7 +35,10 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
-	${OBJECTDIR}/libmystore_srv.o
+	${OBJECTDIR}/libmystore_srv.o \
+	${OBJECTDIR}/libmyhist.o \
+	${OBJECTDIR}/libmymetrics.o \
+	${OBJECTDIR}/libmytrace.o
 
 
 # C Compiler Flags
@@ -67,7 +70,22 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/libmystore_srv.a: ${OBJECTFILES}
 ${OBJECTDIR}/libmystore_srv.o: libmystore_srv.c nbproject/Makefile-${CND_CONF}.mk
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -g -Werror -DDEBUG_LIB -D_XOPEN_SOURCE -I../mycache -I. -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmystore_srv.o libmystore_srv.c
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_XOPEN_SOURCE -I../mycache -I. -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmystore_srv.o libmystore_srv.c
+
+${OBJECTDIR}/libmyhist.o: libmyhist.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_XOPEN_SOURCE -I../mycache -I. -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmyhist.o libmyhist.c
+
+${OBJECTDIR}/libmymetrics.o: libmymetrics.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_XOPEN_SOURCE -I../mycache -I. -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmymetrics.o libmymetrics.c
+
+${OBJECTDIR}/libmytrace.o: libmytrace.c nbproject/Makefile-${CND_CONF}.mk
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_XOPEN_SOURCE -I../mycache -I. -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmytrace.o libmytrace.c
 
 # Subprojects
 .build-subprojects:
@@ -35,7 +35,10 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
-	${OBJECTDIR}/libmystore_srv.o
+	${OBJECTDIR}/libmystore_srv.o \
+	${OBJECTDIR}/libmyhist.o \
+	${OBJECTDIR}/libmymetrics.o \
+	${OBJECTDIR}/libmytrace.o
 
 
 # C Compiler Flags
@@ -69,6 +72,21 @@ ${OBJECTDIR}/libmystore_srv.o: libmystore_srv.c
 	${RM} "$@.d"
 	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmystore_srv.o libmystore_srv.c
 
+${OBJECTDIR}/libmyhist.o: libmyhist.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmyhist.o libmyhist.c
+
+${OBJECTDIR}/libmymetrics.o: libmymetrics.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmymetrics.o libmymetrics.c
+
+${OBJECTDIR}/libmytrace.o: libmytrace.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libmytrace.o libmytrace.c
+
 # Subprojects
 .build-subprojects:
 
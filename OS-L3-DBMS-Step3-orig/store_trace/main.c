@@ -0,0 +1,74 @@
+/*
+ * File:   main.c
+ *
+ * This program decodes a request trace dumped by the store server (send it
+ * SIGUSR1) and prints one line per request, oldest first:
+ *
+ *   event time(us) client seq op index cache status queue(us) service(us)
+ *
+ * Time is relative to the first event of the file.
+ *
+ * Usage: store_trace [trace file]   (store_server.trace by default)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mytrace.h>
+
+/* Names of the operations, in the order of MYSTORE_CLI_OP. */
+static const char *op_names[] = {"read", "write", "sync", "flush", "flushall", "durable", "stats", "setweight", "handover",
+                                 "aggregate"};
+
+/* Names of the values of the hit field. */
+static const char *hit_names[] = {"miss", "hit", "-"};
+
+int
+main (int argc, char **argv)
+{
+  const char *path = argc > 1 ? argv[1] : "store_server.trace";
+  FILE *file = fopen (path, "r");
+  if (file == NULL)
+    {
+      perror (path);
+      return 1;
+    }
+
+  MYT_FILEHEADER_t header;
+  if (fread (&header, sizeof (header), 1, file) != 1 || header.magic != MYT_MAGIC)
+    {
+      fprintf (stderr, "%s is not a trace file.\n", path);
+      fclose (file);
+      return 1;
+    }
+  if (header.version != MYT_VERSION || header.event_size != sizeof (MYT_EVENT_t))
+    {
+      fprintf (stderr, "Unsupported trace version %u (event size %u).\n", header.version, header.event_size);
+      fclose (file);
+      return 1;
+    }
+
+  printf ("# %u events from event %llu\n", header.count, (unsigned long long) header.first);
+  printf ("# event time(us) client seq op index cache status queue(us) service(us)\n");
+  uint64_t start = 0;
+  for (uint32_t i = 0; i < header.count; i++)
+    {
+      MYT_EVENT_t event;
+      if (fread (&event, sizeof (event), 1, file) != 1)
+        {
+          fprintf (stderr, "Trace truncated after %u events.\n", i);
+          fclose (file);
+          return 1;
+        }
+      if (i == 0)
+        start = event.time;
+      const char *op = event.op < sizeof (op_names) / sizeof (op_names[0]) ? op_names[event.op] : "unknown";
+      const char *hit = event.hit < sizeof (hit_names) / sizeof (hit_names[0]) ? hit_names[event.hit] : "?";
+      printf ("%llu %.3f %d %u %s %d %s %d %.3f %.3f\n", (unsigned long long) (header.first + i),
+              (double) (event.time - start) / 1000.0, event.client, event.seq, op, event.index, hit,
+              event.status, event.queue_ns / 1000.0, event.service_ns / 1000.0);
+    }
+
+  fclose (file);
+  return (EXIT_SUCCESS);
+}
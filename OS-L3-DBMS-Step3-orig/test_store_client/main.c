@@ -11,8 +11,12 @@
  * Created on 06 de may de 2021, 15:01
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <mycache.h>
 #include <mystore_cli.h>
@@ -25,6 +29,26 @@ static int debug_level = DEBUG_INIT;
 /* Number of registers to use in the test. */
 #define TEST_LENGTH 68
 #define NUMBER_CACHE_ENTRIES 64
+/* Flooding clients of the fair scheduling test and their writes: to a
+ * record counting them, and scattered over a range of records. On average
+ * at most FLOOD_GAP writes of the count are served between two reads of
+ * another client. */
+#define FLOOD_CLIENTS 4
+#define FLOOD_WRITES 10000
+#define FLOOD_INDEX 1
+#define FLOOD_FIRST (1 << 20)
+#define FLOOD_SPREAD (1 << 20)
+#define FLOOD_GAP 16
+/* Record written with bulk priority before switching to interactive. */
+#define PRIORITY_INDEX 2
+#define PRIORITY_WRITES 2000
+/* DB file of the large file test, opened here without the server, and the
+ * page where its new pages start: 4 TiB into the file. */
+#define LARGE_FILE "large_test.dat"
+#define LARGE_FIRSTPAGE (1u << 30)
+#define LARGE_RECORDS 1000
+/* Sparse keys of the B+tree test, beyond the indices of the other layouts. */
+#define SPARSE_KEY(k) ((int) (0x80000000u + (k) * 1000003u))
 
 /*
  * This test uses the mystore client library to create some registers and then reads them again.
@@ -81,6 +105,59 @@ main (int argc, char** argv)
 
   debug_info ("Write test ended OK.");
 
+  /************************************************************/
+  /* UNACKNOWLEDGED WRITE TEST */
+  /************************************************************/
+  debug_info ("Unacknowledged write test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  /* Write the same records again without waiting for each answer. */
+  STORC_setWriteMode (STORC_WRITE_NOACK, 16);
+  for (int k = 0; k < 100; k++)
+    for (int i = 1; i < TEST_LENGTH - 1; i++)
+      {
+        record.registerid = i;
+        record.age = i;
+        record.gender = -1;
+        snprintf (record.name, sizeof (record.name), "reg #%d", i);
+
+        if (STORC_write (i, &record) != 0)
+          {
+            debug_error ("Error writing to the storage.");
+            exit (1);
+          }
+      }
+  /* Wait for every write to be acknowledged. */
+  if (STORC_setWriteMode (STORC_WRITE_ACK, 1) != 0)
+    {
+      debug_error ("Unacknowledged writes failed.");
+      exit (1);
+    }
+  /* Make every write durable with a single barrier. */
+  if (STORC_lastLSN () == 0 || STORC_waitDurable (STORC_lastLSN ()) != 0)
+    {
+      debug_error ("Error waiting for durable writes.");
+      exit (1);
+    }
+  if (STORC_flush (1) != 0 || STORC_flushAll () != 0)
+    {
+      debug_error ("Error flushing the storage.");
+      exit (1);
+    }
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing API.");
+      exit (1);
+    }
+
+  debug_info ("Unacknowledged write test ended OK.");
+
   /************************************************************/
   /* READ TEST */
   /************************************************************/
@@ -125,6 +202,654 @@ main (int argc, char** argv)
 
   debug_info ("Read test ended OK.");
 
+  /************************************************************/
+  /* PIPELINED READ TEST */
+  /************************************************************/
+  debug_info ("Pipelined read test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  /* The other tests use the compact wire format. This one uses the legacy one. */
+  STORC_setWireFormat (STORC_WIRE_LEGACY);
+  /* Keep many reads in flight and gather them as they complete.
+   * The write test only created records 1 to TEST_LENGTH - 2. */
+  STORC_setWindow (STORC_MAXWINDOW / 2);
+  MYRECORD_RECORD_t records[TEST_LENGTH];
+  int submitted[TEST_LENGTH];
+  int completed[TEST_LENGTH];
+  for (int i = 0; i < TEST_LENGTH; i++)
+    {
+      submitted[i] = -1;
+      completed[i] = 0;
+    }
+  int tags[TEST_LENGTH];
+  int statuses[TEST_LENGTH];
+  int gathered = 0;
+  /* Submit every read, then gather the remaining completions. */
+  for (int i = 1; gathered < TEST_LENGTH - 2; i++)
+    {
+      if (i < TEST_LENGTH - 1 && (submitted[i] = STORC_submitRead (i, &records[i])) < 0)
+        {
+          debug_error ("Error submitting read to server.");
+          exit (1);
+        }
+      int n = STORC_poll (tags, statuses, TEST_LENGTH);
+      if (n < 0)
+        {
+          debug_error ("Error polling for completions.");
+          exit (1);
+        }
+      /* Each completion is one of the reads submitted, and only once. */
+      for (int k = 0; k < n; k++)
+        {
+          int index = 1;
+          while (index < TEST_LENGTH - 1 && (submitted[index] != tags[k] || completed[index]))
+            index++;
+          if (index == TEST_LENGTH - 1)
+            {
+              debug_error ("Completion with unknown tag %d.", tags[k]);
+            }
+          else
+            {
+              completed[index] = 1;
+              if (statuses[k] != 0)
+                debug_error ("Read of register %d completed with status %d.", index, statuses[k]);
+            }
+        }
+      gathered += n;
+    }
+  for (int i = 1; i < TEST_LENGTH - 1; i++)
+    {
+      if (records[i].registerid != i)
+        {
+          debug_error ("Register at %d contains id %d.", i, records[i].registerid);
+        }
+    }
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  debug_info ("Pipelined read test ended OK.");
+
+  /************************************************************/
+  /* FAIR SCHEDULING TEST */
+  /************************************************************/
+  debug_info ("Fair scheduling test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  if (STORC_setWeight (0) != -1 || STORC_setWeight (STORC_MAXWEIGHT + 1) != -1)
+    debug_error ("Setting an invalid weight did not fail.");
+  if (STORC_setWeight (STORC_MAXWEIGHT) != 0)
+    {
+      debug_error ("Error setting the weight of the client.");
+      exit (1);
+    }
+  /* Requests of one client keep their order whatever its weight. */
+  for (int i = 1; i < TEST_LENGTH - 1; i++)
+    {
+      MYRECORD_RECORD_t record;
+      if (STORC_read (i, &record) != 0 || record.registerid != i)
+        {
+          debug_error ("Error reading record %d with weight %d.", i, STORC_MAXWEIGHT);
+          exit (1);
+        }
+    }
+  if (STORC_setWeight (1) != 0)
+    debug_error ("Error restoring the default weight of the client.");
+
+  /* A generous deadline changes nothing while the server keeps up. */
+  if (STORC_setTimeout (-1) != -1)
+    debug_error ("Setting a negative timeout did not fail.");
+  if (STORC_setTimeout (10000) != 0)
+    {
+      debug_error ("Error setting the timeout of the client.");
+      exit (1);
+    }
+  for (int i = 1; i < TEST_LENGTH - 1; i++)
+    {
+      MYRECORD_RECORD_t record;
+      int status = STORC_read (i, &record);
+      if (status != 0 || record.registerid != i)
+        {
+          debug_error ("Error reading record %d with a timeout (status %d).", i, status);
+          exit (1);
+        }
+    }
+  STORC_setTimeout (0);
+
+  /* Requests of every class are served. */
+  if (STORC_setPriority (STORC_PRIORITY_BULK + 1) != -1)
+    debug_error ("Setting an invalid priority did not fail.");
+  STORC_setLocalReads (0);
+  for (int priority = STORC_PRIORITY_INTERACTIVE; priority <= STORC_PRIORITY_BULK; priority++)
+    {
+      MYRECORD_RECORD_t record;
+      if (STORC_setPriority (priority) != 0 || STORC_read (1, &record) != 0 || record.registerid != 1)
+        {
+          debug_error ("Error reading with priority %d.", priority);
+          exit (1);
+        }
+    }
+  STORC_setPriority (STORC_PRIORITY_NORMAL);
+
+  /* Requests sent before changing the class are served first: a read just
+   * after switching sees the last of the bulk writes before it. */
+  MYRECORD_RECORD_t original;
+  if (STORC_read (PRIORITY_INDEX, &original) != 0)
+    {
+      debug_error ("Error reading the record of the priority test.");
+      exit (1);
+    }
+  STORC_setPriority (STORC_PRIORITY_BULK);
+  STORC_setWriteMode (STORC_WRITE_NOACK, STORC_MAXWINDOW);
+  for (int k = 1; k <= PRIORITY_WRITES; k++)
+    {
+      MYRECORD_RECORD_t record = original;
+      record.age = -k;
+      if (STORC_write (PRIORITY_INDEX, &record) != 0)
+        {
+          debug_error ("Error writing with bulk priority.");
+          exit (1);
+        }
+    }
+  if (STORC_setPriority (STORC_PRIORITY_INTERACTIVE) != 0)
+    debug_error ("Error switching to interactive priority.");
+  MYRECORD_RECORD_t switched;
+  if (STORC_read (PRIORITY_INDEX, &switched) != 0 || switched.age != -PRIORITY_WRITES)
+    debug_error ("Read after switching priority overtook the bulk writes (age %d).", switched.age);
+  STORC_setWriteMode (STORC_WRITE_ACK, 1);
+  if (STORC_write (PRIORITY_INDEX, &original) != 0)
+    {
+      debug_error ("Error restoring the record of the priority test.");
+      exit (1);
+    }
+  STORC_setPriority (STORC_PRIORITY_NORMAL);
+  STORC_setLocalReads (1);
+
+  MYRECORD_RECORD_t saved;
+  if (STORC_read (FLOOD_INDEX, &saved) != 0)
+    {
+      debug_error ("Error reading the record of the flood.");
+      exit (1);
+    }
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  /* Other clients flood the server with writes scattered over many pages,
+   * so the server falls behind. The first one also counts down the age of a
+   * record. The reads of this client are served in between, so few writes
+   * of the count are served between two of them. */
+  fflush (NULL);
+  pid_t flooders[FLOOD_CLIENTS];
+  for (int c = 0; c < FLOOD_CLIENTS; c++)
+    {
+      flooders[c] = fork ();
+      if (flooders[c] == -1)
+        {
+          debug_error ("Error starting a flooding client.");
+          exit (1);
+        }
+      if (flooders[c] != 0)
+        continue;
+      if (STORC_init () != 0)
+        exit (1);
+      STORC_setWindow (STORC_MAXWINDOW);
+      STORC_setWriteMode (STORC_WRITE_NOACK, STORC_MAXWINDOW);
+      for (int k = 1; k <= FLOOD_WRITES; k++)
+        {
+          MYRECORD_RECORD_t record = saved;
+          record.age = -k;
+          /* Writes rejected by admission control are not retried. */
+          if ((c == 0 && STORC_write (FLOOD_INDEX, &record) == -1)
+              || STORC_write (FLOOD_FIRST + (k * 7919 + c) % FLOOD_SPREAD, &record) == -1)
+            exit (1);
+        }
+      STORC_setWriteMode (STORC_WRITE_ACK, 1);
+      exit ((c != 0 || STORC_write (FLOOD_INDEX, &saved) == 0) && STORC_close () == 0 ? 0 : 1);
+    }
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+  STORC_setLocalReads (0);
+  int firstAge = 0;
+  int lastAge = 0;
+  int samples = 0;
+  for (int i = 0; i < 100 * FLOOD_WRITES; i++)
+    {
+      MYRECORD_RECORD_t record;
+      if (STORC_read (FLOOD_INDEX, &record) != 0)
+        {
+          debug_error ("Error reading during the flood.");
+          break;
+        }
+      /* Wait for the count to start, and stop when it ends. */
+      if (record.age >= 0 || record.age == -FLOOD_WRITES)
+        {
+          if (samples > 0)
+            break;
+          continue;
+        }
+      if (samples == 0)
+        firstAge = record.age;
+      lastAge = record.age;
+      samples++;
+    }
+  STORC_setLocalReads (1);
+  if (samples < 2 || (firstAge - lastAge) / (samples - 1) > FLOOD_GAP)
+    debug_error ("Reads waited behind a flood of writes (%d reads during %d writes).", samples, firstAge - lastAge);
+  for (int c = 0; c < FLOOD_CLIENTS; c++)
+    {
+      int flooded;
+      if (waitpid (flooders[c], &flooded, 0) != flooders[c] || !WIFEXITED (flooded) || WEXITSTATUS (flooded) != 0)
+        debug_error ("A flooding client failed.");
+    }
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  debug_info ("Fair scheduling test ended OK.");
+
+  /************************************************************/
+  /* TABLE TEST */
+  /************************************************************/
+  debug_info ("Table test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  if (STORC_setTable (-1) != -1 || STORC_setTable (STORC_MAXTABLES) != -1)
+    debug_error ("Invalid tables were accepted.");
+
+  /* Table 1 is served when the server is started with -t file. Its records
+   * are apart from the ones of the default table. */
+  STORC_setTable (1);
+  record.registerid = 1000;
+  int status = STORC_write (1, &record);
+  if (status == 0)
+    {
+      if (STORC_read (1, &record) != 0 || record.registerid != 1000)
+        debug_error ("Record of table 1 read back wrong.");
+      STORC_setTable (0);
+      if (STORC_read (1, &record) != 0 || record.registerid != 1)
+        debug_error ("A write to table 1 changed the default table.");
+    }
+  else if (status == -1)
+    {
+      debug_info ("The server has no table 1 (start it with -t file to test it).");
+    }
+  else
+    {
+      debug_error ("Error writing to table 1.");
+      exit (1);
+    }
+  STORC_setTable (0);
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  debug_info ("Table test ended OK.");
+
+  /************************************************************/
+  /* AGGREGATE TEST */
+  /************************************************************/
+  debug_info ("Aggregate test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  /* Records 1 to TEST_LENGTH - 2 have their index as age. The records never
+   * written in the range are skipped by the default table. The range ends
+   * before TEST_LENGTH, written by the variable length record test. */
+  STORC_AGGREGATE_t aggregate;
+  if (STORC_aggregate ("age", 1, 10, &aggregate) != 0 || aggregate.count != 10 || aggregate.sum != 55
+      || aggregate.min != 1 || aggregate.max != 10)
+    debug_error ("Aggregate of the age of records 1 to 10 is wrong.");
+  if (STORC_aggregate ("gender", TEST_LENGTH - 8, 8, &aggregate) != 0 || aggregate.count != 7
+      || aggregate.sum != -7 || aggregate.min != -1 || aggregate.max != -1)
+    debug_error ("Aggregate of the gender of the last records is wrong.");
+  if (STORC_aggregate ("name", 0, 10, &aggregate) != -1 || STORC_aggregate ("height", 0, 10, &aggregate) != -1)
+    debug_error ("Aggregates of invalid fields were accepted.");
+
+  /* Table 1 may be stored by columns (start the server with -c file):
+   * aggregates read only the column of their field then. It may be stored
+   * as a log-structured merge tree too (-l file:16): the records are written
+   * three times, enough to fill its memtable many times and merge its runs,
+   * and the last version must win. */
+  STORC_setTable (1);
+  int written = 1;
+  for (int pass = 2; pass >= 0 && written; pass--)
+    {
+      for (int i = 0; i < 4000 && written; i++)
+        {
+          record.registerid = i;
+          record.age = i + pass;
+          record.gender = i % 2;
+          snprintf (record.name, sizeof (record.name), "col #%d", i);
+          written = STORC_write (i, &record) == 0;
+        }
+    }
+  if (STORC_aggregate ("age", 0, 4000, &aggregate) == 0)
+    {
+      if (aggregate.count != 4000 || aggregate.sum != 7998000 || aggregate.min != 0 || aggregate.max != 3999)
+        debug_error ("Aggregate of the age of table 1 is wrong.");
+      if (STORC_read (42, &record) != 0 || record.age != 42 || record.gender != 0
+          || strcmp (record.name, "col #42") != 0)
+        debug_error ("Record of table 1 read back wrong.");
+    }
+  else
+    {
+      debug_info ("The server has no table 1 (start it with -c or -l file to test it).");
+    }
+
+  /* Table 1 may be stored in a B+tree (-b file): any registerid is an index
+   * then, even the highest ones, and sparse keys scan in order. The other
+   * layouts refuse them. */
+  written = 0;
+  for (int k = 0; k < 100 && written == k; k++)
+    {
+      record.registerid = SPARSE_KEY (k);
+      record.age = k;
+      record.gender = 1;
+      snprintf (record.name, sizeof (record.name), "key #%d", k);
+      written += STORC_write (SPARSE_KEY (k), &record) == 0;
+    }
+  if (written == 100)
+    {
+      record.registerid = UINT32_MAX;
+      if (STORC_write ((int) UINT32_MAX, &record) != 0 || STORC_read ((int) UINT32_MAX, &record) != 0
+          || record.registerid != UINT32_MAX)
+        debug_error ("Record with the highest key of table 1 read back wrong.");
+      if (STORC_aggregate ("age", SPARSE_KEY (0), SPARSE_KEY (100) - SPARSE_KEY (0), &aggregate) != 0
+          || aggregate.count != 100 || aggregate.sum != 4950 || aggregate.min != 0 || aggregate.max != 99)
+        debug_error ("Aggregate of the sparse keys of table 1 is wrong.");
+      if (STORC_read (SPARSE_KEY (42), &record) != 0 || record.age != 42 || strcmp (record.name, "key #42") != 0
+          || STORC_read (SPARSE_KEY (42) + 1, &record) != 0 || record.registerid != 0)
+        debug_error ("Sparse key of table 1 read back wrong.");
+    }
+  STORC_setTable (0);
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  debug_info ("Aggregate test ended OK.");
+
+  /************************************************************/
+  /* VARIABLE LENGTH RECORD TEST */
+  /************************************************************/
+  debug_info ("Variable length record test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  /* Records are stored packed: a record grows to the longest name and
+   * shrinks back, read from the server and from the shared cache. */
+  for (int length = 1; length < MYRECORD_NAMELENGTH; length += MYRECORD_NAMELENGTH / 4)
+    {
+      MYRECORD_RECORD_t written, read;
+      memset (&written, 0, sizeof (written));
+      written.registerid = TEST_LENGTH;
+      written.age = -length;
+      written.gender = length;
+      memset (written.name, 'a' + length % 26, length == 1 ? MYRECORD_NAMELENGTH : length);
+      if (STORC_write (TEST_LENGTH, &written) != 0)
+        {
+          debug_error ("Error writing a record with a name of %d characters.", length);
+          exit (1);
+        }
+      for (int local = 0; local <= 1; local++)
+        {
+          STORC_setLocalReads (local);
+          if (STORC_read (TEST_LENGTH, &read) != 0 || memcmp (&read, &written, sizeof (read)) != 0)
+            debug_error ("Record with a name of %d characters read back wrong (local reads %d).", length, local);
+        }
+    }
+
+  /* Records never written read as empty. */
+  MYRECORD_RECORD_t empty;
+  record.registerid = 1;
+  if (STORC_read (TEST_LENGTH + 1000, &record) != 0 || memcmp (&record, memset (&empty, 0, sizeof (empty)), sizeof (record)) != 0)
+    debug_error ("A record never written is not empty.");
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  debug_info ("Variable length record test ended OK.");
+
+  /************************************************************/
+  /* LARGE INDEX TEST */
+  /************************************************************/
+  debug_info ("Large index test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  /* Before its directory grows, table 0 has no record past the records it
+   * indexes, and a scan of every index skips them. */
+  STORC_setTable (0);
+  for (int local = 0; local <= 1; local++)
+    {
+      STORC_setLocalReads (local);
+      if (STORC_read ((1 << 29) + 5, &record) != 0 || record.registerid != 0)
+        debug_error ("Record past the directory read back wrong (local reads %d).", local);
+    }
+  STORC_setLocalReads (0);
+  STORC_AGGREGATE_t all;
+  if (STORC_aggregate ("age", 0, INT_MAX, &all) != 0 || all.count == 0)
+    debug_error ("Aggregate of every index before the directory grew failed.");
+
+  /* The highest index grows the directory of table 0 by a level, and the
+   * records below keep their place. A table stored by columns gets column
+   * files of hundreds of GiB, sparse but for their last page. */
+  for (int table = 0; table <= 1; table++)
+    {
+      STORC_setTable (table);
+      record.registerid = INT_MAX;
+      record.age = table;
+      record.gender = 1;
+      snprintf (record.name, sizeof (record.name), "last #%d", table);
+      if (STORC_write (INT_MAX, &record) != 0)
+        {
+          if (table == 0)
+            debug_error ("Error writing the record with the highest index.");
+          continue;
+        }
+      for (int local = 0; local <= 1; local++)
+        {
+          STORC_setLocalReads (local);
+          if (STORC_read (INT_MAX, &record) != 0 || record.registerid != INT_MAX || record.age != table
+              || strcmp (record.name, table == 0 ? "last #0" : "last #1") != 0)
+            debug_error ("Record with the highest index of table %d read back wrong (local reads %d).", table,
+                         local);
+          if (table == 0 && (STORC_read (5, &record) != 0 || record.registerid != 5 || record.age != 5))
+            debug_error ("Record 5 moved when the directory grew (local reads %d).", local);
+          if (STORC_read (INT_MAX - 1, &record) != 0 || (table == 0 && record.registerid != 0))
+            debug_error ("Record before the highest index of table %d read back wrong.", table);
+        }
+      STORC_setLocalReads (0);
+      if (STORC_flush (INT_MAX) != 0)
+        debug_error ("Error flushing the record with the highest index of table %d.", table);
+    }
+  STORC_setTable (0);
+  STORC_AGGREGATE_t last;
+  if (STORC_aggregate ("age", INT_MAX - 1000, 1001, &last) != 0 || last.count != 1 || last.sum != 0)
+    debug_error ("Aggregate of the highest indices is wrong.");
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  debug_info ("Large index test ended OK.");
+
+  /************************************************************/
+  /* LARGE FILE TEST */
+  /************************************************************/
+  debug_info ("Large file test started...");
+
+  /* A table whose new pages start at 4 TiB, as if it had grown that much.
+   * Its header is changed by hand, so the file stays sparse. */
+  remove (LARGE_FILE);
+  int large = MYC_openTable (LARGE_FILE, NUMBER_CACHE_ENTRIES, MYC_LAYOUT_ROWS);
+  memset (&record, 0, sizeof (record));
+  record.registerid = 1;
+  record.age = 1;
+  if (large == -1 || MYC_writeEntry (1, &record) != 0 || MYC_closeTable (large) != 0)
+    {
+      debug_error ("Error creating the large file.");
+      exit (1);
+    }
+  MYC_FILEHEADER_t header;
+  FILE *file = fopen (LARGE_FILE, "r+b");
+  if (file == NULL || fread (&header, sizeof (header), 1, file) != 1)
+    {
+      debug_error ("Error reading the header of the large file.");
+      exit (1);
+    }
+  header.numpages = LARGE_FIRSTPAGE;
+  header.insertpage = 0;
+  if (fseek (file, 0, SEEK_SET) != 0 || fwrite (&header, sizeof (header), 1, file) != 1 || fclose (file) != 0)
+    {
+      debug_error ("Error writing the header of the large file.");
+      exit (1);
+    }
+
+  large = MYC_openTable (LARGE_FILE, NUMBER_CACHE_ENTRIES, MYC_LAYOUT_ROWS);
+  if (large == -1)
+    {
+      debug_error ("Error opening the large file.");
+      exit (1);
+    }
+  for (int i = 0; i < LARGE_RECORDS; i++)
+    {
+      memset (&record, 0, sizeof (record));
+      record.registerid = INT_MAX - i;
+      record.age = i;
+      snprintf (record.name, sizeof (record.name), "far #%d", i);
+      if (MYC_writeEntry (INT_MAX - i, &record) != 0)
+        {
+          debug_error ("Error writing record %d past 4 TiB.", INT_MAX - i);
+          break;
+        }
+    }
+  if (MYC_closeTable (large) != 0)
+    debug_error ("Error closing the large file.");
+  file = fopen (LARGE_FILE, "rb");
+  if (file == NULL || fseek (file, 0, SEEK_END) != 0
+      || ftell (file) <= (long) LARGE_FIRSTPAGE * MYP_PAGESIZE)
+    debug_error ("The pages of the large file are not past 4 TiB.");
+  if (file != NULL)
+    fclose (file);
+
+  /* Reopened, the table reads the records past 4 TiB and the one before. */
+  large = MYC_openTable (LARGE_FILE, NUMBER_CACHE_ENTRIES, MYC_LAYOUT_ROWS);
+  if (large == -1)
+    {
+      debug_error ("Error reopening the large file.");
+      exit (1);
+    }
+  for (int i = 0; i < LARGE_RECORDS; i++)
+    {
+      char name[sizeof (record.name)];
+      snprintf (name, sizeof (name), "far #%d", i);
+      if (MYC_readEntry (INT_MAX - i, &record) != 0 || record.registerid != INT_MAX - i
+          || record.age != i || strcmp (record.name, name) != 0)
+        {
+          debug_error ("Record %d past 4 TiB read back wrong.", INT_MAX - i);
+          break;
+        }
+    }
+  if (MYC_readEntry (1, &record) != 0 || record.registerid != 1 || record.age != 1)
+    debug_error ("Record before 4 TiB read back wrong.");
+  if (MYC_closeTable (large) != 0)
+    debug_error ("Error closing the large file.");
+  remove (LARGE_FILE);
+
+  debug_info ("Large file test ended OK.");
+
+  /************************************************************/
+  /* LATENCY STATISTICS TEST */
+  /************************************************************/
+  debug_info ("Latency statistics test started...");
+
+  if (STORC_init () != 0)
+    {
+      debug_error ("Error initializing client API.");
+      exit (1);
+    }
+
+  /* Every test above went through the server, so some class has requests. */
+  unsigned long long served = 0;
+  for (int class = STORC_LAT_READHIT; class <= STORC_LAT_OTHER; class++)
+    {
+      STORC_LATENCY_t latency;
+      if (STORC_stats (class, &latency) != 0)
+        {
+          debug_error ("Error getting latency statistics of class %d.", class);
+          exit (1);
+        }
+      served += latency.count;
+      debug_info ("Class %d: %llu requests. Total latency p50=%lluns p99=%lluns p999=%lluns.", class,
+                  (unsigned long long) latency.count, (unsigned long long) latency.total[0],
+                  (unsigned long long) latency.total[1], (unsigned long long) latency.total[2]);
+      if (latency.total[0] > latency.total[1] || latency.total[1] > latency.total[2])
+        debug_error ("Percentiles of class %d are not ordered.", class);
+    }
+  if (served == 0)
+    debug_error ("The server measured no requests.");
+  if (STORC_stats (STORC_LAT_OTHER + 1, NULL) != -1)
+    debug_error ("Statistics of an invalid class did not fail.");
+
+  if (STORC_close () != 0)
+    {
+      debug_error ("Error closing client.");
+      exit (1);
+    }
+
+  debug_info ("Latency statistics test ended OK.");
+
   debug_info ("Test store client ended OK.");
 
   return (EXIT_SUCCESS);
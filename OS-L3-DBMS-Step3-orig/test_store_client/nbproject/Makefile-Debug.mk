@@ -52,7 +52,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=../mystore_cli/dist/Debug/GNU-Linux/libmystore_cli.a
+LDLIBSOPTIONS=../mystore_cli/dist/Debug/GNU-Linux/libmystore_cli.a ../mycache/dist/Debug/GNU-Linux/libmycache.a
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -60,6 +60,8 @@ LDLIBSOPTIONS=../mystore_cli/dist/Debug/GNU-Linux/libmystore_cli.a
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_client: ../mystore_cli/dist/Debug/GNU-Linux/libmystore_cli.a
 
+${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_client: ../mycache/dist/Debug/GNU-Linux/libmycache.a
+
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_client: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
 	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_client ${OBJECTFILES} ${LDLIBSOPTIONS}
@@ -67,11 +69,12 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_client: ${OBJECTFILES}
 ${OBJECTDIR}/main.o: main.c nbproject/Makefile-${CND_CONF}.mk
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -g -Werror -DDEBUG_LIB -I../mystore_cli -I../mycache -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
+	$(COMPILE.c) -g -Werror -DDEBUG_LIB -D_GNU_SOURCE -I../mystore_cli -I../mycache -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
 
 # Subprojects
 .build-subprojects:
 	cd ../mystore_cli && ${MAKE}  -f Makefile CONF=Debug
+	cd ../mycache && ${MAKE}  -f Makefile CONF=Debug
 
 # Clean Targets
 .clean-conf: ${CLEAN_SUBPROJECTS}
@@ -80,6 +83,7 @@ ${OBJECTDIR}/main.o: main.c nbproject/Makefile-${CND_CONF}.mk
 # Subprojects
 .clean-subprojects:
 	cd ../mystore_cli && ${MAKE}  -f Makefile CONF=Debug clean
+	cd ../mycache && ${MAKE}  -f Makefile CONF=Debug clean
 
 # Enable dependency checking
 .dep.inc: .depcheck-impl
@@ -14,60 +14,926 @@
 
 #include <mycache.h>
 #include <mystore_srv.h>
+#include <myhist.h>
+#include <mymetrics.h>
+#include <mytrace.h>
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "debug.h"
 
 /* Debug level for messages */
 static int debug_level = DEBUG_INIT;
 
-// the booleans
-volatile static int prog_end_requested = 0;
-volatile static int sigusr1_requested = 0;
-volatile static int sigusr2_reuqested = 0;
-volatile static int alarm_requested = 0;
+/* Seconds between periodic flushes of the cache. */
+#define FLUSH_PERIOD 15
 
-void s_handler(int sig_num)
+/* File rewritten with the metrics of the server and seconds between writes. */
+#define METRICS_FILE "store_server.prom"
+#define METRICS_PERIOD 5
+
+/* Admission control. A full queue alone only means that clients send faster
+ * than the server serves, and they block until there is room. The server is
+ * overloaded when the queue is deep and requests also wait long in it. Then
+ * unacknowledged writes (bulk loads) are rejected first and, past the hard
+ * limits, every read and write. Depth counts requests received or still in
+ * the queue plus answers not collected. */
+#define SHED_SOFT_DEPTH 128
+#define SHED_SOFT_WAIT_NS 50000000ULL
+#define SHED_HARD_DEPTH 256
+#define SHED_HARD_WAIT_NS 200000000ULL
+
+/* File where SIGUSR1 dumps the trace of the last requests. */
+#define TRACE_FILE "store_server.trace"
+
+/* File keeping the records in the cache, saved with each periodic flush and
+ * at the end, and prefetched at start. Records loaded per idle moment. The
+ * other tables add their number to the name. */
+#define HOTSET_FILE "store_server.hot"
+#define PREFETCH_BATCH 8
+
+/* Tables served besides the default one (table 0), given with -t file[:pages],
+ * with -c file[:pages] if stored by columns, with -l file[:pages] if stored
+ * as a log-structured merge tree or with -b file[:pages] if stored in a
+ * B+tree keyed by registerid. Table t is tableFile[t], with a cache of
+ * tablePages[t] pages and the layout tableLayout[t]. */
+static const char *tableFile[MYSTORE_MAXTABLES];
+static int tablePages[MYSTORE_MAXTABLES];
+static int tableLayout[MYSTORE_MAXTABLES];
+static int numTables = 1;
+
+/* Flags added to the layout of every table: MYC_COMPRESSED with -z and
+ * MYC_SEGMENTED with -s. They only change the tables whose file is created now. */
+static int layoutFlags = 0;
+
+/* Hot restart. A server started with -r sends HANDOVER_SIGNAL to the running
+ * one, which serves the requests it already received, saves the state of its
+ * clients to HANDOVER_FILE and leaves the queue and the shared cache, dirty
+ * entries included, to the new server. */
+#define HANDOVER_SIGNAL SIGQUIT
+#define HANDOVER_FILE "store_server.handover"
+#define HANDOVER_MAGIC 0x4d594856
+#define HANDOVER_TIMEOUT_MS 30000
+
+/* Snapshots. SNAPSHOT_SIGNAL starts a snapshot of every table to its file
+ * with SNAPSHOT_SUFFIX added. The pages that did not change are copied when
+ * no request is waiting, SNAPSHOT_BATCH per table at a time. */
+#define SNAPSHOT_SIGNAL SIGRTMIN
+#define SNAPSHOT_SUFFIX ".snap"
+#define SNAPSHOT_BATCH 64
+
+/* Milliseconds to wait before retrying answers waiting for room in the queue. */
+#define BACKLOG_RETRY_MS 1
+
+/* Descriptors of the event loop. Signals and timers are read as events,
+ * so no work is done inside signal handlers. */
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int timer_fd = -1;
+
+/* The server is handing the queue over to a new server. */
+static bool handingOver = false;
+
+/* Pages of the snapshots running left to copy. */
+static int snapshotLeft = 0;
+
+// stats
+/* The metrics exporter reads them from its own thread. */
+static uint64_t numberR;
+static uint64_t numberW;
+static uint64_t numberReq;
+
+/* Requests waiting when the last batch of requests started. */
+static uint64_t queueDepth;
+/* Requests rejected because the server was overloaded. */
+static uint64_t numberShed;
+/* Requests dropped because their deadline passed before serving them. */
+static uint64_t numberExpired;
+
+/* Count one more request without locks. */
+#define countRequest(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+
+/* Latency histograms of one class of requests. */
+typedef struct
+{
+  MYH_HISTOGRAM_t queue;   /* From sending the request to starting serving it. */
+  MYH_HISTOGRAM_t service; /* Serving the request. */
+  MYH_HISTOGRAM_t total;   /* From sending the request to sending its answer. */
+} latency_t;
+
+/* Latencies of each MYSTORE_LATENCY_CLASS. */
+static latency_t Latency[MYSLAT_CLASSES];
+
+/* Maximum number of clients with unacknowledged writes at the same time. */
+#define MAX_NOACK_CLIENTS 256
+
+/* Results of the unacknowledged writes of one client since its last acknowledgement. */
+typedef struct
+{
+  long client;          /* Client identifier. 0 means the entry is free. */
+  unsigned int writes;  /* Writes done since the last acknowledgement. */
+  unsigned int failed;  /* How many of them failed. */
+  int first_error;      /* Status of the first failed write. */
+} noack_state_t;
+
+static noack_state_t noackClients[MAX_NOACK_CLIENTS];
+
+/**
+ * Search the entry of a client with unacknowledged writes.
+ * @param client Client identifier.
+ * @param create Get a free entry if the client has none.
+ * @return The entry or NULL if not found (or no free entry to create it).
+ */
+static noack_state_t *searchNoack(long client, bool create)
+{
+  noack_state_t *free_entry = NULL;
+  for (int i = 0; i < MAX_NOACK_CLIENTS; i++)
+  {
+    if (noackClients[i].client == client)
+      return &noackClients[i];
+    if (free_entry == NULL && noackClients[i].client == 0)
+      free_entry = &noackClients[i];
+  }
+  if (!create)
+    return NULL;
+  if (free_entry == NULL)
+  {
+    debug_error("Too many clients with unacknowledged writes (client=%ld).", client);
+    return NULL;
+  }
+  free_entry->client = client;
+  return free_entry;
+}
+
+/**
+ * Account the result of an unacknowledged write.
+ * @param client Client identifier.
+ * @param status Result of the write.
+ */
+static void noackAccount(long client, int status)
+{
+  noack_state_t *entry = searchNoack(client, true);
+  if (entry == NULL)
+    return;
+  entry->writes++;
+  if (status != 0)
+  {
+    if (entry->failed == 0)
+      entry->first_error = status;
+    entry->failed++;
+  }
+}
+
+/**
+ * Fill an answer with the cumulative acknowledgement of a client and reset it.
+ * @param client Client identifier.
+ * @param answer Answer to fill.
+ */
+static void noackCollect(long client, answer_message_t *answer)
+{
+  noack_state_t *entry = searchNoack(client, false);
+  answer->acked = 0;
+  answer->failed = 0;
+  answer->status = 0;
+  if (entry == NULL)
+    return;
+  answer->acked = entry->writes;
+  answer->failed = entry->failed;
+  answer->status = entry->failed ? entry->first_error : 0;
+  /* Free the entry. It is created again by the next unacknowledged write. */
+  memset(entry, 0, sizeof(*entry));
+}
+
+/**
+ * Fill a latency report with the percentiles of the histograms of a class.
+ * @param latency The histograms of the class.
+ * @param report The report to fill.
+ */
+static void reportLatency(const latency_t *latency, latency_report_t *report)
+{
+  static const double percentiles[MYSLAT_PERCENTILES] = {50.0, 99.0, 99.9};
+  report->count = latency->total.count;
+  for (int p = 0; p < MYSLAT_PERCENTILES; p++)
+  {
+    report->queue[p] = MYH_percentile(&latency->queue, percentiles[p]);
+    report->service[p] = MYH_percentile(&latency->service, percentiles[p]);
+    report->total[p] = MYH_percentile(&latency->total, percentiles[p]);
+  }
+}
+
+/**
+ * Decide whether a request must be rejected because the server is overloaded.
+ * Control operations (sync, flush, stats...) are always served so that
+ * clients can still learn the state of their writes.
+ * @param req The request.
+ * @param depth Requests waiting.
+ * @param wait Time the request waited before being served (ns).
+ * @return true if the request must be rejected.
+ */
+static bool shedRequest(request_message_t *req, int depth, uint64_t wait)
+{
+  if (req->requested_op != MYSCOP_READ && req->requested_op != MYSCOP_WRITE)
+    return false;
+  if (depth >= SHED_HARD_DEPTH && wait >= SHED_HARD_WAIT_NS)
+    return true;
+  return depth >= SHED_SOFT_DEPTH && wait >= SHED_SOFT_WAIT_NS
+      && req->requested_op == MYSCOP_WRITE && (req->flags & MYSCFL_NOACK);
+}
+
+/**
+ * Tell whether an operation works on the table of the request.
+ * @param op The operation.
+ * @return true if the table must be selected before serving it.
+ */
+static bool usesTable(int op)
+{
+  return op == MYSCOP_READ || op == MYSCOP_WRITE || op == MYSCOP_SYNC || op == MYSCOP_FLUSH ||
+         op == MYSCOP_FLUSHALL || op == MYSCOP_DURABLE || op == MYSCOP_AGGREGATE;
+}
+
+/**
+ * Flush the caches of every table.
+ * @return 0 if OK. -1 if some table could not be flushed.
+ */
+static int flushTables()
+{
+  int status = 0;
+  for (int t = 0; t < numTables; t++)
+  {
+    if (MYC_useTable(t) != 0 || MYC_flushAll() != 0)
+      status = -1;
+  }
+  return status;
+}
+
+/**
+ * Get the name of the hot set file of a table.
+ * @param table The table.
+ * @param name Where to write the name.
+ * @param size Size of name.
+ * @return The name.
+ */
+static const char *hotSetFile(int table, char *name, size_t size)
+{
+  if (table == 0)
+    snprintf(name, size, "%s", HOTSET_FILE);
+  else
+    snprintf(name, size, "%s.%d", HOTSET_FILE, table);
+  return name;
+}
+
+/* Save the hot set of every table. */
+static void saveHotSets()
+{
+  char name[FILENAME_MAX];
+  for (int t = 0; t < numTables; t++)
+  {
+    if (MYC_useTable(t) == 0)
+      MYC_saveHotSet(hotSetFile(t, name, sizeof(name)));
+  }
+}
+
+/**
+ * Load the hot set of every table and start reading their pages.
+ * @return Number of pages to prefetch.
+ */
+static int loadHotSets()
+{
+  char name[FILENAME_MAX];
+  int left = 0;
+  for (int t = 0; t < numTables; t++)
+  {
+    int count = MYC_useTable(t) == 0 ? MYC_loadHotSet(hotSetFile(t, name, sizeof(name))) : 0;
+    if (count > 0)
+      left += count;
+  }
+  return left;
+}
+
+/**
+ * Load the next pages of the hot sets into the caches.
+ * @param max Maximum number of pages to load per table.
+ * @return Number of pages left.
+ */
+static int prefetchHotSets(int max)
+{
+  int left = 0;
+  for (int t = 0; t < numTables; t++)
+  {
+    int count = MYC_useTable(t) == 0 ? MYC_prefetchHotSet(max) : 0;
+    if (count > 0)
+      left += count;
+  }
+  return left;
+}
+
+/**
+ * Start a snapshot of every table. Tables with a snapshot running or stored
+ * as a log-structured merge tree are skipped.
+ * @return Number of pages to copy.
+ */
+static int startSnapshots()
+{
+  char name[FILENAME_MAX];
+  int left = 0;
+  for (int t = 0; t < numTables; t++)
+  {
+    snprintf(name, sizeof(name), "%s%s", t == 0 ? MYC_FILENAME : tableFile[t], SNAPSHOT_SUFFIX);
+    if (MYC_useTable(t) != 0 || MYC_startSnapshot(name) != 0)
+      debug_error("No snapshot of table %d.", t);
+    int count = MYC_snapshotStep(0);
+    if (count > 0)
+      left += count;
+  }
+  return left;
+}
+
+/**
+ * Copy the next pages of the snapshots of every table.
+ * @param max Maximum number of pages to copy per table.
+ * @return Number of pages left.
+ */
+static int snapshotTables(int max)
+{
+  int left = 0;
+  for (int t = 0; t < numTables; t++)
+  {
+    int count = MYC_useTable(t) == 0 ? MYC_snapshotStep(max) : 0;
+    if (count > 0)
+      left += count;
+  }
+  return left;
+}
+
+/**
+ * Open the tables given with -t, -c, -l and -b. The default table is already open. Their
+ * caches are shared like the default one, and adopted if the last server
+ * handed them over.
+ * @return 0 if OK. -1 in case of error.
+ */
+static int openTables()
+{
+  static const char *layouts[] = {"by rows", "by columns", "as a log-structured merge tree", "in a B+tree"};
+  for (int t = 1; t < numTables; t++)
+  {
+    if (MYC_openSharedTable(tableFile[t], tablePages[t], tableLayout[t] | layoutFlags, MYSTORE_TABLE_KEY(t)) != t)
+    {
+      debug_error("Error opening table %d (%s).", t, tableFile[t]);
+      return -1;
+    }
+    debug_info("Table %d is %s (%d pages, %s).", t, tableFile[t], tablePages[t], layouts[tableLayout[t]]);
+  }
+  return 0;
+}
+
+/**
+ * Add a table given with -t, -c, -l or -b file[:pages].
+ * @param arg The argument of the option. It is modified.
+ * @param layout MYC_LAYOUT_ROWS, MYC_LAYOUT_COLUMNS, MYC_LAYOUT_LSM or
+ * MYC_LAYOUT_BTREE.
+ * @return 0 if OK. -1 if there are too many tables or pages is not valid.
+ */
+static int addTable(char *arg, int layout)
 {
-  switch (sig_num)
+  if (numTables == MYSTORE_MAXTABLES || numTables == MYC_MAXTABLES)
+    return -1;
+  int pages = MYC_NUMENTRIES;
+  char *colon = strrchr(arg, ':');
+  if (colon != NULL)
   {
-  case SIGINT:
-    signal(SIGINT, s_handler); // calling signal again
-    prog_end_requested = 1;    // setting boolean to 1
+    *colon = '\0';
+    pages = atoi(colon + 1);
+    if (pages <= 0)
+      return -1;
+  }
+  tableFile[numTables] = arg;
+  tablePages[numTables] = pages;
+  tableLayout[numTables] = layout;
+  numTables++;
+  return 0;
+}
+
+/* Aggregate of a field being computed by MYC_scan(). */
+typedef struct
+{
+  int field;                  /* Number of the field in the schema. */
+  aggregate_report_t *report; /* Aggregate so far. */
+} aggregate_scan_t;
+
+/**
+ * Add the value of the field of a record to an aggregate.
+ * @param fileIndex Index of the record.
+ * @param record The record. Only the field aggregated is filled.
+ * @param arg The aggregate_scan_t.
+ * @return 0 to go on scanning.
+ */
+static int aggregateRecord(int fileIndex, const MYRECORD_RECORD_t *record, void *arg)
+{
+  aggregate_scan_t *scan = (aggregate_scan_t *)arg;
+  aggregate_report_t *report = scan->report;
+  int64_t value = 0;
+  MYSCH_getInteger(MYSCH_recordSchema(), scan->field, record, &value);
+  if (report->count == 0 || value < report->min)
+    report->min = value;
+  if (report->count == 0 || value > report->max)
+    report->max = value;
+  report->sum += value;
+  report->count++;
+  return 0;
+}
+
+/**
+ * Aggregate an integer field over a range of records of the selected table.
+ * Only the column of the field is read in a table stored by columns.
+ * @param req The request with the first index, the count and the field.
+ * @param report Where to return the aggregate.
+ * @return 0 if OK. -1 if the field is not an integer or the range is not valid.
+ */
+static int aggregateField(const request_message_t *req, aggregate_report_t *report)
+{
+  const MYSCHEMA_t *schema = MYSCH_recordSchema();
+  memset(report, 0, sizeof(*report));
+  if (req->field < 0 || (unsigned int)req->field >= schema->numfields ||
+      schema->fields[req->field].type == MYSCH_STRING)
+    return -1;
+  aggregate_scan_t scan = {req->field, report};
+  return MYC_scan(req->index, req->count, 1u << req->field, aggregateRecord, &scan);
+}
+
+/**
+ * Serve one request and send back its answer.
+ * @param req The request received from a client.
+ * @param depth Requests waiting behind this one, for admission control.
+ * @return 0 if OK. -1 if the answer could not be sent.
+ */
+static int serveRequest(request_message_t *req, int depth)
+{
+  answer_message_t answer;
+  int status;
+  /* Requests from clients not stamping them are timed from their reception. */
+  uint64_t start = MYH_now();
+  uint64_t origin = req->sent != 0 && req->sent <= start ? req->sent : req->received;
+  int class = MYSLAT_OTHER;
+  int hit = MYT_NOCACHE;
+
+  /* Prepare an answer to our client. */
+  /* Fill the answer type with the identity of the client sending the request. */
+  answer.mtype = req->return_to;
+  /* Echo the sequence number so that pipelined clients can match the answer. */
+  answer.seq = req->seq;
+  /* Answer in the wire format used by the client. */
+  answer.format = req->format;
+  answer.requested_op = req->requested_op;
+  answer.acked = 0;
+  answer.failed = 0;
+  answer.lsn = 0;
+  countRequest(numberReq);
+  /* Unacknowledged writes get no answer unless they close a batch. */
+  bool send_answer = true;
+
+  if (req->deadline != 0 && start >= req->deadline)
+  {
+    /* The client already gave up: don't waste time nor queue room on it. */
+    answer.status = MYSTORE_EXPIRED;
+    send_answer = false;
+    countRequest(numberExpired);
+    debug_debug("Request expired (client=%ld, op=%d, late=%lluns).", req->return_to, req->requested_op,
+                (unsigned long long)(start - req->deadline));
+    if (req->requested_op == MYSCOP_WRITE && (req->flags & MYSCFL_NOACK))
+      noackAccount(req->return_to, MYSTORE_EXPIRED);
+  }
+  else if (usesTable(req->requested_op) && MYC_useTable(req->table) != 0)
+  {
+    /* Nothing is done in a table this server does not serve. */
+    answer.status = -1;
+    debug_debug("Request for unknown table (client=%ld, table=%d).", req->return_to, req->table);
+    if (req->requested_op == MYSCOP_WRITE && (req->flags & MYSCFL_NOACK))
+    {
+      noackAccount(req->return_to, -1);
+      if (req->flags & MYSCFL_ACKNOW)
+        noackCollect(req->return_to, &answer);
+      else
+        send_answer = false;
+    }
+  }
+  else if (shedRequest(req, depth, start - origin))
+  {
+    /* Fail fast: the client can retry later or slow down. */
+    answer.status = MYSTORE_OVERLOADED;
+    countRequest(numberShed);
+    debug_debug("Request rejected (client=%ld, op=%d, depth=%d).", req->return_to, req->requested_op, depth);
+    if (req->requested_op == MYSCOP_WRITE && (req->flags & MYSCFL_NOACK))
+    {
+      noackAccount(req->return_to, MYSTORE_OVERLOADED);
+      if (req->flags & MYSCFL_ACKNOW)
+        noackCollect(req->return_to, &answer);
+      else
+        send_answer = false;
+    }
+  }
+  /* Decode operation. */
+  else switch (req->requested_op)
+  {
+  case MYSCOP_READ:
+    /* Implement read operation with cache library. */
+    /* The index is provided in the request. */
+    /* The record content must be stored in the answer. */
+    status = MYC_readEntry(req->index, &answer.data);
+    answer.status = status; /* Fill status with the result of the operation. */
+    debug_debug("Read operation (client=%ld, idx=%d) ret %d.", req->return_to, req->index, status);
+    debug_verbose("id: %u, age: %d, gender: %d, name: %s", answer.data.registerid, answer.data.age, answer.data.gender, answer.data.name);
+    countRequest(numberR); // stats
+    hit = MYC_lastHit() ? MYT_HIT : MYT_MISS;
+    class = hit == MYT_HIT ? MYSLAT_READHIT : MYSLAT_READMISS;
+    break;
+
+  case MYSCOP_WRITE:
+    /* Implement write operation with cache library. */
+    /* The record to write and the index are provided in the request. */
+    status = MYC_writeEntry(req->index, &req->data);
+    answer.status = status; /* Fill status with the result of the operation. */
+    debug_debug("Write operation (client=%ld, idx=%d) ret %d.", req->return_to, req->index, status);
+    countRequest(numberW); // stats
+    hit = MYC_lastHit() ? MYT_HIT : MYT_MISS;
+    class = hit == MYT_HIT ? MYSLAT_WRITEHIT : MYSLAT_WRITEMISS;
+    /* The LSN lets the client wait until this write is durable. */
+    answer.lsn = MYC_lastLSN();
+    if (req->flags & MYSCFL_NOACK)
+    {
+      noackAccount(req->return_to, status);
+      if (req->flags & MYSCFL_ACKNOW)
+        noackCollect(req->return_to, &answer);
+      else
+        send_answer = false;
+    }
     break;
 
-  case SIGTERM:
-    signal(SIGTERM, s_handler); // calling signal again
-    prog_end_requested = 1;     // setting boolean to 1
+  case MYSCOP_SYNC:
+    /* Report the results of the unacknowledged writes of this client. */
+    noackCollect(req->return_to, &answer);
+    answer.lsn = MYC_lastLSN();
+    debug_debug("Sync operation (client=%ld) acked %u failed %u.", req->return_to, answer.acked, answer.failed);
     break;
 
-  case SIGUSR1:
-    signal(SIGUSR1, s_handler); // calling signal again
-    sigusr1_requested = 1;      // setting boolean to 1
+  case MYSCOP_FLUSH:
+    status = MYC_flushEntry(req->index);
+    answer.status = status;
+    answer.lsn = MYC_durableLSN();
+    debug_debug("Flush operation (client=%ld, idx=%d) ret %d.", req->return_to, req->index, status);
     break;
 
-  case SIGUSR2:
-    signal(SIGUSR2, s_handler); // calling signal again
-    sigusr2_reuqested = 1;      // setting boolean to 1
+  case MYSCOP_FLUSHALL:
+    status = flushTables();
+    answer.status = status;
+    MYC_useTable(req->table);
+    answer.lsn = MYC_durableLSN();
+    debug_debug("Flush all operation (client=%ld) ret %d.", req->return_to, status);
     break;
 
-  case SIGALRM:
-    alarm_requested = 1;        // setting boolean to 1
-    alarm(15);                  // calling after 15 second
-    signal(SIGALRM, s_handler); // calling signal again
+  case MYSCOP_DURABLE:
+    /* Only the entries with writes up to the LSN are flushed. */
+    status = MYC_flushUpTo(req->lsn);
+    answer.status = status;
+    answer.lsn = MYC_durableLSN();
+    debug_debug("Durable operation (client=%ld, lsn=%llu) ret %d.", req->return_to, (unsigned long long)req->lsn, status);
+    break;
+
+  case MYSCOP_STATS:
+    /* The index selects the class of requests. */
+    if (req->index < 0 || req->index >= MYSLAT_CLASSES)
+    {
+      answer.status = -1;
+      break;
+    }
+    reportLatency(&Latency[req->index], &answer.latency);
+    answer.status = 0;
+    debug_debug("Stats operation (client=%ld, class=%d).", req->return_to, req->index);
+    break;
+
+  case MYSCOP_SETWEIGHT:
+    /* It applies to the requests received from now on. */
+    answer.status = STORS_setweight(req->return_to, req->index);
+    break;
+
+  case MYSCOP_AGGREGATE:
+    status = aggregateField(req, &answer.aggregate);
+    answer.status = status;
+    debug_debug("Aggregate operation (client=%ld, idx=%d, count=%d, field=%d) ret %d.", req->return_to, req->index,
+                req->count, req->field, status);
     break;
 
   default:
+    /* Remark unknown operations to stderr!!!
+     Maybe we are using a more advanced client who uses more
+     operations than an older server. */
+    debug_error("Unknown operation received from client.");
+    answer.status = -1; /* You should have an special error for "Unknown operation" */
     break;
   }
+
+  uint64_t served = MYH_now();
+  if (send_answer)
+  {
+    /* Send back the answer */
+    status = STORS_sendanswer(&answer);
+    /* Check status and possible errors. */
+    if (status != 0)
+    {
+      debug_error("Problems sending back an answer.");
+      return -1;
+    }
+  }
+
+  uint64_t end = MYH_now();
+  /* Requests dropped are only traced. */
+  if (answer.status != MYSTORE_EXPIRED)
+  {
+    latency_t *latency = &Latency[class];
+    MYH_record(&latency->queue, start - origin);
+    MYH_record(&latency->service, served - start);
+    MYH_record(&latency->total, end - origin);
+  }
+
+  MYT_EVENT_t event;
+  event.time = start;
+  event.client = (int32_t)req->return_to;
+  event.seq = req->seq;
+  event.index = req->index;
+  event.queue_ns = start - origin > UINT32_MAX ? UINT32_MAX : (uint32_t)(start - origin);
+  event.service_ns = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t)(end - start);
+  event.op = (uint8_t)req->requested_op;
+  event.hit = (uint8_t)hit;
+  event.status = (int16_t)answer.status;
+  MYT_record(&event);
+  return 0;
 }
 
-// stats
-static int numberR;
-static int numberW;
-static int numberReq;
+/**
+ * Create the descriptors of the event loop: a signalfd for the signals
+ * handled by the server, a timerfd for periodic flushes and the eventfd of
+ * the server API. The signals must be blocked before any thread is created.
+ * @param signals The signals read through the signalfd.
+ * @return 0 if OK. -1 in case of error.
+ */
+static int setupEvents(sigset_t *signals)
+{
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
+  {
+    debug_perror("Error creating epoll descriptor. ");
+    return -1;
+  }
+
+  signal_fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd == -1)
+  {
+    debug_perror("Error creating signalfd. ");
+    return -1;
+  }
+
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd == -1)
+  {
+    debug_perror("Error creating timerfd. ");
+    return -1;
+  }
+  struct itimerspec period = {{FLUSH_PERIOD, 0}, {FLUSH_PERIOD, 0}};
+  if (timerfd_settime(timer_fd, 0, &period, NULL) == -1)
+  {
+    debug_perror("Error setting flush timer. ");
+    return -1;
+  }
+
+  int fds[] = {signal_fd, timer_fd, STORS_eventfd()};
+  for (int i = 0; i < 3; i++)
+  {
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fds[i]};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) == -1)
+    {
+      debug_perror("Error adding descriptor to epoll. ");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Close the descriptors of the event loop. */
+static void closeEvents()
+{
+  if (epoll_fd != -1)
+    close(epoll_fd);
+  if (signal_fd != -1)
+    close(signal_fd);
+  if (timer_fd != -1)
+    close(timer_fd);
+  epoll_fd = signal_fd = timer_fd = -1;
+}
+
+/**
+ * Read the pending signals from the signalfd and act on them.
+ * @return 1 if the server must end. 0 otherwise.
+ */
+static int handleSignals()
+{
+  struct signalfd_siginfo info;
+  int end = 0;
+  while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+  {
+    switch (info.ssi_signo)
+    {
+    case SIGINT:
+    case SIGTERM:
+      end = 1;
+      break;
+
+    case SIGUSR1:
+      debug_info("Read  Requests: %llu", (unsigned long long)numberR);
+      debug_info("Write Requests: %llu\n", (unsigned long long)numberW);
+      debug_info("Total Requests: %llu", (unsigned long long)numberReq);
+      MYT_dump(TRACE_FILE);
+      break;
+
+    case HANDOVER_SIGNAL:
+      /* Requests already received are served before ending. */
+      if (!handingOver && STORS_handover() == 0)
+      {
+        debug_info("Handing over to a new server.");
+        handingOver = true;
+      }
+      break;
+
+    case SIGUSR2:
+      debuglevel_rotate();
+      MYC_debuglevel_rotate();
+      STORS_debuglevel_rotate();
+      debug_info("Set debug level to %d", debug_level);
+      break;
+
+    default:
+      /* SIGRTMIN is not a constant. */
+      if ((int)info.ssi_signo == SNAPSHOT_SIGNAL)
+        snapshotLeft = startSnapshots();
+      break;
+    }
+  }
+  return end;
+}
+
+/**
+ * Save the state the next server needs: the unacknowledged writes of each
+ * client and the answers not sent yet.
+ * @return 0 if OK. -1 in case of error.
+ */
+static int saveHandover()
+{
+  FILE *file = fopen(HANDOVER_FILE, "w");
+  if (file == NULL)
+  {
+    debug_perror("Error creating handover file %s. ", HANDOVER_FILE);
+    return -1;
+  }
+  unsigned int magic = HANDOVER_MAGIC;
+  int status = 0;
+  if (fwrite(&magic, sizeof(magic), 1, file) != 1 ||
+      fwrite(noackClients, sizeof(noackClients), 1, file) != 1 ||
+      STORS_saveanswers(file) != 0)
+    status = -1;
+  if (fclose(file) != 0)
+    status = -1;
+  if (status == -1)
+    debug_perror("Error writing handover file %s. ", HANDOVER_FILE);
+  return status;
+}
+
+/**
+ * Load the state saved by the last server, if any, and remove it.
+ * @return 0 if OK. -1 in case of error.
+ */
+static int loadHandover()
+{
+  FILE *file = fopen(HANDOVER_FILE, "r");
+  if (file == NULL)
+  {
+    debug_info("No handover file from the last server.");
+    return 0;
+  }
+  unsigned int magic;
+  int status = 0;
+  if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != HANDOVER_MAGIC ||
+      fread(noackClients, sizeof(noackClients), 1, file) != 1 ||
+      STORS_loadanswers(file) != 0)
+  {
+    debug_error("Handover file %s is not valid.", HANDOVER_FILE);
+    status = -1;
+  }
+  fclose(file);
+  unlink(HANDOVER_FILE);
+  return status;
+}
+
+/**
+ * Take the queue and the shared cache over from the running server. It is
+ * asked to hand them over and this server waits until it did.
+ * @return 0 if OK. -1 in case of error.
+ */
+static int takeOver()
+{
+  pid_t asked = -1;
+  int status;
+  int waited = 0;
+  while ((status = MYC_attachSharedCache(MYSTORE_API_KEY)) == -2 && waited < HANDOVER_TIMEOUT_MS)
+  {
+    /* Another new server may take over first: then ask that one. */
+    pid_t owner = MYC_sharedOwner(MYSTORE_API_KEY);
+    if (owner > 0 && owner != asked)
+    {
+      debug_info("Asking server %d to hand over.", (int)owner);
+      if (kill(owner, HANDOVER_SIGNAL) == -1)
+      {
+        debug_perror("Error signaling server %d. ", (int)owner);
+        return -1;
+      }
+      asked = owner;
+    }
+    struct timespec pause = {0, 10000000};
+    nanosleep(&pause, NULL);
+    waited += 10;
+  }
+  if (status != 0)
+  {
+    debug_error("The cache was not handed over.");
+    return -1;
+  }
+  /* The other tables were handed over before the default one. */
+  if (openTables() != 0)
+  {
+    MYC_closeCache();
+    return -1;
+  }
+  if (STORS_attach() != 0)
+  {
+    MYC_closeCache();
+    return -1;
+  }
+  if (loadHandover() != 0)
+    debug_error("Unacknowledged writes or answers of the last server lost.");
+  debug_info("Took over after %d ms.", waited);
+  return 0;
+}
+
+/* Gauges of the queues of the server for the metrics exporter. */
+static uint64_t queuedMessages()
+{
+  int messages = STORS_queuedmessages();
+  return messages < 0 ? 0 : (uint64_t)messages;
+}
+
+static uint64_t bufferedRequests()
+{
+  return (uint64_t)STORS_bufferedrequests();
+}
+
+static uint64_t pendingAnswers()
+{
+  return (uint64_t)STORS_pendinganswers();
+}
+
+/**
+ * Register the metrics of the server and the cache and start exporting them.
+ * @return 0 if OK. -1 in case of error.
+ */
+static int startMetrics()
+{
+  const MYC_STATS_t *cache = MYC_stats();
+  int status = 0;
+  status |= MYM_register("mystore_requests_total", "Requests served.", MYM_COUNTER, &numberReq);
+  status |= MYM_register("mystore_requests_op_total{op=\"read\"}", "Requests served by operation.", MYM_COUNTER, &numberR);
+  status |= MYM_register("mystore_requests_op_total{op=\"write\"}", "Requests served by operation.", MYM_COUNTER, &numberW);
+  status |= MYM_register("mystore_cache_accesses_total{result=\"hit\"}", "Reads and writes by cache result.", MYM_COUNTER, &cache->hits);
+  status |= MYM_register("mystore_cache_accesses_total{result=\"miss\"}", "Reads and writes by cache result.", MYM_COUNTER, &cache->misses);
+  status |= MYM_register("mystore_cache_evictions_total", "Dirty entries written to make room.", MYM_COUNTER, &cache->evictions);
+  status |= MYM_register("mystore_io_bytes_total{dir=\"read\"}", "Bytes transferred with the DB file.", MYM_COUNTER, &cache->bytes_read);
+  status |= MYM_register("mystore_io_bytes_total{dir=\"write\"}", "Bytes transferred with the DB file.", MYM_COUNTER, &cache->bytes_written);
+  status |= MYM_register("mystore_flushes_total", "Syncs of the DB file to disk.", MYM_COUNTER, &cache->syncs);
+  status |= MYM_register("mystore_flush_seconds_total", "Time spent syncing the DB file.", MYM_SECONDS, &cache->sync_ns);
+  status |= MYM_register("mystore_requests_rejected_total{reason=\"overloaded\"}", "Requests rejected by admission control.", MYM_COUNTER, &numberShed);
+  status |= MYM_register("mystore_requests_rejected_total{reason=\"expired\"}", "Requests rejected by admission control.", MYM_COUNTER, &numberExpired);
+  status |= MYM_register("mystore_queue_depth", "Requests waiting when the last batch started.", MYM_GAUGE, &queueDepth);
+  status |= MYM_registerFunction("mystore_queue_messages", "Messages in the message queue.", MYM_GAUGE, queuedMessages);
+  status |= MYM_registerFunction("mystore_requests_buffered", "Requests received and not served yet.", MYM_GAUGE, bufferedRequests);
+  status |= MYM_registerFunction("mystore_answers_waiting", "Answers waiting for room in the queue.", MYM_GAUGE, pendingAnswers);
+  status |= MYM_registerFunction("mystore_log_dropped_total", "Log messages dropped because a buffer was full.", MYM_COUNTER, MYL_dropped);
+  if (status != 0)
+    return -1;
+  return MYM_start(METRICS_FILE, METRICS_PERIOD);
+}
 
 /* This is the main loop of the server */
 int main(int argc, char **argv)
@@ -77,6 +943,7 @@ int main(int argc, char **argv)
   signal(SIGHUP, SIG_IGN);
 
   bool detaching = true;
+  bool hotRestart = false;
   // parsing cmd arguments -v or -f
   for (int i = 1; i < argc; i++)
   {
@@ -95,6 +962,52 @@ int main(int argc, char **argv)
         // Process -f option
         detaching = false;
       }
+      else if (argv[i][1] == 'r')
+      {
+        // Process -r option: take over from the running server
+        hotRestart = true;
+      }
+      else if ((argv[i][1] == 't' || argv[i][1] == 'c' || argv[i][1] == 'l' || argv[i][1] == 'b') && i + 1 < argc)
+      {
+        // Process -t file[:pages] option: serve one more table
+        // Process -c file[:pages] option: the same, stored by columns
+        // Process -l file[:pages] option: the same, as a log-structured merge tree
+        // Process -b file[:pages] option: the same, in a B+tree keyed by registerid
+        int layout = argv[i][1] == 'c'   ? MYC_LAYOUT_COLUMNS
+                     : argv[i][1] == 'l' ? MYC_LAYOUT_LSM
+                     : argv[i][1] == 'b' ? MYC_LAYOUT_BTREE
+                                         : MYC_LAYOUT_ROWS;
+        if (addTable(argv[++i], layout) != 0)
+        {
+          fprintf(stderr, "NOT VALID TABLE %s\n", argv[i]);
+          exit(1);
+        }
+      }
+      else if (argv[i][1] == 'z')
+      {
+        // Process -z option: compress the pages of the new tables
+        layoutFlags |= MYC_COMPRESSED;
+      }
+      else if (argv[i][1] == 's' && i + 1 < argc)
+      {
+        // Process -s dir[:dir...] option: segment the new tables over the directories
+        if (MYC_setSegmentDirs(argv[++i]) != 0)
+        {
+          fprintf(stderr, "NOT VALID SEGMENT DIRS %s\n", argv[i]);
+          exit(1);
+        }
+        layoutFlags |= MYC_SEGMENTED;
+      }
+      else if (argv[i][1] == 'm' && i + 1 < argc)
+      {
+        // Process -m MiB option: memory of the caches of all the tables
+        long mib = atol(argv[++i]);
+        if (mib <= 0 || MYC_setMemoryLimit((size_t)mib * 1024 * 1024) != 0)
+        {
+          fprintf(stderr, "NOT VALID MEMORY LIMIT %s\n", argv[i]);
+          exit(1);
+        }
+      }
       else
       {
         fprintf(stderr, "NOT VALID ARGS");
@@ -108,12 +1021,21 @@ int main(int argc, char **argv)
     }
   }
 
-  // setting the signals to the handler
-  signal(SIGTERM, s_handler);
-  signal(SIGINT, s_handler);
-  signal(SIGALRM, s_handler);
-  signal(SIGUSR1, s_handler);
-  signal(SIGUSR2, s_handler);
+  /* These signals are read through a signalfd in the main loop. They are
+   * blocked now so that every thread created later inherits the mask. */
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  sigaddset(&signals, SIGUSR2);
+  sigaddset(&signals, HANDOVER_SIGNAL);
+  sigaddset(&signals, SNAPSHOT_SIGNAL);
+  if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1)
+  {
+    perror("Error blocking signals");
+    exit(1);
+  }
 
   // closing stdin
   fclose(stdin);
@@ -121,7 +1043,10 @@ int main(int argc, char **argv)
   fclose(stdout);
 
   // reopening file
-  FILE *logFile = freopen("store_server.log", "w", stderr);
+  // appending: the running server still logs to it when taking over
+  if (!hotRestart)
+    truncate("store_server.log", 0);
+  FILE *logFile = freopen("store_server.log", "a", stderr);
 
   if (logFile == NULL) // error handling
   {
@@ -129,19 +1054,40 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  /* This function initializes the cache. */
-  if (MYC_initCache() != 0)
+  int hotLeft = 0;
+  if (hotRestart)
   {
-    debug_error("Error initializing cache.");
-    exit(1);
+    /* The queue and the cache stay in place: clients don't notice. */
+    if (takeOver() != 0)
+    {
+      debug_error("Error taking over from the running server.");
+      exit(1);
+    }
   }
-
-  if (STORS_init() != 0)
+  else
   {
-    debug_error("Error initializing server side API.");
-    /* Close cache as we end here. */
-    MYC_closeCache();
-    exit(1);
+    /* The message queue is created exclusively, so it is created first to
+     * be sure that no other server owns the shared cache. */
+    if (STORS_init() != 0)
+    {
+      debug_error("Error initializing server side API.");
+      exit(1);
+    }
+
+    /* This function initializes the cache. Local clients can read it. */
+    if (MYC_openSharedTable(MYC_FILENAME, MYC_NUMENTRIES, MYC_LAYOUT_ROWS | layoutFlags, MYSTORE_API_KEY) != 0 ||
+        openTables() != 0)
+    {
+      debug_error("Error initializing cache.");
+      /* Close server API as we end here. */
+      STORS_close();
+      MYC_closeCache();
+      exit(1);
+    }
+
+    /* Start reading the records the last server was using. They are loaded
+     * into the cache while no request is waiting. */
+    hotLeft = loadHotSets();
   }
 
   debug_info("Test store server started OK.");
@@ -165,102 +1111,111 @@ int main(int argc, char **argv)
   // ignoring this signal
   signal(SIGHUP, SIG_IGN);
 
-  // setting timer for 15
-  alarm(15);
+  /* A new server must signal this process to take over. */
+  MYC_adoptCache();
 
-  while (!prog_end_requested)
+  /* Threads don't survive fork(), so they are started in the daemon.
+   * From now on log messages are written by a background thread. */
+  if (MYL_start() != 0 || setupEvents(&signals) != 0 || STORS_start() != 0 || startMetrics() != 0)
   {
+    debug_error("Error starting the event loop.");
+    MYM_stop();
+    closeEvents();
+    STORS_close();
+    MYC_closeCache();
+    exit(1);
+  }
 
-    if (alarm_requested)
+  bool end = false;
+  bool handedOver = false;
+  while (!end)
+  {
+    /* Answers waiting for room in the queue are retried soon. While the hot
+     * set is prefetched or a snapshot is copied, don't wait at all. */
+    int timeout = STORS_pendinganswers() > 0 ? BACKLOG_RETRY_MS : hotLeft > 0 || snapshotLeft > 0 ? 0 : -1;
+    struct epoll_event events[4];
+    int nevents = epoll_wait(epoll_fd, events, 4, timeout);
+    if (nevents == -1)
     {
-      alarm_requested = 0;
-      debug_info("Flushing");
-      MYC_flushAll();
-      fflush(stderr);
+      if (errno == EINTR)
+        continue;
+      debug_perror("Error waiting for events. ");
+      break;
     }
 
-    if (sigusr1_requested)
+    for (int i = 0; i < nevents; i++)
     {
-      sigusr1_requested = 0;
-      debug_info("Read  Requests: %d", numberR);
-      debug_info("Write Requests: %d\n", numberW);
-      debug_info("Total Requests: %d", numberReq);
-      fflush(stderr);
+      if (events[i].data.fd == signal_fd)
+      {
+        if (handleSignals())
+          end = true;
+      }
+      else if (events[i].data.fd == timer_fd)
+      {
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        {
+          debug_info("Flushing");
+          flushTables();
+          /* A hot set still being prefetched is not complete in the cache. */
+          if (hotLeft == 0)
+            saveHotSets();
+        }
+      }
     }
+    if (end)
+      break;
 
-    if (sigusr2_reuqested)
+    /* Serve all the requests received. This also sends waiting answers. */
+    request_message_t req;
+    int status;
+    /* Sample the depth once per batch: it costs a system call. */
+    int messages = STORS_queuedmessages();
+    int depth = (messages < 0 ? 0 : messages) + STORS_bufferedrequests();
+    __atomic_store_n(&queueDepth, (uint64_t)depth, __ATOMIC_RELAXED);
+    while ((status = STORS_readrequest(&req)) == 0)
     {
-      sigusr2_reuqested = 0;
-      debuglevel_rotate();
-      MYC_debuglevel_rotate();
-      STORS_debuglevel_rotate();
-      debug_info("Set debug level to %d", debug_level);
-      fflush(stderr);
+      if (serveRequest(&req, depth) != 0)
+        break;
+      if (depth > 0)
+        depth--;
     }
-
-    /* We need a request and an answer. */
-    request_message_t req;
-    answer_message_t answer;
-
-    /* Wait for a request from a client. */
-    int status = STORS_readrequest(&req);
-    /* Check status and possible errors. */
-    /* A signal interrupted reception. Start loop again to check termination. */
-    if (status == -2)
-      continue;
-    if (status == -1)
+    /* -4 means that all the requests were served. */
+    if (status != -4)
     {
-      debug_error("Problems receiving a request.");
+      if (status == STORS_HANDEDOVER)
+        handedOver = true;
+      else if (status == -1)
+        debug_error("Problems receiving a request.");
       /* Exit from main loop. */
       break;
     }
 
-    /* Prepare an answer to our client. */
-    /* Fill the answer type with the identity of the client sending the request. */
-    answer.mtype = req.return_to;
-    numberReq++;
-
-    /* Decode operation. */
-    switch (req.requested_op)
+    /* Requests go first: prefetch only when none is waiting. */
+    if (hotLeft > 0 && STORS_bufferedrequests() == 0)
     {
-    case MYSCOP_READ:
-      /* Implement read operation with cache library. */
-      /* The index is provided in the request. */
-      /* The record content must be stored in the answer. */
-      status = MYC_readEntry(req.index, &answer.data);
-      answer.status = status; /* Fill status with the result of the operation. */
-      debug_debug("Read operation (client=%ld, idx=%d) ret %d.", req.return_to, req.index, status);
-      debug_verbose("id: %u, age: %d, gender: %d, name: %s", answer.data.registerid, answer.data.age, answer.data.gender, answer.data.name);
-      numberR++; // stats
-      break;
-
-    case MYSCOP_WRITE:
-      /* Implement write operation with cache library. */
-      /* The record to write and the index are provided in the request. */
-      status = MYC_writeEntry(req.index, &req.data);
-      answer.status = status; /* Fill status with the result of the operation. */
-      debug_debug("Write operation (client=%ld, idx=%d) ret %d.", req.return_to, req.index, status);
-      numberW++; // stats
-      break;
-
-    default:
-      /* Remark unknown operations to stderr!!!
-       Maybe we are using a more advanced client who uses more
-       operations than an older server. */
-      debug_error("Unknown operation received from client.");
-      answer.status = -1; /* You should have an special error for "Unknown operation" */
-      break;
+      hotLeft = prefetchHotSets(PREFETCH_BATCH);
+    }
+    if (snapshotLeft > 0 && STORS_bufferedrequests() == 0)
+    {
+      snapshotLeft = snapshotTables(SNAPSHOT_BATCH);
     }
+  }
 
-    /* Send back the answer */
-    status = STORS_sendanswer(&answer);
-    /* Check status and possible errors. */
-    if (status != 0)
+  MYM_stop();
+  closeEvents();
+
+  if (handedOver)
+  {
+    /* Leave the queue and the cache as they are to the new server. */
+    if (saveHandover() != 0 || STORS_release() != 0 || MYC_detachCache() != 0)
     {
-      debug_error("Problems sending back an answer.");
-      /* Exit from main loop. */
-      break;
+      debug_error("Error handing over.");
+      exit(1);
     }
+    debug_info("Test store server handed over OK.");
+    MYL_stop();
+    return (EXIT_SUCCESS);
   }
 
   /* This server never ends (by now). But one day, it will be able to end. */
@@ -272,6 +1227,10 @@ int main(int argc, char **argv)
     /* Do not exit without closing the cache!!! */
   }
 
+  /* The next server starts with the records in use now. */
+  if (hotLeft == 0)
+    saveHotSets();
+
   /* This function closes the cache. It flushes all the information inside the
    * cache that is not written to the file yet. */
   if (MYC_closeCache() != 0)
@@ -281,5 +1240,7 @@ int main(int argc, char **argv)
   }
 
   debug_info("Test store server ended OK.");
+  /* Write the log messages still buffered. */
+  MYL_stop();
   return (EXIT_SUCCESS);
 }
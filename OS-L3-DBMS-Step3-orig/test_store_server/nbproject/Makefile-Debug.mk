@@ -52,7 +52,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=../mycache/dist/Debug/GNU-Linux/libmycache.a ../mystore_srv/dist/Debug/None-Linux/libmystore_srv.a
+LDLIBSOPTIONS=../mystore_srv/dist/Debug/GNU-Linux/libmystore_srv.a ../mycache/dist/Debug/GNU-Linux/libmycache.a -lpthread
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -60,7 +60,7 @@ LDLIBSOPTIONS=../mycache/dist/Debug/GNU-Linux/libmycache.a ../mystore_srv/dist/D
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_server: ../mycache/dist/Debug/GNU-Linux/libmycache.a
 
-${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_server: ../mystore_srv/dist/Debug/None-Linux/libmystore_srv.a
+${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_server: ../mystore_srv/dist/Debug/GNU-Linux/libmystore_srv.a
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_server: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
@@ -69,7 +69,7 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/test_store_server: ${OBJECTFILES}
 ${OBJECTDIR}/main.o: main.c nbproject/Makefile-${CND_CONF}.mk
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -g -Werror -DDEBUG_LIB -D_GNU_SOURCE -D_XOPEN_SOURCE -I../mycache -I../mystore_srv -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
+	$(COMPILE.c) -g -Werror -DDEBUG_ASYNC -DDEBUG_LIB -D_GNU_SOURCE -D_XOPEN_SOURCE -I../mycache -I../mystore_srv -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
 
 # Subprojects
 .build-subprojects: